@@ -45,6 +45,14 @@ errval_t aos_rpc_send_string(struct aos_rpc *chan, const char *string);
 errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t bytes, size_t align,
                              struct capref *retcap, size_t *ret_bytes);
 
+/**
+ * \brief request `count` RAM regions of `bytes` each with a single RPC.
+ * The regions are returned back to back in one RAM capability, which the
+ * caller retypes locally. The server may grant fewer than `count` regions.
+ */
+errval_t aos_rpc_get_ram_cap_batch(struct aos_rpc *chan, size_t count, size_t bytes,
+                                   struct capref *retcap, size_t *ret_count);
+
 /**
  * \brief get one character from the serial port
  */
@@ -37,6 +37,13 @@ struct morecore_state {
     char *freep;
 };
 
+// Chunk of prefetched RAM that single pages are retyped from
+struct ram_reserve_chunk {
+    struct capref cap;
+    size_t next;        // Index of the next page to hand out
+    size_t count;       // Number of pages in the chunk
+};
+
 struct ram_alloc_state {
     bool mem_connect_done;
     errval_t mem_connect_err;
@@ -45,6 +52,9 @@ struct ram_alloc_state {
     uint64_t default_minbase;
     uint64_t default_maxlimit;
     int base_capnum;
+    struct ram_reserve_chunk reserve_cur;   // Chunk pages are taken from
+    struct ram_reserve_chunk reserve_next;  // Chunk prefetched ahead of time
+    bool reserve_refilling;
 };
 
 struct skb_state {
@@ -49,6 +49,10 @@ errval_t periodic_event_create(struct periodic_event *event, struct waitset *ws,
 errval_t periodic_event_cancel(struct periodic_event *event);
 
 // XXX: internal to libbarrelfish; should be in another header file
+errval_t deferred_event_register_disabled(struct deferred_event *event,
+                                          struct waitset *ws, delayus_t delay,
+                                          struct event_closure closure,
+                                          dispatcher_handle_t dh);
 void trigger_deferred_events_disabled(dispatcher_handle_t dh, systime_t now);
 
 __END_DECLS
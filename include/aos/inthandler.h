@@ -29,6 +29,8 @@ errval_t inthandler_setup(interrupt_handler_fn handler, void *handler_arg,
                           uint64_t *ret_vector);
 errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
         uint32_t irq);
+errval_t inthandler_setup_arm_ws(interrupt_handler_fn handler, void *handler_arg,
+        uint32_t irq, struct waitset *ws);
 
 errval_t alloc_dest_irq_cap(struct capref *retcap);
 
@@ -43,6 +43,14 @@
  *
  * cap: NULL_CAP
  *
+ * ==== Memory Alloc Batch ====
+ *
+ * arg0: enum lmp_request_type RequestType = LMP_RequestType_MemoryAllocBatch
+ * arg1: size_t count
+ * arg2: size_t bytes of each element
+ *
+ * cap: NULL_CAP
+ *
  * ==== Memory Free ====
  *
  * arg0: enum lmp_request_type RequestType = LMP_RequestType_MemoryFree
@@ -120,6 +128,14 @@
  *
  * cap: RAM capability to allocated memory
  *
+ * ==== Memory Alloc Batch ====
+ *
+ * arg0: enum lmp_request_type RequestType = LMP_RequestType_MemoryAllocBatch
+ * arg1: errval_t Status code
+ * arg2: size_t Number of elements granted (may be less than requested)
+ *
+ * cap: RAM capability covering all granted elements back to back
+ *
  * ==== Memory Free ====
  *
  * arg0: enum lmp_request_type RequestType = LMP_RequestType_MemoryFree
@@ -198,9 +214,14 @@ enum lmp_request_type {
     LMP_RequestType_LmpBind,
 
     LMP_RequestType_ProcessDeregister,
-    LMP_RequestType_ProcessDeregisterNotify
+    LMP_RequestType_ProcessDeregisterNotify,
+    
+    LMP_RequestType_MemoryAllocBatch
 };
 
+// Largest number of elements the memory server grants in one batch
+#define LMP_MEMORY_ALLOC_BATCH_MAX  64
+
 typedef errval_t (*lmp_server_spawn_handler)(char *name,
                                              coreid_t coreid,
                                              domainid_t terminal_pid,
@@ -214,6 +235,7 @@ typedef errval_t (*ram_free_handler_t)(struct capref);
 void lmp_server_dispatcher(void *arg);
 void lmp_server_register(struct lmp_chan *lc, struct capref cap);
 errval_t lmp_server_memory_alloc(struct lmp_chan *lc, size_t bytes, size_t align);
+errval_t lmp_server_memory_alloc_batch(struct lmp_chan *lc, size_t count, size_t bytes);
 void register_ram_free_handler(ram_free_handler_t ram_free_function);
 errval_t lmp_server_memory_free(struct lmp_chan *lc, struct capref cap);
 errval_t lmp_server_pid_discovery(struct lmp_chan *lc);
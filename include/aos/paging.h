@@ -28,6 +28,15 @@ typedef int paging_flags_t;
 
 #define PAGING_SLAB_BUFSIZE 12
 
+// Number of L1 page table slots covering the user part (lower 2 GiB) of the address space
+#define PAGING_L1_USER_ENTRIES (ARM_L1_MAX_ENTRIES / 2)
+
+// Page fault policy: the handler maps a naturally aligned window of pages
+// around the faulting address. The window starts small and doubles on
+// sequential faults up to the maximum.
+#define PAGING_FAULT_AROUND_MIN_PAGES 4     // 16 KiB
+#define PAGING_FAULT_AROUND_MAX_PAGES 16    // 64 KiB
+
 #define VREGION_FLAGS_READ     0x01 // Reading allowed
 #define VREGION_FLAGS_WRITE    0x02 // Writing allowed
 #define VREGION_FLAGS_EXECUTE  0x04 // Execute allowed
@@ -53,22 +62,44 @@ struct paging_state {
     struct capref l1_pagetable;
     struct slab_allocator vspace_slabs;             // Slab allocator for free_vspace_node
     int vspace_slabs_prevent_refill;                // Keep track when to prevent refill
-    struct vspace_node *alloc_vspace_head;          // Alloc list of allocated vspace regions
-    struct vspace_node *free_vspace_head;           // Free list of free vspace regions
+    struct vspace_node *alloc_vspace_root;          // Tree of allocated vspace regions ordered by address
+    struct vspace_node *free_vspace_root;           // Tree of free vspace regions ordered by address
+    struct vspace_node *free_vspace_size_root;      // Tree of free vspace regions ordered by size
     lvaddr_t free_vspace_base;                      // Base address of free vspace
     struct slab_allocator slabs;                    // Slab allocator for pt_cap_tree_node
     int slabs_prevent_refill;                       // Keep track when to prevent refill
-    struct pt_cap_tree_node *l2_tree_root;          // Tree of all L2 page table caps with subtrees for mappings
+    struct slab_allocator l2_slabs;                 // Slab allocator for pt_l2_occupancy
+    int l2_slabs_prevent_refill;                    // Keep track when to prevent refill
+    struct pt_cap_tree_node *l1_shadow[PAGING_L1_USER_ENTRIES]; // L2 page table caps with subtrees for mappings, indexed by L1 offset
+    size_t fault_around_pages;                      // Current fault-around window in pages
+    lvaddr_t fault_around_last_end;                 // End of the last window mapped by the pagefault handler
+    size_t num_pagefaults;                          // Number of page faults serviced
 };
 
-// struct for list of free virtual address regions
+// links of a vspace_node in one AVL tree
+struct vspace_link {
+    struct vspace_node *left;
+    struct vspace_node *right;
+    int height;
+};
+
+// struct for allocated and free virtual address regions. Allocated regions never
+// overlap, so the interval tree reduces to an AVL tree ordered by base address.
+// Free regions are additionally kept in a tree ordered by (size, base).
 struct vspace_node {
-    struct vspace_node *next;
     lvaddr_t base;
     size_t size;
+    struct vspace_link addr;                        // Links in the address ordered tree
+    struct vspace_link by_size;                     // Links in the size ordered tree (free regions only)
 };
 
-// struct for tree of allocated l2_pagetable capabilities
+// Bitmap of the mapped slots of an L2 page table
+struct pt_l2_occupancy {
+    uint32_t occupied[ARM_L2_MAX_ENTRIES / 32];
+};
+
+// struct for allocated l2_pagetable capabilities (entries of the L1 shadow table)
+// and the trees of frame mappings in them
 struct pt_cap_tree_node {
     struct pt_cap_tree_node *left;
     struct pt_cap_tree_node *right;
@@ -76,6 +107,10 @@ struct pt_cap_tree_node {
     uintptr_t offset;
     struct capref cap;
     struct capref mapping_cap;
+    union {
+        struct pt_l2_occupancy *occupancy;          // Mapped slots (L2 nodes)
+        size_t num_pages;                           // Pages of the mapping (mapping nodes)
+    };
 };
 
 struct thread;
@@ -125,6 +160,12 @@ errval_t paging_alloc_fixed(struct paging_state *st, void *buf, size_t bytes);
 
 errval_t paging_alloc_fixed_commit(struct paging_state *st);
 
+/**
+ * \brief Find the allocated region containing `vaddr` in O(log n).
+ */
+errval_t paging_lookup_region(struct paging_state *st, lvaddr_t vaddr,
+                              lvaddr_t *ret_base, size_t *ret_size);
+
 /**
  * \brief Find a bit of free virtual address space that is large enough to
  *        accomodate a buffer of size `bytes`.
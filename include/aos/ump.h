@@ -9,17 +9,49 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <aos/aos.h>
+#include <aos/waitset.h>
+#include <aos/deferred.h>
+#include <aos/threads.h>
 
-#define UMP_BUF_SIZE           MON_URPC_SIZE
-#define UMP_NUM_SLOTS          64
+#define UMP_CACHE_LINE_SIZE    64
 #define UMP_SLOT_DATA_BYTES    63
 
+// Ring depth in slots per direction (must be a power of two)
+#define UMP_DEFAULT_DEPTH      64
+#define UMP_STREAM_DEPTH       256
+#define UMP_MAX_DEPTH          4096
+
+// Size of a UMP frame holding the header and two rings of `depth` slots
+#define UMP_FRAME_SIZE(depth)  ROUND_UP(sizeof(struct ump_frame_header) + \
+                                        2 * (depth) * sizeof(struct ump_slot), \
+                                        BASE_PAGE_SIZE)
+
+// Size of a UMP frame with rings of the default depth
+#define UMP_BUF_SIZE           UMP_FRAME_SIZE(UMP_DEFAULT_DEPTH)
+
 #define UMP_BSP_BUF_SELECT     0
 #define UMP_APP_BUF_SELECT     1
 
 #define UMP_CLIENT_BUF_SELECT     0
 #define UMP_SERVER_BUF_SELECT     1
 
+// Bulk transfer: a UMP frame larger than UMP_FRAME_SIZE(depth) carries one
+// pool of blocks per direction behind the slot rings. Payloads above the threshold
+// are placed in the sender's pool and only a descriptor travels in a slot.
+// The receiver hands blocks back by clearing them in the shared bitmap.
+#define UMP_BULK_BLOCK_SIZE       BASE_PAGE_SIZE
+#define UMP_BULK_MAX_BLOCKS       32
+#define UMP_BULK_POOL_SIZE        (UMP_BULK_MAX_BLOCKS * UMP_BULK_BLOCK_SIZE)
+#define UMP_BULK_THRESHOLD        (8 * UMP_SLOT_DATA_BYTES)
+
+// Receive events: a registered channel is polled by the dispatcher for
+// UMP_RECV_SPIN_POLLS upcalls after it was last active. An idle channel is
+// then only re-checked by a timer whose delay doubles up to the maximum, so
+// the dispatcher can sleep. There is no cross-core notification to wait on.
+#define UMP_RECV_SPIN_POLLS       128
+#define UMP_RECV_BACKOFF_MIN_US   1000
+#define UMP_RECV_BACKOFF_MAX_US   16000
+
 
 // UMP message types
 #define UMP_MessageType_Bootinfo            0
@@ -34,6 +66,9 @@
 #define UMP_MessageType_UrpcBindRequest     9
 #define UMP_MessageType_UrpcBindAck         10
 #define UMP_MessageType_DeregisterForward   11
+#define UMP_MessageType_RamSteal            12
+#define UMP_MessageType_RamStealAck         13
+#define UMP_MessageType_BulkDescriptor      14
 
 #define UMP_MessageType_User0  32
 #define UMP_MessageType_User1  33
@@ -56,38 +91,83 @@
 typedef uint8_t ump_msg_type_t;
 
 
-struct ump_chan {
-    struct frame_identity fi;
-    struct ump_buf *buf;
-    uint8_t buf_select;         // Buffer for this process
-    uint8_t tx_counter;
-    uint8_t rx_counter;
-    uint8_t ack_counter;
+// Counters of one ring. Both are free running slot counts: the producers
+// publish filled slots by advancing the tail and the consumer hands slots
+// back by advancing the head. Each sits on a cache line of its own.
+struct ump_ring_ctrl {
+    volatile uint32_t tail;
+    char RESERVED0[UMP_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    volatile uint32_t head;
+    char RESERVED1[UMP_CACHE_LINE_SIZE - sizeof(uint32_t)];
 };
 
-
-struct ump_buf_header {
-    uint8_t tx_counter;
-    uint8_t rx_counter;
-    uint8_t ack_counter;
-    char RESERVED[61];      // Make sure the size of the struct is 64 bytes
+// Start of a UMP frame, followed by the two slot rings and the bulk pools
+struct ump_frame_header {
+    struct ump_ring_ctrl rings[2];  // One ring per direction
+    uint32_t depth;                 // Slots per ring, set by the allocator
+    char RESERVED0[UMP_CACHE_LINE_SIZE - sizeof(uint32_t)];
+    volatile uint32_t bulk_used[2]; // Bitmaps of the bulk blocks in use,
+                                    // set by the sender, cleared by the
+                                    // receiver once done with a payload
+    char RESERVED1[UMP_CACHE_LINE_SIZE - 2 * sizeof(uint32_t)];
 };
 
 struct ump_slot {
-    char data[63];
+    char data[UMP_SLOT_DATA_BYTES];
     ump_msg_type_t msg_type     : 6;
     uint8_t last                : 1;
-    uint8_t valid               : 1;
+    uint8_t RESERVED            : 1;
+};
+
+STATIC_ASSERT_SIZEOF(struct ump_ring_ctrl, 2 * UMP_CACHE_LINE_SIZE);
+STATIC_ASSERT_SIZEOF(struct ump_frame_header, 6 * UMP_CACHE_LINE_SIZE);
+STATIC_ASSERT_SIZEOF(struct ump_slot, UMP_CACHE_LINE_SIZE);
+
+// A UMP channel may be sent on by several threads of the domain at once,
+// but only one thread may receive on it.
+struct ump_chan {
+    struct frame_identity fi;
+    void *buf;                  // Mapped UMP frame
+    uint8_t buf_select;         // Ring we send on
+    uint32_t depth;             // Slots per ring
+    struct ump_ring_ctrl *tx_ctrl;
+    struct ump_ring_ctrl *rx_ctrl;
+    struct ump_slot *tx_slots;
+    struct ump_slot *rx_slots;
+    volatile uint32_t tx_reserved;  // Slots reserved by our senders
+    uint32_t tx_head;           // Head of the send ring when last read
+    uint32_t rx_head;           // Next slot to receive
+    uint32_t rx_tail;           // Tail of the receive ring when last read
+    char *bulk_tx;              // Bulk pool we send from (NULL if disabled)
+    char *bulk_rx;              // Bulk pool the other end sends from
+    size_t bulk_blocks;         // Number of blocks in each pool
+    volatile uint32_t *bulk_tx_used;    // Blocks of bulk_tx in use
+    volatile uint32_t *bulk_rx_used;    // Blocks of bulk_rx in use
+    struct thread_mutex bulk_lock;  // Serializes allocations from bulk_tx
+    struct waitset_chanstate recv_waitset;  // Polled receive registration
+    struct deferred_event recv_backoff;     // Timer re-checking an idle chan
+    struct event_closure recv_closure;      // Closure of the registration
+    struct waitset *recv_ws;                // Waitset of the registration
+    uint32_t recv_idle_polls;               // Empty polls since last message
+    delayus_t recv_backoff_delay;           // Current timer delay
 };
 
-struct ump_buf {
-    struct ump_slot slots[UMP_NUM_SLOTS];
+// Descriptor of a payload in a bulk pool
+struct ump_bulk_desc {
+    uint32_t offset;            // Offset into the sender's pool
+    uint32_t length;            // Length of the payload in bytes
+    ump_msg_type_t msg_type;    // Message type of the payload
 };
 
 
-// Initialize a UMP frame
+// Initialize a UMP channel
 void ump_chan_init(struct ump_chan *chan, uint8_t buf_select);
 
+// Set up the rings (and bulk pools) once the frame is mapped at chan->buf.
+// The end that allocated the frame passes the ring depth and must do so
+// before handing the frame over, the other end passes 0 to use that depth.
+errval_t ump_chan_setup(struct ump_chan *chan, size_t depth);
+
 // Send a buffer of at most UMP_SLOT_DATA_BYTES bytes on the UMP channel
 errval_t ump_send_one(struct ump_chan *chan, const void *buf, size_t size,
                        ump_msg_type_t msg_type, uint8_t last);
@@ -109,4 +189,45 @@ errval_t ump_recv(struct ump_chan *chan, void **buf, size_t *size,
 void ump_recv_blocking(struct ump_chan *chan, void **buf, size_t *size,
                     ump_msg_type_t *msg_type);
 
+
+// MARK: - Waitset integration
+
+// Check whether a message is waiting in the receive ring
+static inline bool ump_chan_can_recv(struct ump_chan *chan) {
+    return chan->rx_head != chan->rx_ctrl->tail;
+}
+
+// Register a closure to be run on `ws` when a message can be received.
+// Like an LMP registration it fires once and must be renewed by the handler.
+errval_t ump_chan_register_recv(struct ump_chan *chan, struct waitset *ws,
+                                struct event_closure closure);
+
+// Cancel a registration made with ump_chan_register_recv()
+errval_t ump_chan_deregister_recv(struct ump_chan *chan);
+
+// Poll a registered channel (called by the waitset code while disabled)
+void ump_chan_poll_disabled(struct waitset_chanstate *ws_chan,
+                            dispatcher_handle_t handle);
+
+
+// MARK: - Bulk transfer
+
+// Allocate a buffer of `size` bytes in our bulk pool to fill in place
+errval_t ump_bulk_alloc(struct ump_chan *chan, size_t size, void **buf,
+                        struct ump_bulk_desc *desc);
+
+// Send a filled bulk buffer to the other end (only the descriptor is copied)
+errval_t ump_bulk_send(struct ump_chan *chan, struct ump_bulk_desc *desc,
+                       ump_msg_type_t msg_type);
+
+// Receive a message without copying it out of the other end's bulk pool.
+// Small messages are received as by ump_recv(). Release the buffer with
+// ump_bulk_release() in both cases.
+errval_t ump_recv_bulk(struct ump_chan *chan, void **buf, size_t *size,
+                       ump_msg_type_t *msg_type, struct ump_bulk_desc *desc);
+
+// Release a buffer received with ump_recv_bulk()
+errval_t ump_bulk_release(struct ump_chan *chan, void *buf,
+                          struct ump_bulk_desc *desc);
+
 #endif /* ump_h */
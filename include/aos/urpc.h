@@ -37,6 +37,10 @@
 // UMP message types type
 typedef ump_msg_type_t urpc_msg_type_t;
 
+// Handler for requests of the other core to hand over some of our RAM
+typedef errval_t (*urpc_ram_steal_handler_t)(size_t bytes, size_t alignment,
+                                             struct frame_identity *ret_fi);
+
 // URPC channel
 struct urpc_chan {
     bool use_lmp;
@@ -55,11 +59,27 @@ void urpc_init_server_handler(struct ump_chan *chan, void *msg, size_t size,
 void urpc_register_process_handler(struct ump_chan *chan, void *msg,
                                    size_t size, ump_msg_type_t msg_type);
 
+// Register the function handing over RAM to the other core
+void urpc_register_ram_steal_handler(urpc_ram_steal_handler_t handler);
+
+// Handle UMP_MessageType_RamSteal
+void urpc_ram_steal_request_handler(struct ump_chan *chan, void *msg,
+                                    size_t size, ump_msg_type_t msg_type);
+
 // MARK: - Init URPC Client
 
+// Receive on the init channel. Responses that arrived while urpc_ram_steal()
+// waited are returned here first, in the order they were received.
+errval_t urpc_init_recv(struct ump_chan *chan, void **buf, size_t *size,
+                        ump_msg_type_t *msg_type);
+
 // RPC for registering a process
 void urpc_process_register(struct process_info *pi);
 
+// RPC for taking over a region of RAM from the other core
+errval_t urpc_ram_steal(size_t bytes, size_t alignment,
+                        struct frame_identity *ret_fi);
+
 
 // MARK: - Generic Server
 
@@ -75,6 +95,16 @@ errval_t urpc_accept_blocking(struct urpc_chan *chan);
 // Bind to a URPC server with a specific PID
 errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp);
 
+// Bind to a URPC server with a specific PID and bulk pools of `pool_size`
+// bytes per direction (UMP only)
+errval_t urpc_bind_bulk(domainid_t pid, struct urpc_chan *chan, bool use_lmp,
+                        size_t pool_size);
+
+// Bind to a URPC server with a specific PID, rings of `depth` slots and bulk
+// pools of `pool_size` bytes per direction (UMP only)
+errval_t urpc_bind_ring(domainid_t pid, struct urpc_chan *chan, bool use_lmp,
+                        size_t depth, size_t pool_size);
+
 
 // MARK: - Generic Send & Receive
 
@@ -90,6 +120,16 @@ errval_t urpc_recv(struct urpc_chan *chan, void **buf, size_t *size,
 errval_t urpc_recv_blocking(struct urpc_chan *chan, void **buf, size_t *size,
                             urpc_msg_type_t* msg_type);
 
+// Register a closure to be run on `ws` once a message can be received
+errval_t urpc_register_recv(struct urpc_chan *chan, struct waitset *ws,
+                            struct event_closure closure);
+
+// Cancel a registration made with urpc_register_recv()
+errval_t urpc_deregister_recv(struct urpc_chan *chan);
+
+// Tear down an accepted URPC channel once the other end stopped using it
+void urpc_chan_destroy(struct urpc_chan *chan);
+
 
 // MARK: - URPC bind handlers
 
@@ -38,5 +38,15 @@ struct urpc_bind_request {
     domainid_t pid;
 };
 
+struct urpc_ram_steal_request {
+    size_t bytes;
+    size_t alignment;
+};
+
+struct urpc_ram_steal_response {
+    errval_t err;
+    struct frame_identity fi;
+};
+
 
 #endif /* urpc_protocol_h */
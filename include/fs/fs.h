@@ -7,6 +7,7 @@
 #define INCLUDE_FS_FS_H_
 
 #include <aos/aos.h>
+#include <string.h>
 
 #define FS_PATH_SEP '/'
 
@@ -28,6 +29,46 @@ struct fs_fileinfo {
     size_t size;            ///< Size of the object (in bytes, for a regular file)
 };
 
+/// Record of a packed batch of directory entries, followed by the '\0'
+/// terminated name of the entry
+struct fs_dirbatch_entry {
+    struct fs_fileinfo info;  ///< Type and size of the entry
+    size_t reclen;            ///< Bytes from this record to the next one
+};
+
+/// Bytes taken up in a batch by the record of an entry called `name`
+static inline size_t fs_dirbatch_reclen(const char *name)
+{
+    return ROUND_UP(sizeof(struct fs_dirbatch_entry) + strlen(name) + 1,
+                    sizeof(size_t));
+}
+
+/// Append an entry to the batch in `buf`, unless `*offset` plus its record
+/// exceeds `bytes`. Returns false in that case.
+static inline bool fs_dirbatch_add(void *buf, size_t bytes, size_t *offset,
+                                   const char *name,
+                                   const struct fs_fileinfo *info)
+{
+    size_t reclen = fs_dirbatch_reclen(name);
+    if (*offset + reclen > bytes) {
+        return false;
+    }
+
+    struct fs_dirbatch_entry *e = (struct fs_dirbatch_entry *)((char *)buf + *offset);
+    e->info = *info;
+    e->reclen = reclen;
+    strcpy((char *)(e + 1), name);
+
+    *offset += reclen;
+    return true;
+}
+
+/// Name of an entry of a batch
+static inline char *fs_dirbatch_name(struct fs_dirbatch_entry *e)
+{
+    return (char *)(e + 1);
+}
+
 /*
  * Copyright (c) 2016 ETH Zurich.
  * All rights reserved.
@@ -47,6 +88,16 @@ struct fs_fileinfo {
  */
 errval_t filesystem_init(void);
 
+/**
+ * @brief releases the files still held on the file server
+ *
+ * @return SYS_ERR_OK on success
+ *         errval on failure
+ *
+ * NOTE: No file can be accessed afterwards
+ */
+errval_t filesystem_deinit(void);
+
 /**
  * @brief mounts the URI at a give path
  *
@@ -7,6 +7,7 @@
 #define fs_rpc_h
 
 #include <aos/aos.h>
+#include <aos/ump.h>
 
 #include <fs/fs.h>
 #include <fs/fs_fat.h>
@@ -26,6 +27,24 @@
 #define URPC_MessageType_MakeDir   URPC_MessageType_User10
 #define URPC_MessageType_RemoveDir URPC_MessageType_User11
 
+#define URPC_MessageType_Preallocate URPC_MessageType_User12
+#define URPC_MessageType_Stat      URPC_MessageType_User13
+#define URPC_MessageType_ReadDirBatch URPC_MessageType_User14
+#define URPC_MessageType_Disconnect URPC_MessageType_User15
+
+// Size of the bulk pools of the channel to the server (a frame shared by both)
+#define FS_RPC_BULK_POOL_SIZE       UMP_BULK_POOL_SIZE
+
+// Reads and writes of at least this many bytes are passed through the bulk
+// pools instead of the slots of the UMP channel
+#define FS_RPC_BULK_THRESHOLD       BASE_PAGE_SIZE
+
+// Largest read or write sent in one request (leaves a block for the header)
+#define FS_RPC_MAX_TRANSFER         (FS_RPC_BULK_POOL_SIZE - UMP_BULK_BLOCK_SIZE)
+
+// Largest batch of packed directory entries returned by one readdir request
+#define FS_RPC_READDIR_BATCH_SIZE   (8 * 1024)
+
 typedef void *fat32fs_handle_t;
 
 struct fat32fs_handle
@@ -34,7 +53,14 @@ struct fat32fs_handle
     char *path;
     bool isdir;
     struct fat_dirent *dirent;
-    off_t pos;
+    uint32_t id;                    // Handle of the open file on the server
+    off_t pos;                      // File position or position in the directory
+    
+    // Directory entries received in a batch but not handed out yet
+    void *dir_batch;
+    size_t dir_batch_bytes;         // Bytes of packed entries in dir_batch
+    size_t dir_batch_offset;        // Offset of the next entry to hand out
+    bool dir_end;                   // The server reached the end of the directory
 };
 
 struct fs_message {
@@ -47,6 +73,9 @@ struct fs_message {
 
 errval_t fs_rpc_init(void *state);
 
+// Tell the server we go away, so it drops the handles we still hold
+errval_t fs_rpc_deinit(void);
+
 errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle);
 
 errval_t fs_rpc_create(void *st, char *path, fat32fs_handle_t *ret_handle);
@@ -59,6 +88,9 @@ errval_t fs_rpc_write(void *st, fat32fs_handle_t handle, const void *buffer, siz
 
 errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes);
 
+// Reserve clusters for the first `bytes` bytes of the file without changing its size
+errval_t fs_rpc_preallocate(void *st, fat32fs_handle_t handle, size_t bytes);
+
 errval_t fs_rpc_tell(void *st, fat32fs_handle_t handle, size_t *ret_pos);
 
 errval_t fs_rpc_stat(void *st, fat32fs_handle_t inhandle, struct fs_fileinfo *info);
@@ -71,6 +103,10 @@ errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_handle);
 
 errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name, struct fs_fileinfo *info);
 
+// Get as many entries as fit into `bytes` bytes of `buffer`, packed as struct fs_dirbatch_entry
+errval_t fs_rpc_readdir_batch(void *st, fs_dirhandle_t dirhandle, void *buffer, size_t bytes,
+                              size_t *ret_count, size_t *ret_bytes);
+
 errval_t fs_rpc_closedir(void *st, fs_dirhandle_t dirhandle);
 
 errval_t fs_rpc_mkdir(void *st, char *path);
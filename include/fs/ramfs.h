@@ -43,6 +43,9 @@ errval_t ramfs_opendir(void *st, char *path, ramfs_handle_t *rethandle);
 errval_t ramfs_dir_read_next(void *st, ramfs_handle_t inhandle, char **retname,
                              struct fs_fileinfo *info);
 
+errval_t ramfs_dir_read_batch(void *st, ramfs_handle_t inhandle, void *buf,
+                              size_t bytes, size_t *retcount, size_t *retbytes);
+
 errval_t ramfs_closedir(void *st, ramfs_handle_t dhandle);
 
 errval_t ramfs_mkdir(void *st, char *path);
@@ -50,6 +50,8 @@ errval_t vfs_write(void *st, vfs_handle_t handle, void *buffer, size_t bytes, si
 
 errval_t vfs_truncate(void *st, vfs_handle_t handle, size_t bytes);
 
+errval_t vfs_preallocate(void *st, vfs_handle_t handle, size_t bytes);
+
 errval_t vfs_tell(void *st, vfs_handle_t handle, size_t *pos);
 
 errval_t vfs_stat(void *st, vfs_handle_t handle, struct fs_fileinfo *info);
@@ -64,6 +66,10 @@ errval_t vfs_opendir(void *st, const char *path, vfs_handle_t *rethandle);
 //vfs_readdir(mount, h, name, NULL);
 errval_t vfs_dir_read_next(void *st, vfs_handle_t handle, char **retname, struct fs_fileinfo *info);
 
+// Read as many entries as fit into `bytes` bytes of `buffer`, packed as struct fs_dirbatch_entry
+errval_t vfs_dir_read_batch(void *st, vfs_handle_t handle, void *buffer, size_t bytes,
+                            size_t *retcount, size_t *retbytes);
+
 errval_t vfs_closedir(void *st, vfs_handle_t dirhandle);
 
 
@@ -0,0 +1,73 @@
+//
+//  block_cache.h
+//  DoritOS
+//
+
+#ifndef block_cache_h
+#define block_cache_h
+
+#include <aos/aos.h>
+
+// Memory used for cached clusters
+#define BLOCK_CACHE_BUDGET      (256 * 1024)
+
+// Number of clusters read ahead when a cluster chain is read sequentially
+#define BLOCK_CACHE_READAHEAD   4
+
+enum block_cache_mode {
+
+    BLOCK_CACHE_READ,                       // Load the cluster, may read ahead
+    BLOCK_CACHE_UPDATE,                     // Load the cluster, no read-ahead
+    BLOCK_CACHE_OVERWRITE,                  // Caller overwrites the whole cluster
+
+};
+
+struct block_cache_buf {
+
+    size_t cluster_nr;                      // Cached cluster
+    uint8_t *data;                          // Cluster data (BytesPerClus bytes)
+
+    uint16_t pins;                          // Number of users holding the buffer
+    bool valid;                             // Buffer holds cluster_nr
+    bool dirty;                             // Buffer differs from the card
+    bool referenced;                        // Used since the clock hand passed
+
+    struct block_cache_buf *hash_next;      // Next buffer in hash bucket
+
+};
+
+struct block_cache_stats {
+
+    size_t hits;                            // Lookups served from the cache
+    size_t misses;                          // Lookups that had to go to the card
+    size_t readahead;                       // Clusters loaded by read-ahead
+    size_t evictions;                       // Valid buffers that were reused
+    size_t writebacks;                      // Dirty clusters written to the card
+
+};
+
+// Set up the cache with `budget` bytes worth of cluster buffers
+errval_t block_cache_init(size_t budget);
+
+// Get the pinned buffer for cluster `cluster_nr`
+errval_t block_cache_get(size_t cluster_nr, enum block_cache_mode mode,
+                         struct block_cache_buf **ret_buf);
+
+// Unpin a buffer and mark it dirty if it was modified
+void block_cache_release(struct block_cache_buf *buf, bool dirty);
+
+// Write all dirty clusters back to the card
+errval_t block_cache_sync(void);
+
+// Get the last cluster read with BLOCK_CACHE_READ, which the next read is
+// compared with to detect sequential access
+size_t block_cache_get_stream(void);
+
+// Set the cluster the next read is compared with (e.g. to follow one stream per
+// open file when the reads of several files are interleaved)
+void block_cache_set_stream(size_t cluster_nr);
+
+// Get the hit/miss counters of the cache
+void block_cache_get_stats(struct block_cache_stats *ret_stats);
+
+#endif /* block_cache_h */
@@ -0,0 +1,26 @@
+//
+//  fat_alloc.h
+//  DoritOS
+//
+
+#ifndef fat_alloc_h
+#define fat_alloc_h
+
+#include <aos/aos.h>
+
+// Build the free cluster bitmap from the FAT (after fat_cache_init())
+errval_t fat_alloc_init(void);
+
+// Allocate a run of up to `count` contiguous clusters, linked into a chain that
+// ends with an end of chain marker. The run starts at `hint` if that cluster is
+// free, otherwise the largest run found from the next fit cursor is taken.
+errval_t fat_alloc_run(size_t count, size_t hint, size_t *ret_cluster_nr,
+                       size_t *ret_count);
+
+// Mark `cluster_nr` as free after its FAT entry was set to zero
+void fat_alloc_free(size_t cluster_nr);
+
+// Get the number of free clusters on the volume
+size_t fat_alloc_free_count(void);
+
+#endif /* fat_alloc_h */
@@ -0,0 +1,29 @@
+//
+//  fat_cache.h
+//  DoritOS
+//
+
+#ifndef fat_cache_h
+#define fat_cache_h
+
+#include <aos/aos.h>
+
+// Load the entire FAT when the file system is mounted instead of on demand
+#define FAT_CACHE_PRELOAD   0
+
+// Set up the cache once the BPB has been parsed
+errval_t fat_cache_init(void);
+
+// Get the cached FAT sector `sector_index` (relative to the start of the FAT)
+errval_t fat_cache_get_sector(size_t sector_index, uint32_t **ret_sector);
+
+// Read FAT entry `n` (with the reserved upper 4 bits masked out)
+errval_t fat_cache_get(size_t n, uint32_t *ret_value);
+
+// Set FAT entry `n` in the cache (the reserved upper 4 bits are preserved)
+errval_t fat_cache_set(size_t n, uint32_t value);
+
+// Write all dirty FAT sectors back to every FAT copy on the card
+errval_t fat_cache_sync(void);
+
+#endif /* fat_cache_h */
@@ -0,0 +1,41 @@
+//
+//  fat_dentry.h
+//  DoritOS
+//
+
+#ifndef fat_dentry_h
+#define fat_dentry_h
+
+#include <aos/aos.h>
+
+// Number of directories whose name index is kept at the same time
+#define FAT_DENTRY_DIRS     16
+
+// Directory entry as found in the name index of its directory
+struct fat_dentry {
+
+    char name[11];                  // Name in FAT 8.3 format (not null terminated)
+    bool is_dir;
+
+    size_t pos;                     // Position in the directory
+    size_t first_cluster_nr;
+
+};
+
+// Look up `fat_name` in the directory starting at `dir_cluster_nr`. The index of
+// the directory is built by reading it once, after that a name that is not in
+// the index does not exist (FAT_ERR_FAT_LOOKUP) without going to the card.
+errval_t fat_dentry_lookup(size_t dir_cluster_nr, const char *fat_name,
+                           struct fat_dentry *ret_dentry);
+
+// Record that an entry was written at `pos` of the directory
+void fat_dentry_insert(size_t dir_cluster_nr, const char *fat_name, size_t pos,
+                       size_t first_cluster_nr, bool is_dir);
+
+// Record that the entry `fat_name` was removed from the directory
+void fat_dentry_remove(size_t dir_cluster_nr, const char *fat_name);
+
+// Forget the index of the directory starting at `dir_cluster_nr` (its clusters were freed)
+void fat_dentry_invalidate(size_t dir_cluster_nr);
+
+#endif /* fat_dentry_h */
@@ -0,0 +1,41 @@
+//
+//  fat_extent.h
+//  DoritOS
+//
+
+#ifndef fat_extent_h
+#define fat_extent_h
+
+#include <aos/aos.h>
+
+// Number of cluster chains whose extent maps are kept at the same time
+#define FAT_EXTENT_MAPS     16
+
+// Run of physically contiguous clusters in a cluster chain
+struct fat_extent {
+
+    size_t index;                   // Position of the first cluster in the chain
+    size_t cluster_nr;              // First cluster of the run
+    size_t count;                   // Number of clusters in the run
+
+};
+
+// Look up the `index`th cluster of the chain starting at `first_cluster_nr`.
+// `ret_run` (optional) is set to the number of contiguous clusters from there.
+errval_t fat_extent_lookup(size_t first_cluster_nr, size_t index,
+                           size_t *ret_cluster_nr, size_t *ret_run);
+
+// Get the last cluster and the length of the chain starting at `first_cluster_nr`
+errval_t fat_extent_last(size_t first_cluster_nr, size_t *ret_cluster_nr,
+                         size_t *ret_count);
+
+// Record that `cluster_nr` was linked to the end of the chain
+void fat_extent_append(size_t first_cluster_nr, size_t cluster_nr);
+
+// Record that the chain was cut down to `cluster_count` clusters
+void fat_extent_truncate(size_t first_cluster_nr, size_t cluster_count);
+
+// Forget the chain starting at `first_cluster_nr` (its clusters were freed)
+void fat_extent_invalidate(size_t first_cluster_nr);
+
+#endif /* fat_extent_h */
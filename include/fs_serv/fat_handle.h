@@ -0,0 +1,55 @@
+//
+//  fat_handle.h
+//  DoritOS
+//
+
+#ifndef fat_handle_h
+#define fat_handle_h
+
+#include <aos/aos.h>
+
+#include <fs/fs_fat.h>
+
+// File or directory opened through the RPC server. All opens of the same file
+// share one handle, so its cached size stays current for every client.
+struct fat_handle {
+
+    struct fat_dirent dirent;       // Cached dirent (dirent.size is the file size)
+
+    uint32_t refcount;              // Number of opens (0 if the slot is free)
+    bool removed;                   // File was removed while it was open
+
+    size_t stream_cluster;          // Last cluster read through the handle (read-ahead)
+
+};
+
+// Opens of one handle by one client
+struct fat_handle_ref {
+    uint32_t id;
+    uint32_t opens;
+};
+
+// Handles held by one client (zero-initialized when the client binds)
+struct fat_handle_owner {
+    struct fat_handle_ref *refs;
+    size_t refs_count;
+    size_t refs_capacity;
+};
+
+// Open a handle for `dirent` (or take another reference to an existing one)
+errval_t fat_handle_open(struct fat_handle_owner *owner, struct fat_dirent *dirent, uint32_t *ret_id);
+
+// Get the handle `id`, which `owner` must hold
+errval_t fat_handle_get(struct fat_handle_owner *owner, uint32_t id, struct fat_handle **ret_handle);
+
+// Drop a reference of `owner` to handle `id`
+errval_t fat_handle_close(struct fat_handle_owner *owner, uint32_t id);
+
+// Drop all references of `owner` (when its client goes away)
+void fat_handle_release_owner(struct fat_handle_owner *owner);
+
+// Mark the handles of the file with the directory entry at `parent_pos` in
+// the directory starting at `parent_cluster_nr` as removed
+void fat_handle_invalidate(size_t parent_cluster_nr, size_t parent_pos);
+
+#endif /* fat_handle_h */
@@ -7,7 +7,31 @@
 #define fatfs_rpc_serv_h
 
 #include <aos/aos.h>
+#include <aos/urpc.h>
+#include <aos/systime.h>
 
+// Largest part of a read or write that is served before the next client gets a turn
+#define FATFS_RPC_SERV_CHUNK_SIZE       (16 * 1024)
+
+// Interval for checking for new bind requests in microseconds
+#define FATFS_RPC_SERV_ACCEPT_POLL_US   10000
+
+// Number of message types with latency counters (starting at URPC_MessageType_User0)
+#define FATFS_RPC_SERV_MSG_TYPES        16
+
+// Latency of the requests of one message type (time from arrival to response)
+struct fatfs_rpc_serv_stats {
+    
+    size_t count;                   // Requests served
+    systime_t total;                // Sum of latencies
+    systime_t max;                  // Largest latency
+    
+};
+
+// Get the latency counters of `msg_type`
+void fatfs_rpc_serv_get_stats(urpc_msg_type_t msg_type, struct fatfs_rpc_serv_stats *ret_stats);
+
+// Serve file system requests of all clients, does not return
 errval_t run_rpc_serv(void);
 
 #endif /* fatfs_rpc_serv_h */
@@ -8,6 +8,7 @@
 
 #include <aos/aos.h>
 
+#include <fs/fs.h>
 #include <fs/fs_fat.h>
 
 #define GET_BYTES1(buf, offset) (uint8_t)   ((uint8_t *) buf)[offset]
@@ -122,6 +123,8 @@ errval_t remove_fat_entries_from(size_t cluster_nr, size_t start_index);
 
 errval_t append_cluster_chain(size_t cluster_nr, size_t cluster_count);
 
+errval_t reserve_cluster_chain(size_t cluster_nr, size_t cluster_count);
+
 
 // DIRECTORY FUNCTIONS
 
@@ -129,6 +132,12 @@ errval_t fatfs_serv_opendir(void *st, char *path, struct fat_dirent **ret_dirent
 
 errval_t fatfs_serv_readdir(size_t cluster_nr, size_t dir_index, struct fat_dirent **ret_dirent);
 
+// Pack the entries of a directory into `buffer` (see struct fs_dirbatch_entry),
+// starting at directory entry position `*cursor`. On return `*cursor` is where
+// the next batch starts and `*ret_end` tells if the directory was read to the end.
+errval_t fatfs_serv_readdir_batch(size_t cluster_nr, size_t *cursor, void *buffer, size_t bytes,
+                                  size_t *ret_count, size_t *ret_bytes, bool *ret_end);
+
 
 
 // DIRECTORY ENTRY HELPER FUNCTIONS
@@ -164,6 +173,8 @@ errval_t fatfs_serv_rmdir(void *st, char *path);
 
 errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes);
 
+errval_t preallocate_dirent(struct fat_dirent *dirent, size_t bytes);
+
 
 errval_t read_dirent(struct fat_dirent *dirent, void *buffer, size_t start, size_t bytes, size_t *bytes_read);
 errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, size_t bytes, size_t *bytes_written);
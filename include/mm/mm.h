@@ -29,6 +29,17 @@ enum nodetype {
     NodeType_Allocated  ///< This region exists and is allocated
 };
 
+/**
+ * \brief Search strategy used by mm_alloc_aligned() and mm_free()
+ */
+enum mm_strategy {
+    MM_STRATEGY_SEGREGATED_FIT, ///< Per-order free lists and address index (default)
+    MM_STRATEGY_FIRST_FIT       ///< Linear first-fit walk of the node list
+};
+
+/// Number of size classes (one per power of two of a gensize_t)
+#define MM_NUM_ORDERS   64
+
 struct capinfo {
     struct capref cap;
     genpaddr_t base;
@@ -45,6 +56,11 @@ struct mmnode {
     struct mmnode *next;   ///< Next node in the list.
     genpaddr_t base;       ///< Base address of this region
     gensize_t size;        ///< Size of this free region in cap
+    struct mmnode *free_prev;   ///< Previous node in the free list of this order
+    struct mmnode *free_next;   ///< Next node in the free list of this order
+    struct mmnode *idx_left;    ///< Left child in the address index
+    struct mmnode *idx_right;   ///< Right child in the address index
+    int idx_height;             ///< Height of the subtree in the address index
 };
 
 /**
@@ -61,6 +77,12 @@ struct mm {
     enum objtype objtype;        ///< Type of capabilities stored
     struct mmnode *head;         ///< Head of doubly-linked list of nodes in order
     int is_refilling;            ///< Indicates if the slab allocator is refilling
+    enum mm_strategy strategy;   ///< Strategy used to find nodes
+    struct mmnode *free_lists[MM_NUM_ORDERS]; ///< Free nodes by order of their size
+    uint64_t free_mask;          ///< Bit i is set iff free_lists[i] is non-empty
+    struct mmnode *idx_root;     ///< Root of the AVL tree of all nodes keyed by base
+    gensize_t total;             ///< Total bytes of memory added to the manager
+    gensize_t available;         ///< Bytes of memory currently free
 };
 
 errval_t mm_init(struct mm *mm, enum objtype objtype,
@@ -74,6 +96,7 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment,
 errval_t mm_alloc(struct mm *mm, size_t size, struct capref *retcap);
 errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t size);
 errval_t mm_available(struct mm *mm, gensize_t *available, gensize_t *total);
+void mm_set_strategy(struct mm *mm, enum mm_strategy strategy);
 void mm_dump_mmnodes(struct mm *mm);
 void mm_destroy(struct mm *mm);
 
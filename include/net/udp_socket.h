@@ -12,11 +12,31 @@
 #include <net/common.h>
 
 #include <stdint.h>
+#include <stdbool.h>
 
+#include <aos/aos.h>
+
+
+// Wait as long as it takes for a socket to become readable
+#define UDP_POLL_FOREVER    ((delayus_t) -1)
+
+// Size of the packet buffer pools shared with networkd in each direction
+#define UDP_SOCKET_POOL_SIZE    UMP_BULK_POOL_SIZE
 
 struct udp_socket {
     struct udp_socket_common pub;
     struct urpc_chan chan;
+    
+    // Message received by udp_poll() that recvfrom() has not picked up yet
+    void *pending;
+    size_t pending_size;
+    urpc_msg_type_t pending_type;
+    struct ump_bulk_desc pending_desc;  // Length is 0 unless in the shared pool
+};
+
+struct udp_pollfd {
+    struct udp_socket *socket;
+    bool readable;          // Set by udp_poll() if recvfrom() will not block
 };
 
 
@@ -32,6 +52,30 @@ errval_t recvfrom(struct udp_socket *socket, void *buf, size_t len,
 errval_t sendto(struct udp_socket *socket, void *buf, size_t len,
                 uint32_t to_addr, uint16_t to_port);
 
+// Blockingly receive a UDP packet without copying it. The payload is lent
+// from the pool shared with networkd until it is returned with
+// recvfrom_release().
+errval_t recvfrom_buffer(struct udp_socket *socket, void **ret_buf,
+                         size_t *ret_len, uint32_t *from_addr,
+                         uint16_t *from_port);
+
+// Return a payload lent by recvfrom_buffer()
+errval_t recvfrom_release(struct udp_socket *socket, void *buf);
+
+// Get a buffer for a payload of up to len bytes, to be filled in place and
+// sent with sendto_buffer()
+errval_t sendto_alloc(struct udp_socket *socket, size_t len, void **ret_buf);
+
+// Send a payload of len bytes in a buffer from sendto_alloc(), which is
+// handed over to networkd
+errval_t sendto_buffer(struct udp_socket *socket, void *buf, size_t len,
+                       uint32_t to_addr, uint16_t to_port);
+
+// Wait until at least one of the sockets is readable or timeout microseconds
+// passed (0 only checks, UDP_POLL_FOREVER never times out)
+errval_t udp_poll(struct udp_pollfd *fds, size_t count, delayus_t timeout,
+                  size_t *ret_ready);
+
 // Close a UDP socket
 errval_t close(struct udp_socket *socket);
 
@@ -29,10 +29,22 @@
 
 
 /**
- * Blocking write to serial port.
+ * Queue bytes for the serial port. They are sent from the TX interrupt,
+ * this only blocks while the TX ring is full.
  */
 void serial_write(uint8_t *buf, size_t len);
 
+/**
+ * Get the contiguous free space at the end of the TX ring, so callers can
+ * encode into it directly. Blocks until at least one byte is free.
+ */
+uint8_t *serial_tx_reserve(size_t *ret_len);
+
+/**
+ * Queue the first len bytes of the space returned by serial_tx_reserve().
+ */
+void serial_tx_commit(size_t len);
+
 /**
  * Initialize UART. Device frame must be mapped
  * at address vbase.
@@ -41,7 +53,9 @@ errval_t serial_init(lvaddr_t vbase, uint32_t irq);
 
 /**
  * This is called whenever input is ready. The client of this
- * library must implement this function.
+ * library must implement this function. It is called from a waitset
+ * event with all characters received since the last call, split in
+ * at most two parts where the RX ring wraps around.
  */ 
 void serial_input(uint8_t *buf, size_t len);
 
@@ -58,39 +58,24 @@ errval_t aos_rpc_send_string(struct aos_rpc *chan, const char *string)
 
 }
 
-errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t size, size_t align,
-                             struct capref *retcap, size_t *ret_size)
+// Receive the response to a memory request on the dedicated memory waitset
+static errval_t aos_rpc_recv_mem_response(struct aos_rpc *chan,
+                                          enum lmp_request_type type,
+                                          struct capref *retcap,
+                                          struct lmp_recv_msg *msg)
 {
-    // TODO: implement functionality to request a RAM capability over the
-    // given channel and wait until it is delivered.
-
-    errval_t err = SYS_ERR_OK;
-
-    // Make sure that there are enough slots in advance.
-    // If there are not, this will trigger a refill.
-    struct capref dummy_slot;
-    slot_alloc(&dummy_slot);
-    slot_free(dummy_slot);
-
-    err = lmp_chan_send3(chan->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_MemoryAlloc, size, align);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
-        return err;
-    }
-
-    // Initializing message
-    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    errval_t err;
 
     do {
 
         // Receive the response
-        lmp_client_recv_waitset(chan->lc, retcap, &msg, &chan->mem_ws);
+        lmp_client_recv_waitset(chan->lc, retcap, msg, &chan->mem_ws);
         
         // Check if we got the message we wanted
-        if (msg.words[0] != LMP_RequestType_MemoryAlloc) {
+        if (msg->words[0] != type) {
 
 #if PRINT_DEBUG
-            debug_printf("Got ack of type: %d\n", msg.words[0]);
+            debug_printf("Got ack of type: %d\n", msg->words[0]);
 #endif
             
             // Allocate a new slot if necessary
@@ -103,7 +88,7 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t size, size_t align,
             }
         
             // Request resend
-            err = lmp_chan_send9(chan->lc, LMP_SEND_FLAGS_DEFAULT, *retcap, LMP_RequestType_Echo, msg.words[0], msg.words[1], msg.words[2], msg.words[3], msg.words[4], msg.words[5], msg.words[6], msg.words[7]);
+            err = lmp_chan_send9(chan->lc, LMP_SEND_FLAGS_DEFAULT, *retcap, LMP_RequestType_Echo, msg->words[0], msg->words[1], msg->words[2], msg->words[3], msg->words[4], msg->words[5], msg->words[6], msg->words[7]);
             if (err_is_fail(err)) {
                 debug_printf("%s\n", err_getstring(err));
                 return err;
@@ -111,7 +96,7 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t size, size_t align,
             
         }
 
-    } while (msg.words[0] != LMP_RequestType_MemoryAlloc);
+    } while (msg->words[0] != type);
 
     // Allocate recv slot
     err = lmp_chan_alloc_recv_slot(chan->lc);
@@ -120,6 +105,38 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t size, size_t align,
         return err;
     }
 
+    return SYS_ERR_OK;
+}
+
+errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t size, size_t align,
+                             struct capref *retcap, size_t *ret_size)
+{
+    // TODO: implement functionality to request a RAM capability over the
+    // given channel and wait until it is delivered.
+
+    errval_t err = SYS_ERR_OK;
+
+    // Make sure that there are enough slots in advance.
+    // If there are not, this will trigger a refill.
+    struct capref dummy_slot;
+    slot_alloc(&dummy_slot);
+    slot_free(dummy_slot);
+
+    err = lmp_chan_send3(chan->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_MemoryAlloc, size, align);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    // Initializing message
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+
+    // Receive the response
+    err = aos_rpc_recv_mem_response(chan, LMP_RequestType_MemoryAlloc, retcap, &msg);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
     // TODO: Implement ret_size
     *ret_size = size;
 
@@ -129,6 +146,41 @@ errval_t aos_rpc_get_ram_cap(struct aos_rpc *chan, size_t size, size_t align,
     return err;
 }
 
+errval_t aos_rpc_get_ram_cap_batch(struct aos_rpc *chan, size_t count, size_t bytes,
+                                   struct capref *retcap, size_t *ret_count)
+{
+    errval_t err = SYS_ERR_OK;
+
+    // Make sure that there are enough slots in advance.
+    // If there are not, this will trigger a refill.
+    struct capref dummy_slot;
+    slot_alloc(&dummy_slot);
+    slot_free(dummy_slot);
+
+    err = lmp_chan_send3(chan->lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_MemoryAllocBatch, count, bytes);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+
+    // Initializing message
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+
+    // Receive the response
+    err = aos_rpc_recv_mem_response(chan, LMP_RequestType_MemoryAllocBatch, retcap, &msg);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Set the number of elements we were granted
+    *ret_count = msg.words[2];
+
+    // Set err to error of response message
+    err = msg.words[1];
+
+    return err;
+}
+
 errval_t aos_rpc_serial_getchar(struct aos_rpc *chan, char *retc)
 {
     errval_t err;
@@ -607,9 +659,12 @@ errval_t aos_rpc_init(struct aos_rpc *rpc, struct lmp_chan *lc)
     err = aos_rpc_process_get_pid_by_name("terminal", &pid);
     assert(err_is_ok(err));
     
-    err = urpc_bind(disp_get_terminal_pid(),
-                    rpc->uc,
-                    (pid != disp_get_terminal_pid() ? 1 : !disp_get_core_id()));
+    // Terminal output is a high-rate stream, so use deeper rings
+    err = urpc_bind_ring(disp_get_terminal_pid(),
+                         rpc->uc,
+                         (pid != disp_get_terminal_pid() ? 1 : !disp_get_core_id()),
+                         UMP_STREAM_DEPTH,
+                         0);
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
     }
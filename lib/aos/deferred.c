@@ -61,18 +61,21 @@ void deferred_event_init(struct deferred_event *event)
 /**
  * \brief Register a deferred event
  *
+ * This function must only be called when disabled.
+ *
  * \param ws Waitset
  * \param delay Delay in microseconds
  * \param closure Event closure to execute
  * \param event Storage for event metadata
+ * \param dh Dispatcher handle
  */
-errval_t deferred_event_register(struct deferred_event *event,
-                                 struct waitset *ws, delayus_t delay,
-                                 struct event_closure closure)
+errval_t deferred_event_register_disabled(struct deferred_event *event,
+                                          struct waitset *ws, delayus_t delay,
+                                          struct event_closure closure,
+                                          dispatcher_handle_t dh)
 {
     errval_t err;
 
-    dispatcher_handle_t dh = disp_disable();
     err = waitset_chan_register_disabled(ws, &event->waitset_state, closure);
     if (err_is_ok(err)) {
         struct dispatcher_generic *dg = get_dispatcher_generic(dh);
@@ -85,7 +88,7 @@ errval_t deferred_event_register(struct deferred_event *event,
              p = e, e = e->next) {
             if (e == NULL || e->time > event->time) {
                 if (p == NULL) { // insert at head
-                    assert(e == dg->deferred_events);
+                    assert_disabled(e == dg->deferred_events);
                     event->prev = NULL;
                     event->next = e;
                     if (e != NULL) {
@@ -107,6 +110,24 @@ errval_t deferred_event_register(struct deferred_event *event,
 
     update_wakeup_disabled(dh);
 
+    return err;
+}
+
+/**
+ * \brief Register a deferred event
+ *
+ * \param ws Waitset
+ * \param delay Delay in microseconds
+ * \param closure Event closure to execute
+ * \param event Storage for event metadata
+ */
+errval_t deferred_event_register(struct deferred_event *event,
+                                 struct waitset *ws, delayus_t delay,
+                                 struct event_closure closure)
+{
+    dispatcher_handle_t dh = disp_disable();
+    errval_t err = deferred_event_register_disabled(event, ws, delay, closure,
+                                                    dh);
     disp_enable(dh);
 
     return err;
@@ -40,6 +40,7 @@ struct interrupt_handler_state {
     void *handler_arg;
     interrupt_handler_fn reloc_handler;
     void *reloc_handler_arg;
+    struct waitset *ws;     ///< Waitset the endpoint is (re-)registered on
 };
 
 static void generic_interrupt_handler(void *arg)
@@ -71,7 +72,7 @@ static void generic_interrupt_handler(void *arg)
         .handler = generic_interrupt_handler,
         .arg = arg,
     };
-    err = lmp_endpoint_register(state->idcep, barrelfish_interrupt_waitset, cl);
+    err = lmp_endpoint_register(state->idcep, state->ws, cl);
     assert(err_is_ok(err));
 }
 
@@ -87,12 +88,30 @@ static void generic_interrupt_handler(void *arg)
 errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
         uint32_t irq)
 {
-    errval_t err;
-
     if(barrelfish_interrupt_waitset == NULL) {
         barrelfish_interrupt_waitset = get_default_waitset();
     }
 
+    return inthandler_setup_arm_ws(handler, handler_arg, irq,
+                                   barrelfish_interrupt_waitset);
+}
+
+/**
+ * rief Setup an interrupt handler function to receive device interrupts
+ *        on the ARM platform on a specific waitset
+ *
+ * \param handler Handler function
+ * \param handler_arg Argument passed to #handler
+ * \param irq the IRQ number to activate
+ * \param ws Waitset every interrupt of #irq is delivered on
+ */
+errval_t inthandler_setup_arm_ws(interrupt_handler_fn handler, void *handler_arg,
+        uint32_t irq, struct waitset *ws)
+{
+    errval_t err;
+
+    assert(ws != NULL);
+
     /* alloc state */
     struct interrupt_handler_state *state;
     state = malloc(sizeof(struct interrupt_handler_state));
@@ -100,6 +119,9 @@ errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
 
     state->handler = handler;
     state->handler_arg = handler_arg;
+    state->reloc_handler = NULL;
+    state->reloc_handler_arg = NULL;
+    state->ws = ws;
 
     /* create endpoint to handle interrupts */
     struct capref epcap;
@@ -122,7 +144,7 @@ errval_t inthandler_setup_arm(interrupt_handler_fn handler, void *handler_arg,
         .handler = generic_interrupt_handler,
         .arg = state,
     };
-    err = lmp_endpoint_register(state->idcep, barrelfish_interrupt_waitset, cl);
+    err = lmp_endpoint_register(state->idcep, state->ws, cl);
     if (err_is_fail(err)) {
         lmp_endpoint_free(state->idcep);
         // TODO: release vector
@@ -159,6 +181,7 @@ errval_t inthandler_setup_movable_cap(struct capref dest_cap, interrupt_handler_
     state->handler_arg = handler_arg;
     state->reloc_handler = reloc_handler;
     state->reloc_handler_arg = reloc_handler_arg;
+    state->ws = barrelfish_interrupt_waitset;
 
     /* create endpoint to handle interrupts */
     struct capref epcap;
@@ -175,7 +198,7 @@ errval_t inthandler_setup_movable_cap(struct capref dest_cap, interrupt_handler_
         .handler = generic_interrupt_handler,
         .arg = state,
     };
-    err = lmp_endpoint_register(state->idcep, barrelfish_interrupt_waitset, cl);
+    err = lmp_endpoint_register(state->idcep, state->ws, cl);
     if (err_is_fail(err)) {
         lmp_endpoint_free(state->idcep);
         // TODO: release vector
@@ -218,6 +241,7 @@ errval_t inthandler_setup_movable(interrupt_handler_fn handler, void *handler_ar
     state->handler_arg = handler_arg;
     state->reloc_handler = reloc_handler;
     state->reloc_handler_arg = reloc_handler_arg;
+    state->ws = barrelfish_interrupt_waitset;
 
     // Get irq_dest_cap from monitor
     struct capref irq_dest_cap;
@@ -254,7 +278,7 @@ errval_t inthandler_setup_movable(interrupt_handler_fn handler, void *handler_ar
         .handler = generic_interrupt_handler,
         .arg = state,
     };
-    err = lmp_endpoint_register(state->idcep, barrelfish_interrupt_waitset, cl);
+    err = lmp_endpoint_register(state->idcep, state->ws, cl);
     if (err_is_fail(err)) {
         lmp_endpoint_free(state->idcep);
         // TODO: release vector
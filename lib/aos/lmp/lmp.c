@@ -111,6 +111,14 @@ void lmp_server_dispatcher(void *arg) {
             break;
             
             
+        case LMP_RequestType_MemoryAllocBatch:
+#if PRINT_DEBUG
+            debug_printf("Memory Alloc Batch Message!\n");
+#endif
+            lmp_server_memory_alloc_batch(lc, msg.words[1], msg.words[2]);
+            break;
+            
+            
         case LMP_RequestType_MemoryFree:
 #if PRINT_DEBUG
             debug_printf("Memory Free Message!\n");
@@ -311,6 +319,56 @@ errval_t lmp_server_memory_alloc(struct lmp_chan *lc, size_t bytes, size_t align
     
 }
 
+// MEMSERV: Handle requests for a batch of equally sized memory regions
+errval_t lmp_server_memory_alloc_batch(struct lmp_chan *lc, size_t count, size_t bytes) {
+    
+    errval_t err = SYS_ERR_OK;
+    
+    // Checking for invalid batch (the total size must not overflow)
+    if (count == 0 || bytes == 0 || bytes % BASE_PAGE_SIZE || count > SIZE_MAX / bytes) {
+        debug_printf("invalid batch size\n");
+        lmp_chan_send3(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_MemoryAllocBatch, SYS_ERR_INVALID_SIZE, 0);
+        return SYS_ERR_INVALID_SIZE;
+    }
+    
+    // Grant at most a bounded batch, clients ask again for more
+    count = MIN(count, LMP_MEMORY_ALLOC_BATCH_MAX);
+    
+    // Allocate all elements as one region, grant fewer if memory is tight
+    struct capref ram;
+    do {
+        err = ram_alloc_aligned(&ram, count * bytes, BASE_PAGE_SIZE);
+        if (err_is_fail(err)) {
+            count /= 2;
+        }
+    } while (err_is_fail(err) && count > 0);
+    
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        lmp_chan_send3(lc, LMP_SEND_FLAGS_DEFAULT, NULL_CAP, LMP_RequestType_MemoryAllocBatch, err, 0);
+        return err;
+    }
+    
+    // Responding by sending the ram capability back
+    do {
+        err = lmp_chan_send3(lc, LMP_SEND_FLAGS_DEFAULT, ram, LMP_RequestType_MemoryAllocBatch, SYS_ERR_OK, count);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s. Retrying..\n", err_getstring(err));
+#endif
+        }
+    } while (err_is_fail(err));
+    
+    // Deleting the ram capability
+    cap_delete(ram);
+    
+    // Freeing the slot
+    slot_free(ram);
+    
+    return err;
+    
+}
+
 static ram_free_handler_t ram_free_handler;
 
 // Registering ram_free_handler function
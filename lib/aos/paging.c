@@ -31,6 +31,220 @@ static errval_t insert_vspace_free_node(struct paging_state *st, struct vspace_n
 
 static struct paging_state current;
 
+// Trees a vspace_node can be part of
+enum vspace_tree {
+    VSPACE_TREE_ADDR,       // Ordered by base address
+    VSPACE_TREE_SIZE,       // Ordered by size, then base address
+};
+
+static inline struct vspace_link *vspace_link(struct vspace_node *node, enum vspace_tree tree)
+{
+    return tree == VSPACE_TREE_ADDR ? &node->addr : &node->by_size;
+}
+
+static inline int vspace_height(struct vspace_node *node, enum vspace_tree tree)
+{
+    return node == NULL ? 0 : vspace_link(node, tree)->height;
+}
+
+static int vspace_compare(struct vspace_node *a, struct vspace_node *b, enum vspace_tree tree)
+{
+    if (tree == VSPACE_TREE_SIZE && a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    if (a->base != b->base) {
+        return a->base < b->base ? -1 : 1;
+    }
+    return 0;
+}
+
+static void vspace_update_height(struct vspace_node *node, enum vspace_tree tree)
+{
+    struct vspace_link *link = vspace_link(node, tree);
+    link->height = 1 + MAX(vspace_height(link->left, tree), vspace_height(link->right, tree));
+}
+
+static struct vspace_node *vspace_rotate_right(struct vspace_node *node, enum vspace_tree tree)
+{
+    struct vspace_node *left = vspace_link(node, tree)->left;
+    vspace_link(node, tree)->left = vspace_link(left, tree)->right;
+    vspace_link(left, tree)->right = node;
+    vspace_update_height(node, tree);
+    vspace_update_height(left, tree);
+    return left;
+}
+
+static struct vspace_node *vspace_rotate_left(struct vspace_node *node, enum vspace_tree tree)
+{
+    struct vspace_node *right = vspace_link(node, tree)->right;
+    vspace_link(node, tree)->right = vspace_link(right, tree)->left;
+    vspace_link(right, tree)->left = node;
+    vspace_update_height(node, tree);
+    vspace_update_height(right, tree);
+    return right;
+}
+
+// Restore the AVL property at node and return the new subtree root
+static struct vspace_node *vspace_balance(struct vspace_node *node, enum vspace_tree tree)
+{
+    struct vspace_link *link = vspace_link(node, tree);
+    vspace_update_height(node, tree);
+    int balance = vspace_height(link->left, tree) - vspace_height(link->right, tree);
+    if (balance > 1) {
+        struct vspace_link *left = vspace_link(link->left, tree);
+        if (vspace_height(left->left, tree) < vspace_height(left->right, tree)) {
+            link->left = vspace_rotate_left(link->left, tree);
+        }
+        return vspace_rotate_right(node, tree);
+    }
+    if (balance < -1) {
+        struct vspace_link *right = vspace_link(link->right, tree);
+        if (vspace_height(right->right, tree) < vspace_height(right->left, tree)) {
+            link->right = vspace_rotate_right(link->right, tree);
+        }
+        return vspace_rotate_left(node, tree);
+    }
+    return node;
+}
+
+static struct vspace_node *vspace_tree_insert(struct vspace_node *root, struct vspace_node *node,
+                                              enum vspace_tree tree)
+{
+    if (root == NULL) {
+        struct vspace_link *link = vspace_link(node, tree);
+        link->left = NULL;
+        link->right = NULL;
+        link->height = 1;
+        return node;
+    }
+    struct vspace_link *link = vspace_link(root, tree);
+    if (vspace_compare(node, root, tree) < 0) {
+        link->left = vspace_tree_insert(link->left, node, tree);
+    }
+    else {
+        link->right = vspace_tree_insert(link->right, node, tree);
+    }
+    return vspace_balance(root, tree);
+}
+
+static struct vspace_node *vspace_tree_remove_min(struct vspace_node *root, enum vspace_tree tree,
+                                                  struct vspace_node **ret_min)
+{
+    struct vspace_link *link = vspace_link(root, tree);
+    if (link->left == NULL) {
+        *ret_min = root;
+        return link->right;
+    }
+    link->left = vspace_tree_remove_min(link->left, tree, ret_min);
+    return vspace_balance(root, tree);
+}
+
+// Remove node from the tree. Must be called before changing the node's key.
+static struct vspace_node *vspace_tree_remove(struct vspace_node *root, struct vspace_node *node,
+                                              enum vspace_tree tree)
+{
+    if (root == NULL) {
+        return NULL;
+    }
+    struct vspace_link *link = vspace_link(root, tree);
+    int cmp = vspace_compare(node, root, tree);
+    if (cmp < 0) {
+        link->left = vspace_tree_remove(link->left, node, tree);
+    }
+    else if (cmp > 0) {
+        link->right = vspace_tree_remove(link->right, node, tree);
+    }
+    else {
+        if (link->right == NULL) {
+            return link->left;
+        }
+        struct vspace_node *min;
+        struct vspace_node *right = vspace_tree_remove_min(link->right, tree, &min);
+        vspace_link(min, tree)->left = link->left;
+        vspace_link(min, tree)->right = right;
+        return vspace_balance(min, tree);
+    }
+    return vspace_balance(root, tree);
+}
+
+// Find the region with the greatest base address <= vaddr
+static struct vspace_node *vspace_tree_floor(struct vspace_node *root, lvaddr_t vaddr)
+{
+    struct vspace_node *best = NULL;
+    while (root != NULL) {
+        if (root->base <= vaddr) {
+            best = root;
+            root = root->addr.right;
+        }
+        else {
+            root = root->addr.left;
+        }
+    }
+    return best;
+}
+
+// Find the region with the smallest base address >= vaddr
+static struct vspace_node *vspace_tree_ceil(struct vspace_node *root, lvaddr_t vaddr)
+{
+    struct vspace_node *best = NULL;
+    while (root != NULL) {
+        if (root->base >= vaddr) {
+            best = root;
+            root = root->addr.left;
+        }
+        else {
+            root = root->addr.right;
+        }
+    }
+    return best;
+}
+
+// Find the region containing vaddr
+static struct vspace_node *vspace_tree_find(struct vspace_node *root, lvaddr_t vaddr)
+{
+    struct vspace_node *node = vspace_tree_floor(root, vaddr);
+    if (node != NULL && vaddr < node->base + node->size) {
+        return node;
+    }
+    return NULL;
+}
+
+// Find the smallest free region of at least `bytes` (lowest address on ties)
+static struct vspace_node *vspace_tree_best_fit(struct vspace_node *root, size_t bytes)
+{
+    struct vspace_node *best = NULL;
+    while (root != NULL) {
+        if (root->size >= bytes) {
+            best = root;
+            root = root->by_size.left;
+        }
+        else {
+            root = root->by_size.right;
+        }
+    }
+    return best;
+}
+
+// Add a region to both free trees
+static void free_tree_insert(struct paging_state *st, struct vspace_node *node)
+{
+    st->free_vspace_root = vspace_tree_insert(st->free_vspace_root, node, VSPACE_TREE_ADDR);
+    st->free_vspace_size_root = vspace_tree_insert(st->free_vspace_size_root, node, VSPACE_TREE_SIZE);
+}
+
+// Remove a region from both free trees
+static void free_tree_remove(struct paging_state *st, struct vspace_node *node)
+{
+    st->free_vspace_root = vspace_tree_remove(st->free_vspace_root, node, VSPACE_TREE_ADDR);
+    st->free_vspace_size_root = vspace_tree_remove(st->free_vspace_size_root, node, VSPACE_TREE_SIZE);
+}
+
+// Add a region to the allocated tree
+static void alloc_tree_insert(struct paging_state *st, struct vspace_node *node)
+{
+    st->alloc_vspace_root = vspace_tree_insert(st->alloc_vspace_root, node, VSPACE_TREE_ADDR);
+}
+
 /**
  * \brief Helper function that allocates a slot and
  *        creates a ARM l2 page table capability
@@ -51,6 +265,155 @@ static errval_t arml2_alloc(struct paging_state * st, struct capref *ret)
     return SYS_ERR_OK;
 }
 
+// Find the L2 page table node for the given L1 offset
+static struct pt_cap_tree_node *find_l2_node(struct paging_state *st, uintptr_t l1_offset)
+{
+    if (l1_offset >= PAGING_L1_USER_ENTRIES) {
+        return NULL;
+    }
+    return st->l1_shadow[l1_offset];
+}
+
+// Mark a range of slots of an L2 page table as mapped or unmapped
+static void set_l2_occupancy(struct pt_cap_tree_node *node, uintptr_t l2_offset,
+                             size_t num_pages, bool mapped)
+{
+    assert(l2_offset + num_pages <= ARM_L2_MAX_ENTRIES);
+    for (uintptr_t slot = l2_offset; slot < l2_offset + num_pages; slot++) {
+        if (mapped) {
+            node->occupancy->occupied[slot / 32] |= (1u << (slot % 32));
+        }
+        else {
+            node->occupancy->occupied[slot / 32] &= ~(1u << (slot % 32));
+        }
+    }
+}
+
+// Check whether the page at the given virtual address is mapped
+static bool is_page_mapped(struct paging_state *st, lvaddr_t vaddr)
+{
+    struct pt_cap_tree_node *node = find_l2_node(st, ARM_L1_OFFSET(vaddr));
+    if (node == NULL) {
+        return false;
+    }
+    uintptr_t slot = ARM_L2_OFFSET(vaddr);
+    return node->occupancy->occupied[slot / 32] & (1u << (slot % 32));
+}
+
+// Refill the vspace slab allocator if it is running low
+static void vspace_slabs_check_refill(struct paging_state *st)
+{
+    size_t freecount = slab_freecount((struct slab_allocator *)&st->vspace_slabs);
+    if (freecount <= 6 && !st->vspace_slabs_prevent_refill) {
+#if PRINT_DEBUG
+        debug_printf("Vspace slab allocator refilling...\n");
+#endif
+        st->vspace_slabs_prevent_refill = 1;
+        slab_default_refill((struct slab_allocator *)&st->vspace_slabs);
+        st->vspace_slabs_prevent_refill = 0;
+    }
+}
+
+/**
+ * \brief Reserve virtual address space around an unreserved faulting page.
+ * The window [*win_base, *win_end) is clipped to the free range containing
+ * the fault and carved out of the free trees (or the unmanaged space above
+ * free_vspace_base) in place, instead of rebuilding them.
+ */
+static errval_t pagefault_reserve_vspace(struct paging_state *st, lvaddr_t fault,
+                                         lvaddr_t *win_base, lvaddr_t *win_end)
+{
+    lvaddr_t start = *win_base;
+    lvaddr_t end = *win_end;
+
+    // Allocate the node for the alloc tree up front
+    struct vspace_node *alloc_node = slab_alloc(&st->vspace_slabs);
+    if (alloc_node == NULL) {
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+
+    // Find the free range containing the faulting address
+    struct vspace_node *node = vspace_tree_find(st->free_vspace_root, fault);
+
+    if (node != NULL) {
+
+        // Clip the window to the free range
+        lvaddr_t node_end = node->base + node->size;
+        start = MAX(start, node->base);
+        end = MIN(end, node_end);
+
+        // Allocate a node for the part above the window if the range is split
+        struct vspace_node *tail = NULL;
+        if (start > node->base && end < node_end) {
+            tail = slab_alloc(&st->vspace_slabs);
+            if (tail == NULL) {
+                slab_free(&st->vspace_slabs, alloc_node);
+                return LIB_ERR_SLAB_ALLOC_FAIL;
+            }
+            tail->base = end;
+            tail->size = node_end - end;
+        }
+
+        // Take the free range out of the trees and put back what remains of it
+        free_tree_remove(st, node);
+        if (start > node->base) {
+            node->size = start - node->base;
+            free_tree_insert(st, node);
+            if (tail != NULL) {
+                free_tree_insert(st, tail);
+            }
+        }
+        else if (end < node_end) {
+            node->base = end;
+            node->size = node_end - end;
+            free_tree_insert(st, node);
+        }
+        else {
+            slab_free(&st->vspace_slabs, node);
+        }
+
+    }
+    else if (fault >= st->free_vspace_base) {
+
+        // Return the gap below the window to the free list
+        if (start > st->free_vspace_base) {
+            struct vspace_node *gap = slab_alloc(&st->vspace_slabs);
+            if (gap == NULL) {
+                slab_free(&st->vspace_slabs, alloc_node);
+                return LIB_ERR_SLAB_ALLOC_FAIL;
+            }
+            gap->base = st->free_vspace_base;
+            gap->size = start - st->free_vspace_base;
+            insert_vspace_free_node(st, gap);
+        }
+        start = MAX(start, st->free_vspace_base);
+
+        // Move the start of the unmanaged space past the window
+        st->free_vspace_base = end;
+
+    }
+    else {
+
+        // Address space not tracked by us (e.g. mapped before paging_init),
+        // only take the faulting page
+        start = ROUND_DOWN(fault, BASE_PAGE_SIZE);
+        end = start + BASE_PAGE_SIZE;
+
+    }
+
+    // Register the window in the alloc tree
+    alloc_node->base = start;
+    alloc_node->size = end - start;
+    alloc_tree_insert(st, alloc_node);
+
+    vspace_slabs_check_refill(st);
+
+    *win_base = start;
+    *win_end = end;
+
+    return SYS_ERR_OK;
+}
+
 static void pagefault_handler(int subtype, void *addr, arch_registers_state_t *regs, arch_registers_fpu_state_t *fpuregs) {
 
     // Try to lock the mutex to prevent multiple threads from concurrently servicing a pagefault
@@ -74,7 +437,7 @@ static void pagefault_handler(int subtype, void *addr, arch_registers_state_t *r
     // Get current paging state
     struct paging_state *st = get_current_paging_state();
 
-    void *base = (void *) ROUND_DOWN((lvaddr_t) addr, BASE_PAGE_SIZE);
+    lvaddr_t base = ROUND_DOWN((lvaddr_t) addr, BASE_PAGE_SIZE);
 
     // Get thread information
     struct thread *td = thread_self();
@@ -86,44 +449,78 @@ static void pagefault_handler(int subtype, void *addr, arch_registers_state_t *r
         USER_PANIC("Stack overflow.. Sad.");
     }
 
-    // Allocate a new frame
-    struct capref frame_cap;
-    size_t frame_size = BASE_PAGE_SIZE;
-    err = frame_alloc(&frame_cap, frame_size, &frame_size);
-    if (err_is_fail(err)) {
-        debug_printf("%s\n", err_getstring(err));
-        return;
-    }
+    st->num_pagefaults++;
 
-    // Check if vspace is already allocated
-    int vspace_allocated = 0;
-    for(struct vspace_node *node = st->alloc_vspace_head; node != NULL; node = node->next) {
-        if (node->base <= (lvaddr_t) base && (lvaddr_t) base < node->base + node->size) {
-            vspace_allocated = 1;
-            assert((lvaddr_t) base + BASE_PAGE_SIZE <= node->base + node->size);
-            break;
-        }
+    // Another thread might have mapped the page in the meantime
+    if (is_page_mapped(st, base)) {
+        goto unlock;
     }
 
-    // Allocate address space for the new frame if necessary
-    if (!vspace_allocated) {
-        err = paging_alloc_fixed(st, base, frame_size);
+    // Grow the fault-around window on sequential faults, reset it otherwise
+    if (base == st->fault_around_last_end) {
+        st->fault_around_pages = MIN(2 * st->fault_around_pages,
+                                     PAGING_FAULT_AROUND_MAX_PAGES);
+    }
+    else {
+        st->fault_around_pages = PAGING_FAULT_AROUND_MIN_PAGES;
+    }
+    size_t window_size = st->fault_around_pages * BASE_PAGE_SIZE;
+    lvaddr_t win_base = ROUND_DOWN(base, window_size);
+    lvaddr_t win_end = win_base + window_size;
+
+    // Check if vspace is already allocated and clip the window to it
+    lvaddr_t region_base;
+    size_t region_size;
+    err = paging_lookup_region(st, base, &region_base, &region_size);
+    if (err_is_ok(err)) {
+        assert(base + BASE_PAGE_SIZE <= region_base + region_size);
+        win_base = MAX(win_base, region_base);
+        win_end = MIN(win_end, region_base + region_size);
+    }
+    else {
+        // Reserve address space for the window
+        err = pagefault_reserve_vspace(st, base, &win_base, &win_end);
         if (err_is_fail(err)) {
             debug_printf("%s\n", err_getstring(err));
-            return;
+            goto unlock;
         }
-        // Rebuild the free list
-        //  FIXME: THIS IS INEFFICIENT
-        paging_alloc_fixed_commit(st);
     }
 
-    // Map the new frame into virtual memory
-    err = paging_map_fixed(st, (lvaddr_t) base, frame_cap, frame_size);
+    // Shrink the window to the run of unmapped pages around the faulting page
+    lvaddr_t map_base = base;
+    while (map_base > win_base && !is_page_mapped(st, map_base - BASE_PAGE_SIZE)) {
+        map_base -= BASE_PAGE_SIZE;
+    }
+    lvaddr_t map_end = base + BASE_PAGE_SIZE;
+    while (map_end < win_end && !is_page_mapped(st, map_end)) {
+        map_end += BASE_PAGE_SIZE;
+    }
+
+    // Allocate a frame for the whole window, falling back to a single page
+    struct capref frame_cap;
+    size_t frame_size = map_end - map_base;
+    err = frame_alloc(&frame_cap, frame_size, &frame_size);
+    if (err_is_fail(err) && map_end - map_base > BASE_PAGE_SIZE) {
+        map_base = base;
+        map_end = base + BASE_PAGE_SIZE;
+        frame_size = BASE_PAGE_SIZE;
+        err = frame_alloc(&frame_cap, frame_size, &frame_size);
+    }
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
-        return;
+        goto unlock;
     }
 
+    // Map the new frame into virtual memory with a single mapping
+    err = paging_map_fixed(st, map_base, frame_cap, map_end - map_base);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        goto unlock;
+    }
+
+    st->fault_around_last_end = map_end;
+
+unlock:
     // Unlock the mutex
     thread_mutex_unlock(&mutex);
 
@@ -168,12 +565,12 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
     // Set the capability reference for the l1 page table
     st->l1_pagetable = pdir;
     
-    // Initialize L2 page table tree
-    st->l2_tree_root = NULL;
+    // L1 shadow table is cleared by the memset above
     
     // Set up state for vspace allocation
-    st->free_vspace_head = NULL;
-    st->alloc_vspace_head = NULL;
+    st->alloc_vspace_root = NULL;
+    st->free_vspace_root = NULL;
+    st->free_vspace_size_root = NULL;
     st->free_vspace_base = start_vaddr;
 
     // Initialize the slab allocator for free vspace nodes
@@ -201,6 +598,15 @@ errval_t paging_init_state(struct paging_state *st, lvaddr_t start_vaddr,
         //slab_default_refill(&st->slabs);
     }
     
+    // Initialize the slab allocator for the bitmaps of L2 page tables
+    st->l2_slabs_prevent_refill = 0;
+    slab_init(&st->l2_slabs, sizeof(struct pt_l2_occupancy), slab_default_refill);
+    if (first_call) {
+        // Add memory to slab allocator the first time, as this is the paging state for init.
+        static char l2_buf[sizeof(struct pt_l2_occupancy)*16];
+        slab_grow(&st->l2_slabs, l2_buf, sizeof(l2_buf));
+    }
+    
     first_call = 0;
     
     return SYS_ERR_OK;
@@ -280,6 +686,7 @@ errval_t paging_init(void)
 
         st->vspace_slabs.refill_func = slab_default_refill;
         st->slabs.refill_func = slab_default_refill;
+        st->l2_slabs.refill_func = slab_default_refill;
 
     }
 
@@ -439,17 +846,40 @@ errval_t paging_region_unmap(struct paging_region *pr, lvaddr_t base, size_t byt
     return SYS_ERR_OK;
 }
 
+static void debug_print_vspace_tree(struct vspace_node *node, const char *name) {
+    if (node == NULL) {
+        return;
+    }
+    debug_print_vspace_tree(node->addr.left, name);
+    debug_printf("%s: %p -> %p\n", name, node->base, node->base + node->size);
+    debug_print_vspace_tree(node->addr.right, name);
+}
+
 __attribute__((__unused__))
 void debug_print_vspace_layout(void) {
     struct paging_state *st = get_current_paging_state();
-    struct vspace_node *node;
-    for (node = st->alloc_vspace_head; node != NULL; node = node->next) {
-        debug_printf("ALLOC: %p -> %p\n", node->base, node->base + node->size);
+    debug_print_vspace_tree(st->alloc_vspace_root, "ALLOC");
+    debug_print_vspace_tree(st->free_vspace_root, "FREE");
+    debug_printf("FREE_BASE: %p\n", st->free_vspace_base);
+}
+
+/**
+ * \brief Find the allocated region containing `vaddr` in O(log n).
+ */
+errval_t paging_lookup_region(struct paging_state *st, lvaddr_t vaddr,
+                              lvaddr_t *ret_base, size_t *ret_size)
+{
+    struct vspace_node *node = vspace_tree_find(st->alloc_vspace_root, vaddr);
+    if (node == NULL) {
+        return LIB_ERR_VSPACE_VREGION_NOT_FOUND;
     }
-    for (node = st->free_vspace_head; node != NULL; node = node->next) {
-        debug_printf("FREE: %p -> %p\n", node->base, node->base + node->size);
+    if (ret_base != NULL) {
+        *ret_base = node->base;
     }
-    debug_printf("FREE_BASE: %p\n", st->free_vspace_base);
+    if (ret_size != NULL) {
+        *ret_size = node->size;
+    }
+    return SYS_ERR_OK;
 }
 
 /**
@@ -460,10 +890,6 @@ void debug_print_vspace_layout(void) {
 errval_t paging_alloc_fixed(struct paging_state *st, void *buf, size_t bytes)
 {
     
-    // Check that the free list is empty
-    //  FIXME: Maybe support changing the free list
-//    assert(st->free_vspace_head == NULL);
-    
     // Check page alignment
     assert(!((lvaddr_t) buf % BASE_PAGE_SIZE));
     
@@ -477,85 +903,64 @@ errval_t paging_alloc_fixed(struct paging_state *st, void *buf, size_t bytes)
     // Check that the virtual address range can be put into the allocated list
     assert((lvaddr_t) buf + bytes <= st->free_vspace_base);
     
-    // Register the allocation in the alloc list
+    // Register the allocation in the alloc tree
     struct vspace_node *new_node = slab_alloc(&st->vspace_slabs);
     new_node->base = (uintptr_t) buf;
     new_node->size = bytes;
-    new_node->next = st->alloc_vspace_head;
-    st->alloc_vspace_head = new_node;
+    alloc_tree_insert(st, new_node);
     
     // Check that there are sufficient slabs left in the slab allocator
-    size_t freecount = slab_freecount((struct slab_allocator *)&st->vspace_slabs);
-    if (freecount <= 6 && !st->vspace_slabs_prevent_refill) {
-#if PRINT_DEBUG
-        debug_printf("Vspace slab allocator refilling...\n");
-#endif
-        st->vspace_slabs_prevent_refill = 1;
-        slab_default_refill((struct slab_allocator *)&st->vspace_slabs);
-        st->vspace_slabs_prevent_refill = 0;
-    }
+    vspace_slabs_check_refill(st);
     
     return SYS_ERR_OK;
     
 }
 
-errval_t paging_alloc_fixed_commit(struct paging_state *st) {
+// Free all nodes of a free tree
+static void vspace_free_tree_destroy(struct paging_state *st, struct vspace_node *node) {
+    if (node == NULL) {
+        return;
+    }
+    vspace_free_tree_destroy(st, node->addr.left);
+    vspace_free_tree_destroy(st, node->addr.right);
+    slab_free(&st->vspace_slabs, node);
+}
+
+// Insert the holes between the allocated regions into the free trees (in order)
+static void vspace_collect_holes(struct paging_state *st, struct vspace_node *node, lvaddr_t *start) {
+    if (node == NULL) {
+        return;
+    }
     
-    // First page in virtual address space is not used and thus should not be mapped
-    lvaddr_t start = BASE_PAGE_SIZE;
+    vspace_collect_holes(st, node->addr.left, start);
     
-    // Iterating through free linked list and getting indirect pointer to the end
-    struct vspace_node **indirect = &st->free_vspace_head;
-    while (*indirect != NULL) {
-        indirect = &(*indirect)->next;
-    }
+    // Checking that allocated block doesn't overlap with first page in virtual address space
+    assert(node->base >= BASE_PAGE_SIZE);
     
-    // Walking through alloc linked list and insert the holes inbetween into the free linked list
-    while (true) {
-        
-        // Assigning lowest_base and lowest_size to max unsigned int value
-        lvaddr_t lowest_base = UINT_MAX;
-        size_t lowest_size = UINT_MAX;
-        
-        // Finding least upper bound base with threshold start in alloc linked list
-        struct vspace_node *node = st->alloc_vspace_head;
-        while (node != NULL) {
-            
-            // Checking that allocated block doesn't overlap with first page in virtual address space
-            assert(node->base >= BASE_PAGE_SIZE);
-            
-            // Assigning lowest_base and lowest_size to be of the lowest allocated node over start (least upper bound)
-            if (node->base < lowest_base && node->base > start) {
-                lowest_base = node->base;
-                lowest_size = node->size;
-            }
-            
-            node = node->next;
-        }
-        
-        // Checking ig we have gone through all alloc linked list elements
-        if (lowest_base == UINT_MAX) {
-            break;
-        }
-        
-        // Checking if two alloc blocks are next to each other
-        if (lowest_base - start == 0) {
-            continue;
-        }
-        
-        // Allocating and create a new node to be inserted into the free linked list
+    // Inserting the hole below this allocated block
+    if (node->base > *start) {
         struct vspace_node *new_node = slab_alloc(&st->vspace_slabs);
-        new_node->base = start;
-        new_node->size = lowest_base - start;
-        new_node->next = NULL;
+        new_node->base = *start;
+        new_node->size = node->base - *start;
+        free_tree_insert(st, new_node);
+    }
+    
+    // Updating start address threshold to be end of the allocated block
+    *start = MAX(*start, node->base + node->size);
     
-        // Appeningd new node to end of free linked list
-        *indirect = new_node;
-        indirect = &(*indirect)->next;
+    vspace_collect_holes(st, node->addr.right, start);
+}
 
-        // Updating new start address threshold to be end of the allocated block
-        start = lowest_base + lowest_size;
-    }
+errval_t paging_alloc_fixed_commit(struct paging_state *st) {
+    
+    // First page in virtual address space is not used and thus should not be mapped
+    lvaddr_t start = BASE_PAGE_SIZE;
+    
+    // Rebuilding the free trees from the holes between allocated regions
+    vspace_free_tree_destroy(st, st->free_vspace_root);
+    st->free_vspace_root = NULL;
+    st->free_vspace_size_root = NULL;
+    vspace_collect_holes(st, st->alloc_vspace_root, &start);
     
     // Updating free_vspace_base of paging state
     st->free_vspace_base = start;
@@ -583,31 +988,25 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes)
         bytes = pages * BASE_PAGE_SIZE;
     }
     
-    // Iterating free list and check for suitable address range
-    struct vspace_node **indirect = &st->free_vspace_head;
-    while ((*indirect) != NULL) {
-        if ((*indirect)->size >= bytes) {
-            break;
-        }
-        indirect = &(*indirect)->next;
-    }
+    // Searching the size tree for the smallest suitable address range
+    struct vspace_node *node = vspace_tree_best_fit(st->free_vspace_size_root, bytes);
     
     // Checking if we found a free address range
-    if (*indirect) {
+    if (node) {
         // Return the base address of the node
-        *buf = (void *) (*indirect)->base;
+        *buf = (void *) node->base;
+        // Removing the node from the free trees before changing its keys
+        free_tree_remove(st, node);
         // Checking if free range needs to be split
-        if ((*indirect)->size > bytes) {
-            // Reconfiguring the node
-            (*indirect)->base += bytes;
-            (*indirect)->size -= bytes;
+        if (node->size > bytes) {
+            // Reconfiguring and reinserting the node
+            node->base += bytes;
+            node->size -= bytes;
+            free_tree_insert(st, node);
         }
         else {
-            struct vspace_node *old_node = *indirect;
-            // Removing the node
-            *indirect = (*indirect)->next;
             // Freeing the slab
-            slab_free(&st->vspace_slabs, old_node);
+            slab_free(&st->vspace_slabs, node);
         }
     }
     else {
@@ -616,23 +1015,14 @@ errval_t paging_alloc(struct paging_state *st, void **buf, size_t bytes)
         st->free_vspace_base += bytes;
     }
     
-    // Registering the allocation in the alloc list
+    // Registering the allocation in the alloc tree
     struct vspace_node *new_node = slab_alloc(&st->vspace_slabs);
     new_node->base = (uintptr_t) *buf;
     new_node->size = bytes;
-    new_node->next = st->alloc_vspace_head;
-    st->alloc_vspace_head = new_node;
+    alloc_tree_insert(st, new_node);
     
     // Checking that there are sufficient slabs left in the slab allocator
-    size_t freecount = slab_freecount((struct slab_allocator *)&st->vspace_slabs);
-    if (freecount <= 6 && !st->vspace_slabs_prevent_refill) {
-#if PRINT_DEBUG
-        debug_printf("Vspace slab allocator refilling...\n");
-#endif
-        st->vspace_slabs_prevent_refill = 1;
-        slab_default_refill((struct slab_allocator *)&st->vspace_slabs);
-        st->vspace_slabs_prevent_refill = 0;
-    }
+    vspace_slabs_check_refill(st);
     
     // Summary
 #if PRINT_DEBUG
@@ -702,35 +1092,32 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
         uintptr_t l2_offset = ARM_L2_OFFSET(addr);
         uintptr_t mapping_offset = addr / BASE_PAGE_SIZE;
 
-        // Search for L2 pagetable capability in the tree
-        struct pt_cap_tree_node *node = st->l2_tree_root;
-        struct pt_cap_tree_node *prev = node;
-
-        while (node != NULL) {
-            if (l1_offset == node->offset) {
-                break;
-            }
-            prev = node;
-            if (l1_offset < node->offset) {
-                node = node->left;
-            }
-            else if (l1_offset > node->offset) {
-                node = node->right;
-            }
-        }
+        // Look up the L2 pagetable capability in the L1 shadow table
+        assert(l1_offset < PAGING_L1_USER_ENTRIES);
+        struct pt_cap_tree_node *node = st->l1_shadow[l1_offset];
 
         // Create a L2 pagetable capability node if it wasn't found
         if (node == NULL) {
 
-            // Allocate the new tree node
+            // Allocate the new node
             node = slab_alloc(&st->slabs);
             node->left = NULL;
             node->right = NULL;
             node->subtree = NULL;
+            node->offset = l1_offset;
+
+            // Allocate the bitmap of mapped slots (only L2 nodes have one)
+            node->occupancy = slab_alloc(&st->l2_slabs);
+            if (node->occupancy == NULL) {
+                slab_free(&st->slabs, node);
+                return LIB_ERR_SLAB_ALLOC_FAIL;
+            }
+            memset(node->occupancy, 0, sizeof(struct pt_l2_occupancy));
 
             // Allocate a new slot for the mapping capability
             errval_t err_slot_alloc = st->slot_alloc->alloc(st->slot_alloc, &node->mapping_cap);
             if (err_is_fail(err_slot_alloc)) {
+                slab_free(&st->l2_slabs, node->occupancy);
                 slab_free(&st->slabs, node);
                 return err_slot_alloc;
             }
@@ -739,77 +1126,45 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
             errval_t err_l2_alloc = arml2_alloc(st, &node->cap);
             if (!err_is_ok(err_l2_alloc)) {
                 slot_free(node->mapping_cap);
+                slab_free(&st->l2_slabs, node->occupancy);
                 slab_free(&st->slabs, node);
                 return err_l2_alloc;
             }
 
-            // Check for reentrant call of this function
-            int skip_l2_creation = 0;
-            if (prev && prev->offset > l1_offset && prev->left != NULL) {
-                struct pt_cap_tree_node *same_node = prev->left;
-                while (same_node != NULL) {
-                    // Check if reentrant call created a node for this offset
-                    if (l1_offset == same_node->offset) {
-                        slab_free(&st->slabs, node);
-                        node = same_node;
-                        skip_l2_creation = 1;
-                        break;
-                    }
-                    // Move prev to avoid overwriting an existing node
-                    prev = same_node;
-                    if (l1_offset < same_node->offset) {
-                        same_node = same_node->left;
-                    }
-                    else if (l1_offset > same_node->offset) {
-                        same_node = same_node->right;
-                    }
-                }
-            }
-            else if (prev && prev->offset < l1_offset && prev->right != NULL) {
-                struct pt_cap_tree_node *same_node = prev->right;
-                while (same_node != NULL) {
-                    // Check if reentrant call created a node for this offset
-                    if (l1_offset == same_node->offset) {
-                        slab_free(&st->slabs, node);
-                        node = same_node;
-                        skip_l2_creation = 1;
-                        break;
-                    }
-                    // Move prev to avoid overwriting an existing node
-                    prev = same_node;
-                    if (l1_offset < same_node->offset) {
-                        same_node = same_node->left;
-                    }
-                    else if (l1_offset > same_node->offset) {
-                        same_node = same_node->right;
-                    }
-                }
+            // Check whether a reentrant call (slot or slab refill) created the
+            // L2 pagetable for this offset in the meantime
+            if (st->l1_shadow[l1_offset] != NULL) {
+                cap_destroy(node->cap);
+                slot_free(node->mapping_cap);
+                slab_free(&st->l2_slabs, node->occupancy);
+                slab_free(&st->slabs, node);
+                node = st->l1_shadow[l1_offset];
             }
-            if (!skip_l2_creation) {
+            else {
 
                 // Map L2 pagetable to appropriate slot in L1 pagetable
                 errval_t err_l2_map = vnode_map(st->l1_pagetable, node->cap, l1_offset, flags, 0, 1, node->mapping_cap);
                 if (!err_is_ok(err_l2_map)) {
                     slot_free(node->cap);
                     slot_free(node->mapping_cap);
+                    slab_free(&st->l2_slabs, node->occupancy);
                     slab_free(&st->slabs, node);
                     return err_l2_map;
                 }
 
-                // Set the offset for the new node
-                node->offset = l1_offset;
+                // Store new node in the shadow table
+                st->l1_shadow[l1_offset] = node;
 
-                // Store new node in the tree
-                if (st->l2_tree_root == NULL) {
-                    st->l2_tree_root = node;
-                }
-                else if (prev->offset > l1_offset) {
-                    prev->left = node;
-                }
-                else {
-                    prev->right = node;
-                }
+            }
 
+            // Check that there are sufficient bitmaps left for new L2 nodes
+            if (slab_freecount(&st->l2_slabs) <= 2 && !st->l2_slabs_prevent_refill) {
+#if PRINT_DEBUG
+                debug_printf("L2 bitmap slab allocator refilling...\n");
+#endif
+                st->l2_slabs_prevent_refill = 1;
+                slab_default_refill(&st->l2_slabs);
+                st->l2_slabs_prevent_refill = 0;
             }
 
         }
@@ -841,9 +1196,13 @@ errval_t paging_map_fixed_attr(struct paging_state *st, lvaddr_t vaddr,
             return err_frame_map;
         }
 
-        // Store the frame capability and L2 page table offset
+        // Mark the slots as mapped in the L2 page table node
+        set_l2_occupancy(node, l2_offset, num_pages, true);
+
+        // Store the frame capability, L2 page table offset and size of the mapping
         map_node->cap = frame;
         map_node->offset = mapping_offset;
+        map_node->num_pages = num_pages;
 
         // Store the new node in the mapping capability tree
         if (node->subtree == NULL) {
@@ -910,7 +1269,7 @@ errval_t paging_unmap(struct paging_state *st, const void *region)
         return err;
     }*/
     
-    // Searching for node in alloc linked list
+    // Searching for node in alloc tree
     struct vspace_node *ret_node;
     err = delete_vspace_alloc_node(st, (lvaddr_t) region, &ret_node);
     if (err_is_fail(err)) {
@@ -924,7 +1283,7 @@ errval_t paging_unmap(struct paging_state *st, const void *region)
         return err;
     }
     
-    // Insert ret_node in vspace free linked list (coalescing included)
+    // Insert ret_node in vspace free trees (coalescing included)
     err = insert_vspace_free_node(st, ret_node);
     if (err_is_fail(err)) {
         debug_printf("Error calling insert_vspace_free_node");
@@ -938,7 +1297,7 @@ errval_t paging_free(struct paging_state *st, const void *region, size_t *ret_si
     
     errval_t err;
     
-    // Searching for node in alloc linked list
+    // Searching for node in alloc tree
     struct vspace_node *ret_node;
     err = delete_vspace_alloc_node(st, (lvaddr_t) region, &ret_node);
     if (err_is_fail(err)) {
@@ -948,7 +1307,7 @@ errval_t paging_free(struct paging_state *st, const void *region, size_t *ret_si
     // Returning size of freed memory
     *ret_size = ret_node->size;
     
-    // Insert ret_node in vspace free linked list (coalescing included)
+    // Insert ret_node in vspace free trees (coalescing included)
     err = insert_vspace_free_node(st, ret_node);
     
     return err;
@@ -972,23 +1331,12 @@ errval_t paging_unmap_fixed(struct paging_state *st, lvaddr_t vaddr, size_t byte
         //uintptr_t l2_offset = ARM_L2_OFFSET(addr);            // TODO: Use l2_offset instead of mapping_offset as key in subtee
         uintptr_t mapping_offset = addr / BASE_PAGE_SIZE;
         
-        // Searching for l2 pagetable capability in the l2 tree with l1_offset as key
-        struct pt_cap_tree_node *l2_node = st->l2_tree_root;
-        while (l2_node != NULL) {
-            
-            if (l1_offset < l2_node->offset) {
-                l2_node = l2_node->left;
-            } else if (l1_offset > l2_node->offset) {
-                l2_node = l2_node->right;
-            } else {
-                break;
-            }
-            
-        }
+        // Looking up l2 pagetable capability in the l1 shadow table
+        struct pt_cap_tree_node *l2_node = find_l2_node(st, l1_offset);
         
-        // Check if l2 tree node was found
+        // Check if l2 node was found
         if (l2_node == NULL) {
-            debug_printf("l2 node in l2 tree not found");
+            debug_printf("l2 node in l1 shadow table not found");
             return MM_ERR_NOT_FOUND;
         }
         
@@ -1087,6 +1435,10 @@ errval_t paging_unmap_fixed(struct paging_state *st, lvaddr_t vaddr, size_t byte
             return err;
         }
         
+        // Marking only the slots of the removed mapping as unmapped in the l2 node
+        set_l2_occupancy(l2_node, ARM_L2_OFFSET(deletion_node->offset * BASE_PAGE_SIZE),
+                         deletion_node->num_pages, false);
+        
         // Destroying deletion_node mapping capability
         err = cap_destroy(deletion_node->mapping_cap);
         if (err_is_fail(err)) {
@@ -1115,26 +1467,17 @@ errval_t paging_unmap_fixed(struct paging_state *st, lvaddr_t vaddr, size_t byte
 
 static errval_t delete_vspace_alloc_node(struct paging_state *st, lvaddr_t base, struct vspace_node **ret_node) {
     
-    // Searching through alloc linked list
-    struct vspace_node **node_indirect = &st->alloc_vspace_head;
-    while (*node_indirect != NULL) {
-        
-        if ((*node_indirect)->base == base) {
-            break;
-        }
-        node_indirect = &(*node_indirect)->next;
-        
-    }
-    
-    if (*node_indirect == NULL) {
+    // Searching the alloc tree for the region starting at base
+    struct vspace_node *node = vspace_tree_floor(st->alloc_vspace_root, base);
+    if (node == NULL || node->base != base) {
         debug_printf("alloc node was not found");
         return LIB_ERR_VSPACE_VREGION_NOT_FOUND;
     }
     
-    *ret_node = *node_indirect;
+    // Remove node from the alloc tree
+    st->alloc_vspace_root = vspace_tree_remove(st->alloc_vspace_root, node, VSPACE_TREE_ADDR);
     
-    // Remove node from linked list by changing next of previous node
-    *node_indirect = (*node_indirect)->next;
+    *ret_node = node;
     
     return SYS_ERR_OK;
     
@@ -1142,91 +1485,30 @@ static errval_t delete_vspace_alloc_node(struct paging_state *st, lvaddr_t base,
 
 static errval_t insert_vspace_free_node(struct paging_state *st, struct vspace_node *new_node) {
     
-    // Check if list empty or node would have to get new head
-    if (st->free_vspace_head == NULL || new_node->base + new_node->size < st->free_vspace_head->base) {
-        
-        // Add new_node to head of the linked list
-        new_node->next = st->free_vspace_head;
-        st->free_vspace_head = new_node;
-        
-        return SYS_ERR_OK;
-        
-    }
-    else if (new_node->base + new_node->size == st->free_vspace_head->base) {
-        
-        // Coalescing with front of head
-        st->free_vspace_head->base = new_node->base;
-        st->free_vspace_head->size += new_node->size;
+    // Coalescing with the free region directly below
+    struct vspace_node *prev = vspace_tree_floor(st->free_vspace_root, new_node->base);
+    if (prev != NULL && prev->base + prev->size == new_node->base) {
+        free_tree_remove(st, prev);
+        prev->size += new_node->size;
         
         // Free the memory/slab for new_node
         slab_free(&st->vspace_slabs, new_node);
-
-        return SYS_ERR_OK;
-        
+        new_node = prev;
     }
     
-    // Iterating through loop adding new_node if necessary,
-    // otherwise coalescing by changing base and size of exisiting node
-    // and freeing slab of new_node
-    struct vspace_node *node;
-    for (node = st->free_vspace_head; node != NULL; node = node->next) {
+    // Coalescing with the free region directly above
+    struct vspace_node *next = vspace_tree_ceil(st->free_vspace_root, new_node->base + new_node->size);
+    if (next != NULL && next->base == new_node->base + new_node->size) {
+        free_tree_remove(st, next);
+        new_node->size += next->size;
         
-        if (node->next != NULL &&
-            node->base + node->size == new_node->base &&
-            new_node->base + new_node->size == node->next->base) {
-            
-            // Coalescing with back of node and front of node->next
-            node->size += new_node->size + node->next->size;
-            // Remove the node->next from the linked list
-            struct vspace_node *next_node = node->next;
-            node->next = node->next->next;
-            
-            // Free the memory/slab for node->next
-            slab_free(&st->vspace_slabs, next_node);
-            
-            // Free the memory/slab for new_node
-            slab_free(&st->vspace_slabs, new_node);
-            
-            break;
-            
-        }
-        else if (node->next != NULL &&
-                 new_node->base + new_node->size == node->next->base) {
-            
-            // Coalescing with front of node->next
-            node->next->base = new_node->base;
-            node->next->size += new_node->size;
-            
-            // Free the memory/slab for new_node
-            slab_free(&st->vspace_slabs, new_node);
-            
-            break;
-        }
-        else if (node->base + node->size == new_node->base) {
-            
-            // Coalescing with back of node
-            node->size += new_node->size;
-            
-            // Free the memory/slab for new_node
-            slab_free(&st->vspace_slabs, new_node);
-            
-            break;
-        
-        }
-        else if (node->base + node->size < new_node->base){
-            
-            // Add new_node to the linked list between node and node->next (which is potentially null)
-            new_node->next = node->next;
-            node->next = new_node;
-            
-            break;
-            
-        }
-
+        // Free the memory/slab for next
+        slab_free(&st->vspace_slabs, next);
     }
     
+    // Add the (coalesced) node to the free trees
+    free_tree_insert(st, new_node);
+    
     return SYS_ERR_OK;
     
 }
-
-
@@ -17,11 +17,128 @@
 #include <aos/aos_rpc.h>
 #include <aos/lmp.h>
 
+/// Number of pages requested from the memory server at once
+#define RAM_RESERVE_CHUNK_PAGES     LMP_MEMORY_ALLOC_BATCH_MAX
+
+/// Prefetch the next chunk once fewer pages than this are left
+#define RAM_RESERVE_LOW_WATERMARK   16
+
+static inline size_t ram_reserve_chunk_left(struct ram_reserve_chunk *chunk)
+{
+    return chunk->count - chunk->next;
+}
+
+/* drop our reference to a chunk, the pages retyped from it stay valid */
+static void ram_reserve_chunk_release(struct ram_reserve_chunk *chunk)
+{
+    if (chunk->count > 0) {
+        cap_delete(chunk->cap);
+        slot_free(chunk->cap);
+    }
+    chunk->next = 0;
+    chunk->count = 0;
+}
+
+/* fetch a new chunk of pages from the memory server with a single RPC */
+static errval_t ram_reserve_refill(struct ram_alloc_state *state)
+{
+    errval_t err;
+    
+    // Only a single refill at a time, nested allocations use what is left
+    if (state->reserve_refilling) {
+        return LIB_ERR_RAM_RESERVE_BUSY;
+    }
+    if (ram_reserve_chunk_left(&state->reserve_next)) {
+        return SYS_ERR_OK;
+    }
+    state->reserve_refilling = true;
+    
+    struct ram_reserve_chunk chunk = { .next = 0 };
+    err = aos_rpc_get_ram_cap_batch(aos_rpc_get_memory_channel(),
+                                    RAM_RESERVE_CHUNK_PAGES, BASE_PAGE_SIZE,
+                                    &chunk.cap, &chunk.count);
+    
+    state->reserve_refilling = false;
+    
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Start using the new chunk right away if the current one is used up
+    if (ram_reserve_chunk_left(&state->reserve_cur) == 0) {
+        ram_reserve_chunk_release(&state->reserve_cur);
+        state->reserve_cur = chunk;
+    } else {
+        state->reserve_next = chunk;
+    }
+    
+    return SYS_ERR_OK;
+}
+
+/* hand out a single page from the local reserve */
+static errval_t ram_reserve_alloc_page(struct capref *ret)
+{
+    errval_t err;
+    
+    struct ram_alloc_state *state = get_ram_alloc_state();
+    
+    // Allocate the slot first, as this might allocate memory itself
+    err = slot_alloc(ret);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Prefetch the next chunk once we drop below the low watermark
+    if (ram_reserve_chunk_left(&state->reserve_cur) +
+        ram_reserve_chunk_left(&state->reserve_next) < RAM_RESERVE_LOW_WATERMARK) {
+        err = ram_reserve_refill(state);
+        if (err_is_fail(err) && ram_reserve_chunk_left(&state->reserve_cur) == 0 &&
+            ram_reserve_chunk_left(&state->reserve_next) == 0) {
+            slot_free(*ret);
+            
+            // Nested in the refill RPC with nothing left, get this page alone
+            if (err == LIB_ERR_RAM_RESERVE_BUSY) {
+                size_t ret_size;
+                return aos_rpc_get_ram_cap(aos_rpc_get_memory_channel(),
+                                           BASE_PAGE_SIZE, BASE_PAGE_SIZE,
+                                           ret, &ret_size);
+            }
+            
+            return err;
+        }
+    }
+    
+    // Move on to the prefetched chunk
+    if (ram_reserve_chunk_left(&state->reserve_cur) == 0) {
+        ram_reserve_chunk_release(&state->reserve_cur);
+        state->reserve_cur = state->reserve_next;
+        state->reserve_next.next = 0;
+        state->reserve_next.count = 0;
+    }
+    assert(ram_reserve_chunk_left(&state->reserve_cur) > 0);
+    
+    // Retype the next page of the chunk into its own capability
+    size_t index = state->reserve_cur.next++;
+    err = cap_retype(*ret, state->reserve_cur.cap, index * BASE_PAGE_SIZE,
+                     ObjType_RAM, BASE_PAGE_SIZE, 1);
+    if (err_is_fail(err)) {
+        slot_free(*ret);
+        return err;
+    }
+    
+    return SYS_ERR_OK;
+}
+
 /* remote (indirect through a channel) version of ram_alloc, for most domains */
 static errval_t ram_alloc_remote(struct capref *ret, size_t size, size_t alignment)
 {
     errval_t err = SYS_ERR_OK;
     
+    // Serve single pages from the local reserve
+    if (size == BASE_PAGE_SIZE && alignment <= BASE_PAGE_SIZE) {
+        return ram_reserve_alloc_page(ret);
+    }
+    
     // Calling the rpc to get the ram capability
     size_t ret_size;
     err = aos_rpc_get_ram_cap(aos_rpc_get_memory_channel(), size, alignment, ret, &ret_size);
@@ -129,6 +246,11 @@ void ram_alloc_init(void)
     ram_alloc_state->default_minbase  = 0;
     ram_alloc_state->default_maxlimit = 0;
     ram_alloc_state->base_capnum      = 0;
+    ram_alloc_state->reserve_cur.next   = 0;
+    ram_alloc_state->reserve_cur.count  = 0;
+    ram_alloc_state->reserve_next.next  = 0;
+    ram_alloc_state->reserve_next.count = 0;
+    ram_alloc_state->reserve_refilling  = false;
 }
 
 /**
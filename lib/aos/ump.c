@@ -4,15 +4,23 @@
 //
 
 #include <string.h>
+#include <stddef.h>
 
 #include <aos/capabilities.h>
+#include <aos/waitset_chan.h>
 #include <machine/atomic.h>
 
 #include "aos/ump.h"
+#include "waitset_chan_priv.h"
 
 // Struct for UMP channel with the other init (only in init)
 struct ump_chan init_uc;
 
+static void ump_bulk_init(struct ump_chan *chan);
+static errval_t ump_bulk_copy_out(struct ump_chan *chan, const void *msg,
+                                  void **buf, size_t *size,
+                                  ump_msg_type_t *msg_type);
+
 // Initialize a UMP channel
 void ump_chan_init(struct ump_chan *chan, uint8_t buf_select) {
     
@@ -20,45 +28,185 @@ void ump_chan_init(struct ump_chan *chan, uint8_t buf_select) {
     assert(buf_select < 2);
     chan->buf_select = buf_select;
     
+    // The rings are set up by ump_chan_setup() once the frame is mapped
+    chan->buf = NULL;
+    chan->depth = 0;
+    chan->tx_ctrl = NULL;
+    chan->rx_ctrl = NULL;
+    chan->tx_slots = NULL;
+    chan->rx_slots = NULL;
+    
     // Set the counters to zero
-    chan->tx_counter = 0;
-    chan->rx_counter = 0;
-    chan->ack_counter = 0;
+    chan->tx_reserved = 0;
+    chan->tx_head = 0;
+    chan->rx_head = 0;
+    chan->rx_tail = 0;
+    
+    // Bulk transfer is disabled until ump_chan_setup()
+    chan->bulk_tx = NULL;
+    chan->bulk_rx = NULL;
+    chan->bulk_blocks = 0;
+    chan->bulk_tx_used = NULL;
+    chan->bulk_rx_used = NULL;
+    thread_mutex_init(&chan->bulk_lock);
+    
+    // Not registered on any waitset yet
+    waitset_chanstate_init(&chan->recv_waitset, CHANTYPE_UMP_IN);
+    deferred_event_init(&chan->recv_backoff);
+    chan->recv_ws = NULL;
+    chan->recv_idle_polls = 0;
+    chan->recv_backoff_delay = UMP_RECV_BACKOFF_MIN_US;
     
 }
 
-// Send a buffer of at most UMP_SLOT_DATA_BYTES bytes on the URPC channel
-errval_t ump_send_one(struct ump_chan *chan, const void *buf, size_t size,
-                       ump_msg_type_t msg_type, uint8_t last) {
+// Set up the rings (and bulk pools) once the frame is mapped at chan->buf
+errval_t ump_chan_setup(struct ump_chan *chan, size_t depth) {
     
-    // Check for invalid sizes
-    //assert(size <= UMP_SLOT_DATA_BYTES);
-    if (size > UMP_SLOT_DATA_BYTES) {
+    struct ump_frame_header *header = chan->buf;
+    
+    // The allocating end decides on the depth, the other end adopts it
+    bool allocator = depth != 0;
+    if (!allocator) {
+        depth = header->depth;
+    }
+    
+    // Check the depth is a power of two and the rings fit into the frame
+    if (depth == 0 || depth > UMP_MAX_DEPTH || (depth & (depth - 1)) ||
+        UMP_FRAME_SIZE(depth) > chan->fi.bytes) {
         return LIB_ERR_UMP_BUFSIZE_INVALID;
     }
     
-    // Get the correct UMP buffer
-    struct ump_buf *tx_buf = chan->buf + chan->buf_select;
+    if (allocator) {
+        
+        // Reset the counters of both rings and the bulk pools
+        for (int i = 0; i < 2; i++) {
+            header->rings[i].tail = 0;
+            header->rings[i].head = 0;
+            header->bulk_used[i] = 0;
+        }
+        header->depth = depth;
+        
+        // Memory barrier
+        dmb();
+        
+    }
+    
+    // Locate the rings
+    struct ump_slot *slots = (struct ump_slot *) (header + 1);
+    chan->depth = depth;
+    chan->tx_ctrl = &header->rings[chan->buf_select];
+    chan->rx_ctrl = &header->rings[!chan->buf_select];
+    chan->tx_slots = slots + chan->buf_select * depth;
+    chan->rx_slots = slots + !chan->buf_select * depth;
+    
+    // Pick up the counters where they are
+    chan->tx_reserved = chan->tx_ctrl->tail;
+    chan->tx_head = chan->tx_ctrl->head;
+    chan->rx_head = chan->rx_ctrl->head;
+    chan->rx_tail = chan->rx_head;
+    
+    // Use the space behind the rings for bulk transfer
+    ump_bulk_init(chan);
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Back off while waiting for the other end: spin for a bounded number of
+// polls, then give up the CPU between polls so the other threads and
+// domains on this core can run
+static inline void ump_backoff(size_t *polls) {
+    
+    if (*polls < UMP_RECV_SPIN_POLLS) {
+        (*polls)++;
+    }
+    else {
+        thread_yield();
+    }
+    
+}
+
+// Wait until the slot with counter `slot` is free to be filled
+static void ump_wait_for_space(struct ump_chan *chan, uint32_t slot) {
     
-    // Make sure there is space in the ring buffer and wait otherwise
-    while (tx_buf->slots[chan->tx_counter].valid) ;
+    size_t polls = 0;
+    
+    while (slot - chan->tx_head >= chan->depth) {
+        ump_backoff(&polls);
+        chan->tx_head = chan->tx_ctrl->head;
+    }
     
     // Memory barrier
     dmb();
     
-    // Copy data to the slot
-    memcpy(tx_buf->slots[chan->tx_counter].data, buf, size);
-    tx_buf->slots[chan->tx_counter].msg_type = msg_type;
-    tx_buf->slots[chan->tx_counter].last = last;
+}
+
+// Publish the slots from `from` up to `to` once all earlier slots are
+static void ump_publish(struct ump_chan *chan, uint32_t from, uint32_t to) {
+    
+    size_t polls = 0;
+    
+    // Senders publish in the order they reserved their slots
+    while (chan->tx_ctrl->tail != from) {
+        ump_backoff(&polls);
+    }
     
     // Memory barrier
     dmb();
     
-    // Mark the message as valid
-    tx_buf->slots[chan->tx_counter].valid = 1;
+    // Publish the whole batch with a single update
+    chan->tx_ctrl->tail = to;
+    
+}
+
+// Send a buffer in `count` consecutive slots, reserved in one go so that
+// the fragments of concurrent senders do not interleave
+static void ump_send_slots(struct ump_chan *chan, const void *buf, size_t size,
+                           size_t count, ump_msg_type_t msg_type,
+                           uint8_t last) {
+    
+    // Reserve the slots
+    uint32_t first = atomic_fetchadd_32(&chan->tx_reserved, count);
+    uint32_t end = first + count;
+    uint32_t published = first;
     
-    // Set the index of the next slot to use for sending
-    chan->tx_counter = (chan->tx_counter + 1) % UMP_NUM_SLOTS;
+    for (uint32_t i = first; i != end; i++) {
+        
+        // If the ring is full, let the receiver have what we filled so far
+        if (i - chan->tx_head >= chan->depth) {
+            if (i != published) {
+                ump_publish(chan, published, i);
+                published = i;
+            }
+            ump_wait_for_space(chan, i);
+        }
+        
+        // Copy data to the slot
+        struct ump_slot *slot = &chan->tx_slots[i & (chan->depth - 1)];
+        size_t slot_size = MIN(size, UMP_SLOT_DATA_BYTES);
+        memcpy(slot->data, buf, slot_size);
+        slot->msg_type = msg_type;
+        slot->last = i + 1 == end ? last : 0;
+        
+        buf += slot_size;
+        size -= slot_size;
+        
+    }
+    
+    ump_publish(chan, published, end);
+    
+}
+
+// Send a buffer of at most UMP_SLOT_DATA_BYTES bytes on the URPC channel
+errval_t ump_send_one(struct ump_chan *chan, const void *buf, size_t size,
+                       ump_msg_type_t msg_type, uint8_t last) {
+    
+    // Check for invalid sizes
+    if (size > UMP_SLOT_DATA_BYTES) {
+        return LIB_ERR_UMP_BUFSIZE_INVALID;
+    }
+    
+    ump_send_slots(chan, buf, size, 1, msg_type, last);
     
     return SYS_ERR_OK;
     
@@ -70,58 +218,79 @@ errval_t ump_send(struct ump_chan *chan, const void *buf, size_t size,
 
     errval_t err = SYS_ERR_OK;
 
-    while (size > 0) {
+    // Send large payloads through the bulk pool if the channel has one
+    if (chan->bulk_tx != NULL && size > UMP_BULK_THRESHOLD) {
         
-        size_t msg_size = MIN(size, UMP_SLOT_DATA_BYTES);
+        void *bulk_buf;
+        struct ump_bulk_desc desc;
         
-        // Send fragment of entire message
-        err = ump_send_one(chan,
-                            buf,
-                            msg_size,
-                            msg_type,
-                            size <= UMP_SLOT_DATA_BYTES);
-        if (err_is_fail(err)) {
-            return err;
+        err = ump_bulk_alloc(chan, size, &bulk_buf, &desc);
+        if (err_is_ok(err)) {
+            memcpy(bulk_buf, buf, size);
+            return ump_bulk_send(chan, &desc, msg_type);
         }
         
-        buf += msg_size;
-        size -= msg_size;
+        // Fall back to sending through the slots if the pool is exhausted
+        err = SYS_ERR_OK;
         
     }
+
+    // Send all fragments as one batch
+    if (size > 0) {
+        ump_send_slots(chan, buf, size,
+                       DIVIDE_ROUND_UP(size, UMP_SLOT_DATA_BYTES),
+                       msg_type, 1);
+    }
     
     return err;
     
 }
 
+// Get the next slot of the receive ring, or NULL if it is empty
+static struct ump_slot *ump_peek(struct ump_chan *chan) {
+    
+    // Look for newly published slots once we consumed the last batch
+    if (chan->rx_head == chan->rx_tail) {
+        uint32_t tail = chan->rx_ctrl->tail;
+        if (tail == chan->rx_head || tail - chan->rx_head > chan->depth) {
+            return NULL;
+        }
+        chan->rx_tail = tail;
+        
+        // Memory barrier
+        dmb();
+    }
+    
+    return &chan->rx_slots[chan->rx_head & (chan->depth - 1)];
+    
+}
+
 // Receive a buffer of UMP_SLOT_DATA_BYTES bytes on the UMP channel
 errval_t ump_recv_one(struct ump_chan *chan, void *buf,
                        ump_msg_type_t* msg_type, uint8_t *last) {
     
-    // Get the correct UMP buffer
-    struct ump_buf *rx_buf = chan->buf + !chan->buf_select;
-    
     // Check if there is a new message
-    if (!rx_buf->slots[chan->rx_counter].valid) {
+    struct ump_slot *slot = ump_peek(chan);
+    if (slot == NULL) {
         return LIB_ERR_NO_UMP_MSG;
     }
-
-    // Memory barrier
-    dmb();
     
     // Copy data from the slot
-    memcpy(buf, rx_buf->slots[chan->rx_counter].data, UMP_SLOT_DATA_BYTES);
-    *msg_type = rx_buf->slots[chan->rx_counter].msg_type;
-    *last = rx_buf->slots[chan->rx_counter].last;
-
-    // Memory barrier
-    dmb();
-
-    // Mark the message as invalid
-    rx_buf->slots[chan->rx_counter].valid = 0;
-
-    // Set the index of the next slot to read
-    chan->rx_counter = (chan->rx_counter + 1) % UMP_NUM_SLOTS;
-
+    memcpy(buf, slot->data, UMP_SLOT_DATA_BYTES);
+    *msg_type = slot->msg_type;
+    *last = slot->last;
+    
+    // Hand the batch back to the sender with a single update once drained
+    chan->rx_head++;
+    if (chan->rx_head == chan->rx_tail) {
+        
+        // Memory barrier
+        dmb();
+        
+        chan->rx_ctrl->head = chan->rx_head;
+        
+    }
+    
     return SYS_ERR_OK;
     
 }
@@ -133,6 +302,11 @@ errval_t ump_recv(struct ump_chan *chan, void **buf, size_t *size,
 
     uint8_t last;
 
+    // Don't bother allocating a buffer if the ring is empty
+    if (!ump_chan_can_recv(chan)) {
+        return LIB_ERR_NO_UMP_MSG;
+    }
+
     // Allocate memory for the first message
     *size = UMP_SLOT_DATA_BYTES;
     *buf = malloc(*size);
@@ -146,6 +320,14 @@ errval_t ump_recv(struct ump_chan *chan, void **buf, size_t *size,
         free(*buf);
         return err;
     }
+    
+    // Copy a bulk payload out of the pool in one go
+    if (*msg_type == UMP_MessageType_BulkDescriptor) {
+        char desc_msg[UMP_SLOT_DATA_BYTES];
+        memcpy(desc_msg, *buf, UMP_SLOT_DATA_BYTES);
+        free(*buf);
+        return ump_bulk_copy_out(chan, desc_msg, buf, size, msg_type);
+    }
 
     // Loop until we received the final message
     while (!last) {
@@ -159,15 +341,15 @@ errval_t ump_recv(struct ump_chan *chan, void **buf, size_t *size,
             return LIB_ERR_MALLOC_FAIL;
         }
 
-        // Receive the next message
-        err = ump_recv_one(chan,
-                            *buf + *size - UMP_SLOT_DATA_BYTES,
-                            &this_msg_type,
-                            &last);
-        if (err == LIB_ERR_NO_UMP_MSG) {
-            continue;
+        // Receive the next message, which may not be published yet
+        size_t polls = 0;
+        while ((err = ump_recv_one(chan,
+                                   *buf + *size - UMP_SLOT_DATA_BYTES,
+                                   &this_msg_type,
+                                   &last)) == LIB_ERR_NO_UMP_MSG) {
+            ump_backoff(&polls);
         }
-        else if (err_is_fail(err)) {
+        if (err_is_fail(err)) {
             free(*buf);
             return err;
         }
@@ -184,7 +366,332 @@ errval_t ump_recv(struct ump_chan *chan, void **buf, size_t *size,
 void ump_recv_blocking(struct ump_chan *chan, void **buf, size_t *size,
                        ump_msg_type_t *msg_type) {
     errval_t err;
+    size_t polls = 0;
     do {
+        while (!ump_chan_can_recv(chan)) {
+            ump_backoff(&polls);
+        }
         err = ump_recv(chan, buf, size, msg_type);
     } while(err == LIB_ERR_NO_UMP_MSG);
 }
+
+
+// MARK: - Waitset integration
+
+// Timer handler re-checking a channel that went idle
+static void ump_chan_backoff_handler(void *arg) {
+    
+    struct ump_chan *chan = arg;
+    errval_t err;
+    
+    if (ump_chan_can_recv(chan)) {
+        // Renew the registration, which fires immediately
+        err = ump_chan_register_recv(chan, chan->recv_ws, chan->recv_closure);
+    }
+    else {
+        // Check again later, backing off exponentially
+        chan->recv_backoff_delay = MIN(2 * chan->recv_backoff_delay,
+                                       UMP_RECV_BACKOFF_MAX_US);
+        err = deferred_event_register(&chan->recv_backoff,
+                                      chan->recv_ws,
+                                      chan->recv_backoff_delay,
+                                      MKCLOSURE(ump_chan_backoff_handler,
+                                                chan));
+    }
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "in ump_chan_backoff_handler");
+    }
+    
+}
+
+// Register a closure to be run on `ws` when a message can be received
+errval_t ump_chan_register_recv(struct ump_chan *chan, struct waitset *ws,
+                                struct event_closure closure) {
+    
+    errval_t err;
+    
+    dispatcher_handle_t handle = disp_disable();
+    
+    // Only one registration at a time, including one sleeping on the timer
+    if (chan->recv_waitset.waitset != NULL ||
+        chan->recv_backoff.waitset_state.waitset != NULL) {
+        disp_enable(handle);
+        return LIB_ERR_CHAN_ALREADY_REGISTERED;
+    }
+    
+    // Remember the registration and start polling eagerly again
+    chan->recv_ws = ws;
+    chan->recv_closure = closure;
+    chan->recv_idle_polls = 0;
+    chan->recv_backoff_delay = UMP_RECV_BACKOFF_MIN_US;
+    
+    if (ump_chan_can_recv(chan)) {
+        // Trigger immediately
+        err = waitset_chan_trigger_closure_disabled(ws, &chan->recv_waitset,
+                                                    closure, handle);
+    }
+    else {
+        // Have the dispatcher poll the channel
+        err = waitset_chan_register_polled_disabled(ws, &chan->recv_waitset,
+                                                    closure, handle);
+    }
+    
+    disp_enable(handle);
+    
+    return err;
+    
+}
+
+// Cancel a registration made with ump_chan_register_recv()
+errval_t ump_chan_deregister_recv(struct ump_chan *chan) {
+    
+    errval_t err = waitset_chan_deregister(&chan->recv_waitset);
+    if (err == LIB_ERR_CHAN_NOT_REGISTERED) {
+        // The channel may be waiting for the backoff timer instead
+        err = deferred_event_cancel(&chan->recv_backoff);
+    }
+    
+    return err;
+    
+}
+
+// Poll a registered channel (called by the waitset code while disabled)
+void ump_chan_poll_disabled(struct waitset_chanstate *ws_chan,
+                            dispatcher_handle_t handle) {
+    
+    struct ump_chan *chan = (struct ump_chan *)
+        ((char *) ws_chan - offsetof(struct ump_chan, recv_waitset));
+    errval_t err;
+    
+    // Fire the event if a message arrived
+    if (ump_chan_can_recv(chan)) {
+        err = waitset_chan_trigger_disabled(ws_chan, handle);
+        assert_disabled(err_is_ok(err));
+        return;
+    }
+    
+    // Keep polling eagerly for a while after the channel was last active
+    if (++chan->recv_idle_polls < UMP_RECV_SPIN_POLLS) {
+        return;
+    }
+    
+    // Stop polling so the dispatcher may sleep, and check back on a timer
+    struct waitset *ws = ws_chan->waitset;
+    err = waitset_chan_deregister_disabled(ws_chan, handle);
+    assert_disabled(err_is_ok(err));
+    err = deferred_event_register_disabled(&chan->recv_backoff,
+                                           ws,
+                                           chan->recv_backoff_delay,
+                                           MKCLOSURE(ump_chan_backoff_handler,
+                                                     chan),
+                                           handle);
+    assert_disabled(err_is_ok(err));
+    
+}
+
+
+// MARK: - Bulk transfer
+
+// Set up the bulk pools if the mapped UMP frame is large enough
+static void ump_bulk_init(struct ump_chan *chan) {
+    
+    // Check there is space behind the slot rings
+    size_t rings_size = UMP_FRAME_SIZE(chan->depth);
+    if (chan->fi.bytes <= rings_size) {
+        return;
+    }
+    
+    // Split the remaining space into one pool per direction
+    size_t pool_size = (chan->fi.bytes - rings_size) / 2;
+    chan->bulk_blocks = MIN(pool_size / UMP_BULK_BLOCK_SIZE, UMP_BULK_MAX_BLOCKS);
+    if (chan->bulk_blocks == 0) {
+        return;
+    }
+    
+    // We send from the pool matching our buffer selector
+    struct ump_frame_header *header = chan->buf;
+    char *pools = (char *) chan->buf + rings_size;
+    chan->bulk_tx = pools + chan->buf_select * pool_size;
+    chan->bulk_rx = pools + !chan->buf_select * pool_size;
+    chan->bulk_tx_used = &header->bulk_used[chan->buf_select];
+    chan->bulk_rx_used = &header->bulk_used[!chan->buf_select];
+    
+}
+
+// Bitmap mask for `count` blocks starting at block `start`
+static inline uint32_t ump_bulk_mask(size_t start, size_t count) {
+    
+    uint32_t mask = count >= 32 ? ~0u : (1u << count) - 1;
+    return mask << start;
+    
+}
+
+// Check that a descriptor lies within a pool
+static bool ump_bulk_desc_valid(struct ump_chan *chan,
+                                struct ump_bulk_desc *desc) {
+    
+    size_t pool_size = chan->bulk_blocks * UMP_BULK_BLOCK_SIZE;
+    return desc->length > 0 &&
+           desc->offset % UMP_BULK_BLOCK_SIZE == 0 &&
+           desc->offset < pool_size &&
+           desc->length <= pool_size - desc->offset;
+    
+}
+
+// Find `count` contiguous free blocks in our pool
+static int ump_bulk_find_blocks(struct ump_chan *chan, size_t count) {
+    
+    for (size_t start = 0; start + count <= chan->bulk_blocks; start++) {
+        if (!(*chan->bulk_tx_used & ump_bulk_mask(start, count))) {
+            return start;
+        }
+    }
+    
+    return -1;
+    
+}
+
+// Allocate a buffer of `size` bytes in our bulk pool to fill in place
+errval_t ump_bulk_alloc(struct ump_chan *chan, size_t size, void **buf,
+                        struct ump_bulk_desc *desc) {
+    
+    // Check the channel has a pool
+    if (chan->bulk_tx == NULL) {
+        return LIB_ERR_UMP_BULK_DISABLED;
+    }
+    
+    // Check the payload fits into the pool
+    size_t count = DIVIDE_ROUND_UP(size, UMP_BULK_BLOCK_SIZE);
+    if (count == 0 || count > chan->bulk_blocks) {
+        return LIB_ERR_UMP_BUFSIZE_INVALID;
+    }
+    
+    // Find free blocks (the other end may free blocks at any time)
+    thread_mutex_lock(&chan->bulk_lock);
+    int start = ump_bulk_find_blocks(chan, count);
+    if (start < 0) {
+        thread_mutex_unlock(&chan->bulk_lock);
+        return LIB_ERR_UMP_BULK_POOL_FULL;
+    }
+    
+    // Mark the blocks as used
+    atomic_set_32(chan->bulk_tx_used, ump_bulk_mask(start, count));
+    thread_mutex_unlock(&chan->bulk_lock);
+    
+    desc->offset = start * UMP_BULK_BLOCK_SIZE;
+    desc->length = size;
+    desc->msg_type = 0;
+    *buf = chan->bulk_tx + desc->offset;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Send a filled bulk buffer to the other end (only the descriptor is copied)
+errval_t ump_bulk_send(struct ump_chan *chan, struct ump_bulk_desc *desc,
+                       ump_msg_type_t msg_type) {
+    
+    desc->msg_type = msg_type;
+    
+    // The payload is published by the barrier in ump_publish()
+    return ump_send_one(chan, desc, sizeof(struct ump_bulk_desc),
+                        UMP_MessageType_BulkDescriptor, 1);
+    
+}
+
+// Hand the blocks of a received payload back to the other end
+static errval_t ump_bulk_free(struct ump_chan *chan, struct ump_bulk_desc *desc) {
+    
+    // Make sure we are done reading before the blocks can be reused
+    dmb();
+    
+    atomic_clear_32(chan->bulk_rx_used,
+                    ump_bulk_mask(desc->offset / UMP_BULK_BLOCK_SIZE,
+                                  DIVIDE_ROUND_UP(desc->length,
+                                                  UMP_BULK_BLOCK_SIZE)));
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Copy the payload of a UMP_MessageType_BulkDescriptor message to a new buffer
+static errval_t ump_bulk_copy_out(struct ump_chan *chan, const void *msg,
+                                  void **buf, size_t *size,
+                                  ump_msg_type_t *msg_type) {
+    
+    struct ump_bulk_desc desc;
+    memcpy(&desc, msg, sizeof(struct ump_bulk_desc));
+    
+    if (chan->bulk_rx == NULL || !ump_bulk_desc_valid(chan, &desc)) {
+        return LIB_ERR_UMP_BULK_DESC_INVALID;
+    }
+    
+    *buf = malloc(desc.length);
+    if (*buf == NULL) {
+        ump_bulk_free(chan, &desc);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    
+    memcpy(*buf, chan->bulk_rx + desc.offset, desc.length);
+    *size = desc.length;
+    *msg_type = desc.msg_type;
+    
+    return ump_bulk_free(chan, &desc);
+    
+}
+
+// Receive a message without copying it out of the other end's bulk pool
+errval_t ump_recv_bulk(struct ump_chan *chan, void **buf, size_t *size,
+                       ump_msg_type_t *msg_type, struct ump_bulk_desc *desc) {
+    
+    // Check if the next message is a bulk descriptor
+    struct ump_slot *slot = ump_peek(chan);
+    if (chan->bulk_rx != NULL && slot != NULL) {
+        
+        if (slot->msg_type == UMP_MessageType_BulkDescriptor) {
+            
+            char msg[UMP_SLOT_DATA_BYTES];
+            uint8_t last;
+            errval_t err = ump_recv_one(chan, msg, msg_type, &last);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            
+            memcpy(desc, msg, sizeof(struct ump_bulk_desc));
+            if (!ump_bulk_desc_valid(chan, desc)) {
+                return LIB_ERR_UMP_BULK_DESC_INVALID;
+            }
+            
+            // Hand out the payload in place
+            *buf = chan->bulk_rx + desc->offset;
+            *size = desc->length;
+            *msg_type = desc->msg_type;
+            
+            return SYS_ERR_OK;
+            
+        }
+        
+    }
+    
+    // Receive a copied message, marked by a descriptor of length zero
+    desc->offset = 0;
+    desc->length = 0;
+    errval_t err = ump_recv(chan, buf, size, msg_type);
+    desc->msg_type = *msg_type;
+    return err;
+    
+}
+
+// Release a buffer received with ump_recv_bulk()
+errval_t ump_bulk_release(struct ump_chan *chan, void *buf,
+                          struct ump_bulk_desc *desc) {
+    
+    // Copied messages are simply freed
+    if (desc->length == 0) {
+        free(buf);
+        return SYS_ERR_OK;
+    }
+    
+    return ump_bulk_free(chan, desc);
+    
+}
@@ -46,6 +46,10 @@ void urpc_init_server_handler(struct ump_chan *chan, void *msg, size_t size,
             urpc_handle_deregister_forward(chan, msg, size, msg_type);
             break;
             
+        case UMP_MessageType_RamSteal:
+            urpc_ram_steal_request_handler(chan, msg, size, msg_type);
+            break;
+            
         default:
             USER_PANIC("Unknown UMP message type\n");
             break;
@@ -95,10 +99,108 @@ void urpc_register_process_handler(struct ump_chan *chan, void *msg,
     
 }
 
+static urpc_ram_steal_handler_t ram_steal_handler = NULL;
+
+// Register the function handing over RAM to the other core
+void urpc_register_ram_steal_handler(urpc_ram_steal_handler_t handler) {
+    ram_steal_handler = handler;
+}
+
+// Handle UMP_MessageType_RamSteal
+void urpc_ram_steal_request_handler(struct ump_chan *chan, void *msg,
+                                    size_t size, ump_msg_type_t msg_type) {
+    
+    assert(msg_type == UMP_MessageType_RamSteal);
+    
+    struct urpc_ram_steal_request *req = msg;
+    struct urpc_ram_steal_response res;
+    
+    // Ask the local memory server for a region it can spare
+    if (ram_steal_handler != NULL) {
+        res.err = ram_steal_handler(req->bytes, req->alignment, &res.fi);
+    } else {
+        res.err = LIB_ERR_RAM_ALLOC;
+    }
+    
+    // Send response back to requesting core
+    ump_send(chan,
+             (void *) &res,
+             sizeof(struct urpc_ram_steal_response),
+             UMP_MessageType_RamStealAck);
+    
+}
+
 
 
 // MARK: - Init URPC Client
 
+// Message received by urpc_ram_steal() for another RPC waiting on the channel
+struct urpc_deferred_msg {
+    struct urpc_deferred_msg *next;
+    void *buf;
+    size_t size;
+    ump_msg_type_t msg_type;
+};
+
+// Deferred messages in the order they were received
+static struct urpc_deferred_msg *deferred_head;
+static struct urpc_deferred_msg **deferred_tail = &deferred_head;
+
+// Check whether a message is a request the init server handler can serve
+static bool urpc_init_is_request(ump_msg_type_t msg_type) {
+    
+    switch (msg_type) {
+        case UMP_MessageType_Spawn:
+        case UMP_MessageType_RegisterProcess:
+        case UMP_MessageType_UrpcBindRequest:
+        case UMP_MessageType_DeregisterForward:
+        case UMP_MessageType_RamSteal:
+            return true;
+        default:
+            return false;
+    }
+    
+}
+
+// Keep a message for the next urpc_init_recv()
+static void urpc_init_defer(void *buf, size_t size, ump_msg_type_t msg_type) {
+    
+    struct urpc_deferred_msg *d = malloc(sizeof(struct urpc_deferred_msg));
+    assert(d != NULL);
+    
+    d->next = NULL;
+    d->buf = buf;
+    d->size = size;
+    d->msg_type = msg_type;
+    
+    *deferred_tail = d;
+    deferred_tail = &d->next;
+    
+}
+
+// Receive on the init channel, replaying deferred messages first
+errval_t urpc_init_recv(struct ump_chan *chan, void **buf, size_t *size,
+                        ump_msg_type_t *msg_type) {
+    
+    struct urpc_deferred_msg *d = deferred_head;
+    if (d == NULL) {
+        return ump_recv(chan, buf, size, msg_type);
+    }
+    
+    deferred_head = d->next;
+    if (deferred_head == NULL) {
+        deferred_tail = &deferred_head;
+    }
+    
+    *buf = d->buf;
+    *size = d->size;
+    *msg_type = d->msg_type;
+    free(d);
+    
+    return SYS_ERR_OK;
+    
+}
+
 // RPC for registering a process
 void urpc_process_register(struct process_info *pi) {
     
@@ -114,17 +216,24 @@ void urpc_process_register(struct process_info *pi) {
     
     free(msg);
     
-    domainid_t *pid = malloc(UMP_SLOT_DATA_BYTES);
-    
+    domainid_t *pid;
+    size_t size;
     ump_msg_type_t msg_type;
-    uint8_t last;
     errval_t err;
     do {
-        err = ump_recv_one(&init_uc, (void *)pid, &msg_type, &last);
+        err = urpc_init_recv(&init_uc, (void **) &pid, &size, &msg_type);
+        
+        // The other core might run low on RAM while we wait
+        if (err_is_ok(err) && msg_type == UMP_MessageType_RamSteal) {
+            urpc_ram_steal_request_handler(&init_uc, (void *)pid,
+                                           size, msg_type);
+            free(pid);
+            err = LIB_ERR_NO_UMP_MSG;
+        }
     } while (err == LIB_ERR_NO_UMP_MSG);
     assert(err_is_ok(err));
     assert(msg_type == UMP_MessageType_RegisterProcessAck);
-    assert(last == 1);
+    assert(size >= sizeof(domainid_t));
     
     pi->pid = *pid;
     
@@ -132,6 +241,65 @@ void urpc_process_register(struct process_info *pi) {
     
 }
 
+// RPC for taking over a region of RAM from the other core
+errval_t urpc_ram_steal(size_t bytes, size_t alignment,
+                        struct frame_identity *ret_fi) {
+    
+    errval_t err;
+    
+    struct urpc_ram_steal_request req = {
+        .bytes = bytes,
+        .alignment = alignment
+    };
+    
+    // Send request to the init on the other core
+    err = ump_send(&init_uc, (void *) &req,
+                   sizeof(struct urpc_ram_steal_request),
+                   UMP_MessageType_RamSteal);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    struct urpc_ram_steal_response *res;
+    size_t size;
+    ump_msg_type_t msg_type;
+    
+    // Wait for the response and serve the other core in the meantime
+    while (true) {
+        
+        err = ump_recv(&init_uc, (void **) &res, &size, &msg_type);
+        if (err == LIB_ERR_NO_UMP_MSG) {
+            continue;
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+        
+        if (msg_type == UMP_MessageType_RamStealAck) {
+            break;
+        }
+        
+        // Responses belong to an RPC we are nested in, keep them for it
+        if (!urpc_init_is_request(msg_type)) {
+            urpc_init_defer(res, size, msg_type);
+            continue;
+        }
+        
+        // Handle requests of the other core
+        urpc_init_server_handler(&init_uc, (void *) res, size, msg_type);
+        free(res);
+        
+    }
+    
+    err = res->err;
+    *ret_fi = res->fi;
+    
+    free(res);
+    
+    return err;
+    
+}
+
 
 
 // MARK: - Generic Server
@@ -233,6 +401,12 @@ static errval_t urpc_accept_from_msg(struct urpc_chan *chan,
             return err;
         }
         
+        // Set up the rings and bulk pools laid out by the client
+        err = ump_chan_setup(chan->ump, 0);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        
     }
     
     // Send the ack over URPC
@@ -294,6 +468,24 @@ errval_t urpc_accept_blocking(struct urpc_chan *chan) {
 // Bind to a URPC server with a specific PID
 errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp) {
     
+    return urpc_bind_bulk(pid, chan, use_lmp, 0);
+    
+}
+
+// Bind to a URPC server with a specific PID and bulk pools of `pool_size`
+// bytes per direction (UMP only)
+errval_t urpc_bind_bulk(domainid_t pid, struct urpc_chan *chan, bool use_lmp,
+                        size_t pool_size) {
+    
+    return urpc_bind_ring(pid, chan, use_lmp, UMP_DEFAULT_DEPTH, pool_size);
+    
+}
+
+// Bind to a URPC server with a specific PID, rings of `depth` slots and bulk
+// pools of `pool_size` bytes per direction (UMP only)
+errval_t urpc_bind_ring(domainid_t pid, struct urpc_chan *chan, bool use_lmp,
+                        size_t depth, size_t pool_size) {
+    
     errval_t err;
     
     // Set the new chanel to correct transport protocol
@@ -376,24 +568,14 @@ errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp) {
         chan->ump = (struct ump_chan *) malloc(sizeof(struct ump_chan));
         assert(chan->ump);
 
-        // Allocate a frame for the new UMP channel
+        // Allocate a frame for the new UMP channel and its bulk pools
         struct capref ump_frame_cap;
-        size_t ump_frame_size = UMP_BUF_SIZE;
+        size_t ump_frame_size = UMP_FRAME_SIZE(depth) + 2 * ROUND_UP(pool_size, UMP_BULK_BLOCK_SIZE);
         err = frame_alloc(&ump_frame_cap, ump_frame_size, &ump_frame_size);
         if (err_is_fail(err)) {
             return err;
         }
-        assert(ump_frame_size >= UMP_BUF_SIZE);
-
-        // Send a bind request with the frame capability to this core's init
-        err = lmp_chan_send2(lc,
-                       LMP_SEND_FLAGS_DEFAULT,
-                       ump_frame_cap,
-                       LMP_RequestType_UmpBind,
-                       pid);
-        if (err_is_fail(err)) {
-            return err;
-        }
+        assert(ump_frame_size >= UMP_FRAME_SIZE(depth));
 
         // Initialize the UMP channel
         ump_chan_init(chan->ump, UMP_CLIENT_BUF_SELECT);
@@ -410,6 +592,22 @@ errval_t urpc_bind(domainid_t pid, struct urpc_chan *chan, bool use_lmp) {
         if (err_is_fail(err)) {
             return err;
         }
+        
+        // Lay out the rings and bulk pools before the server sees the frame
+        err = ump_chan_setup(chan->ump, depth);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        // Send a bind request with the frame capability to this core's init
+        err = lmp_chan_send2(lc,
+                       LMP_SEND_FLAGS_DEFAULT,
+                       ump_frame_cap,
+                       LMP_RequestType_UmpBind,
+                       pid);
+        if (err_is_fail(err)) {
+            return err;
+        }
     }
     
     // Wait for ack from server
@@ -521,6 +719,58 @@ errval_t urpc_recv_blocking(struct urpc_chan *chan, void **buf, size_t *size,
 }
 
 
+// Register a closure to be run on `ws` once a message can be received
+errval_t urpc_register_recv(struct urpc_chan *chan, struct waitset *ws,
+                            struct event_closure closure) {
+    
+    // Switch between transport protocols
+    if (chan->use_lmp) {
+        return lmp_chan_register_recv(chan->lmp, ws, closure);
+    }
+    else {
+        return ump_chan_register_recv(chan->ump, ws, closure);
+    }
+    
+}
+
+// Cancel a registration made with urpc_register_recv()
+errval_t urpc_deregister_recv(struct urpc_chan *chan) {
+    
+    // Switch between transport protocols
+    if (chan->use_lmp) {
+        return lmp_chan_deregister_recv(chan->lmp);
+    }
+    else {
+        return ump_chan_deregister_recv(chan->ump);
+    }
+    
+}
+
+// Tear down an accepted URPC channel once the other end stopped using it
+void urpc_chan_destroy(struct urpc_chan *chan) {
+    
+    // Drop a pending registration (none is left when called from the handler)
+    urpc_deregister_recv(chan);
+    
+    // Switch between transport protocols
+    if (chan->use_lmp) {
+        lmp_chan_destroy(chan->lmp);
+        free(chan->lmp);
+        chan->lmp = NULL;
+    }
+    else {
+        // Unmap the frame holding the rings and bulk pools
+        errval_t err = paging_unmap(get_current_paging_state(), chan->ump->buf);
+        if (err_is_fail(err)) {
+            debug_printf("Error in paging_unmap(): %s\n", err_getstring(err));
+        }
+        free(chan->ump);
+        chan->ump = NULL;
+    }
+    
+}
+
+
 
 // MARK: - URPC bind handlers
 
@@ -23,6 +23,7 @@
 #include <aos/waitset_chan.h>
 #include <aos/threads.h>
 #include <aos/dispatch.h>
+#include <aos/ump.h>
 #include "threads_priv.h"
 #include "waitset_chan_priv.h"
 #include <stdio.h>
@@ -217,13 +218,21 @@ void poll_ahci(struct waitset_chanstate *chan)
 /// Check polled channels
 void poll_channels_disabled(dispatcher_handle_t handle) {
     struct dispatcher_generic *dp = get_dispatcher_generic(handle);
-    struct waitset_chanstate *chan;
+    struct waitset_chanstate *chan, *next, *last;
+    bool done;
 
     if (!dp->polled_channels)
         return;
+    // polling may dequeue the channel, so remember where to go next
     chan = dp->polled_channels;
+    last = chan->polled_prev;
     do {
+        next = chan->polled_next;
+        done = chan == last;
         switch (chan->chantype) {
+        case CHANTYPE_UMP_IN:
+            ump_chan_poll_disabled(chan, handle);
+            break;
         case CHANTYPE_LWIP_SOCKET:
             arranet_polling_loop_proxy();
             break;
@@ -233,7 +242,8 @@ void poll_channels_disabled(dispatcher_handle_t handle) {
         default:
             assert(!"invalid channel type to poll!");
         }
-    } while (chan != dp->polled_channels);
+        chan = next;
+    } while (!done);
 }
 
 /// Re-register a channel (if persistent)
@@ -27,6 +27,18 @@
 
 extern void *vfs_state;
 
+extern void (*_libc_exit_func)(int);
+
+// Exit function of libc before filesystem_init() hooked in
+static void (*fs_prev_exit_func)(int);
+
+// Release the files held on the file server before the domain exits
+static void fs_exit(int status)
+{
+    filesystem_deinit();
+    fs_prev_exit_func(status);
+}
+
 /**
  * @brief initializes the filesystem library
  *
@@ -62,6 +74,11 @@ errval_t filesystem_init(void)
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
     }
+    else if (fs_prev_exit_func == NULL) {
+        // Let the file server drop our handles when we exit
+        fs_prev_exit_func = _libc_exit_func;
+        _libc_exit_func = fs_exit;
+    }
     
     void *mbt_mount = NULL;
     
@@ -98,6 +115,21 @@ errval_t filesystem_init(void)
     
 }
 
+/**
+ * @brief releases the files still held on the file server
+ *
+ * @return SYS_ERR_OK on success
+ *         errval on failure
+ *
+ * NOTE: No file can be accessed afterwards
+ */
+errval_t filesystem_deinit(void)
+{
+    
+    return fs_rpc_deinit();
+    
+}
+
 /**
  * @brief mounts the URI at a give path
  *
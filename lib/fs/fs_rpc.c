@@ -38,9 +38,9 @@ errval_t fs_rpc_init(void *state) {
         return err;
     }
 
-    // Try to bind to mmchs
+    // Try to bind to mmchs with bulk pools for large reads and writes
     //  Use LMP when on core 0!
-    err = urpc_bind(pid, &chan, !disp_get_core_id());
+    err = urpc_bind_bulk(pid, &chan, !disp_get_core_id(), FS_RPC_BULK_POOL_SIZE);
     if (err_is_fail(err)) {
         return err;
     }
@@ -49,6 +49,20 @@ errval_t fs_rpc_init(void *state) {
 
 }
 
+errval_t fs_rpc_deinit(void) {
+    
+    // The server does not respond and tears down the channel
+    struct fs_message send_msg = {
+        .arg1 = 0,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    return urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Disconnect);
+    
+}
+
 
 /// -> [fs_message] | [path]
 /// <- [fs_message] | [dirent]
@@ -113,6 +127,9 @@ errval_t fs_rpc_open(void *st, char *path, fat32fs_handle_t *ret_handle) {
     // Construct/open handle
     struct fat32fs_handle *handle = handle_open(dirent);
     
+    // Set handle of the file on the server
+    handle->id = recv_msg->arg2;
+    
     // Copy in path string
     handle->path = strdup(path);
     
@@ -189,6 +206,9 @@ errval_t fs_rpc_create(void *st, char *path, fat32fs_handle_t *ret_handle) {
     // Construct/open handle
     struct fat32fs_handle *handle = handle_open(dirent);
     
+    // Set handle of the file on the server
+    handle->id = recv_msg->arg2;
+    
     // Copy in path string
     handle->path = strdup(path);
     
@@ -263,57 +283,67 @@ errval_t fs_rpc_remove(void *st, char *path)
     
 }
 
-/// -> [fs_message] | [dirent]
-/// <- [fs_message] | [buffer]
-errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t bytes,
-                      size_t *bytes_read) {
+// Wait for a response, leaving a bulk payload in the server's pool
+static errval_t recv_response(void **buf, size_t *size, urpc_msg_type_t *msg_type,
+                              struct ump_bulk_desc *desc) {
     
-    errval_t err;
+    if (chan.use_lmp) {
+        desc->length = 0;
+        return urpc_recv_blocking(&chan, buf, size, msg_type);
+    }
     
-    struct fat32fs_handle *h = handle;
+    // Spin for a while before giving up the CPU, like ump_recv_blocking()
+    size_t polls = 0;
+    while (!ump_chan_can_recv(chan.ump)) {
+        if (++polls > UMP_RECV_SPIN_POLLS) {
+            thread_yield();
+        }
+    }
     
-    assert(bytes_read != NULL);
+    return ump_recv_bulk(chan.ump, buf, size, msg_type, desc);
+    
+}
 
-    assert(handle != NULL);
+// Release a response received with recv_response()
+static void release_response(void *buf, struct ump_bulk_desc *desc) {
     
-    if (h->isdir) {
-        return FS_ERR_NOTFILE;
+    if (chan.use_lmp) {
+        free(buf);
+    } else {
+        ump_bulk_release(chan.ump, buf, desc);
     }
     
-    assert(h->pos >= 0);
+}
+
+/// -> [fs_message]
+/// <- [fs_message] | [buffer]
+static errval_t read_part(struct fat32fs_handle *h, void *buffer, size_t bytes,
+                          size_t *bytes_read) {
+    
+    errval_t err;
     
     struct fs_message send_msg = {
-        .arg1 = h->pos,
-        .arg2 = bytes,
-        .arg3 = 0,
+        .arg1 = h->id,
+        .arg2 = h->pos,
+        .arg3 = bytes,
         .arg4 = 0
     };
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-    
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
-    
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
-    
-    // Copy dirent into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message), h->dirent, sizeof(struct fat_dirent));
-    
     // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Read);
-    
-    // Free send buffer
-    free(send_buffer);
+    urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Read);
     
     // Receive response message from server
     size_t recv_size;
     urpc_msg_type_t recv_msg_type;
     uint8_t *recv_buffer;
+    struct ump_bulk_desc recv_desc;
     
-    // Wait for response from server
-    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    // Wait for response from server (large responses are read in place)
+    err = recv_response((void **) &recv_buffer, &recv_size, &recv_msg_type, &recv_desc);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
     
     assert(recv_msg_type == URPC_MessageType_Read);
     
@@ -340,61 +370,108 @@ errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t byt
     // Set return argument bytes read by server
     *bytes_read = ret_bytes;
     
-    // Free receive buffer
-    free(recv_buffer);
+    // Free receive buffer (or hand it back to the server's pool)
+    release_response(recv_buffer, &recv_desc);
     
     return err;
     
 }
 
-/// -> [fs_message] | [dirent] | [buffer]
-/// <- [fs_message] | [buffer]
-errval_t fs_rpc_write(void *st, fat32fs_handle_t handle, const void *buffer,
-                       size_t bytes, size_t *bytes_written) {
+errval_t fs_rpc_read(void *st, fat32fs_handle_t handle, void *buffer, size_t bytes,
+                      size_t *bytes_read) {
     
-    errval_t err;
+    errval_t err = SYS_ERR_OK;
     
     struct fat32fs_handle *h = handle;
     
-    assert(bytes_written != NULL);
-    
+    assert(bytes_read != NULL);
+
     assert(handle != NULL);
     
-    //struct fat32_handle *h = handle;
-    
     if (h->isdir) {
         return FS_ERR_NOTFILE;
     }
     
     assert(h->pos >= 0);
     
-    struct fs_message send_msg = {
-        .arg1 = h->pos,
-        .arg2 = bytes,
-        .arg3 = 0,
-        .arg4 = 0
-    };
+    *bytes_read = 0;
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent) + bytes;
+    // Split reads that do not fit into the bulk pool
+    for (size_t done = 0; done < bytes; done += FS_RPC_MAX_TRANSFER) {
+        
+        size_t part = MIN(bytes - done, FS_RPC_MAX_TRANSFER);
+        size_t part_read = 0;
+        
+        err = read_part(h, (uint8_t *) buffer + done, part, &part_read);
+        
+        *bytes_read += part_read;
+        
+        // Stop at the end of the file
+        if (err_is_fail(err) || part_read < part) {
+            break;
+        }
+        
+    }
     
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
+    return err;
     
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+}
+
+/// -> [fs_message] | [buffer]
+/// <- [fs_message]
+static errval_t write_part(struct fat32fs_handle *h, const void *buffer, size_t bytes,
+                           size_t *bytes_written) {
     
-    // Copy dirent into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message), h->dirent, sizeof(struct fat_dirent));
+    errval_t err;
     
-    // Copy buffer into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message) + sizeof(struct fat_dirent), buffer, bytes);
+    struct fs_message send_msg = {
+        .arg1 = h->id,
+        .arg2 = h->pos,
+        .arg3 = bytes,
+        .arg4 = 0
+    };
     
-    // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Write);
+    // Size of send buffer
+    size_t send_size = sizeof(struct fs_message) + bytes;
+    
+    // Fill large requests in place in the bulk pool shared with the server
+    uint8_t *send_buffer = NULL;
+    struct ump_bulk_desc send_desc;
+    if (!chan.use_lmp && bytes >= FS_RPC_BULK_THRESHOLD) {
+        err = ump_bulk_alloc(chan.ump, send_size, (void **) &send_buffer, &send_desc);
+        if (err_is_fail(err)) {
+            // Fall back to sending through the slots
+            send_buffer = NULL;
+        }
+    }
     
-    // Free send buffer
-    free(send_buffer);
+    if (send_buffer != NULL) {
+        
+        // Copy fs_message and buffer into the bulk buffer
+        memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+        memcpy(send_buffer + sizeof(struct fs_message), buffer, bytes);
+        
+        // Send request message to server (only the descriptor goes through the slots)
+        ump_bulk_send(chan.ump, &send_desc, URPC_MessageType_Write);
+        
+    } else {
+        
+        // Allocate send buffer
+        send_buffer = calloc(1, send_size);
+        
+        // Copy fs_message into send buffer
+        memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+        
+        // Copy buffer into send buffer
+        memcpy(send_buffer + sizeof(struct fs_message), buffer, bytes);
+        
+        // Send request message to server
+        urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Write);
+        
+        // Free send buffer
+        free(send_buffer);
+        
+    }
     
     // Receive response message from server
     size_t recv_size;
@@ -431,7 +508,46 @@ errval_t fs_rpc_write(void *st, fat32fs_handle_t handle, const void *buffer,
     
 }
 
-/// -> [fs_message] | [dirent]
+errval_t fs_rpc_write(void *st, fat32fs_handle_t handle, const void *buffer,
+                       size_t bytes, size_t *bytes_written) {
+    
+    errval_t err = SYS_ERR_OK;
+    
+    struct fat32fs_handle *h = handle;
+    
+    assert(bytes_written != NULL);
+    
+    assert(handle != NULL);
+    
+    if (h->isdir) {
+        return FS_ERR_NOTFILE;
+    }
+    
+    assert(h->pos >= 0);
+    
+    *bytes_written = 0;
+    
+    // Split writes that do not fit into the bulk pool
+    for (size_t done = 0; done < bytes; done += FS_RPC_MAX_TRANSFER) {
+        
+        size_t part = MIN(bytes - done, FS_RPC_MAX_TRANSFER);
+        size_t part_written = 0;
+        
+        err = write_part(h, (const uint8_t *) buffer + done, part, &part_written);
+        
+        *bytes_written += part_written;
+        
+        if (err_is_fail(err) || part_written < part) {
+            break;
+        }
+        
+    }
+    
+    return err;
+    
+}
+
+/// -> [fs_message]
 /// <- [fs_message]
 errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes) {
     
@@ -440,29 +556,58 @@ errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes) {
     struct fat32fs_handle *h = handle;
     
     struct fs_message send_msg = {
-        .arg1 = bytes,
-        .arg2 = 0,
+        .arg1 = h->id,
+        .arg2 = bytes,
         .arg3 = 0,
         .arg4 = 0
     };
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
+    // Send request message to server
+    urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Truncate);
+    
+    // Receive response message from server
+    size_t recv_size;
+    urpc_msg_type_t recv_msg_type;
+    uint8_t *recv_buffer;
+    
+    // Wait for response from server
+    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    
+    assert(recv_msg_type == URPC_MessageType_Truncate);
+    
+    // Receive header response message
+    struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
+    
+    // Set error
+    err = recv_msg->arg1;
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    }
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
+    return err;
+    
+}
 
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
+
+
+errval_t fs_rpc_preallocate(void *st, fat32fs_handle_t handle, size_t bytes) {
     
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+    errval_t err;
     
-    // Copy path (including '\0' into send buffers
-    memcpy(send_buffer + sizeof(struct fs_message), h->dirent, sizeof(struct fat32fs_handle));
+    struct fat32fs_handle *h = handle;
     
-    // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_Truncate);
+    struct fs_message send_msg = {
+        .arg1 = h->id,
+        .arg2 = bytes,
+        .arg3 = 0,
+        .arg4 = 0
+    };
     
-    // Free send buffer
-    free(send_buffer);
+    // Send request message to server
+    urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Preallocate);
     
     // Receive response message from server
     size_t recv_size;
@@ -472,7 +617,7 @@ errval_t fs_rpc_truncate(void *st, fat32fs_handle_t handle, size_t bytes) {
     // Wait for response from server
     urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
     
-    assert(recv_msg_type == URPC_MessageType_Truncate);
+    assert(recv_msg_type == URPC_MessageType_Preallocate);
     
     // Receive header response message
     struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
@@ -520,15 +665,54 @@ errval_t fs_rpc_tell(void *st, fat32fs_handle_t handle, size_t *ret_pos) {
 
 errval_t fs_rpc_stat(void *st, fat32fs_handle_t inhandle, struct fs_fileinfo *info) {
     
+    errval_t err;
+    
     struct fat32fs_handle *h = inhandle;
     
     assert(h != NULL);
     
     assert(info != NULL);
-    info->type = h->isdir ? FS_DIRECTORY : FS_FILE;
-    info->size = h->dirent->size;
     
-    return SYS_ERR_OK;
+    struct fs_message send_msg = {
+        .arg1 = h->id,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // Send request message to server
+    urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Stat);
+    
+    // Receive response message from server
+    size_t recv_size;
+    urpc_msg_type_t recv_msg_type;
+    uint8_t *recv_buffer;
+    
+    // Wait for response from server
+    urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
+    
+    assert(recv_msg_type == URPC_MessageType_Stat);
+    
+    // Receive header response message
+    struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
+    
+    // Set error
+    err = recv_msg->arg1;
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+    } else {
+        
+        // Set file information and update the size of the dirent
+        info->type = recv_msg->arg3 ? FS_DIRECTORY : FS_FILE;
+        info->size = recv_msg->arg2;
+        h->dirent->size = recv_msg->arg2;
+        
+    }
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
+    return err;
     
 }
 
@@ -652,6 +836,9 @@ errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_dirhandle) {
     // Construct/open handle
     struct fat32fs_handle *handle = handle_open(dirent);
     
+    // Set handle of the file on the server
+    handle->id = recv_msg->arg2;
+    
     // Copy in path string
     handle->path = strdup(path);
     
@@ -667,46 +854,29 @@ errval_t fs_rpc_opendir(void *st, char *path, fs_dirhandle_t *ret_dirhandle) {
 
 
 
-errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
-                        struct fs_fileinfo *info) {
+/// -> [fs_message]
+/// <- [fs_message] | [packed entries]
+static errval_t readdir_batch_rpc(struct fat32fs_handle *handle, void *buffer, size_t bytes,
+                                  size_t *ret_count, size_t *ret_bytes) {
     
     errval_t err;
     
-    struct fat32fs_handle *handle = dirhandle;
-    
-    assert(ret_name != NULL);
-    
-    //assert(info != NULL);
-    
-    assert(handle != NULL);
-    
-    if (!handle->isdir) {
-        return FS_ERR_NOTDIR;
+    // Nothing left to ask the server for
+    if (handle->dir_end) {
+        return FS_ERR_INDEX_BOUNDS;
     }
     
     assert(handle->pos >= 0);
     
     struct fs_message send_msg = {
-        .arg1 = handle->pos,
-        .arg2 = 0,
-        .arg3 = 0,
+        .arg1 = handle->id,
+        .arg2 = handle->pos,
+        .arg3 = bytes,
         .arg4 = 0
     };
     
-    // Size of send buffer
-    size_t send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
-    
-    // Allocate send buffer
-    uint8_t *send_buffer = calloc(1, send_size);
-    
-    // Copy fs_message into send buffer
-    memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
-    
-    // Copy dirent into send buffer
-    memcpy(send_buffer + sizeof(struct fs_message), handle->dirent, sizeof(struct fat_dirent));
-    
     // Send request message to server
-    urpc_send(&chan, send_buffer, send_size, URPC_MessageType_ReadDir);
+    urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_ReadDirBatch);
     
     // Receive response message from server
     size_t recv_size;
@@ -716,7 +886,7 @@ errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
     // Wait for response from server
     urpc_recv_blocking(&chan, (void **) &recv_buffer, &recv_size, &recv_msg_type);
     
-    assert(recv_msg_type == URPC_MessageType_ReadDir);
+    assert(recv_msg_type == URPC_MessageType_ReadDirBatch);
     
     // Receive header response message
     struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
@@ -725,52 +895,135 @@ errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
     err = recv_msg->arg1;
     if (err_is_fail(err)) {
         debug_printf("%s\n", err_getstring(err));
+        free(recv_buffer);
+        return err;
     }
     
+    // Continue at the position following the batch next time
+    handle->pos = recv_msg->arg3;
+    handle->dir_end = recv_msg->arg4;
+    
+    *ret_count = recv_msg->arg2;
+    *ret_bytes = recv_size - sizeof(struct fs_message);
+    
+    assert(*ret_bytes <= bytes);
+    
+    // Copy packed entries from receive buffer into buffer
+    memcpy(buffer, recv_buffer + sizeof(struct fs_message), *ret_bytes);
+    
+    // Free receive buffer
+    free(recv_buffer);
+    
     // Check if directory position pointer reached the end
-    if (err == FS_ERR_INDEX_BOUNDS) {
+    if (*ret_count == 0) {
 #if PRINT_DEBUG
         debug_printf("Reached end of directory\n");
 #endif
-        // Set return name to NULL
-        *ret_name = NULL;
+        return FS_ERR_INDEX_BOUNDS;
+    }
+    
+    return SYS_ERR_OK;
+    
+}
+
+errval_t fs_rpc_readdir_batch(void *st, fs_dirhandle_t dirhandle, void *buffer, size_t bytes,
+                              size_t *ret_count, size_t *ret_bytes) {
+    
+    struct fat32fs_handle *handle = dirhandle;
+    
+    assert(handle != NULL);
+    assert(ret_count != NULL && ret_bytes != NULL);
+    
+    if (!handle->isdir) {
+        return FS_ERR_NOTDIR;
+    }
+    
+    // Hand out entries fetched by fs_rpc_readdir() first
+    if (handle->dir_batch_offset < handle->dir_batch_bytes) {
         
-        // Set return file system info to NULL
-        //info->type = ???;
-        //info->size = ???;
-                
-        // Free receive buffer
-        free(recv_buffer);
+        size_t count = 0;
+        size_t offset = handle->dir_batch_offset;
+        while (offset < handle->dir_batch_bytes) {
+            struct fs_dirbatch_entry *e = (struct fs_dirbatch_entry *) ((uint8_t *) handle->dir_batch + offset);
+            if (offset + e->reclen - handle->dir_batch_offset > bytes) {
+                break;
+            }
+            offset += e->reclen;
+            count++;
+        }
         
-        return err;
+        if (count == 0) {
+            return FS_ERR_BUFFER_TOO_SMALL;
+        }
+        
+        *ret_bytes = offset - handle->dir_batch_offset;
+        memcpy(buffer, (uint8_t *) handle->dir_batch + handle->dir_batch_offset, *ret_bytes);
+        handle->dir_batch_offset = offset;
+        *ret_count = count;
+        
+        return SYS_ERR_OK;
         
     }
     
-    // Update directory index
-    handle->pos += 1;
+    return readdir_batch_rpc(handle, buffer, MIN(bytes, FS_RPC_READDIR_BATCH_SIZE),
+                             ret_count, ret_bytes);
     
-    // Allocate and copy in dirent from receive buffer
-    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
-    
-    // Copy read data from receive buffer into buffer
-    memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
+}
 
-    // Set return file system info accordingly
-    if (info != NULL) {
-        info->type = dirent->is_dir ? FS_DIRECTORY : FS_FILE;
-        info->size = dirent->size;
+errval_t fs_rpc_readdir(void *st, fs_dirhandle_t dirhandle, char **ret_name,
+                        struct fs_fileinfo *info) {
+    
+    errval_t err;
+    
+    struct fat32fs_handle *handle = dirhandle;
+    
+    assert(ret_name != NULL);
+    
+    assert(handle != NULL);
+    
+    if (!handle->isdir) {
+        return FS_ERR_NOTDIR;
     }
     
-    // Set return argument bytes read by server
-    *ret_name = convert_to_normal_name(dirent->name);
+    // Fetch the next batch once all entries of the last one were handed out
+    if (handle->dir_batch_offset >= handle->dir_batch_bytes) {
+        
+        if (handle->dir_batch == NULL) {
+            handle->dir_batch = malloc(FS_RPC_READDIR_BATCH_SIZE);
+            if (handle->dir_batch == NULL) {
+                return LIB_ERR_MALLOC_FAIL;
+            }
+        }
+        
+        size_t count;
+        handle->dir_batch_offset = 0;
+        handle->dir_batch_bytes = 0;
+        err = readdir_batch_rpc(handle, handle->dir_batch, FS_RPC_READDIR_BATCH_SIZE,
+                                &count, &handle->dir_batch_bytes);
+        if (err_is_fail(err)) {
+            
+            // Set return name to NULL
+            *ret_name = NULL;
+            
+            return err;
+            
+        }
+        
+    }
     
-    // Free dirent
-    free(dirent);
+    // Take the next entry of the batch
+    struct fs_dirbatch_entry *e = (struct fs_dirbatch_entry *) ((uint8_t *) handle->dir_batch + handle->dir_batch_offset);
+    handle->dir_batch_offset += e->reclen;
     
-    // Free receive buffer
-    free(recv_buffer);
+    // Set return file system info accordingly
+    if (info != NULL) {
+        *info = e->info;
+    }
     
-    return err;
+    // Set return name
+    *ret_name = strdup(fs_dirbatch_name(e));
+    
+    return SYS_ERR_OK;
     
 }
 
@@ -932,9 +1185,17 @@ static struct fat32fs_handle *handle_open(struct fat_dirent *dirent)
 
 static void handle_close(struct fat32fs_handle *handle)
 {
-    //assert(h->dirent->refcount > 0);
-    //h->dirent->refcount--;
-    //free(handle->dirent);
+    // Release the handle on the server (no response is sent)
+    struct fs_message send_msg = {
+        .arg1 = handle->id,
+        .arg2 = 0,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    urpc_send(&chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Close);
+    
+    free(handle->dir_batch);
+    free(handle->dirent);
     free(handle->path);
     free(handle);
 }
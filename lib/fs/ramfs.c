@@ -551,6 +551,49 @@ errval_t ramfs_dir_read_next(void *st, ramfs_handle_t inhandle, char **retname,
     return SYS_ERR_OK;
 }
 
+errval_t ramfs_dir_read_batch(void *st, ramfs_handle_t inhandle, void *buf,
+                              size_t bytes, size_t *retcount, size_t *retbytes)
+{
+    struct ramfs_handle *h = inhandle;
+
+    if (!h->isdir) {
+        return FS_ERR_NOTDIR;
+    }
+
+    struct ramfs_dirent *d = h->dir_pos;
+    if (d == NULL) {
+        return FS_ERR_INDEX_BOUNDS;
+    }
+
+    size_t count = 0;
+    size_t offset = 0;
+
+    /* pack entries until the buffer is full, continuing where
+     * ramfs_dir_read_next() left off */
+    while (d != NULL) {
+        struct fs_fileinfo info = {
+            .type = d->is_dir ? FS_DIRECTORY : FS_FILE,
+            .size = d->size,
+        };
+        if (!fs_dirbatch_add(buf, bytes, &offset, d->name, &info)) {
+            break;
+        }
+        count++;
+        d = d->next;
+    }
+
+    if (count == 0) {
+        return FS_ERR_BUFFER_TOO_SMALL;
+    }
+
+    h->dir_pos = d;
+
+    *retcount = count;
+    *retbytes = offset;
+
+    return SYS_ERR_OK;
+}
+
 errval_t ramfs_closedir(void *st, ramfs_handle_t dhandle)
 {
     struct ramfs_handle *handle = dhandle;
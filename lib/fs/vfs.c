@@ -267,6 +267,30 @@ errval_t vfs_truncate(void *st, vfs_handle_t handle, size_t bytes) {
     
 }
 
+errval_t vfs_preallocate(void *st, vfs_handle_t handle, size_t bytes) {
+    
+    errval_t err;
+    
+    // VFS mount state with root directories and mount linked list
+    struct vfs_mount *mt = st;
+    
+    // VFS handle to store the FS specific handle and the type
+    struct vfs_handle *h = handle;
+    
+    switch (h->type) {
+        case FATFS:
+            err = fs_rpc_preallocate(mt->fat_mount, h->handle, bytes);
+            break;
+        default:
+            // Preallocation is only a hint, nothing to do for memory backed files
+            err = SYS_ERR_OK;
+            break;
+    }
+    
+    return err;
+    
+}
+
 errval_t vfs_tell(void *st, vfs_handle_t handle, size_t *pos){
     
     errval_t err;
@@ -471,6 +495,40 @@ errval_t vfs_dir_read_next(void *st, vfs_handle_t handle, char **retname, struct
     
 }
 
+errval_t vfs_dir_read_batch(void *st, vfs_handle_t handle, void *buffer, size_t bytes,
+                            size_t *retcount, size_t *retbytes) {
+    
+    errval_t err;
+    
+    // VFS mount state with root directories and mount linked list
+    struct vfs_mount *mt = st;
+    
+    // VFS handle to store the FS specific handle and the type
+    struct vfs_handle *h = handle;
+    
+    switch (h->type) {
+        case RAMFS:
+            err = ramfs_dir_read_batch(mt->ram_mount, h->handle, buffer, bytes, retcount, retbytes);
+            break;
+        case FATFS:
+            err = fs_rpc_readdir_batch(mt->fat_mount, h->handle, buffer, bytes, retcount, retbytes);
+            break;
+        case MBTFS:
+            err = LIB_ERR_NOT_IMPLEMENTED;
+            break;
+        default:
+            // Nothing was read, so leave no stale counts behind
+            *retcount = 0;
+            *retbytes = 0;
+            err = VFS_ERR_NOT_SUPPORTED;
+            debug_printf("vfs read dir batch unsuccessful\n");
+            break;
+    }
+    
+    return err;
+    
+}
+
 
 errval_t vfs_closedir(void *st, vfs_handle_t dirhandle) {
     
@@ -0,0 +1,350 @@
+//
+//  block_cache.c
+//  DoritOS
+//
+//  Buffer cache for data clusters between the FAT server and the MMCHS driver.
+//  Buffers are looked up through a hash table and replaced with the CLOCK
+//  algorithm, skipping pinned buffers. Dirty buffers are written back when
+//  they are evicted or when block_cache_sync() is called. When a cluster chain
+//  is read in order, the following clusters of the chain are read ahead.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/block_cache.h>
+
+#define PRINT_DEBUG 0
+
+extern errval_t mmchs_read_blocks(size_t block_nr, size_t count, void *buffer);
+extern errval_t mmchs_write_blocks(size_t block_nr, size_t count, void *buffer);
+
+// Cluster buffers
+static struct block_cache_buf *bufs;
+static size_t bufs_count;
+
+// Hash table of valid buffers (bucket count is a power of two)
+static struct block_cache_buf **buckets;
+static size_t buckets_mask;
+
+// Position of the clock hand in bufs
+static size_t clock_hand;
+
+// Last cluster that was requested with BLOCK_CACHE_READ (0 if none)
+static size_t last_cluster;
+
+static struct block_cache_stats stats;
+
+// MARK: - Helpers
+
+static inline size_t hash_cluster(size_t cluster_nr) {
+
+    return (cluster_nr * 2654435761u) & buckets_mask;
+
+}
+
+static struct block_cache_buf *lookup(size_t cluster_nr) {
+
+    struct block_cache_buf *buf = buckets[hash_cluster(cluster_nr)];
+
+    while (buf != NULL && buf->cluster_nr != cluster_nr) {
+        buf = buf->hash_next;
+    }
+
+    return buf;
+
+}
+
+static void hash_remove(struct block_cache_buf *buf) {
+
+    struct block_cache_buf **link = &buckets[hash_cluster(buf->cluster_nr)];
+
+    while (*link != buf) {
+        link = &(*link)->hash_next;
+    }
+
+    *link = buf->hash_next;
+    buf->hash_next = NULL;
+
+}
+
+static errval_t transfer_cluster(struct block_cache_buf *buf, bool write) {
+
+    errval_t err;
+
+    // Sector number of cluster that occupies the data
+    size_t sector_nr = ((buf->cluster_nr - 2) * BPB_SecPerClus) + FirstDataSector;
+
+    // Transfer all sectors of the cluster with one multi-block command
+    if (write) {
+        err = mmchs_write_blocks(sector_nr, BPB_SecPerClus, buf->data);
+    } else {
+        err = mmchs_read_blocks(sector_nr, BPB_SecPerClus, buf->data);
+    }
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
+
+    return err;
+
+}
+
+// Find an unpinned buffer with the clock algorithm and detach it from its cluster
+static errval_t get_victim(struct block_cache_buf **ret_buf) {
+
+    errval_t err;
+
+    // Two sweeps clear every reference bit, so a third one cannot find more
+    for (size_t n = 0; n < 2 * bufs_count; n++) {
+
+        struct block_cache_buf *buf = &bufs[clock_hand];
+        clock_hand = (clock_hand + 1) % bufs_count;
+
+        if (buf->pins > 0) {
+            continue;
+        }
+
+        if (buf->referenced) {
+            buf->referenced = false;
+            continue;
+        }
+
+        if (buf->valid) {
+
+            // Write back modified data before the buffer is reused
+            if (buf->dirty) {
+                err = transfer_cluster(buf, true);
+                if (err_is_fail(err)) {
+                    return err;
+                }
+                buf->dirty = false;
+                stats.writebacks++;
+            }
+
+            hash_remove(buf);
+            buf->valid = false;
+            stats.evictions++;
+
+        }
+
+        *ret_buf = buf;
+
+        return SYS_ERR_OK;
+
+    }
+
+    return FAT_ERR_CACHE_FULL;
+
+}
+
+// Load the clusters following `cluster_nr` in its chain that are not cached yet
+static void read_ahead(size_t cluster_nr) {
+
+    errval_t err;
+
+    for (int i = 0; i < BLOCK_CACHE_READAHEAD; i++) {
+
+        uint32_t next_nr;
+        err = fat_cache_get(cluster_nr, &next_nr);
+        if (err_is_fail(err) || next_nr < 2 || next_nr >= 0x0FFFFFF7) {
+            return;
+        }
+        cluster_nr = next_nr;
+
+        if (lookup(cluster_nr) != NULL) {
+            continue;
+        }
+
+        struct block_cache_buf *buf;
+        err = get_victim(&buf);
+        if (err_is_fail(err)) {
+            return;
+        }
+
+        buf->cluster_nr = cluster_nr;
+        err = transfer_cluster(buf, false);
+        if (err_is_fail(err)) {
+            return;
+        }
+
+        // Not referenced yet, so unused read-ahead is the first to go
+        buf->valid = true;
+        buf->referenced = false;
+        buf->hash_next = buckets[hash_cluster(cluster_nr)];
+        buckets[hash_cluster(cluster_nr)] = buf;
+
+        stats.readahead++;
+
+    }
+
+}
+
+// MARK: - Interface
+
+errval_t block_cache_init(size_t budget) {
+
+    // Bytes per cluster
+    uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
+
+    // A cluster chain operation holds one buffer while another one is loaded
+    bufs_count = MAX(budget / BytesPerClus, 2);
+
+    size_t buckets_count = 1;
+    while (buckets_count < bufs_count) {
+        buckets_count <<= 1;
+    }
+    buckets_mask = buckets_count - 1;
+
+    bufs = calloc(bufs_count, sizeof(struct block_cache_buf));
+    buckets = calloc(buckets_count, sizeof(struct block_cache_buf *));
+    uint8_t *data = malloc(bufs_count * BytesPerClus);
+    if (bufs == NULL || buckets == NULL || data == NULL) {
+        free(bufs);
+        free(buckets);
+        free(data);
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (size_t i = 0; i < bufs_count; i++) {
+        bufs[i].data = data + i * BytesPerClus;
+    }
+
+    clock_hand = 0;
+    last_cluster = 0;
+    memset(&stats, 0, sizeof(stats));
+
+#if PRINT_DEBUG
+    debug_printf("Block cache: %zu buffers of %u bytes\n", bufs_count, BytesPerClus);
+#endif
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t block_cache_get(size_t cluster_nr, enum block_cache_mode mode,
+                         struct block_cache_buf **ret_buf) {
+
+    errval_t err;
+
+    assert(ret_buf != NULL);
+
+    if (cluster_nr < 2) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    struct block_cache_buf *buf = lookup(cluster_nr);
+
+    if (buf != NULL) {
+
+        stats.hits++;
+
+    } else {
+
+        if (mode != BLOCK_CACHE_OVERWRITE) {
+            stats.misses++;
+        }
+
+        err = get_victim(&buf);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            return err;
+        }
+
+        buf->cluster_nr = cluster_nr;
+
+        if (mode != BLOCK_CACHE_OVERWRITE) {
+            err = transfer_cluster(buf, false);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+
+        buf->valid = true;
+        buf->hash_next = buckets[hash_cluster(cluster_nr)];
+        buckets[hash_cluster(cluster_nr)] = buf;
+
+    }
+
+    buf->pins++;
+    buf->referenced = true;
+
+    if (mode == BLOCK_CACHE_READ) {
+
+        // Read ahead if this cluster follows the previously read one in its chain
+        uint32_t next_nr;
+        if (last_cluster != 0 && err_is_ok(fat_cache_get(last_cluster, &next_nr)) &&
+            next_nr == cluster_nr) {
+            read_ahead(cluster_nr);
+        }
+
+        last_cluster = cluster_nr;
+
+    }
+
+    *ret_buf = buf;
+
+    return SYS_ERR_OK;
+
+}
+
+void block_cache_release(struct block_cache_buf *buf, bool dirty) {
+
+    assert(buf->pins > 0);
+
+    buf->pins--;
+    buf->dirty |= dirty;
+
+}
+
+errval_t block_cache_sync(void) {
+
+    errval_t err;
+
+    for (size_t i = 0; i < bufs_count; i++) {
+
+        struct block_cache_buf *buf = &bufs[i];
+
+        if (!buf->valid || !buf->dirty) {
+            continue;
+        }
+
+        err = transfer_cluster(buf, true);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        buf->dirty = false;
+        stats.writebacks++;
+
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+size_t block_cache_get_stream(void) {
+
+    return last_cluster;
+
+}
+
+void block_cache_set_stream(size_t cluster_nr) {
+
+    last_cluster = cluster_nr;
+
+}
+
+void block_cache_get_stats(struct block_cache_stats *ret_stats) {
+
+    *ret_stats = stats;
+
+}
@@ -0,0 +1,246 @@
+//
+//  fat_alloc.c
+//  DoritOS
+//
+//  Cluster allocator of the FAT server. A bitmap of the clusters in use is
+//  built from the FAT when the file system is mounted, so free clusters are
+//  found without going through the FAT sectors again. Allocations hand out
+//  runs of contiguous clusters, searched with a next fit cursor that starts
+//  behind the previous allocation, so growing files get sequential chains.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/fat_alloc.h>
+
+#define PRINT_DEBUG 0
+
+#define BITS_PER_WORD   32
+
+// Bit n is set if cluster n is in use (clusters 0 and 1 are reserved)
+static uint32_t *bitmap;
+
+// One past the highest cluster number of the volume
+static size_t cluster_end;
+
+// Cluster to start the next search at
+static size_t cursor;
+
+static size_t free_count;
+
+// MARK: - Helpers
+
+static inline bool is_used(size_t n) {
+
+    return bitmap[n / BITS_PER_WORD] & (1u << (n % BITS_PER_WORD));
+
+}
+
+static inline void set_used(size_t n) {
+
+    bitmap[n / BITS_PER_WORD] |= 1u << (n % BITS_PER_WORD);
+
+}
+
+static inline void set_free(size_t n) {
+
+    bitmap[n / BITS_PER_WORD] &= ~(1u << (n % BITS_PER_WORD));
+
+}
+
+// Number of free clusters from `n` on, stopping at `end` or after `limit` clusters
+static size_t free_run_length(size_t n, size_t end, size_t limit) {
+
+    size_t length = 0;
+
+    while (n + length < end && length < limit && !is_used(n + length)) {
+        length++;
+    }
+
+    return length;
+
+}
+
+// Find the first run of `count` free clusters in [from, end). If there is none,
+// the largest run found is returned. Runs only replace a longer `*ret_count`.
+static void find_run(size_t from, size_t end, size_t count,
+                     size_t *ret_cluster_nr, size_t *ret_count) {
+
+    size_t n = from;
+
+    while (n < end && *ret_count < count) {
+
+        // Skip words of clusters that are all in use
+        if (n % BITS_PER_WORD == 0 && bitmap[n / BITS_PER_WORD] == 0xFFFFFFFF) {
+            n += BITS_PER_WORD;
+            continue;
+        }
+
+        if (is_used(n)) {
+            n++;
+            continue;
+        }
+
+        size_t length = free_run_length(n, end, count);
+        if (length > *ret_count) {
+            *ret_cluster_nr = n;
+            *ret_count = length;
+        }
+
+        n += length;
+
+    }
+
+}
+
+// MARK: - Interface
+
+errval_t fat_alloc_init(void) {
+
+    errval_t err;
+
+    // Number of FAT entries that fit into one sector
+    size_t FATEntPerSec = BPB_BytsPerSec / sizeof(uint32_t);
+
+    // Number of data clusters (clusters start at 2)
+    size_t TotSec = BPB_TotSec16 != 0 ? BPB_TotSec16 : BPB_TotSec32;
+    size_t CountOfClusters = (TotSec - FirstDataSector) / BPB_SecPerClus;
+
+    cluster_end = MIN(CountOfClusters + 2, FATEntPerSec * FATSz);
+
+    free(bitmap);
+    bitmap = calloc((cluster_end + BITS_PER_WORD - 1) / BITS_PER_WORD, sizeof(uint32_t));
+    if (bitmap == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    set_used(0);
+    set_used(1);
+
+    free_count = 0;
+
+    // Cached FAT sector
+    uint32_t *sector = NULL;
+
+    for (size_t n = 2; n < cluster_end; n++) {
+
+        if (sector == NULL || n % FATEntPerSec == 0) {
+
+            // Get FAT sector that contains nth entry
+            err = fat_cache_get_sector(n / FATEntPerSec, &sector);
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
+#endif
+                return err;
+            }
+
+        }
+
+        if ((sector[n % FATEntPerSec] & 0x0FFFFFFF) == 0) {
+            free_count++;
+        } else {
+            set_used(n);
+        }
+
+    }
+
+    cursor = 2;
+
+#if PRINT_DEBUG
+    debug_printf("FAT allocator: %zu of %zu clusters free\n", free_count, cluster_end - 2);
+#endif
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_alloc_run(size_t count, size_t hint, size_t *ret_cluster_nr,
+                       size_t *ret_count) {
+
+    errval_t err;
+
+    assert(count > 0);
+
+    if (free_count == 0) {
+        return FAT_ERR_DISK_FULL;
+    }
+
+    size_t cluster_nr = 0;
+    size_t length = 0;
+
+    if (2 <= hint && hint < cluster_end) {
+
+        // Continue the run the caller ends at
+        cluster_nr = hint;
+        length = free_run_length(hint, cluster_end, count);
+
+    }
+
+    if (length == 0) {
+
+        // Next fit: search behind the cursor first, then wrap around
+        find_run(cursor, cluster_end, count, &cluster_nr, &length);
+        find_run(2, cursor, count, &cluster_nr, &length);
+
+    }
+
+    assert(length > 0);
+
+    // Link the run into a chain
+    for (size_t i = 0; i < length; i++) {
+
+        uint32_t value = i + 1 < length ? cluster_nr + i + 1 : 0x0FFFFFFF;
+
+        err = fat_cache_set(cluster_nr + i, value);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            // Unlink the clusters linked so far and give them back
+            for (size_t j = 0; j < i; j++) {
+                fat_cache_set(cluster_nr + j, 0);
+                set_free(cluster_nr + j);
+                free_count++;
+            }
+            return err;
+        }
+
+        set_used(cluster_nr + i);
+        free_count--;
+
+    }
+
+    cursor = cluster_nr + length;
+    if (cursor >= cluster_end) {
+        cursor = 2;
+    }
+
+    *ret_cluster_nr = cluster_nr;
+    *ret_count = length;
+
+    return SYS_ERR_OK;
+
+}
+
+void fat_alloc_free(size_t cluster_nr) {
+
+    if (cluster_nr < 2 || cluster_nr >= cluster_end || !is_used(cluster_nr)) {
+        return;
+    }
+
+    set_free(cluster_nr);
+    free_count++;
+
+}
+
+size_t fat_alloc_free_count(void) {
+
+    return free_count;
+
+}
@@ -0,0 +1,181 @@
+//
+//  fat_cache.c
+//  DoritOS
+//
+//  In-memory copy of the FAT. Sectors are loaded on first use and modified in
+//  place. Modified sectors are tracked in a dirty bitmap and written back to
+//  all FAT copies by fat_cache_sync(), which the server calls at the end of
+//  every request.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+
+#define PRINT_DEBUG 0
+
+extern errval_t mmchs_read_block(size_t block_nr, void *buffer);
+extern errval_t mmchs_write_block(size_t block_nr, void *buffer);
+
+// Cached FAT sectors (NULL until loaded)
+static uint32_t **fat_sectors;
+
+// Bitmap of the FAT sectors modified since the last sync
+static uint32_t *fat_dirty;
+
+// Number of dirty FAT sectors
+static size_t fat_dirty_count;
+
+// FAT copy the cache is loaded from
+static size_t fat_active;
+
+errval_t fat_cache_init(void) {
+
+    // Allocate the sector table and the dirty bitmap
+    fat_sectors = calloc(FATSz, sizeof(uint32_t *));
+    fat_dirty = calloc(DIVIDE_ROUND_UP(FATSz, 32), sizeof(uint32_t));
+    if (fat_sectors == NULL || fat_dirty == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+    fat_dirty_count = 0;
+
+    // With mirroring disabled only the FAT selected in BPB_ExtFlags is used
+    fat_active = (BPB_ExtFlags & 0x80) ? (BPB_ExtFlags & 0x0F) : 0;
+
+#if FAT_CACHE_PRELOAD
+    for (size_t i = 0; i < FATSz; i++) {
+        uint32_t *sector;
+        errval_t err = fat_cache_get_sector(i, &sector);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+#endif
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_get_sector(size_t sector_index, uint32_t **ret_sector) {
+
+    errval_t err;
+
+    if (sector_index >= FATSz) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    // Load the sector on first use
+    if (fat_sectors[sector_index] == NULL) {
+
+        uint32_t *sector = malloc(BPB_BytsPerSec);
+        if (sector == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+
+        err = mmchs_read_block(BPB_ResvdSecCnt + fat_active * FATSz + sector_index,
+                               sector);
+        if (err_is_fail(err)) {
+            free(sector);
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            return err;
+        }
+
+        fat_sectors[sector_index] = sector;
+
+    }
+
+    *ret_sector = fat_sectors[sector_index];
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_get(size_t n, uint32_t *ret_value) {
+
+    // Number of FAT entries that fit into one sector
+    size_t FATEntPerSec = BPB_BytsPerSec / sizeof(uint32_t);
+
+    uint32_t *sector;
+    errval_t err = fat_cache_get_sector(n / FATEntPerSec, &sector);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *ret_value = sector[n % FATEntPerSec] & 0x0FFFFFFF;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_set(size_t n, uint32_t value) {
+
+    // Number of FAT entries that fit into one sector
+    size_t FATEntPerSec = BPB_BytsPerSec / sizeof(uint32_t);
+
+    uint32_t *sector;
+    errval_t err = fat_cache_get_sector(n / FATEntPerSec, &sector);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // Change FAT entry to value without MSB
+    uint32_t *entry = &sector[n % FATEntPerSec];
+    *entry = (*entry & 0xF0000000) | (value & 0x0FFFFFFF);
+
+    // Mark the sector dirty
+    size_t i = n / FATEntPerSec;
+    if (!(fat_dirty[i / 32] & (1u << (i % 32)))) {
+        fat_dirty[i / 32] |= 1u << (i % 32);
+        fat_dirty_count++;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_cache_sync(void) {
+
+    errval_t err;
+
+    for (size_t i = 0; fat_dirty_count > 0 && i < FATSz; i++) {
+
+        if (!(fat_dirty[i / 32] & (1u << (i % 32)))) {
+            // Skip clean words in one go
+            if (fat_dirty[i / 32] == 0) {
+                i |= 31;
+            }
+            continue;
+        }
+
+        // Write the sector to every FAT copy that is kept up to date
+        for (size_t fat = 0; fat < BPB_NumFATs; fat++) {
+
+            if ((BPB_ExtFlags & 0x80) && fat != fat_active) {
+                continue;
+            }
+
+            err = mmchs_write_block(BPB_ResvdSecCnt + fat * FATSz + i,
+                                    fat_sectors[i]);
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
+#endif
+                return err;
+            }
+
+        }
+
+        fat_dirty[i / 32] &= ~(1u << (i % 32));
+        fat_dirty_count--;
+
+    }
+
+    return SYS_ERR_OK;
+
+}
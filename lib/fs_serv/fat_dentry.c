@@ -0,0 +1,395 @@
+//
+//  fat_dentry.c
+//  DoritOS
+//
+//  Name indexes of directories for path resolution. The first lookup in a
+//  directory reads all of its entries into a hash table keyed by the FAT name,
+//  so later lookups, including ones for names that do not exist, are answered
+//  without scanning the directory again. Indexes are kept current by the
+//  functions that add and remove directory entries. The least recently used
+//  index is replaced when all FAT_DENTRY_DIRS slots are taken.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/block_cache.h>
+#include <fs_serv/fat_dentry.h>
+
+#define PRINT_DEBUG 0
+
+#define NO_SLOT     SIZE_MAX
+
+// Entry of an index with the link of its hash chain
+struct fat_dentry_slot {
+
+    struct fat_dentry dentry;       // dentry.name[0] is 0 if the slot is free
+    size_t next;                    // Next slot in hash chain or free list
+
+};
+
+struct fat_dentry_index {
+
+    size_t dir_cluster_nr;          // First cluster of the directory (0 if unused)
+
+    struct fat_dentry_slot *slots;
+    size_t slot_count;              // Slots handed out so far (free ones included)
+    size_t slot_capacity;
+    size_t free_slot;               // First free slot below slot_count
+
+    size_t *buckets;                // First slot of each hash chain
+    size_t buckets_mask;            // Bucket count is a power of two
+
+    size_t last_use;                // Value of use_counter on last access
+
+};
+
+static struct fat_dentry_index indexes[FAT_DENTRY_DIRS];
+
+static size_t use_counter;
+
+// MARK: - Helpers
+
+// FNV-1a hash of a FAT name
+static inline size_t hash_name(const char *fat_name) {
+
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < 11; i++) {
+        hash = (hash ^ (uint8_t) fat_name[i]) * 16777619u;
+    }
+
+    return hash;
+
+}
+
+static void clear_index(struct fat_dentry_index *index) {
+
+    free(index->slots);
+    free(index->buckets);
+    memset(index, 0, sizeof(struct fat_dentry_index));
+
+}
+
+static struct fat_dentry_index *find_index(size_t dir_cluster_nr) {
+
+    for (size_t i = 0; i < FAT_DENTRY_DIRS; i++) {
+        if (indexes[i].dir_cluster_nr == dir_cluster_nr) {
+            indexes[i].last_use = ++use_counter;
+            return &indexes[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+// Double the number of buckets and rehash all entries
+static errval_t grow_buckets(struct fat_dentry_index *index) {
+
+    size_t buckets_count = MAX(2 * (index->buckets_mask + 1), 16);
+
+    size_t *buckets = malloc(buckets_count * sizeof(size_t));
+    if (buckets == NULL) {
+        return LIB_ERR_MALLOC_FAIL;
+    }
+
+    for (size_t i = 0; i < buckets_count; i++) {
+        buckets[i] = NO_SLOT;
+    }
+
+    for (size_t i = 0; i < index->slot_count; i++) {
+
+        struct fat_dentry_slot *slot = &index->slots[i];
+        if (slot->dentry.name[0] == 0) {
+            continue;
+        }
+
+        size_t bucket = hash_name(slot->dentry.name) & (buckets_count - 1);
+        slot->next = buckets[bucket];
+        buckets[bucket] = i;
+
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->buckets_mask = buckets_count - 1;
+
+    return SYS_ERR_OK;
+
+}
+
+static errval_t add_entry(struct fat_dentry_index *index, const char *fat_name,
+                          size_t pos, size_t first_cluster_nr, bool is_dir) {
+
+    errval_t err;
+
+    size_t n = index->free_slot;
+
+    if (n != NO_SLOT) {
+
+        // Reuse the slot of a removed entry
+        index->free_slot = index->slots[n].next;
+
+    } else {
+
+        if (index->slot_count == index->slot_capacity) {
+            size_t capacity = MAX(2 * index->slot_capacity, 16);
+            struct fat_dentry_slot *slots = realloc(index->slots, capacity * sizeof(struct fat_dentry_slot));
+            if (slots == NULL) {
+                return LIB_ERR_MALLOC_FAIL;
+            }
+            index->slots = slots;
+            index->slot_capacity = capacity;
+        }
+
+        // Keep at most one entry per bucket on average
+        if (index->slot_count > index->buckets_mask) {
+            err = grow_buckets(index);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+
+        n = index->slot_count++;
+
+    }
+
+    struct fat_dentry_slot *slot = &index->slots[n];
+    memcpy(slot->dentry.name, fat_name, 11);
+    slot->dentry.is_dir = is_dir;
+    slot->dentry.pos = pos;
+    slot->dentry.first_cluster_nr = first_cluster_nr;
+
+    size_t bucket = hash_name(fat_name) & index->buckets_mask;
+    slot->next = index->buckets[bucket];
+    index->buckets[bucket] = n;
+
+    return SYS_ERR_OK;
+
+}
+
+// Read all entries of the directory into an empty index
+static errval_t build_index(struct fat_dentry_index *index, size_t dir_cluster_nr) {
+
+    errval_t err;
+
+    // Bytes per cluster
+    uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
+
+    // Entries per cluster
+    size_t EntriesPerClus = BytesPerClus / 32;
+
+    // Number of clusters on the volume (bounds the walk on a corrupted FAT)
+    size_t max_clusters = FATSz * (BPB_BytsPerSec / sizeof(uint32_t));
+
+    err = grow_buckets(index);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    index->free_slot = NO_SLOT;
+
+    size_t cluster_nr = dir_cluster_nr;
+
+    for (size_t cluster_index = 0; cluster_index < max_clusters; cluster_index++) {
+
+        struct block_cache_buf *buf;
+        err = block_cache_get(cluster_nr, BLOCK_CACHE_READ, &buf);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            return err;
+        }
+
+        for (size_t pos_index = 0; pos_index < EntriesPerClus; pos_index++) {
+
+            uint8_t *entry = &buf->data[pos_index * 32];
+
+            // Free entry and no more entries after this one
+            if (entry[0] == 0x00) {
+                block_cache_release(buf, false);
+                return SYS_ERR_OK;
+            }
+
+            // Skip free entries and long name parts
+            if (entry[0] == 0xE5 || entry[11] == 0x0F) {
+                continue;
+            }
+
+            size_t first_cluster_nr = *((uint16_t *) &entry[26]) | *((uint16_t *) &entry[20]) << 16;
+
+            err = add_entry(index, (char *) entry, cluster_index * EntriesPerClus + pos_index,
+                            first_cluster_nr, entry[11] & 0x18);
+            if (err_is_fail(err)) {
+                block_cache_release(buf, false);
+                return err;
+            }
+
+        }
+
+        block_cache_release(buf, false);
+
+        // Continue with the next cluster of the directory
+        uint32_t next_nr;
+        err = fat_cache_get(cluster_nr, &next_nr);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (next_nr < 2 || next_nr >= 0x0FFFFFF7) {
+            break;
+        }
+        cluster_nr = next_nr;
+
+    }
+
+#if PRINT_DEBUG
+    debug_printf("Indexed %zu entries of directory %zu\n", index->slot_count, dir_cluster_nr);
+#endif
+
+    return SYS_ERR_OK;
+
+}
+
+// Get the index of a directory, building a new one in the least recently used slot
+static errval_t get_index(size_t dir_cluster_nr, struct fat_dentry_index **ret_index) {
+
+    errval_t err;
+
+    if (dir_cluster_nr < 2) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    struct fat_dentry_index *index = find_index(dir_cluster_nr);
+    if (index != NULL) {
+        *ret_index = index;
+        return SYS_ERR_OK;
+    }
+
+    index = &indexes[0];
+    for (size_t i = 1; i < FAT_DENTRY_DIRS && index->dir_cluster_nr != 0; i++) {
+        if (indexes[i].dir_cluster_nr == 0 || indexes[i].last_use < index->last_use) {
+            index = &indexes[i];
+        }
+    }
+
+    clear_index(index);
+
+    err = build_index(index, dir_cluster_nr);
+    if (err_is_fail(err)) {
+        clear_index(index);
+        return err;
+    }
+
+    index->dir_cluster_nr = dir_cluster_nr;
+    index->last_use = ++use_counter;
+
+    *ret_index = index;
+
+    return SYS_ERR_OK;
+
+}
+
+// Unlink the slot of `fat_name` from its hash chain and return it (NO_SLOT if absent)
+static size_t unlink_entry(struct fat_dentry_index *index, const char *fat_name) {
+
+    size_t *link = &index->buckets[hash_name(fat_name) & index->buckets_mask];
+
+    while (*link != NO_SLOT) {
+
+        size_t n = *link;
+        struct fat_dentry_slot *slot = &index->slots[n];
+
+        if (memcmp(slot->dentry.name, fat_name, 11) == 0) {
+            *link = slot->next;
+            return n;
+        }
+
+        link = &slot->next;
+
+    }
+
+    return NO_SLOT;
+
+}
+
+// MARK: - Interface
+
+errval_t fat_dentry_lookup(size_t dir_cluster_nr, const char *fat_name,
+                           struct fat_dentry *ret_dentry) {
+
+    errval_t err;
+
+    struct fat_dentry_index *index;
+    err = get_index(dir_cluster_nr, &index);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    size_t n = index->buckets[hash_name(fat_name) & index->buckets_mask];
+
+    while (n != NO_SLOT) {
+
+        struct fat_dentry_slot *slot = &index->slots[n];
+
+        if (memcmp(slot->dentry.name, fat_name, 11) == 0) {
+            *ret_dentry = slot->dentry;
+            return SYS_ERR_OK;
+        }
+
+        n = slot->next;
+
+    }
+
+    return FAT_ERR_FAT_LOOKUP;
+
+}
+
+void fat_dentry_insert(size_t dir_cluster_nr, const char *fat_name, size_t pos,
+                       size_t first_cluster_nr, bool is_dir) {
+
+    struct fat_dentry_index *index = find_index(dir_cluster_nr);
+
+    // A directory without index picks the entry up when it is indexed
+    if (index == NULL) {
+        return;
+    }
+
+    if (err_is_fail(add_entry(index, fat_name, pos, first_cluster_nr, is_dir))) {
+        clear_index(index);
+    }
+
+}
+
+void fat_dentry_remove(size_t dir_cluster_nr, const char *fat_name) {
+
+    struct fat_dentry_index *index = find_index(dir_cluster_nr);
+    if (index == NULL) {
+        return;
+    }
+
+    size_t n = unlink_entry(index, fat_name);
+    if (n == NO_SLOT) {
+        return;
+    }
+
+    // Put the slot on the free list
+    index->slots[n].dentry.name[0] = 0;
+    index->slots[n].next = index->free_slot;
+    index->free_slot = n;
+
+}
+
+void fat_dentry_invalidate(size_t dir_cluster_nr) {
+
+    struct fat_dentry_index *index = find_index(dir_cluster_nr);
+    if (index != NULL) {
+        clear_index(index);
+    }
+
+}
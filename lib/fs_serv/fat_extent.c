@@ -0,0 +1,296 @@
+//
+//  fat_extent.c
+//  DoritOS
+//
+//  Extent maps of cluster chains. A map lists the runs of contiguous clusters
+//  of one chain, so finding the nth cluster of a file is a binary search
+//  instead of a walk through the FAT. Maps are built lazily, only as far into
+//  the chain as has been asked for, and are updated by the functions that
+//  link and free clusters. The least recently used map is replaced when all
+//  FAT_EXTENT_MAPS slots are taken.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/fat_extent.h>
+
+#define PRINT_DEBUG 0
+
+struct fat_extent_map {
+
+    size_t first_cluster_nr;        // First cluster of the chain (0 if unused)
+
+    struct fat_extent *extents;     // Runs sorted by index
+    size_t extent_count;
+    size_t extent_capacity;
+
+    size_t cluster_count;           // Number of clusters mapped so far
+    bool complete;                  // Mapped up to the end of chain marker
+
+    size_t last_use;                // Value of use_counter on last access
+
+};
+
+static struct fat_extent_map maps[FAT_EXTENT_MAPS];
+
+static size_t use_counter;
+
+// MARK: - Helpers
+
+static errval_t add_cluster(struct fat_extent_map *map, size_t cluster_nr) {
+
+    // Grow the last run if the cluster follows it on disk
+    if (map->extent_count > 0) {
+        struct fat_extent *last = &map->extents[map->extent_count - 1];
+        if (last->cluster_nr + last->count == cluster_nr) {
+            last->count++;
+            map->cluster_count++;
+            return SYS_ERR_OK;
+        }
+    }
+
+    if (map->extent_count == map->extent_capacity) {
+        size_t capacity = MAX(2 * map->extent_capacity, 4);
+        struct fat_extent *extents = realloc(map->extents, capacity * sizeof(struct fat_extent));
+        if (extents == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        map->extents = extents;
+        map->extent_capacity = capacity;
+    }
+
+    struct fat_extent *extent = &map->extents[map->extent_count++];
+    extent->index = map->cluster_count;
+    extent->cluster_nr = cluster_nr;
+    extent->count = 1;
+
+    map->cluster_count++;
+
+    return SYS_ERR_OK;
+
+}
+
+static void clear_map(struct fat_extent_map *map) {
+
+    free(map->extents);
+    memset(map, 0, sizeof(struct fat_extent_map));
+
+}
+
+static struct fat_extent_map *find_map(size_t first_cluster_nr) {
+
+    for (size_t i = 0; i < FAT_EXTENT_MAPS; i++) {
+        if (maps[i].first_cluster_nr == first_cluster_nr) {
+            maps[i].last_use = ++use_counter;
+            return &maps[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+// Get the map of a chain, starting a new one in the least recently used slot
+static errval_t get_map(size_t first_cluster_nr, struct fat_extent_map **ret_map) {
+
+    errval_t err;
+
+    if (first_cluster_nr < 2) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    struct fat_extent_map *map = find_map(first_cluster_nr);
+    if (map != NULL) {
+        *ret_map = map;
+        return SYS_ERR_OK;
+    }
+
+    map = &maps[0];
+    for (size_t i = 1; i < FAT_EXTENT_MAPS && map->first_cluster_nr != 0; i++) {
+        if (maps[i].first_cluster_nr == 0 || maps[i].last_use < map->last_use) {
+            map = &maps[i];
+        }
+    }
+
+    clear_map(map);
+
+    err = add_cluster(map, first_cluster_nr);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    map->first_cluster_nr = first_cluster_nr;
+    map->last_use = ++use_counter;
+
+    *ret_map = map;
+
+    return SYS_ERR_OK;
+
+}
+
+// Follow the FAT from the last mapped cluster until `index` is mapped or the chain ends
+static errval_t extend_map(struct fat_extent_map *map, size_t index) {
+
+    errval_t err;
+
+    // Number of clusters on the volume (bounds the walk on a corrupted FAT)
+    size_t max_clusters = FATSz * (BPB_BytsPerSec / sizeof(uint32_t));
+
+    while (!map->complete && map->cluster_count <= index) {
+
+        struct fat_extent *last = &map->extents[map->extent_count - 1];
+
+        uint32_t next_nr;
+        err = fat_cache_get(last->cluster_nr + last->count - 1, &next_nr);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            return err;
+        }
+
+        // End of chain (free or reserved entries also end a damaged chain)
+        if (next_nr >= 0x0FFFFFF7 || next_nr < 2 || map->cluster_count >= max_clusters) {
+            map->complete = true;
+            break;
+        }
+
+        err = add_cluster(map, next_nr);
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+// MARK: - Interface
+
+errval_t fat_extent_lookup(size_t first_cluster_nr, size_t index,
+                           size_t *ret_cluster_nr, size_t *ret_run) {
+
+    errval_t err;
+
+    struct fat_extent_map *map;
+    err = get_map(first_cluster_nr, &map);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = extend_map(map, index);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (index >= map->cluster_count) {
+        return FAT_ERR_CLUSTER_BOUNDS;
+    }
+
+    // Binary search for the last run that starts at or before index
+    size_t lo = 0;
+    size_t hi = map->extent_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->extents[mid].index <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    struct fat_extent *extent = &map->extents[lo];
+    size_t offset = index - extent->index;
+
+    *ret_cluster_nr = extent->cluster_nr + offset;
+    if (ret_run != NULL) {
+        *ret_run = extent->count - offset;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_extent_last(size_t first_cluster_nr, size_t *ret_cluster_nr,
+                         size_t *ret_count) {
+
+    errval_t err;
+
+    struct fat_extent_map *map;
+    err = get_map(first_cluster_nr, &map);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    err = extend_map(map, SIZE_MAX - 1);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct fat_extent *last = &map->extents[map->extent_count - 1];
+
+    *ret_cluster_nr = last->cluster_nr + last->count - 1;
+    if (ret_count != NULL) {
+        *ret_count = map->cluster_count;
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+void fat_extent_append(size_t first_cluster_nr, size_t cluster_nr) {
+
+    struct fat_extent_map *map = find_map(first_cluster_nr);
+
+    // An incomplete map picks the cluster up when it is extended
+    if (map == NULL || !map->complete) {
+        return;
+    }
+
+    if (err_is_fail(add_cluster(map, cluster_nr))) {
+        clear_map(map);
+    }
+
+}
+
+void fat_extent_truncate(size_t first_cluster_nr, size_t cluster_count) {
+
+    struct fat_extent_map *map = find_map(first_cluster_nr);
+    if (map == NULL) {
+        return;
+    }
+
+    // The first cluster stays allocated, as in remove_fat_entries_from()
+    cluster_count = MAX(cluster_count, 1);
+
+    if (cluster_count > map->cluster_count) {
+        // The new end lies beyond what was mapped so far
+        return;
+    }
+
+    // Drop the runs that start behind the new end and shorten the last one
+    while (map->extents[map->extent_count - 1].index >= cluster_count) {
+        map->extent_count--;
+    }
+    struct fat_extent *last = &map->extents[map->extent_count - 1];
+    last->count = cluster_count - last->index;
+
+    map->cluster_count = cluster_count;
+    map->complete = true;
+
+}
+
+void fat_extent_invalidate(size_t first_cluster_nr) {
+
+    struct fat_extent_map *map = find_map(first_cluster_nr);
+    if (map != NULL) {
+        clear_map(map);
+    }
+
+}
@@ -0,0 +1,207 @@
+//
+//  fat_handle.c
+//  DoritOS
+//
+//  Table of the files opened through the RPC server. Clients refer to an open
+//  file by the ID of its handle, which is its index in the table plus one.
+//  The handle caches the dirent and the size of the file, so read and write
+//  requests neither carry the dirent nor look the size up in the parent
+//  directory. The table grows when all slots are in use. Each client keeps
+//  the IDs it opened in its owner, so it can only use and close those.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aos/aos.h>
+
+#include <fs_serv/fat_handle.h>
+
+#define PRINT_DEBUG 0
+
+static struct fat_handle *handles;
+static size_t handles_count;
+
+// MARK: - Owner
+
+// Reference of `owner` to handle `id` (NULL if it holds none)
+static struct fat_handle_ref *owner_find(struct fat_handle_owner *owner, uint32_t id) {
+
+    for (size_t i = 0; i < owner->refs_count; i++) {
+        if (owner->refs[i].id == id) {
+            return &owner->refs[i];
+        }
+    }
+
+    return NULL;
+
+}
+
+// Record another open of handle `id` by `owner`
+static errval_t owner_add(struct fat_handle_owner *owner, uint32_t id) {
+
+    struct fat_handle_ref *ref = owner_find(owner, id);
+    if (ref != NULL) {
+        ref->opens++;
+        return SYS_ERR_OK;
+    }
+
+    if (owner->refs_count == owner->refs_capacity) {
+
+        size_t capacity = MAX(2 * owner->refs_capacity, 8);
+        struct fat_handle_ref *refs = realloc(owner->refs, capacity * sizeof(struct fat_handle_ref));
+        if (refs == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+
+        owner->refs = refs;
+        owner->refs_capacity = capacity;
+
+    }
+
+    owner->refs[owner->refs_count].id = id;
+    owner->refs[owner->refs_count].opens = 1;
+    owner->refs_count++;
+
+    return SYS_ERR_OK;
+
+}
+
+// Drop one open of `ref` (removes it once the last open is closed)
+static void owner_drop(struct fat_handle_owner *owner, struct fat_handle_ref *ref) {
+
+    ref->opens--;
+    if (ref->opens == 0) {
+        *ref = owner->refs[--owner->refs_count];
+    }
+
+}
+
+// MARK: - Interface
+
+errval_t fat_handle_open(struct fat_handle_owner *owner, struct fat_dirent *dirent, uint32_t *ret_id) {
+
+    errval_t err;
+
+    assert(owner != NULL);
+    assert(dirent != NULL);
+    assert(ret_id != NULL);
+
+    // Slot to use if the file is not open yet
+    size_t free_index = handles_count;
+
+    for (size_t i = 0; i < handles_count; i++) {
+
+        struct fat_handle *handle = &handles[i];
+
+        if (handle->refcount == 0) {
+            free_index = MIN(free_index, i);
+            continue;
+        }
+
+        // Share the handle of a file that is already open (identified by its
+        // directory entry, empty files have no cluster yet)
+        if (!handle->removed &&
+            handle->dirent.parent_cluster_nr == dirent->parent_cluster_nr &&
+            handle->dirent.parent_pos == dirent->parent_pos) {
+
+            err = owner_add(owner, i + 1);
+            if (err_is_fail(err)) {
+                return err;
+            }
+
+            handle->refcount++;
+            *ret_id = i + 1;
+            return SYS_ERR_OK;
+
+        }
+
+    }
+
+    if (free_index == handles_count) {
+
+        size_t count = MAX(2 * handles_count, 16);
+        struct fat_handle *new_handles = realloc(handles, count * sizeof(struct fat_handle));
+        if (new_handles == NULL) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
+        memset(new_handles + handles_count, 0, (count - handles_count) * sizeof(struct fat_handle));
+
+        handles = new_handles;
+        handles_count = count;
+
+    }
+
+    err = owner_add(owner, free_index + 1);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct fat_handle *handle = &handles[free_index];
+    memset(handle, 0, sizeof(struct fat_handle));
+    memcpy(&handle->dirent, dirent, sizeof(struct fat_dirent));
+    handle->refcount = 1;
+
+#if PRINT_DEBUG
+    debug_printf("Opened handle %zu for cluster %zu\n", free_index + 1, dirent->first_cluster_nr);
+#endif
+
+    *ret_id = free_index + 1;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_handle_get(struct fat_handle_owner *owner, uint32_t id, struct fat_handle **ret_handle) {
+
+    if (id == 0 || id > handles_count || owner_find(owner, id) == NULL) {
+        return FS_ERR_INVALID_FH;
+    }
+
+    struct fat_handle *handle = &handles[id - 1];
+    if (handle->removed) {
+        return FS_ERR_NOTFOUND;
+    }
+
+    *ret_handle = handle;
+
+    return SYS_ERR_OK;
+
+}
+
+errval_t fat_handle_close(struct fat_handle_owner *owner, uint32_t id) {
+
+    struct fat_handle_ref *ref = owner_find(owner, id);
+    if (id == 0 || id > handles_count || ref == NULL) {
+        return FS_ERR_INVALID_FH;
+    }
+
+    owner_drop(owner, ref);
+    handles[id - 1].refcount--;
+
+    return SYS_ERR_OK;
+
+}
+
+void fat_handle_release_owner(struct fat_handle_owner *owner) {
+
+    for (size_t i = 0; i < owner->refs_count; i++) {
+        handles[owner->refs[i].id - 1].refcount -= owner->refs[i].opens;
+    }
+
+    free(owner->refs);
+    memset(owner, 0, sizeof(struct fat_handle_owner));
+
+}
+
+void fat_handle_invalidate(size_t parent_cluster_nr, size_t parent_pos) {
+
+    for (size_t i = 0; i < handles_count; i++) {
+        if (handles[i].refcount > 0 &&
+            handles[i].dirent.parent_cluster_nr == parent_cluster_nr &&
+            handles[i].dirent.parent_pos == parent_pos) {
+            handles[i].removed = true;
+        }
+    }
+
+}
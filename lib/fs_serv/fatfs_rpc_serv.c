@@ -9,21 +9,78 @@
 #include <aos/aos.h>
 #include <aos/urpc.h>
 #include <aos/aos_rpc.h>
+#include <aos/deferred.h>
+#include <aos/systime.h>
 
 #include <fs_serv/fatfs_serv.h>
 #include <fs_serv/fatfs_rpc_serv.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/block_cache.h>
+#include <fs_serv/fat_handle.h>
 
 #include <fs/fs_rpc.h>
 
-#include <collections/list.h>
-
 #define PRINT_DEBUG 0
 
-// List of bound channels
-static collections_listnode *chan_list;
+// Request received from a client, queued until it is served
+struct fatfs_request {
+    
+    struct fatfs_request *next;     // Next request of the same client
+    
+    uint8_t *recv_buffer;
+    size_t recv_size;
+    urpc_msg_type_t msg_type;
+    struct ump_bulk_desc recv_desc; // Place of recv_buffer in the client's bulk pool
+    
+    systime_t arrival;              // Time the request was received
+    
+    // Arguments of a read or write, copied when the request is queued since
+    // the client can still write to a message in its bulk pool
+    uint32_t handle_id;
+    size_t start;
+    size_t bytes;
+    
+    // State of a read or write that is served in chunks
+    uint8_t *send_buffer;           // Response of a read
+    struct ump_bulk_desc send_desc; // Place of send_buffer in our bulk pool
+    bool send_bulk;                 // send_buffer was allocated from the bulk pool
+    size_t done;                    // Bytes of the request handled so far
+    size_t transferred;             // Bytes read or written (with padding)
+    
+};
+
+// Bound client with its queue of requests
+struct fatfs_client {
+    
+    struct urpc_chan chan;
+    
+    struct fat_handle_owner handles;    // Handles opened by the client
+    
+    struct fatfs_request *head;     // Oldest request (being served)
+    struct fatfs_request *tail;     // Newest request
+    
+    struct fatfs_client *next;      // Next client in the run queue
+    bool runnable;                  // Client is in the run queue
+    
+};
 
+// Waitset the channels and the accept timer are registered on
+static struct waitset ws;
 
+// Timer for checking for new bind requests
+static struct periodic_event accept_event;
+
+// Clients with queued requests, served round-robin
+static struct fatfs_client *run_head;
+static struct fatfs_client *run_tail;
+
+// Latency counters indexed by message type
+static struct fatfs_rpc_serv_stats stats[FATFS_RPC_SERV_MSG_TYPES];
+
+
+// Handle a request that is served in one go (everything but read and write)
 static void handle_urpc_msg(struct urpc_chan *chan,
+                            struct fat_handle_owner *owner,
                             uint8_t *recv_buffer,
                             size_t recv_size,
                             urpc_msg_type_t recv_msg_type,
@@ -35,19 +92,27 @@ static void handle_urpc_msg(struct urpc_chan *chan,
     size_t send_size;
     uint8_t *send_buffer;
     
-    // Allocate dirent
-    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
+    // Dirent allocated by open, create, opendir and readdir
+    struct fat_dirent *ret_dirent = NULL;
+    
+    // Handle of the file or directory a request refers to
+    struct fat_handle *handle;
+    uint32_t handle_id = 0;
     
     // Receive header response message
     struct fs_message *recv_msg = (struct fs_message *) recv_buffer;
     
-    // Size and bytes for read and write
-    size_t start;
+    // Bytes for truncate and preallocate
     size_t bytes;
     
     // Directory index for readdir
     size_t dir_index;
     
+    // Packed entries for batched readdir
+    size_t batch_count = 0;
+    size_t batch_bytes = 0;
+    bool batch_end = false;
+    
     // Path for open and create
     char *path;
     
@@ -70,7 +135,7 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             //int flags = recv_msg->arg1;
             
             // Open existing file and return dirent
-            err = fatfs_serv_open((void *) mt, path, &dirent);
+            err = fatfs_serv_open((void *) mt, path, &ret_dirent);
             if (err_is_fail(err)) {
                 debug_printf("%s\n", err_getstring(err));
             }
@@ -78,8 +143,17 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Free path string
             free(path);
             
-            // Set err as argument 1 of send message
+            // Hand out a handle (the root directory has no dirent of its own)
+            if (err_is_ok(err)) {
+                if (ret_dirent == NULL) {
+                    ret_dirent = mt->root;
+                }
+                err = fat_handle_open(owner, ret_dirent, &handle_id);
+            }
+            
+            // Set err as argument 1 and handle as argument 2 of send message
             send_msg.arg1 = err;
+            send_msg.arg2 = handle_id;
             
             // Size of send buffer
             send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
@@ -91,7 +165,9 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
             
             // Copy dirent into send buffers
-            memcpy(send_buffer + sizeof(struct fs_message), dirent, sizeof(struct fat_dirent));
+            if (err_is_ok(err) && ret_dirent != NULL) {
+                memcpy(send_buffer + sizeof(struct fs_message), ret_dirent, sizeof(struct fat_dirent));
+            }
             
             // Send response message to client
             urpc_send(chan, send_buffer, send_size, URPC_MessageType_Open);
@@ -109,7 +185,7 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             //int flags = recv_msg->arg1;
             
             // Create existing file and return dirent
-            err = fatfs_serv_create((void *) mt, path, &dirent);
+            err = fatfs_serv_create((void *) mt, path, &ret_dirent);
             if (err_is_fail(err)) {
                 debug_printf("%s\n", err_getstring(err));
             }
@@ -117,8 +193,17 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Free path string
             free(path);
             
-            // Set err as argument 1 of send message
+            // Hand out a handle (the root directory has no dirent of its own)
+            if (err_is_ok(err)) {
+                if (ret_dirent == NULL) {
+                    ret_dirent = mt->root;
+                }
+                err = fat_handle_open(owner, ret_dirent, &handle_id);
+            }
+            
+            // Set err as argument 1 and handle as argument 2 of send message
             send_msg.arg1 = err;
+            send_msg.arg2 = handle_id;
             
             // Size of send buffer
             send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
@@ -129,8 +214,10 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Copy fs_message into send buffer
             memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
             
-            // Copy path (including '\0' into send buffers
-            memcpy(send_buffer + sizeof(struct fs_message), dirent, sizeof(struct fat_dirent));
+            // Copy dirent into send buffers
+            if (err_is_ok(err) && ret_dirent != NULL) {
+                memcpy(send_buffer + sizeof(struct fs_message), ret_dirent, sizeof(struct fat_dirent));
+            }
             
             // Send response message to client
             urpc_send(chan, send_buffer, send_size, URPC_MessageType_Create);
@@ -144,81 +231,65 @@ static void handle_urpc_msg(struct urpc_chan *chan,
 #if PRINT_DEBUG
             debug_printf("URPC Message Close Request!\n");
 #endif
+            // Drop the reference of the client (no response is sent)
+            err = fat_handle_close(owner, recv_msg->arg1);
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
+#endif
+            }
+            
             break;
             
-        case URPC_MessageType_Read:
+        case URPC_MessageType_Truncate:
 #if PRINT_DEBUG
-            debug_printf("URPC Message Read Request!\n");
+            debug_printf("URPC Message Truncate Request!\n");
 #endif
-            // Set start and bytes
-            start = recv_msg->arg1;
+
+            // Get bytes to be truncated from arguments
             bytes = recv_msg->arg2;
             
-            // Copy from buffer into dirents
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-            
-            // Update dirent size
-            err = update_dirent_size(dirent);
+            // Get handle from arguments and truncate its dirent to size bytes
+            err = fat_handle_get(owner, recv_msg->arg1, &handle);
+            if (err_is_ok(err)) {
+                err = truncate_dirent(&handle->dirent, bytes);
+            }
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
 #endif
             }
-            // Setup bytes that will be read
-            size_t bytes_read = 0;
             
             // Size of send buffer
-            send_size = sizeof(struct fs_message) + bytes;
+            send_size = sizeof(struct fs_message);
             
             // Allocate send buffer
             send_buffer = calloc(1, send_size);
             
-            // Read dirent data into buffer part of send buffer
-            err = read_dirent(dirent, send_buffer + sizeof(struct fs_message), start, bytes, &bytes_read);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-            }
-            
             // Set error
             ((struct fs_message *) send_buffer)->arg1 = err;
             
-            // Set bytes read
-            ((struct fs_message *) send_buffer)->arg2 = bytes_read;
-            
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Read);
+            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Truncate);
             
             // Free send buffer
             free(send_buffer);
             
             break;
             
-        case URPC_MessageType_Write:
+        case URPC_MessageType_Preallocate:
 #if PRINT_DEBUG
-            debug_printf("URPC Message Write Request!\n");
+            debug_printf("URPC Message Preallocate Request!\n");
 #endif
-            // Get start and bytes from arguments
-            start = recv_msg->arg1;
-            bytes = recv_msg->arg2;
             
-            // Copy from receive buffer into dirent
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
+            // Get bytes to be preallocated from arguments
+            bytes = recv_msg->arg2;
             
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
+            // Get handle from arguments and reserve clusters for bytes without changing the file size
+            err = fat_handle_get(owner, recv_msg->arg1, &handle);
+            if (err_is_ok(err)) {
+                err = preallocate_dirent(&handle->dirent, bytes);
             }
-            
-            // Setup bytes that will be written
-            size_t bytes_written = 0;
-            
-            // Write buffer part of receive buffer to dirent
-            err = write_dirent(dirent, recv_buffer + sizeof(struct fs_message) + sizeof(struct fat_dirent), start, bytes, &bytes_written);
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
@@ -226,7 +297,7 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             }
             
             // Size of send buffer
-            send_size = sizeof(struct fs_message) + bytes;
+            send_size = sizeof(struct fs_message);
             
             // Allocate send buffer
             send_buffer = calloc(1, send_size);
@@ -234,58 +305,30 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Set error
             ((struct fs_message *) send_buffer)->arg1 = err;
             
-            // Set bytes written
-            ((struct fs_message *) send_buffer)->arg2 = bytes_written;
-            
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Write);
+            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Preallocate);
             
             // Free send buffer
             free(send_buffer);
             
             break;
             
-        case URPC_MessageType_Truncate:
-#if PRINT_DEBUG
-            debug_printf("URPC Message Truncate Request!\n");
-#endif
-
-            // Get bytes to be truncated from arguments
-            bytes = recv_msg->arg1;
-            
-            // Copy from receive buffer into dirents
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-      
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
+        case URPC_MessageType_Stat:
 #if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
+            debug_printf("URPC Message Stat Request!\n");
 #endif
-            }
+            // Get handle from arguments
+            err = fat_handle_get(owner, recv_msg->arg1, &handle);
             
-            // Truncate dirent to size bytes
-            err = truncate_dirent(dirent, bytes);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
+            // Set error, size and type
+            send_msg.arg1 = err;
+            if (err_is_ok(err)) {
+                send_msg.arg2 = handle->dirent.size;
+                send_msg.arg3 = handle->dirent.is_dir;
             }
             
-            // Size of send buffer
-            send_size = sizeof(struct fs_message);
-            
-            // Allocate send buffer
-            send_buffer = calloc(1, send_size);
-            
-            // Set error
-            ((struct fs_message *) send_buffer)->arg1 = err;
-            
             // Send response message to client
-            urpc_send(chan, send_buffer, send_size, URPC_MessageType_Truncate);
-            
-            // Free send buffer
-            free(send_buffer);
+            urpc_send(chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Stat);
             
             break;
             
@@ -334,7 +377,7 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             path = strdup((char *) (recv_buffer + sizeof(struct fs_message)));
             
             // Open directory
-            err = fatfs_serv_opendir((void *) mt, path, &dirent);
+            err = fatfs_serv_opendir((void *) mt, path, &ret_dirent);
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
@@ -344,8 +387,17 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Free path string
             free(path);
             
-            // Set err as argument 1 of send message
+            // Hand out a handle (the root directory has no dirent of its own)
+            if (err_is_ok(err)) {
+                if (ret_dirent == NULL) {
+                    ret_dirent = mt->root;
+                }
+                err = fat_handle_open(owner, ret_dirent, &handle_id);
+            }
+            
+            // Set err as argument 1 and handle as argument 2 of send message
             send_msg.arg1 = err;
+            send_msg.arg2 = handle_id;
             
             // Size of send buffer
             send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
@@ -357,7 +409,9 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
             
             // Copy dirent into send buffers
-            memcpy(send_buffer + sizeof(struct fs_message), dirent, sizeof(struct fat_dirent));
+            if (err_is_ok(err) && ret_dirent != NULL) {
+                memcpy(send_buffer + sizeof(struct fs_message), ret_dirent, sizeof(struct fat_dirent));
+            }
             
             // Send response message to client
             urpc_send(chan, send_buffer, send_size, URPC_MessageType_OpenDir);
@@ -372,18 +426,7 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             debug_printf("URPC Message Read Directory Request!\n");
 #endif
             // Set directory index
-            dir_index = recv_msg->arg1;
-            
-            // Copy from receive buffer into dirents
-            memcpy(dirent, recv_buffer + sizeof(struct fs_message), sizeof(struct fat_dirent));
-            
-            // Update dirent size
-            err = update_dirent_size(dirent);
-            if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-            }
+            dir_index = recv_msg->arg2;
             
             // Size of send buffer
             send_size = sizeof(struct fs_message) + sizeof(struct fat_dirent);
@@ -391,11 +434,11 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Allocate send buffer
             send_buffer = calloc(1, send_size);
             
-            // Allocate return dirent
-            struct fat_dirent *ret_dirent = calloc(1, sizeof(struct fat_dirent));
-            
-            // Find dirent data
-            err = fatfs_serv_readdir(dirent->first_cluster_nr, dir_index, &ret_dirent);
+            // Get directory handle from arguments and find dirent data
+            err = fat_handle_get(owner, recv_msg->arg1, &handle);
+            if (err_is_ok(err)) {
+                err = fatfs_serv_readdir(handle->dirent.first_cluster_nr, dir_index, &ret_dirent);
+            }
             if (err_is_fail(err)) {
 #if PRINT_DEBUG
                 debug_printf("%s\n", err_getstring(err));
@@ -413,8 +456,50 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             // Send response message to client
             urpc_send(chan, send_buffer, send_size, URPC_MessageType_ReadDir);
             
-            // Free return dirent
-            free(ret_dirent);
+            // Free send buffer
+            free(send_buffer);
+            
+            break;
+            
+        case URPC_MessageType_ReadDirBatch:
+#if PRINT_DEBUG
+            debug_printf("URPC Message Read Directory Batch Request!\n");
+#endif
+            // Set directory position to continue at
+            dir_index = recv_msg->arg2;
+            
+            // Bytes the client can take (bounded by our batch size)
+            bytes = MIN(recv_msg->arg3, FS_RPC_READDIR_BATCH_SIZE);
+            
+            // Allocate send buffer for the largest batch
+            send_buffer = calloc(1, sizeof(struct fs_message) + bytes);
+            
+            // Get directory handle from arguments and pack its entries
+            err = fat_handle_get(owner, recv_msg->arg1, &handle);
+            if (err_is_ok(err)) {
+                err = fatfs_serv_readdir_batch(handle->dirent.first_cluster_nr, &dir_index,
+                                               send_buffer + sizeof(struct fs_message), bytes,
+                                               &batch_count, &batch_bytes, &batch_end);
+            }
+            if (err_is_fail(err)) {
+#if PRINT_DEBUG
+                debug_printf("%s\n", err_getstring(err));
+#endif
+                batch_bytes = 0;
+            }
+            
+            // Set error, number of entries, next position and end of directory
+            send_msg.arg1 = err;
+            send_msg.arg2 = batch_count;
+            send_msg.arg3 = dir_index;
+            send_msg.arg4 = batch_end;
+            memcpy(send_buffer, &send_msg, sizeof(struct fs_message));
+            
+            // Size of send buffer
+            send_size = sizeof(struct fs_message) + batch_bytes;
+            
+            // Send response message to client
+            urpc_send(chan, send_buffer, send_size, URPC_MessageType_ReadDirBatch);
             
             // Free send buffer
             free(send_buffer);
@@ -494,94 +579,509 @@ static void handle_urpc_msg(struct urpc_chan *chan,
             break;
     }
     
-    // Clean up
-    free(dirent);
+    // Clean up (the root directory is shared and stays allocated)
+    if (ret_dirent != mt->root) {
+        free(ret_dirent);
+    }
     
 }
 
-errval_t run_rpc_serv(void) {
+// MARK: - Read and write
+
+// Receive on a client's channel, leaving bulk payloads in the client's pool
+static errval_t client_recv(struct fatfs_client *client, struct fatfs_request *req) {
     
     errval_t err;
     
-    struct fatfs_serv_mount mt;
+    if (client->chan.use_lmp) {
+        req->recv_desc.length = 0;
+        return urpc_recv(&client->chan, (void **) &req->recv_buffer,
+                         &req->recv_size, &req->msg_type);
+    }
     
-    // Initialize root directory for fatfs_serv
-    err = init_root_dir((void *) &mt);
-    if (err_is_fail(err)) {
+    err = ump_recv_bulk(client->chan.ump, (void **) &req->recv_buffer,
+                        &req->recv_size, &req->msg_type, &req->recv_desc);
+    if (err == LIB_ERR_NO_UMP_MSG) {
+        return LIB_ERR_NO_URPC_MSG;
+    }
+    
+    return err;
+    
+}
+
+// Free the receive buffer of a request (or hand it back to the client's pool)
+static void client_release(struct fatfs_client *client, struct fatfs_request *req) {
+    
+    if (client->chan.use_lmp) {
+        free(req->recv_buffer);
+    } else {
+        ump_bulk_release(client->chan.ump, req->recv_buffer, &req->recv_desc);
+    }
+    
+    req->recv_buffer = NULL;
+    req->recv_desc.length = 0;
+    
+}
+
+// Serve the next chunk of a read request, returns true once it is complete
+static bool serve_read_chunk(struct fatfs_client *client, struct fatfs_request *req) {
+    
+    errval_t err;
+    
+    // Start and bytes of the whole request
+    size_t start = req->start;
+    size_t bytes = req->bytes;
+    
+    // Size of send buffer
+    size_t send_size = sizeof(struct fs_message) + bytes;
+    
+    if (req->send_buffer == NULL) {
+        
+        // Read large requests straight into the bulk pool shared with the client
+        if (!client->chan.use_lmp && bytes >= FS_RPC_BULK_THRESHOLD) {
+            err = ump_bulk_alloc(client->chan.ump, send_size,
+                                 (void **) &req->send_buffer, &req->send_desc);
+            req->send_bulk = err_is_ok(err);
+        }
+        
+        // Allocate send buffer (sent through the slots)
+        if (!req->send_bulk) {
+            req->send_buffer = calloc(1, send_size);
+        }
+        
+        // Fail the request with a response that only has the header
+        if (req->send_buffer == NULL) {
+            struct fs_message send_msg = {
+                .arg1 = LIB_ERR_MALLOC_FAIL,
+                .arg2 = 0,
+                .arg3 = 0,
+                .arg4 = 0
+            };
+            urpc_send(&client->chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Read);
+            return true;
+        }
+        
+    }
+    
+    // Get handle (looked up every turn since another client may close it in between)
+    struct fat_handle *handle;
+    err = fat_handle_get(&client->handles, req->handle_id, &handle);
+    
+    // Read the next chunk into buffer part of send buffer
+    size_t chunk = MIN(bytes - req->done, FATFS_RPC_SERV_CHUNK_SIZE);
+    size_t bytes_read = 0;
+    if (err_is_ok(err) && chunk > 0) {
+        
+        // Continue the read-ahead stream of this file
+        block_cache_set_stream(handle->stream_cluster);
+        
+        err = read_dirent(&handle->dirent, req->send_buffer + sizeof(struct fs_message) + req->done,
+                          start + req->done, chunk, &bytes_read);
+        
+        handle->stream_cluster = block_cache_get_stream();
+        
+        if (err_is_fail(err)) {
 #if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
+            debug_printf("%s\n", err_getstring(err));
 #endif
+        }
     }
     
-    // Initialize channel list
-    collections_list_create(&chan_list, free);
+    req->done += chunk;
+    req->transferred += bytes_read;
     
-//    domainid_t pid = 0;
-//    aos_rpc_process_spawn(aos_rpc_get_init_channel(), "filereader", 0, &pid);
+    // Continue with the next chunk on the client's next turn
+    if (err_is_ok(err) && bytes_read == chunk && req->done < bytes) {
+        return false;
+    }
     
-    // Receive request message from client
-    uint8_t *recv_buffer;
-    size_t recv_size;
-    urpc_msg_type_t recv_msg_type;
+    // Set error
+    ((struct fs_message *) req->send_buffer)->arg1 = err;
+    
+    // Set bytes read
+    ((struct fs_message *) req->send_buffer)->arg2 = req->transferred;
+    
+    // Send response message to client
+    if (req->send_bulk) {
+        
+        // Only the descriptor is copied, the client releases the blocks
+        ump_bulk_send(client->chan.ump, &req->send_desc, URPC_MessageType_Read);
+        req->send_buffer = NULL;
+        
+    } else {
+        urpc_send(&client->chan, req->send_buffer, send_size, URPC_MessageType_Read);
+    }
+    
+    return true;
+    
+}
+
+// Serve the next chunk of a write request, returns true once it is complete
+static bool serve_write_chunk(struct fatfs_client *client, struct fatfs_request *req) {
+    
+    errval_t err;
+    
+    // Start and bytes of the whole request
+    size_t start = req->start;
+    size_t bytes = req->bytes;
+    
+    // Get handle (looked up every turn since another client may close it in between)
+    struct fat_handle *handle;
+    err = fat_handle_get(&client->handles, req->handle_id, &handle);
+    
+    // The payload must hold all bytes of the request
+    if (err_is_ok(err) && bytes > req->recv_size - sizeof(struct fs_message)) {
+        err = SYS_ERR_INVALID_SIZE;
+    }
     
-    struct urpc_chan *new_chan = malloc(sizeof(struct urpc_chan));
-    assert(new_chan);
+    // Write the next chunk of the buffer part of receive buffer to dirent
+    size_t chunk = MIN(bytes - req->done, FATFS_RPC_SERV_CHUNK_SIZE);
+    size_t bytes_written = 0;
+    if (err_is_ok(err) && chunk > 0) {
+        err = write_dirent(&handle->dirent,
+                           req->recv_buffer + sizeof(struct fs_message) + req->done,
+                           start + req->done, chunk, &bytes_written);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+        }
+    }
+    
+    req->done += chunk;
+    req->transferred += bytes_written;
+    
+    // Continue with the next chunk on the client's next turn
+    if (err_is_ok(err) && req->done < bytes) {
+        return false;
+    }
+    
+    // Hand the payload back before the client can start its next write
+    client_release(client, req);
+    
+    // The client only looks at the header of the response
+    struct fs_message send_msg = {
+        .arg1 = err,
+        .arg2 = req->transferred,
+        .arg3 = 0,
+        .arg4 = 0
+    };
+    
+    // Send response message to client
+    urpc_send(&client->chan, &send_msg, sizeof(struct fs_message), URPC_MessageType_Write);
+    
+    return true;
+    
+}
 
-//    domainid_t pid;
-//    struct aos_rpc *init_chan = aos_rpc_get_init_channel();
-//    err = aos_rpc_process_spawn(init_chan, "shell", 0, &pid);
-//    if (err_is_fail(err)) {
-//#if PRINT_DEBUG
-//        debug_printf("%s\n", err_getstring(err));
-//#endif
-//    }
 
-    while (true) {
+// MARK: - Scheduling
+
+static void record_latency(urpc_msg_type_t msg_type, systime_t latency) {
+    
+    size_t index = msg_type - URPC_MessageType_User0;
+    if (index >= FATFS_RPC_SERV_MSG_TYPES) {
+        return;
+    }
+    
+    stats[index].count++;
+    stats[index].total += latency;
+    stats[index].max = MAX(stats[index].max, latency);
+    
+}
+
+// Drop everything a client holds once it went away
+static void client_destroy(struct fatfs_client *client) {
+    
+    // Close the files the client left open
+    fat_handle_release_owner(&client->handles);
+    
+    // Drop the requests still queued
+    while (client->head != NULL) {
+        struct fatfs_request *req = client->head;
+        client->head = req->next;
+        // Buffers in our bulk pool go away with the channel
+        if (!req->send_bulk) {
+            free(req->send_buffer);
+        }
+        client_release(client, req);
+        free(req);
+    }
+    
+    urpc_chan_destroy(&client->chan);
+    free(client);
+    
+}
+
+// Serve one turn of the client at the head of the run queue
+static void serve_next_client(struct fatfs_serv_mount *mt) {
+    
+    errval_t err;
+    
+    // Take client off the run queue
+    struct fatfs_client *client = run_head;
+    run_head = client->next;
+    if (run_head == NULL) {
+        run_tail = NULL;
+    }
+    client->next = NULL;
+    
+    struct fatfs_request *req = client->head;
+    
+    // The client went away (it is off the run queue already)
+    if (req->msg_type == URPC_MessageType_Disconnect) {
+        client_destroy(client);
+        return;
+    }
+    
+    bool complete;
+    switch (req->msg_type) {
+        case URPC_MessageType_Read:
+            complete = serve_read_chunk(client, req);
+            break;
+        case URPC_MessageType_Write:
+            complete = serve_write_chunk(client, req);
+            break;
+        default:
+            handle_urpc_msg(&client->chan, &client->handles, req->recv_buffer,
+                            req->recv_size, req->msg_type, mt);
+            complete = true;
+            break;
+    }
+    
+    if (complete) {
         
-        // Accept a binding request from a client
-        err = urpc_accept(new_chan);
-        if (err_is_ok(err)) {
-            collections_list_insert(chan_list, new_chan);
-            new_chan = malloc(sizeof(struct urpc_chan));
-            assert(new_chan);
+        record_latency(req->msg_type, systime_now() - req->arrival);
+        
+        // Write back the clusters modified by the request
+        err = block_cache_sync();
+        if (err_is_fail(err)) {
+            debug_printf("Error in block_cache_sync(): %s\n", err_getstring(err));
+        }
+        
+        // Write back the FAT sectors modified by the request
+        err = fat_cache_sync();
+        if (err_is_fail(err)) {
+            debug_printf("Error in fat_cache_sync(): %s\n", err_getstring(err));
         }
-        else if (err != LIB_ERR_NO_URPC_BIND_REQ) {
+        
 #if PRINT_DEBUG
-            debug_printf("Error in urpc_accept(): %s\n", err_getstring(err));
+        struct block_cache_stats cache_stats;
+        block_cache_get_stats(&cache_stats);
+        debug_printf("Block cache: %zu hits %zu misses %zu read ahead "
+                     "%zu evictions %zu writebacks\n",
+                     cache_stats.hits, cache_stats.misses, cache_stats.readahead,
+                     cache_stats.evictions, cache_stats.writebacks);
 #endif
+        
+        // Dequeue request
+        client->head = req->next;
+        if (client->head == NULL) {
+            client->tail = NULL;
+        }
+        
+        free(req->send_buffer);
+        client_release(client, req);
+        free(req);
+        
+    }
+    
+    // Put client back at the end of the run queue if there is more to do
+    if (client->head != NULL) {
+        if (run_tail != NULL) {
+            run_tail->next = client;
+        } else {
+            run_head = client;
+        }
+        run_tail = client;
+    } else {
+        client->runnable = false;
+    }
+    
+}
+
+// Handler for messages on a client's channel
+static void client_event_handler(void *arg) {
+    
+    struct fatfs_client *client = arg;
+    errval_t err;
+    
+    // Queue all messages received on the client's channel
+    while (true) {
+        
+        struct fatfs_request *req = calloc(1, sizeof(struct fatfs_request));
+        assert(req != NULL);
+        
+        err = client_recv(client, req);
+        if (err_is_fail(err) && err != LIB_ERR_NO_URPC_MSG) {
+            // The channel is broken, tear the client down after its queue
+            req->msg_type = URPC_MessageType_Disconnect;
+            req->recv_buffer = NULL;
+            req->recv_desc.length = 0;
         }
+        else if (err_is_fail(err)) {
+            free(req);
+            break;
+        }
+        
+        req->arrival = systime_now();
         
-        // Iterate all bound URPC channels
-        struct urpc_chan *chan;
-        collections_list_traverse_start(chan_list);
-        while ((chan = (struct urpc_chan *) collections_list_traverse_next(chan_list)) != NULL) {
+        // Copy the arguments of reads and writes once (a message without a
+        // header refers to no handle and fails)
+        if ((req->msg_type == URPC_MessageType_Read || req->msg_type == URPC_MessageType_Write) &&
+            req->recv_size >= sizeof(struct fs_message)) {
             
-            // Wait for fs_message from client
-            err = urpc_recv(chan,
-                            (void **) &recv_buffer,
-                            &recv_size,
-                            &recv_msg_type);
-            if (err_is_ok(err)) {
-                
-                // Handle received message
-                handle_urpc_msg(chan, recv_buffer, recv_size, recv_msg_type, &mt);
-                
-                // Free receive buffer
-                free(recv_buffer);
-                
+            struct fs_message recv_msg;
+            memcpy(&recv_msg, req->recv_buffer, sizeof(struct fs_message));
+            
+            req->handle_id = recv_msg.arg1;
+            req->start = recv_msg.arg2;
+            req->bytes = recv_msg.arg3;
+            
+            // Never read more than fits into the client's pool
+            if (req->msg_type == URPC_MessageType_Read) {
+                req->bytes = MIN(req->bytes, FS_RPC_MAX_TRANSFER);
             }
-            else if (err != LIB_ERR_NO_URPC_MSG) {
+            
+        }
+        
+        if (client->tail != NULL) {
+            client->tail->next = req;
+        } else {
+            client->head = req;
+        }
+        client->tail = req;
+        
+        // Nothing follows a disconnect
+        if (req->msg_type == URPC_MessageType_Disconnect) {
+            break;
+        }
+        
+    }
+    if (err_is_fail(err) && err != LIB_ERR_NO_URPC_MSG) {
 #if PRINT_DEBUG
-                debug_printf("Error in urpc_recv(): %s\n", err_getstring(err));
+        debug_printf("Error in urpc_recv(): %s\n", err_getstring(err));
 #endif
+    }
+    
+    // Add client to the run queue
+    if (client->head != NULL && !client->runnable) {
+        client->runnable = true;
+        if (run_tail != NULL) {
+            run_tail->next = client;
+        } else {
+            run_head = client;
+        }
+        run_tail = client;
+    }
+    
+    // Reregister for the next message unless the client went away
+    if (client->tail != NULL && client->tail->msg_type == URPC_MessageType_Disconnect) {
+        return;
+    }
+    err = urpc_register_recv(&client->chan, &ws, MKCLOSURE(client_event_handler, client));
+    if (err_is_fail(err)) {
+        debug_printf("Error in urpc_register_recv(): %s\n", err_getstring(err));
+    }
+    
+}
+
+// Handler for accepting new bind requests
+static void accept_event_handler(void *arg) {
+    
+    errval_t err;
+    
+    static struct fatfs_client *client = NULL;
+    while (true) {
+        
+        if (client == NULL) {
+            client = calloc(1, sizeof(struct fatfs_client));
+            assert(client != NULL);
+        }
+        
+        // Accept a binding request from a client
+        err = urpc_accept(&client->chan);
+        if (err_is_fail(err)) {
+            break;
+        }
+        
+        err = urpc_register_recv(&client->chan, &ws, MKCLOSURE(client_event_handler, client));
+        if (err_is_fail(err)) {
+            debug_printf("Error in urpc_register_recv(): %s\n", err_getstring(err));
+        }
+        
+        client = NULL;
+        
+    }
+    if (err != LIB_ERR_NO_URPC_BIND_REQ) {
+#if PRINT_DEBUG
+        debug_printf("Error in urpc_accept(): %s\n", err_getstring(err));
+#endif
+    }
+    
+}
+
+
+// MARK: - Interface
+
+void fatfs_rpc_serv_get_stats(urpc_msg_type_t msg_type, struct fatfs_rpc_serv_stats *ret_stats) {
+    
+    size_t index = msg_type - URPC_MessageType_User0;
+    
+    if (index < FATFS_RPC_SERV_MSG_TYPES) {
+        *ret_stats = stats[index];
+    } else {
+        memset(ret_stats, 0, sizeof(struct fatfs_rpc_serv_stats));
+    }
+    
+}
+
+errval_t run_rpc_serv(void) {
+    
+    errval_t err;
+    
+    struct fatfs_serv_mount mt;
+    
+    // Initialize root directory for fatfs_serv
+    err = init_root_dir((void *) &mt);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+    }
+    
+    waitset_init(&ws);
+    
+    // Check for bind requests periodically
+    err = periodic_event_create(&accept_event, &ws, FATFS_RPC_SERV_ACCEPT_POLL_US,
+                                MKCLOSURE(accept_event_handler, NULL));
+    if (err_is_fail(err)) {
+        debug_printf("Error in periodic_event_create(): %s\n", err_getstring(err));
+        return err;
+    }
+    
+    while (true) {
+        
+        if (run_head == NULL) {
+            
+            // Nothing queued, wait for the next message or bind request
+            err = event_dispatch(&ws);
+            if (err_is_fail(err)) {
+                debug_printf("Error in event_dispatch(): %s\n", err_getstring(err));
             }
             
+        } else {
+            
+            // Queue requests that arrived in the meantime
+            while (err_is_ok(event_dispatch_non_block(&ws)));
+            
+            // Give the next client a turn
+            serve_next_client(&mt);
+            
         }
-        collections_list_traverse_end(chan_list);
         
     }
     
     return err;
     
 }
-
@@ -9,6 +9,12 @@
 #include <aos/aos.h>
 
 #include <fs_serv/fat_helper.h>
+#include <fs_serv/fat_cache.h>
+#include <fs_serv/block_cache.h>
+#include <fs_serv/fat_extent.h>
+#include <fs_serv/fat_alloc.h>
+#include <fs_serv/fat_handle.h>
+#include <fs_serv/fat_dentry.h>
 
 #include <fs_serv/fatfs_serv.h>
 
@@ -135,6 +141,27 @@ errval_t init_BPB(void) {
  
     free(data);
     
+    // Set up the FAT cache
+    err = fat_cache_init();
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    // Build the free cluster bitmap
+    err = fat_alloc_init();
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
+    // Set up the block cache for data clusters
+    err = block_cache_init(BLOCK_CACHE_BUDGET);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return err;
+    }
+    
     return err;
     
 }
@@ -149,32 +176,18 @@ uint32_t getFATEntry(size_t n) {
     
     errval_t err;
     
-    // Number of FAT entries that fit into one sector
-    size_t FATEntPerSec = BPB_BytsPerSec/sizeof(uint32_t);
-    
-    // FAT sector that contains nth entry
-    size_t ThisFATSecNum = BPB_ResvdSecCnt + (n / FATEntPerSec);
+    uint32_t value;
     
-    // FAT entry in that sector
-    size_t ThisFATEnt = n % FATEntPerSec;
-    
-    // Allocate buffer for FAT sector
-    uint32_t *buffer = calloc(FATEntPerSec, sizeof(uint32_t));
-    
-    // Read FAT sector
-    err = mmchs_read_block(ThisFATSecNum, buffer);
+    // Look up entry in the FAT cache
+    err = fat_cache_get(n, &value);
     if (err_is_fail(err)) {
-        free(buffer);
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
 #endif
-        return err;
+        // Treat unreadable entries as end of chain
+        return 0x0FFFFFFF;
     }
     
-    uint32_t value = buffer[ThisFATEnt] & 0x0FFFFFFF;
-    
-    free(buffer);
-    
     // Return entry in FAT with MSB masked out
     return value;
     
@@ -185,43 +198,14 @@ errval_t setFATEntry(size_t n, uint32_t value) {
  
     errval_t err;
  
-    // Number of FAT entries that fit into one sector
-    size_t FATEntPerSec = BPB_BytsPerSec/sizeof(uint32_t);
-
-    // FAT sector that contains nth entry
-    size_t ThisFATSecNum = BPB_ResvdSecCnt + (n / FATEntPerSec);
- 
-    // FAT entry in that sector
-    size_t ThisFATEnt = n % FATEntPerSec;
-
-    // Allocate buffer for FAT sector
-    uint32_t *buffer = calloc(FATEntPerSec, sizeof(uint32_t));
-
-    // Read FAT sector of SD card
-    err = mmchs_read_block(ThisFATSecNum, buffer);
-    if (err_is_fail(err)) {
-        free(buffer);
-#if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
-#endif
-        return err;
-    }
- 
-    // Change FAT entry to value without MSB
-    buffer[ThisFATEnt] = buffer[ThisFATEnt] & 0xF0000000;
-    buffer[ThisFATEnt] = buffer[ThisFATEnt] | value;
- 
-    // Write FAT sector back to SD card
-    err = mmchs_write_block(ThisFATSecNum, buffer);
+    // Change FAT entry in the cache, written back by fat_cache_sync()
+    err = fat_cache_set(n, value);
     if (err_is_fail(err)) {
-        free(buffer);
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
 #endif
         return err;
     }
-    
-    free(buffer);
  
     return err;
  
@@ -333,6 +317,13 @@ errval_t fatfs_serv_create(void *st, char *path, struct fat_dirent **ret_dirent)
     
     // Search for a free FAT entry and claim it
     size_t file_cluster_nr = find_free_fat_entry_and_set(0, 0x0FFFFFFF);
+    if (file_cluster_nr == (uint32_t) -1) {
+        free(parent);
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(FAT_ERR_DISK_FULL));
+#endif
+        return FAT_ERR_DISK_FULL;
+    }
 
 #if PRINT_DEBUG
     debug_printf("file_cluster_nr: %zu\n", file_cluster_nr);
@@ -445,12 +436,8 @@ errval_t fat_resolve_path(struct fat_dirent *root, char *path, struct fat_dirent
         err = fat_find_dirent(curr_dirent, pathbuf, &next_dirent);
         if (err_is_fail(err)) {
             
-            // Free both current dirent
+            // Free current dirent (next dirent is the same after the first level)
             free(curr_dirent);
-            // Free when next dirent if previously allocated
-            if (next_dirent != NULL) {
-                free(next_dirent);
-            }
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
 #endif
@@ -499,89 +486,54 @@ errval_t fat_find_dirent(struct fat_dirent *curr_dirent, char *name, struct fat_
     // Converts name into fat directory name format (with max 8 + 3 size)
     char *fat_name = convert_to_fat_name(name);
     
-    // Bytes per cluster
-    uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
+    // Look up name in the index of the directory (read from the card on first use)
+    struct fat_dentry dentry;
+    err = fat_dentry_lookup(curr_dirent->first_cluster_nr, fat_name, &dentry);
     
-    // Temporal cluster number
-    size_t temp_nr = curr_dirent->first_cluster_nr;
+    // Free converted FAT directory entry name
+    free(fat_name);
     
-    // Indicates if End Of File is reached
-    bool isEOF = false;
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
-    // Data buffer for the data of one cluster
-    uint8_t *data = calloc(1, BytesPerClus);
+    // Allocating memory for return dirent
+    struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
     
-    for (int cluster_index = 0; !isEOF; cluster_index++) {
-        
-        // Read data from cluster[temp_nr] in data section
-        err = read_cluster(temp_nr , (void *) data);
+    // Set name of dirent
+    memcpy(&dirent->name, dentry.name, 11);
+    
+    // Set parent directory first cluster number
+    dirent->parent_cluster_nr = curr_dirent->first_cluster_nr;
+    
+    // Set position in parent directory
+    dirent->parent_pos = dentry.pos;
+    
+    // Set if dirent is a directory
+    dirent->is_dir = dentry.is_dir;
+    
+    // Set first cluster number of dirent
+    dirent->first_cluster_nr = dentry.first_cluster_nr;
+    
+    // Set size of dirent (changes with every write, so it is not part of the index)
+    if (!dirent->is_dir) {
+        err = get_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, &dirent->size);
         if (err_is_fail(err)) {
-            // Free converted FAT directory entry name
-            free(fat_name);
-            // Free data buffer
-            free(data);
-            
+            free(dirent);
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
 #endif
             return err;
         }
-        
-        for (int pos_index = 0; pos_index < BytesPerClus / 32; pos_index++) {
-            
-            uint8_t *dirent_data = &data[pos_index * 32];
-            
-            if (memcmp(fat_name, &dirent_data[0], 11) == 0) {
-#if PRINT_DEBUG
-                debug_printf("SAME NAME\n");
-#endif
-                // Allocating memory for return dirent
-                struct fat_dirent *dirent = calloc(1, sizeof(struct fat_dirent));
-                
-                // Set size of dirent
-                dirent->size = *((uint32_t *) &dirent_data[28]);
-                
-                // Set name of dirent
-                memcpy(&dirent->name, &dirent_data[0], 11);
-                
-                // Set parent directory first cluster number
-                dirent->parent_cluster_nr = curr_dirent->first_cluster_nr;
-                
-                // Set position in parent directory
-                dirent->parent_pos = (cluster_index * BytesPerClus / 32) + pos_index;
-                
-                // Set if dirent is a directory
-                dirent->is_dir = dirent_data[11] & 0x18;
-                
-                // Set first cluster number of dirent
-                dirent->first_cluster_nr = *((uint16_t *) &dirent_data[26]) | *((uint16_t *) &dirent_data[20]) << 16;
-                
-                // Return newly allocated dirent
-                *ret_dirent = dirent;
-                
-                // Free data buffer
-                free(data);
-                
-                return SYS_ERR_OK;
-                
-            }
-            
-        }
-        
-        // Update temp_nr to be next cluster_nr and check if it is EOF
-        if (0x0FFFFFF8 <= (temp_nr = getFATEntry(temp_nr))) {
-            isEOF = true;
-        }
-        
     }
     
-    // Free converted FAT directory entry name
-    free(fat_name);
-    
-    // Free data buffer
-    free(data);
+    // Return newly allocated dirent
+    *ret_dirent = dirent;
     
-    return FAT_ERR_FAT_LOOKUP;
+    return SYS_ERR_OK;
     
 }
 
@@ -649,6 +601,9 @@ errval_t remove_dirent(struct fat_dirent *dirent) {
         return err;
     }
     
+    // Open handles of the file refer to freed clusters now
+    fat_handle_invalidate(dirent->parent_cluster_nr, dirent->parent_pos);
+    
     // Zeros out all FAT entries of dirent's cluster chain
     err = remove_fat_entries(dirent->first_cluster_nr);
     if (err_is_fail(err)) {
@@ -814,7 +769,8 @@ errval_t find_free_dir_entry(size_t cluster_nr, size_t *ret_pos) {
     }
     
     // Return position that would be free after appending the cluster chain
-    *ret_pos = (cluster_index * EntriesPerClus) + pos_index;
+    // (cluster_index is the number of clusters in the directory by now)
+    *ret_pos = cluster_index * EntriesPerClus;
     
     free(data);
                            
@@ -922,6 +878,9 @@ errval_t add_dir_entry(size_t cluster_nr, struct DIR_Entry *dir_data, size_t *re
         return err;
     }
     
+    // Add entry to the name index of the directory
+    fat_dentry_insert(cluster_nr, dir_data->Name, pos, dir_data->FstClus, dir_data->Attr & 0x18);
+    
     // Set return position
     *ret_pos = pos;
     
@@ -987,6 +946,16 @@ errval_t remove_dir_entry(size_t cluster_nr, size_t pos) {
 #if PRINT_DEBUG
     debug_printf("remove dir entry %zu %zu\n", cluster_nr, pos);
 #endif
+    // Name of the entry for the name index of the directory
+    char name[11];
+    err = read_cluster_chain(cluster_nr, name, pos * 32, 11);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
+    
     // Set directory entry region [0, 10] to indicate free entry
     uint8_t empty_name_buffer[11];
     memset(empty_name_buffer, 0, 11);
@@ -1014,6 +983,9 @@ errval_t remove_dir_entry(size_t cluster_nr, size_t pos) {
         return err;
     }
     
+    // Remove entry from the name index of the directory
+    fat_dentry_remove(cluster_nr, name);
+    
     return err;
     
 }
@@ -1123,6 +1095,10 @@ errval_t remove_fat_entries(size_t cluster_nr) {
     
     errval_t err = SYS_ERR_OK;
     
+    // Forget the extent map of the chain and the index if it is a directory
+    fat_extent_invalidate(cluster_nr);
+    fat_dentry_invalidate(cluster_nr);
+    
     // Current cluster number
     size_t curr_nr = cluster_nr;
     
@@ -1157,6 +1133,9 @@ errval_t remove_fat_entries(size_t cluster_nr) {
             return err;
         }
         
+        // Give the cluster back to the allocator
+        fat_alloc_free(curr_nr);
+        
         // Update current cluster number to next cluster number
         curr_nr = next_nr;
         
@@ -1168,50 +1147,44 @@ errval_t remove_fat_entries(size_t cluster_nr) {
 
 errval_t remove_fat_entries_from(size_t cluster_nr, size_t start_index) {
     
-    errval_t err = SYS_ERR_OK;
+    errval_t err;
     
-    // Current cluster number
-    size_t curr_nr = cluster_nr;
+    // The first cluster stays allocated since the directory entry refers to it
+    if (start_index < 1) {
+        start_index = 1;
+    }
     
-    // Next cluster number
-    size_t next_nr;
+    // New last cluster of the chain
+    size_t last_nr;
+    err = fat_extent_lookup(cluster_nr, start_index - 1, &last_nr, NULL);
+    if (err_is_fail(err)) {
+        // Chain is already shorter
+        return err == FAT_ERR_CLUSTER_BOUNDS ? SYS_ERR_OK : err;
+    }
     
-    // End of file
-    bool isEOF = false;
+    // First cluster to be removed
+    size_t next_nr = getFATEntry(last_nr);
     
-    // Set cluster chain entries in FAT to zero
-    for (int cluster_index = 0; !isEOF; cluster_index++) {
-        
-        // Set next cluster number to be next cluster number of current cluster number and check if it is EOC
-        if (0x0FFFFFF8 <= (next_nr = getFATEntry(curr_nr))) {
-            isEOF = true;
-        }
-        
-        // Check that current cluster number is not one of the first two special FAT entries
-        if (curr_nr < 2) {
+    // Terminate the chain after the new last cluster
+    err = setFATEntry(last_nr, 0x0FFFFFFF);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("Current cluster number is in first two special FAT entries\n");
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            break;
-        }
-        
-        // Only start setting FAT entries to zero when we have reached
-        if (start_index <= cluster_index) {
-            
-            // Set current cluster number FAT entry to zero
-            err = setFATEntry(curr_nr, 0);
-            if (err_is_fail(err)) {
+        return err;
+    }
+    
+    fat_extent_truncate(cluster_nr, start_index);
+    
+    // Set the FAT entries of the rest of the chain to zero
+    if (2 <= next_nr && next_nr < 0x0FFFFFF7) {
+        err = remove_fat_entries(next_nr);
+        if (err_is_fail(err)) {
 #if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
+            debug_printf("%s\n", err_getstring(err));
 #endif
-                return err;
-            }
-
+            return err;
         }
-        
-        // Update current cluster number to next cluster number
-        curr_nr = next_nr;
-        
     }
     
     return err;
@@ -1229,27 +1202,18 @@ errval_t read_dirent(struct fat_dirent *dirent, void *buffer, size_t start, size
     assert(dirent != NULL);
     assert(bytes_read != NULL);
 
-    // Current file size
-    size_t file_size;
-    
-    // Get the current file size from parent directory entry
-    err = get_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, &file_size);
-    if (err_is_fail(err)) {
-#if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
-#endif
-        return err;
-    }
+    // Current file size (kept current by the handle the dirent belongs to)
+    size_t file_size = dirent->size;
     
     // Check if requested region start is in file bounds
     if (start >= file_size) {
         *bytes_read = 0;
-        return err;
+        return SYS_ERR_OK;
     }
     
     // Check if entire requested region in file bounds and if not shorten it
     if (start + bytes > file_size) {
-        bytes = (start + bytes) - file_size;
+        bytes = file_size - start;
     }
     
     //assert(start + bytes <= file_size);
@@ -1277,17 +1241,8 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
     assert(dirent != NULL);
     assert(bytes_written != NULL);
     
-    // Current file size
-    size_t file_size;
-    
-    // Get the current file size from parent directory entry
-    err = get_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, &file_size);
-    if (err_is_fail(err)) {
-#if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
-#endif
-        return err;
-    }
+    // Current file size (kept current by the handle the dirent belongs to)
+    size_t file_size = dirent->size;
     
     // Current data buffer
     uint8_t *data = buffer;
@@ -1315,18 +1270,16 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
     // Bytes per cluster
     size_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    // Old count of clusters (round up)
-    size_t old_cluster_count = (file_size + (BytesPerClus - 1)) / BytesPerClus;
-    
     // New count of clusters (round up)
     size_t new_cluster_count = (start + bytes + (BytesPerClus - 1)) / BytesPerClus;
     
-    // Check if appending of new clusters is required
-    if (old_cluster_count < new_cluster_count) {
-        
-        // Append cluster chain by difference
-        append_cluster_chain(dirent->first_cluster_nr, new_cluster_count - old_cluster_count);
-    
+    // Append clusters if the cluster chain is too short
+    err = reserve_cluster_chain(dirent->first_cluster_nr, new_cluster_count);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
     }
     
     // Write data to cluster chain region
@@ -1338,16 +1291,22 @@ errval_t write_dirent(struct fat_dirent *dirent, void *buffer, size_t start, siz
         return err;
     }
     
-    // Update file size
-    file_size = MAX(file_size, start + bytes);
-
-    // Set new file size in parent directory entry
-    err = set_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, file_size);
-    if (err_is_fail(err)) {
+    // Set new file size in parent directory entry if the write extended the file
+    if (start + bytes > file_size) {
+        
+        file_size = start + bytes;
+        
+        err = set_dir_entry_size(dirent->parent_cluster_nr, dirent->parent_pos, file_size);
+        if (err_is_fail(err)) {
 #if PRINT_DEBUG
-        debug_printf("%s\n", err_getstring(err));
+            debug_printf("%s\n", err_getstring(err));
 #endif
-        return err;
+            return err;
+        }
+        
+        // Keep the size of the caller's dirent current
+        dirent->size = file_size;
+        
     }
     
     // Return actual bytes written (can be more due to padding)
@@ -1372,16 +1331,24 @@ errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes) {
     // Bytes per cluster
     size_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    // Calculate amount of old clusters
-    size_t old_cluster_count = (dirent->size + (BytesPerClus - 1)) / BytesPerClus;
-
+    // Get the actual length of the chain, which can reach past the file size
+    // if clusters were preallocated
+    size_t last_cluster_nr;
+    size_t old_cluster_count;
+    err = fat_extent_last(dirent->first_cluster_nr, &last_cluster_nr, &old_cluster_count);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
     // Calculate amount of new clusters needed
     size_t new_cluster_count = (bytes + (BytesPerClus - 1)) / BytesPerClus;
     
     if (old_cluster_count < new_cluster_count) {
     
-        err = append_cluster_chain(dirent->first_cluster_nr, new_cluster_count - old_cluster_count);
+        err = reserve_cluster_chain(dirent->first_cluster_nr, new_cluster_count);
         if (err_is_fail(err)) {
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
@@ -1392,7 +1359,7 @@ errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes) {
     } else if (old_cluster_count > new_cluster_count) {
         
         // Remove all FAT entries from index new_cluster_count (starting with 0)
-        remove_fat_entries_from(dirent->first_cluster_nr, new_cluster_count);
+        err = remove_fat_entries_from(dirent->first_cluster_nr, new_cluster_count);
         if (err_is_fail(err)) {
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
@@ -1402,6 +1369,9 @@ errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes) {
         
     }
     
+    // Keep the size of the caller's dirent current
+    dirent->size = bytes;
+    
     return err;
     
 }
@@ -1412,60 +1382,52 @@ errval_t truncate_dirent(struct fat_dirent *dirent, size_t bytes) {
 
 errval_t read_cluster(size_t cluster_nr, void *buffer) {
     
-    errval_t err = SYS_ERR_OK;
-    
-    // Sector number of cluster that occupies the data
-    size_t sector_nr = getFirstSectorOfCluster(cluster_nr);
+    errval_t err;
     
-    // Temporal buffer
-    uint8_t *temp_buffer = buffer;
+    // Bytes per cluster
+    uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    for (int i = 0; i < BPB_SecPerClus; i++) {
-        
-        // Read part of cluster and write it to buffer
-        err = mmchs_read_block(sector_nr + i, temp_buffer);
-        if (err_is_fail(err)) {
+    // Get cluster from block cache
+    struct block_cache_buf *buf;
+    err = block_cache_get(cluster_nr, BLOCK_CACHE_READ, &buf);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            return err;
-        }
-        
-        // Update temporal buffer
-        temp_buffer += BPB_BytsPerSec;
-        
+        return err;
     }
     
+    // Copy cluster to buffer
+    memcpy(buffer, buf->data, BytesPerClus);
+    
+    block_cache_release(buf, false);
+    
     return err;
     
 }
 
 errval_t write_cluster(size_t cluster_nr, void *buffer) {
     
-    errval_t err = SYS_ERR_OK;
-    
-    // Sector number of cluster that occupies the data
-    size_t sector_nr = getFirstSectorOfCluster(cluster_nr);
+    errval_t err;
     
-    // Temporal buffer
-    uint8_t *temp_buffer = buffer;
+    // Bytes per cluster
+    uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
-    for (int i = 0; i < BPB_SecPerClus; i++) {
-        
-        // Write back part of buffer
-        err = mmchs_write_block(sector_nr + i, temp_buffer);
-        if (err_is_fail(err)) {
+    // Get cluster from block cache without reading it from the card
+    struct block_cache_buf *buf;
+    err = block_cache_get(cluster_nr, BLOCK_CACHE_OVERWRITE, &buf);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            return err;
-        }
-        
-        // Update temporal buffer
-        temp_buffer += BPB_BytsPerSec;
-
+        return err;
     }
     
+    // Copy buffer to cluster (written back by block_cache_sync() or on eviction)
+    memcpy(buf->data, buffer, BytesPerClus);
+    
+    block_cache_release(buf, true);
+    
     return err;
     
 }
@@ -1477,11 +1439,18 @@ errval_t read_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size_
     
     errval_t err = SYS_ERR_OK;
     
+    if (bytes == 0) {
+        return err;
+    }
+    
     // Bytes per cluster
     uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
     // Temporal cluster number
-    size_t temp_nr = cluster_nr;
+    size_t temp_nr = 0;
+    
+    // Remaining clusters in the current run of contiguous clusters
+    size_t run = 0;
     
     // Temporal buffer of data to be read from cluster chain
     uint8_t *temp_buf = buffer;
@@ -1492,83 +1461,61 @@ errval_t read_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size_
     // Index of last cluster that covers requested region (inclusive)
     size_t end_index = (start + bytes - 1) / BytesPerClus;
     
-    // Offset for first cluster that covers requested region
-    size_t offset;
-    
-    // Carryover for last cluster that covers requested region
-    size_t carryover;
+    // Cached cluster
+    struct block_cache_buf *buf;
     
-    // Data buffer for the data of one cluster
-    uint8_t data[BytesPerClus];
 #if PRINT_DEBUG
     debug_printf("start_index: %zu end_index: %zu\n", start_index, end_index);
 #endif
-    bool isEOF = false;
-    
-    int cluster_index;
-    
-    for (cluster_index = 0; !isEOF && cluster_index <= end_index; cluster_index++) {
+    for (size_t cluster_index = start_index; cluster_index <= end_index; cluster_index++) {
         
-        if (start_index <= cluster_index && cluster_index <= end_index) {
-            
-            // Set offset if first cluster that covers requested region
-            if (cluster_index == start_index) {
-                offset = start % BytesPerClus;
-            } else {
-                offset = 0;
-            }
-            
-            // Set carryover if last cluster that covers requested region
-            if (cluster_index == end_index) {
-                carryover = BytesPerClus - ((start + bytes) % BytesPerClus);
-            } else {
-                carryover = 0;
-            }
+        // Look up cluster in the extent map at the start of every run
+        if (run == 0) {
+            err = fat_extent_lookup(cluster_nr, cluster_index, &temp_nr, &run);
+            if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("offset: %zu carryover: %zu\n", offset, carryover);
+                debug_printf("Input range was too big for file\n");
 #endif
-            // Actual bytes that are copied fron data to temp_buf
-            size_t copy_size = BytesPerClus - offset - carryover;
-
-            // Read data from cluster[temp_nr] in data section
-            err = read_cluster(temp_nr, (void *) data);
-            if (err_is_fail(err)) {
-                debug_printf("%s\n", err_getstring(err));
                 return err;
             }
-            
-            //debug_printf("Copy size %zu\n", copy_size);
-            
-            // Copy data from data (with offset) into temp_buf
-            memcpy(temp_buf, data + offset, copy_size);
-            
-            // Increment temp_buf pointer by the amount of data copied over
-            temp_buf += copy_size;
-            
+        } else {
+            temp_nr++;
         }
+        run--;
         
-        // Update temp_nr to be next cluster_nr and check if it is EOF
-        if (0x0FFFFFF8 <= (temp_nr = getFATEntry(temp_nr))) {
-#if PRINT_DEBUG
-            debug_printf("is EOF\n");
-#endif
-            isEOF = true;
+        // Offset for first cluster that covers requested region
+        size_t offset = (cluster_index == start_index) ? start % BytesPerClus : 0;
+        
+        // Carryover for last cluster that covers requested region
+        size_t carryover = 0;
+        if (cluster_index == end_index) {
+            carryover = (BytesPerClus - ((start + bytes) % BytesPerClus)) % BytesPerClus;
         }
 #if PRINT_DEBUG
-        debug_printf("temp_nr: %zu\n", temp_nr);
+        debug_printf("offset: %zu carryover: %zu\n", offset, carryover);
 #endif
+        // Actual bytes that are copied fron data to temp_buf
+        size_t copy_size = BytesPerClus - offset - carryover;
+        
+        // Get cluster[temp_nr] in data section from block cache
+        err = block_cache_get(temp_nr, BLOCK_CACHE_READ, &buf);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            return err;
+        }
+        
+        // Copy data from cluster (with offset) into temp_buf
+        memcpy(temp_buf, buf->data + offset, copy_size);
+        
+        block_cache_release(buf, false);
+        
+        // Increment temp_buf pointer by the amount of data copied over
+        temp_buf += copy_size;
+        
     }
-    
-    if (isEOF && !(cluster_index > end_index)) {
-#if PRINT_DEBUG
-        debug_printf("Input range was too big for file\n");
-        return FAT_ERR_CLUSTER_BOUNDS;
-#endif
-    } else {
 #if PRINT_DEBUG
-        debug_printf("Successfully read file with starting cluster %zu in range [%zu,%zu]\n", cluster_nr, start, start + bytes - 1);
+    debug_printf("Successfully read file with starting cluster %zu in range [%zu,%zu]\n", cluster_nr, start, start + bytes - 1);
 #endif
-    }
     
     return err;
 
@@ -1578,11 +1525,18 @@ errval_t write_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size
     
     errval_t err = SYS_ERR_OK;
     
+    if (bytes == 0) {
+        return err;
+    }
+    
     // Bytes per cluster
     uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
     
     // Temporal cluster number
-    size_t temp_nr = cluster_nr;
+    size_t temp_nr = 0;
+    
+    // Remaining clusters in the current run of contiguous clusters
+    size_t run = 0;
     
     // Temporal buffer of data to be read from cluster chain
     uint8_t *temp_buf = buffer;
@@ -1593,97 +1547,65 @@ errval_t write_cluster_chain(size_t cluster_nr, void *buffer, size_t start, size
     // Index of last cluster that covers requested region (inclusive)
     size_t end_index = (start + bytes - 1) / BytesPerClus;
     
-    // Offset for first cluster that covers requested region
-    size_t offset;
-    
-    // Carryover for last cluster that covers requested region
-    size_t carryover;
-    
-    // Data buffer for the data of one cluster
-    uint8_t *data = calloc(1, BytesPerClus);
-    
-    bool isEOF = false;
-
-    int cluster_index;
+    // Cached cluster
+    struct block_cache_buf *buf;
     
-    for (cluster_index = 0; !isEOF && cluster_index <= end_index; cluster_index++) {
+    for (size_t cluster_index = start_index; cluster_index <= end_index; cluster_index++) {
         
-        if (start_index <= cluster_index && cluster_index <= end_index) {
-            
-            // Set offset if first cluster that covers requested region
-            if (cluster_index == start_index) {
-                offset = start % BytesPerClus;
-            } else {
-                offset = 0;
-            }
-            
-            // Set carryover if last cluster that covers requested region
-            if (cluster_index == end_index) {
-                carryover = BytesPerClus - ((start + bytes) % BytesPerClus);
-            } else {
-                carryover = 0;
-            }
-            
-            // Actual bytes that are copied fron temp_buf to data
-            size_t copy_size = BytesPerClus - offset - carryover;
-            
-            // Copy previously stored data into data buffer if not entire cluster is overwritten
-            if (copy_size < BytesPerClus) {
-                
-                // Read data from cluster[temp_nr] in data section
-                err = read_cluster(temp_nr, (void *) data);
-                if (err_is_fail(err)) {
-#if PRINT_DEBUG
-                    debug_printf("%s\n", err_getstring(err));
-#endif
-                    return err;
-                }
-                
-            }
-#if PRINT_DEBUG
-            debug_printf("offset: %zu carryover: %zu copy_size: %zu\n", offset, carryover, copy_size);
-#endif
-            
-            // Copy data from temp_buf into data (with offset)
-            memcpy(data + offset, temp_buf, copy_size);
-            
-            // Write data to cluster[temp_nr] in data section
-            err = write_cluster(temp_nr, (void *) data);
+        // Look up cluster in the extent map at the start of every run
+        if (run == 0) {
+            err = fat_extent_lookup(cluster_nr, cluster_index, &temp_nr, &run);
             if (err_is_fail(err)) {
-                // Free data
-                free(data);
 #if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
+                debug_printf("Input range was too big for file\n");
 #endif
                 return err;
             }
-            
-            // Increment temp_buf pointer by the amount of data copied over
-            temp_buf += copy_size;
-            
+        } else {
+            temp_nr++;
         }
+        run--;
         
-        // Update temp_nr to be next cluster_nr and check if it is EOF
-        if (0x0FFFFFF8 <= (temp_nr = getFATEntry(temp_nr))) {
-            isEOF = true;
+        // Offset for first cluster that covers requested region
+        size_t offset = (cluster_index == start_index) ? start % BytesPerClus : 0;
+        
+        // Carryover for last cluster that covers requested region
+        size_t carryover = 0;
+        if (cluster_index == end_index) {
+            carryover = (BytesPerClus - ((start + bytes) % BytesPerClus)) % BytesPerClus;
         }
         
-    }
-    
-    if (isEOF && cluster_index < end_index) {
+        // Actual bytes that are copied fron temp_buf to data
+        size_t copy_size = BytesPerClus - offset - carryover;
+        
+        // Get cluster[temp_nr] in data section from block cache (only loaded
+        // from the card if not entire cluster is overwritten)
+        err = block_cache_get(temp_nr,
+                              copy_size < BytesPerClus ? BLOCK_CACHE_UPDATE : BLOCK_CACHE_OVERWRITE,
+                              &buf);
+        if (err_is_fail(err)) {
 #if PRINT_DEBUG
-        debug_printf("Input range was too big for file\n");
+            debug_printf("%s\n", err_getstring(err));
 #endif
-        return FAT_ERR_CLUSTER_BOUNDS;
-        
-    } else {
+            return err;
+        }
 #if PRINT_DEBUG
-        debug_printf("Successfully write file with starting cluster %zu in range [%zu,%zu]\n", cluster_nr, start, start + bytes - 1);
+        debug_printf("offset: %zu carryover: %zu copy_size: %zu\n", offset, carryover, copy_size);
 #endif
+        
+        // Copy data from temp_buf into cluster (with offset)
+        memcpy(buf->data + offset, temp_buf, copy_size);
+        
+        // Cluster is written back by block_cache_sync() or on eviction
+        block_cache_release(buf, true);
+        
+        // Increment temp_buf pointer by the amount of data copied over
+        temp_buf += copy_size;
+        
     }
-    
-    // Free data
-    free(data);
+#if PRINT_DEBUG
+    debug_printf("Successfully write file with starting cluster %zu in range [%zu,%zu]\n", cluster_nr, start, start + bytes - 1);
+#endif
     
     return err;
     
@@ -1694,22 +1616,10 @@ uint32_t find_free_fat_entry_and_set(size_t start_search_entry, uint32_t value)
     
     errval_t err;
     
-    // Set it search entry to start with at least to 2
-    if (start_search_entry < 2) {
-        start_search_entry = 2;
-    }
-    
-    // Number of FAT entries that fit into one sector
-    size_t FATEntPerSec = BPB_BytsPerSec/sizeof(uint32_t);
-
-    // Buffer for FAT sector
-    uint32_t *buffer = calloc(FATEntPerSec, sizeof(uint32_t));
-    
-    // FAT sector that contains nth entry
-    size_t ThisFATSecNum = BPB_ResvdSecCnt + (start_search_entry / FATEntPerSec);
-    
-    // Read new FAT sector into buffer
-    err = mmchs_read_block(ThisFATSecNum, buffer);
+    // Free cluster (start_search_entry is taken if it is free)
+    size_t cluster_nr;
+    size_t count;
+    err = fat_alloc_run(1, start_search_entry, &cluster_nr, &count);
     if (err_is_fail(err)) {
 #if PRINT_DEBUG
         debug_printf("%s\n", err_getstring(err));
@@ -1717,59 +1627,16 @@ uint32_t find_free_fat_entry_and_set(size_t start_search_entry, uint32_t value)
         return -1;
     }
     
-    // FAT entry in that sector
-    size_t ThisFATEnt = start_search_entry % FATEntPerSec;
-
-    for (int n = start_search_entry; n < FATEntPerSec * FATSz; n++) {
-        
-        if (n % FATEntPerSec == 0) {
-            
-            // Update FAT sector that contains nth entry
-            ThisFATSecNum = BPB_ResvdSecCnt + (n / FATEntPerSec);
-            
-            // Read new FAT sector into buffer
-            err = mmchs_read_block(ThisFATSecNum, buffer);
-            if (err_is_fail(err)) {
-                free(buffer);
-#if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
-#endif
-                return -1;
-            }
-            
-        }
-        
-        // Update FAT entry in that sector
-        ThisFATEnt = n % FATEntPerSec;
-
-        if ((n >= 2) && (buffer[ThisFATEnt] == 0)) {
-            
-            // Change FAT entry to value without MSB
-            buffer[ThisFATEnt] = buffer[ThisFATEnt] & 0xF0000000;
-            buffer[ThisFATEnt] = buffer[ThisFATEnt] | value;
-
-            // Write new FAT sector with changed free entry back
-            err = mmchs_write_block(ThisFATSecNum, buffer);
-            if (err_is_fail(err)) {
-                free(buffer);
+    // Set the claimed entry
+    err = fat_cache_set(cluster_nr, value);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-                debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-                return -1;
-            }
-            
-            free(buffer);
-            
-            return n;
-            
-        }
-        
+        return -1;
     }
     
-    free(buffer);
-    
-    // Couldn't find a free FAT entry
-    return -1;
+    return cluster_nr;
     
 }
 
@@ -1780,33 +1647,32 @@ errval_t append_cluster_chain(size_t cluster_nr, size_t cluster_count) {
     
     assert(cluster_count > 0);
     
-    // Current cluster number
-    size_t curr_nr = cluster_nr;
-    
-    // Next cluster number
-    size_t next_nr;
-    
-    // End of file
-    bool isEOF = false;
+    // Current cluster number (last cluster of the chain)
+    size_t curr_nr;
+    err = fat_extent_last(cluster_nr, &curr_nr, NULL);
+    if (err_is_fail(err)) {
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(err));
+#endif
+        return err;
+    }
     
-    // Set cluster chain entries in FAT to zero
-    while(!isEOF) {
-        
-        // Set next cluster number to be next cluster number of current cluster number and check if it is EOC
-        if (0x0FFFFFF8 <= (next_nr = getFATEntry(curr_nr))) {
-            isEOF = true;
-        }
+    // Append cluster_count clusters to the end of the cluster chain
+    while (cluster_count > 0) {
         
-        // Check that current cluster number is not one of the first two special FAT entries
-        if (next_nr < 2) {
+        // Allocate a run of clusters, preferably right behind the end of the chain
+        size_t run_nr;
+        size_t run_count;
+        err = fat_alloc_run(cluster_count, curr_nr + 1, &run_nr, &run_count);
+        if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("Current cluster number is in first two special FAT entries\n");
+            debug_printf("%s\n", err_getstring(err));
 #endif
-            break;
+            return err;
         }
         
-        // Set current cluster number FAT entry to zero
-        err = setFATEntry(curr_nr, 0);
+        // Let current FAT entry point to the first cluster of the run
+        err = setFATEntry(curr_nr, run_nr);
         if (err_is_fail(err)) {
 #if PRINT_DEBUG
             debug_printf("%s\n", err_getstring(err));
@@ -1814,50 +1680,60 @@ errval_t append_cluster_chain(size_t cluster_nr, size_t cluster_count) {
             return err;
         }
         
-        // Update current cluster number to next cluster number
-        curr_nr = next_nr;
+        // Add the clusters to the extent map of the chain
+        for (size_t i = 0; i < run_count; i++) {
+            fat_extent_append(cluster_nr, run_nr + i);
+        }
+        
+        // Update current cluster number to the last cluster of the run
+        curr_nr = run_nr + run_count - 1;
+        
+        cluster_count -= run_count;
         
     }
     
-    // Entry to start searching for the next free FAT entry
-    size_t free_entry = 0;
+    return err;
     
-    // Append cluster_count clusters to the end of the cluster chain
-    for (int i = 0; i < cluster_count; i++) {
-        
-        // Find a free FAT entry and set it to value 0x0FFFFFFF
-        next_nr = find_free_fat_entry_and_set(free_entry, 0x0FFFFFFF);
-        if (next_nr == -1) {
+}
+
+errval_t reserve_cluster_chain(size_t cluster_nr, size_t cluster_count) {
+    
+    errval_t err;
+    
+    // Current length of the cluster chain
+    size_t last_nr;
+    size_t chain_count;
+    err = fat_extent_last(cluster_nr, &last_nr, &chain_count);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("FAT full! Couldn't find a free entry...\n");
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            return FAT_ERR_FAT_LOOKUP;
-        }
-        
-        // Update entry to start searching for the next free FAT entry
-        free_entry = next_nr + 1;
-        
-        /*
-        // Mark this FAT entry as taken
-        err = setFATEntry(next_nr, 0x0FFFFFFF);
-        if (err_is_fail(err)) {
-            debug_printf("%s\n", err_getstring(err));
-            return err;
-        }
-        */
-        
-        // Let current FAT entry point to next (previously free) FAT entry
-        err = setFATEntry(curr_nr, next_nr);
-        if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Clusters beyond the file size (e.g. preallocated ones) are used first
+    if (chain_count < cluster_count) {
+        err = append_cluster_chain(cluster_nr, cluster_count - chain_count);
+    }
+    
+    return err;
+    
+}
+
+errval_t preallocate_dirent(struct fat_dirent *dirent, size_t bytes) {
+    
+    errval_t err;
+    
+    // Bytes per cluster
+    size_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
+    
+    // Reserve the clusters without changing the file size
+    err = reserve_cluster_chain(dirent->first_cluster_nr, (bytes + (BytesPerClus - 1)) / BytesPerClus);
+    if (err_is_fail(err)) {
 #if PRINT_DEBUG
-            debug_printf("%s\n", err_getstring(err));
+        debug_printf("%s\n", err_getstring(err));
 #endif
-            return err;
-        }
-        
-        // Update current cluster number to next cluster number
-        curr_nr = next_nr;
-        
+        return err;
     }
     
     return err;
@@ -2049,6 +1925,110 @@ errval_t fatfs_serv_readdir(size_t cluster_nr, size_t dir_index, struct fat_dire
     
 }
 
+errval_t fatfs_serv_readdir_batch(size_t cluster_nr, size_t *cursor, void *buffer, size_t bytes,
+                                  size_t *ret_count, size_t *ret_bytes, bool *ret_end) {
+    
+    errval_t err;
+    
+    assert(cursor != NULL);
+    assert(ret_count != NULL && ret_bytes != NULL && ret_end != NULL);
+    
+    // Bytes per cluster
+    uint32_t BytesPerClus = BPB_BytsPerSec * BPB_SecPerClus;
+    
+    // Entries per cluster
+    size_t EntriesPerClus = BytesPerClus / 32;
+    
+    // Directory entry position to continue at
+    size_t pos = *cursor;
+    
+    // Number and bytes of packed entries
+    size_t count = 0;
+    size_t offset = 0;
+    
+    bool isEOF = false;
+    bool isFull = false;
+    
+    while (!isEOF && !isFull) {
+        
+        // Find cluster of the position without walking the chain from the start
+        size_t temp_nr;
+        err = fat_extent_lookup(cluster_nr, pos / EntriesPerClus, &temp_nr, NULL);
+        if (err == FAT_ERR_CLUSTER_BOUNDS) {
+            isEOF = true;
+            break;
+        }
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            return err;
+        }
+        
+        struct block_cache_buf *buf;
+        err = block_cache_get(temp_nr, BLOCK_CACHE_READ, &buf);
+        if (err_is_fail(err)) {
+#if PRINT_DEBUG
+            debug_printf("%s\n", err_getstring(err));
+#endif
+            return err;
+        }
+        
+        for (size_t pos_index = pos % EntriesPerClus; pos_index < EntriesPerClus; pos_index++, pos++) {
+            
+            uint8_t *dir_entry = &buf->data[pos_index * 32];
+            
+            if (dir_entry[0] == 0x00) {
+                // Free entry and no more entries after this one
+                isEOF = true;
+                break;
+            } else if (dir_entry[0] == 0xE5 || dir_entry[11] == 0x0F) {
+                // Free entry or part of a long name
+                continue;
+            }
+            
+            // Name with '\0' for conversion
+            char fat_name[12];
+            memcpy(fat_name, dir_entry, 11);
+            fat_name[11] = '\0';
+            
+            char *name = convert_to_normal_name(fat_name);
+            
+            struct fs_fileinfo info = {
+                .type = (dir_entry[11] & 0x10) ? FS_DIRECTORY : FS_FILE,
+                .size = *((uint32_t *) &dir_entry[28])
+            };
+            
+            // Stop in front of the first entry that does not fit
+            isFull = !fs_dirbatch_add(buffer, bytes, &offset, name, &info);
+            
+            free(name);
+            
+            if (isFull) {
+                break;
+            }
+            
+            count++;
+            
+        }
+        
+        block_cache_release(buf, false);
+        
+    }
+    
+    if (count == 0 && isFull) {
+        return FS_ERR_BUFFER_TOO_SMALL;
+    }
+    
+    *cursor = pos;
+    *ret_count = count;
+    *ret_bytes = offset;
+    *ret_end = isEOF;
+    
+    return SYS_ERR_OK;
+    
+}
+
 errval_t fatfs_serv_mkdir(void *st, char *path) {
     
     errval_t err;
@@ -2114,6 +2094,13 @@ errval_t fatfs_serv_mkdir(void *st, char *path) {
     
     // Search for a free FAT entry and claim it
     size_t dir_cluster_nr = find_free_fat_entry_and_set(0, 0x0FFFFFFF);
+    if (dir_cluster_nr == (uint32_t) -1) {
+        free(parent);
+#if PRINT_DEBUG
+        debug_printf("%s\n", err_getstring(FAT_ERR_DISK_FULL));
+#endif
+        return FAT_ERR_DISK_FULL;
+    }
     
 #if PRINT_DEBUG
     debug_printf("dir_cluster_nr: %zu\n", dir_cluster_nr);
@@ -2260,6 +2247,9 @@ errval_t fatfs_serv_rmdir(void *st, char *path) {
         return err;
     }
     
+    // Open handles of the directory refer to freed clusters now
+    fat_handle_invalidate(dirent->parent_cluster_nr, dirent->parent_pos);
+    
     // Zeros out all FAT entries of dirent's cluster chain
     err = remove_fat_entries(dirent->first_cluster_nr);
     if (err_is_fail(err)) {
@@ -38,6 +38,7 @@ __FBSDID("$FreeBSD$");
 
 #include "namespace.h"
 #include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -103,6 +104,32 @@ __fread(void * __restrict buf, size_t size, size_t count, FILE * __restrict fp)
 		/* fp->_r = 0 ... done in __srefill */
 		p += r;
 		resid -= r;
+		/*
+		 * Once the buffer is drained, let __srefill() read the rest
+		 * of a large request straight into the caller's buffer rather
+		 * than one buffer size at a time.
+		 */
+		if ((fp->_flags & (__SMBF | __SRD)) == (__SMBF | __SRD) &&
+		    !HASUB(fp) &&
+		    resid >= (size_t)fp->_bf._size) {
+			struct __sbuf save = fp->_bf;
+			int eof;
+
+			fp->_bf._base = (unsigned char *)p;
+			fp->_bf._size = resid > INT_MAX ? INT_MAX : (int)resid;
+			eof = __srefill(fp);
+			r = fp->_r;
+			fp->_bf = save;
+			fp->_p = fp->_bf._base;
+			fp->_r = 0;
+			if (eof) {
+				/* no more input: return partial result */
+				return ((total - resid) / size);
+			}
+			p += r;
+			resid -= r;
+			continue;
+		}
 		if (__srefill(fp)) {
 			/* no more input: return partial result */
 			return ((total - resid) / size);
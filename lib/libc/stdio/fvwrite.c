@@ -36,6 +36,7 @@ static char sccsid[] = "@(#)fvwrite.c	8.1 (Berkeley) 6/4/93";
 #include <sys/cdefs.h>
 __FBSDID("$FreeBSD$");
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -138,7 +139,8 @@ __sfvwrite(FILE *fp, struct __suio *uio)
 				if (__fflush(fp))
 					goto err;
 			} else if (len >= (w = fp->_bf._size)) {
-				/* write directly */
+				/* write all whole chunks directly */
+				w = (len > INT_MAX ? INT_MAX : len) / w * w;
 				w = _swrite(fp, p, w);
 				if (w <= 0)
 					goto err;
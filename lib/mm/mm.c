@@ -10,6 +10,258 @@
 
 void coalesce_next(struct mm *mm, struct mmnode *node);
 
+// MARK: - Address index
+
+/*
+ * All nodes are kept in an AVL tree keyed by their base address, such that
+ * mm_free() can find the node of a region in O(log n) instead of walking the
+ * whole list.
+ */
+
+static inline int idx_height(struct mmnode *node)
+{
+    return (node != NULL) ? node->idx_height : 0;
+}
+
+static inline void idx_update(struct mmnode *node)
+{
+    int left = idx_height(node->idx_left);
+    int right = idx_height(node->idx_right);
+    node->idx_height = 1 + ((left > right) ? left : right);
+}
+
+static struct mmnode *idx_rotate_right(struct mmnode *node)
+{
+    struct mmnode *left = node->idx_left;
+    node->idx_left = left->idx_right;
+    left->idx_right = node;
+    idx_update(node);
+    idx_update(left);
+    return left;
+}
+
+static struct mmnode *idx_rotate_left(struct mmnode *node)
+{
+    struct mmnode *right = node->idx_right;
+    node->idx_right = right->idx_left;
+    right->idx_left = node;
+    idx_update(node);
+    idx_update(right);
+    return right;
+}
+
+static struct mmnode *idx_balance(struct mmnode *node)
+{
+    idx_update(node);
+    
+    int balance = idx_height(node->idx_left) - idx_height(node->idx_right);
+    
+    if (balance > 1) {
+        if (idx_height(node->idx_left->idx_left) < idx_height(node->idx_left->idx_right)) {
+            node->idx_left = idx_rotate_left(node->idx_left);
+        }
+        return idx_rotate_right(node);
+    }
+    
+    if (balance < -1) {
+        if (idx_height(node->idx_right->idx_right) < idx_height(node->idx_right->idx_left)) {
+            node->idx_right = idx_rotate_right(node->idx_right);
+        }
+        return idx_rotate_left(node);
+    }
+    
+    return node;
+}
+
+static struct mmnode *idx_insert(struct mmnode *root, struct mmnode *node)
+{
+    if (root == NULL) {
+        node->idx_left = NULL;
+        node->idx_right = NULL;
+        node->idx_height = 1;
+        return node;
+    }
+    
+    if (node->base < root->base) {
+        root->idx_left = idx_insert(root->idx_left, node);
+    } else {
+        root->idx_right = idx_insert(root->idx_right, node);
+    }
+    
+    return idx_balance(root);
+}
+
+static struct mmnode *idx_remove_min(struct mmnode *root, struct mmnode **min)
+{
+    if (root->idx_left == NULL) {
+        *min = root;
+        return root->idx_right;
+    }
+    
+    root->idx_left = idx_remove_min(root->idx_left, min);
+    
+    return idx_balance(root);
+}
+
+static struct mmnode *idx_remove(struct mmnode *root, struct mmnode *node)
+{
+    if (root == NULL) {
+        return NULL;
+    }
+    
+    if (node->base < root->base) {
+        root->idx_left = idx_remove(root->idx_left, node);
+    } else if (node->base > root->base) {
+        root->idx_right = idx_remove(root->idx_right, node);
+    } else {
+        
+        // Replace the removed node with the smallest node of its right subtree
+        struct mmnode *left = root->idx_left;
+        struct mmnode *right = root->idx_right;
+        if (right == NULL) {
+            return left;
+        }
+        
+        struct mmnode *min;
+        right = idx_remove_min(right, &min);
+        min->idx_left = left;
+        min->idx_right = right;
+        
+        return idx_balance(min);
+    }
+    
+    return idx_balance(root);
+}
+
+static struct mmnode *idx_find(struct mmnode *root, genpaddr_t base)
+{
+    while (root != NULL && root->base != base) {
+        root = (base < root->base) ? root->idx_left : root->idx_right;
+    }
+    return root;
+}
+
+// MARK: - Free lists
+
+/*
+ * Free nodes are kept in segregated lists, one per order (floor(log2(size))).
+ * `free_mask` has a bit set for every non-empty list, so the smallest order
+ * that is guaranteed to satisfy a request can be found with a single ctz.
+ */
+
+static inline unsigned log2_floor(gensize_t x)
+{
+    assert(x != 0);
+    return 63 - __builtin_clzll(x);
+}
+
+static inline unsigned log2_ceil(gensize_t x)
+{
+    return (x <= 1) ? 0 : 64 - __builtin_clzll(x - 1);
+}
+
+static void free_list_insert(struct mm *mm, struct mmnode *node)
+{
+    unsigned order = log2_floor(node->size);
+    
+    node->free_prev = NULL;
+    node->free_next = mm->free_lists[order];
+    if (node->free_next != NULL) {
+        node->free_next->free_prev = node;
+    }
+    mm->free_lists[order] = node;
+    mm->free_mask |= (1ULL << order);
+}
+
+static void free_list_remove(struct mm *mm, struct mmnode *node)
+{
+    unsigned order = log2_floor(node->size);
+    
+    if (node->free_prev != NULL) {
+        node->free_prev->free_next = node->free_next;
+    } else {
+        mm->free_lists[order] = node->free_next;
+    }
+    if (node->free_next != NULL) {
+        node->free_next->free_prev = node->free_prev;
+    }
+    if (mm->free_lists[order] == NULL) {
+        mm->free_mask &= ~(1ULL << order);
+    }
+    
+    node->free_prev = NULL;
+    node->free_next = NULL;
+}
+
+// MARK: - Node search
+
+static inline gensize_t align_padding(genpaddr_t base, size_t alignment)
+{
+    return (base % alignment != 0) ? alignment - (base % alignment) : 0;
+}
+
+static inline bool node_fits(struct mmnode *node, size_t size, size_t alignment,
+                             gensize_t *padding)
+{
+    *padding = align_padding(node->base, alignment);
+    return node->type == NodeType_Free &&
+           node->size >= *padding &&    // Preventing underflow in next line
+           node->size - *padding >= size;
+}
+
+static struct mmnode *find_first_fit(struct mm *mm, size_t size, size_t alignment,
+                                     gensize_t *padding)
+{
+    // Iterate the list of mmnodes
+    for (struct mmnode *node = mm->head; node != NULL; node = node->next) {
+        if (node_fits(node, size, alignment, padding)) {
+            return node;
+        }
+    }
+    
+    return NULL;
+}
+
+static struct mmnode *find_segregated_fit(struct mm *mm, size_t size, size_t alignment,
+                                          gensize_t *padding)
+{
+    // Any page aligned free block of at least this size satisfies the request
+    // regardless of where it starts
+    unsigned order = log2_ceil((gensize_t) size + alignment - BASE_PAGE_SIZE);
+    
+    // Take the head of the smallest non-empty order that is large enough
+    uint64_t mask = (order < MM_NUM_ORDERS) ? mm->free_mask & ~((1ULL << order) - 1) : 0;
+    while (mask != 0) {
+        struct mmnode *node = mm->free_lists[__builtin_ctzll(mask)];
+        if (node_fits(node, size, alignment, padding)) {
+            return node;
+        }
+        mask &= mask - 1;
+    }
+    
+    // Smaller orders may still contain a block that happens to be aligned
+    unsigned max_order = (order < MM_NUM_ORDERS) ? order : MM_NUM_ORDERS;
+    for (unsigned i = log2_floor(size); i < max_order; i++) {
+        for (struct mmnode *node = mm->free_lists[i]; node != NULL; node = node->free_next) {
+            if (node_fits(node, size, alignment, padding)) {
+                return node;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+static inline void list_insert_after(struct mmnode *node, struct mmnode *new_node)
+{
+    new_node->prev = node;
+    new_node->next = node->next;
+    if (node->next != NULL) {
+        node->next->prev = new_node;
+    }
+    node->next = new_node;
+}
+
 /**
  * Initialize the memory manager.
  *
@@ -34,6 +286,14 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
     mm->slot_alloc_inst = slot_alloc_inst;
     mm->head = NULL;
     mm->is_refilling = 0;
+    mm->strategy = MM_STRATEGY_SEGREGATED_FIT;
+    mm->free_mask = 0;
+    mm->idx_root = NULL;
+    mm->total = 0;
+    mm->available = 0;
+    for (int i = 0; i < MM_NUM_ORDERS; i++) {
+        mm->free_lists[i] = NULL;
+    }
     
     // Set the default refill function for the slab allocator
     if (slab_refill_func == NULL) {
@@ -45,6 +305,22 @@ errval_t mm_init(struct mm *mm, enum objtype objtype,
     return SYS_ERR_OK;
 }
 
+/**
+ * Select the strategy used for finding nodes.
+ *
+ * Both strategies maintain the same bookkeeping, so this may be changed at
+ * any point, e.g. to compare them with the same set of regions.
+ *
+ * \param  mm       The memory manager.
+ * \param  strategy The strategy to use from now on.
+ */
+void mm_set_strategy(struct mm *mm, enum mm_strategy strategy)
+{
+    assert(mm != NULL);
+    
+    mm->strategy = strategy;
+}
+
 /**
  * Destroys the memory allocator.
  */
@@ -69,6 +345,9 @@ errval_t mm_add(struct mm *mm, struct capref cap, genpaddr_t base, size_t size)
 
     // Allocating new block for mmnode:
     struct mmnode *newNode = slab_alloc((struct slab_allocator *)&mm->slabs);
+    if (newNode == NULL) {
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
     
     newNode->type = NodeType_Free;
     newNode->cap.cap = cap;
@@ -84,6 +363,13 @@ errval_t mm_add(struct mm *mm, struct capref cap, genpaddr_t base, size_t size)
     }
     mm->head = newNode;
     
+    // Index the node and make it available for allocation
+    mm->idx_root = idx_insert(mm->idx_root, newNode);
+    free_list_insert(mm, newNode);
+    
+    mm->total += size;
+    mm->available += size;
+    
     return SYS_ERR_OK;
 }
 
@@ -128,67 +414,62 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct c
         alignment = tempAlignment;
     }
     
+    // Make sure splitting the node cannot run out of slabs half way through
+    if (slab_freecount((struct slab_allocator *)&mm->slabs) < 2) {
+        return LIB_ERR_SLAB_ALLOC_FAIL;
+    }
+    
     struct mmnode *node;
-    size_t padding = 0;
+    gensize_t padding = 0;
     
-    // Iterate the list of mmnodes
-    for (node = mm->head; node != NULL; node = node->next) {
-
-        // Calculate the amount of padding needed at the beginning of the block to match the alignment criteria
-        padding = (node->base % alignment != 0) ? alignment - (node->base % alignment) : 0;
-
-        // Break if we found a free mmnode with sufficient size and correct alignment
-        if (node->type == NodeType_Free &&
-            node->size >= padding &&    // Preventing underflow in next line
-            node->size - padding >= size) {
-            break;
-        }
-        
+    // Find a free node with sufficient size and correct alignment
+    if (mm->strategy == MM_STRATEGY_FIRST_FIT) {
+        node = find_first_fit(mm, size, alignment, &padding);
+    } else {
+        node = find_segregated_fit(mm, size, alignment, &padding);
     }
 
     // Check if we actually found a node
     if (node != NULL) {
         
-        // Mark the node as allocated
-        node->type = NodeType_Allocated;
-
-        // Check if the memory region needs to be split at the back
-        if (node->size != padding + size) {
+        // The node is going to be resized, so take it off its free list
+        free_list_remove(mm, node);
+        
+        // Check if the memory region needs to be split at the front
+        if (padding != 0) {
             
             // Allocate new mmnode that will follow the `node` mmnode
             struct mmnode *newNode = slab_alloc((struct slab_allocator *)&mm->slabs);
             
-            // Calculate new bases and sizes
-            newNode->base = node->base + padding + size;
-            newNode->size = node->size - padding - size;
-            node->size = padding + size;
-            
-            // Set type of newNode
-            newNode->type = NodeType_Free;
+            // Calculate new bases and sizes, `node` keeps the padding
+            newNode->base = node->base + padding;
+            newNode->size = node->size - padding;
+            node->size = padding;
             
             // Copy capability info
             newNode->cap = node->cap;
             
             // Link stuff up
-            newNode->prev = node;
-            newNode->next = node->next;
-            if (node->next != NULL) {
-                node->next->prev = newNode;
-            }
-            node->next = newNode;
+            list_insert_after(node, newNode);
+            mm->idx_root = idx_insert(mm->idx_root, newNode);
+            
+            // The padding remains free
+            free_list_insert(mm, node);
+            
+            // Continue with the aligned part
+            node = newNode;
         }
         
-        // Check if the memory region needs to be split at the front
-        if (padding != 0) {
+        // Check if the memory region needs to be split at the back
+        if (node->size != size) {
             
-            // Allocate new mmnode that will precede the `node` mmnode
+            // Allocate new mmnode that will follow the `node` mmnode
             struct mmnode *newNode = slab_alloc((struct slab_allocator *)&mm->slabs);
             
             // Calculate new bases and sizes
-            newNode->base = node->base;
-            newNode->size = padding;
-            node->base += padding;
-            node->size -= padding;
+            newNode->base = node->base + size;
+            newNode->size = node->size - size;
+            node->size = size;
             
             // Set type of newNode
             newNode->type = NodeType_Free;
@@ -197,17 +478,15 @@ errval_t mm_alloc_aligned(struct mm *mm, size_t size, size_t alignment, struct c
             newNode->cap = node->cap;
             
             // Link stuff up
-            newNode->prev = node->prev;
-            newNode->next = node;
-            if (node->prev != NULL) {
-                node->prev->next = newNode;
-            }
-            node->prev = newNode;
-            if (mm->head == newNode) {
-                mm->head = newNode;
-            }
+            list_insert_after(node, newNode);
+            mm->idx_root = idx_insert(mm->idx_root, newNode);
+            free_list_insert(mm, newNode);
         }
         
+        // Mark the node as allocated
+        node->type = NodeType_Allocated;
+        mm->available -= node->size;
+        
         // Allocate a new slot for the returned capability
         errval_t errSlot = slot_alloc(retcap);
         if (!err_is_ok(errSlot)) {
@@ -280,11 +559,16 @@ errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t si
     
     struct mmnode *node;
 
-    // Walk the list of mmnodes until we find the node containing the memory region
-    for(node = mm->head; node != NULL; node = node->next) {
-        if (node->base == base) {
-            break;
+    if (mm->strategy == MM_STRATEGY_FIRST_FIT) {
+        // Walk the list of mmnodes until we find the node containing the memory region
+        for(node = mm->head; node != NULL; node = node->next) {
+            if (node->base == base) {
+                break;
+            }
         }
+    } else {
+        // Look the node up in the address index
+        node = idx_find(mm->idx_root, base);
     }
 
     // Check the node was found and isn't allocated
@@ -301,6 +585,7 @@ errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t si
     
     // Mark the region as free
     node->type = NodeType_Free;
+    mm->available += node->size;
 
     // Free the slot for the removed node
     slot_free(cap);
@@ -315,6 +600,9 @@ errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t si
         debug_printf("Coalescing with previous node\n");
 #endif
 
+        // The previous node is going to grow
+        free_list_remove(mm, node->prev);
+
         //Moving to previous node
         node = node->prev;
 
@@ -332,10 +620,16 @@ errval_t mm_free(struct mm *mm, struct capref cap, genpaddr_t base, gensize_t si
         debug_printf("Coalescing with next node\n");
 #endif
 
+        // The next node is absorbed
+        free_list_remove(mm, node->next);
+
         // Coalesce with next node
         coalesce_next(mm, node);
     }
 
+    // Make the (coalesced) region available again
+    free_list_insert(mm, node);
+
     // Summary
 #if PRINT_DEBUG
     debug_printf("Done! Free block of %llu bytes at 0x%llx\n", node->size, node->base);
@@ -354,6 +648,9 @@ void coalesce_next(struct mm *mm, struct mmnode *node) {
 
     struct mmnode *next_node = node->next;
 
+    // Remove the next node from the address index
+    mm->idx_root = idx_remove(mm->idx_root, next_node);
+
     // Remove the next node from the linked list
     node->next = node->next->next;
     if (node->next != NULL) {
@@ -366,17 +663,9 @@ void coalesce_next(struct mm *mm, struct mmnode *node) {
 
 errval_t mm_available(struct mm *mm, gensize_t *available, gensize_t *total) {
 
-    *available = 0;
-    *total = 0;
-    
-    for (struct mmnode *node = mm->head; node != NULL; node = node->next) {
-        if (node->type == NodeType_Free) {
-            *available += node->size;
-        }
-        *total += node->size;
-    }
+    *available = mm->available;
+    *total = mm->total;
     
     return SYS_ERR_OK;
     
 }
-
@@ -11,10 +11,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <aos/aos.h>
 #include <aos/aos_rpc.h>
+#include <aos/deferred.h>
+#include <aos/ump.h>
 
 
 // Bind to networkd
@@ -30,9 +33,11 @@ static errval_t bind_networkd(struct urpc_chan *chan) {
         return err;
     }
     
-    // Try to bind to networkd
+    // Try to bind to networkd, with deep rings for packet streams and pools
+    // packets are passed through in place
     //  Use LMP when on core 0!
-    err = urpc_bind(pid, chan, !disp_get_core_id());
+    err = urpc_bind_ring(pid, chan, !disp_get_core_id(), UMP_STREAM_DEPTH,
+                         UDP_SOCKET_POOL_SIZE);
     if (err_is_fail(err)) {
         chan = NULL;
         return err;
@@ -42,6 +47,103 @@ static errval_t bind_networkd(struct urpc_chan *chan) {
     
 }
 
+// Get the packet header in front of a payload
+static inline struct udp_urpc_packet *packet_of_payload(void *buf) {
+    return (struct udp_urpc_packet *) ((char *) buf -
+                                       offsetof(struct udp_urpc_packet, payload));
+}
+
+// Get the offset of a buffer in the pool we send from or the one networkd
+// sends from (-1 if it is not in the pool)
+static ptrdiff_t pool_offset(struct udp_socket *socket, bool tx, void *buf) {
+    
+    if (socket->chan.use_lmp) {
+        return -1;
+    }
+    
+    char *pool = tx ? socket->chan.ump->bulk_tx : socket->chan.ump->bulk_rx;
+    if (pool == NULL) {
+        return -1;
+    }
+    
+    ptrdiff_t offset = (char *) buf - pool;
+    if (offset < 0 ||
+        (size_t) offset >= socket->chan.ump->bulk_blocks * UMP_BULK_BLOCK_SIZE) {
+        return -1;
+    }
+    
+    return offset;
+    
+}
+
+// Receive a message without blocking, leaving payloads from networkd in the
+// shared pool
+static errval_t socket_recv(struct udp_socket *socket) {
+    
+    errval_t err;
+    
+    if (socket->chan.use_lmp) {
+        socket->pending_desc.length = 0;
+        err = urpc_recv(&socket->chan, &socket->pending, &socket->pending_size,
+                        &socket->pending_type);
+    }
+    else {
+        err = ump_recv_bulk(socket->chan.ump, &socket->pending,
+                            &socket->pending_size, &socket->pending_type,
+                            &socket->pending_desc);
+        if (err == LIB_ERR_NO_UMP_MSG) {
+            err = LIB_ERR_NO_URPC_MSG;
+        }
+    }
+    
+    if (err_is_fail(err)) {
+        socket->pending = NULL;
+    }
+    
+    return err;
+    
+}
+
+// Free a received message (or hand it back to networkd's pool)
+static void socket_release(struct udp_socket *socket, void *buf,
+                           struct ump_bulk_desc *desc) {
+    
+    if (socket->chan.use_lmp) {
+        free(buf);
+    }
+    else {
+        ump_bulk_release(socket->chan.ump, buf, desc);
+    }
+    
+}
+
+// Take the next message, waiting for one if necessary
+static errval_t socket_take(struct udp_socket *socket, void **buf,
+                            size_t *size, urpc_msg_type_t *msg_type,
+                            struct ump_bulk_desc *desc) {
+    
+    errval_t err;
+    
+    if (socket->pending == NULL) {
+        struct udp_pollfd fd = { .socket = socket };
+        size_t ready;
+        err = udp_poll(&fd, 1, UDP_POLL_FOREVER, &ready);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        assert(socket->pending != NULL);
+    }
+    
+    *buf = socket->pending;
+    *size = socket->pending_size;
+    *msg_type = socket->pending_type;
+    *desc = socket->pending_desc;
+    socket->pending = NULL;
+    
+    return SYS_ERR_OK;
+    
+}
+
 // Open a UDP socket and optionally bind to a specific port
 //  Specify port 0 to bind on random port.
 errval_t socket(struct udp_socket *socket, uint16_t port) {
@@ -56,6 +158,7 @@ errval_t socket(struct udp_socket *socket, uint16_t port) {
     
     // Set port the socket should bind to
     socket->pub.port = port;
+    socket->pending = NULL;
     
     // Send URPC messages
     err = urpc_send(&socket->chan,
@@ -94,12 +197,13 @@ errval_t socket(struct udp_socket *socket, uint16_t port) {
 errval_t recvfrom(struct udp_socket *socket, void *buf, size_t len,
                   size_t *ret_len, uint32_t *from_addr, uint16_t *from_port) {
     
-    // Receive a packet over URPC
+    // Receive a packet (in place if it is in the shared pool)
     struct udp_urpc_packet *packet;
     size_t size;
     urpc_msg_type_t msg_type;
-    errval_t err = urpc_recv_blocking(&socket->chan, (void **) &packet, &size,
-                                      &msg_type);
+    struct ump_bulk_desc desc;
+    errval_t err = socket_take(socket, (void **) &packet, &size, &msg_type,
+                               &desc);
     if (err_is_fail(err)) {
         return err;
     }
@@ -112,12 +216,13 @@ errval_t recvfrom(struct udp_socket *socket, void *buf, size_t len,
         *from_port = packet->port;
         *ret_len = packet->size;
         memcpy(buf, packet->payload, MIN(len, *ret_len));
-        free(packet);
+        socket_release(socket, packet, &desc);
         return SYS_ERR_OK;
         
     }
     else {
         
+        socket_release(socket, packet, &desc);
         return NET_ERR_INVALID_URPC;
         
     }
@@ -130,39 +235,279 @@ errval_t sendto(struct udp_socket *socket, void *buf, size_t len,
     
     errval_t err;
     
+    // Get a buffer (in the shared pool if possible)
+    void *payload;
+    err = sendto_alloc(socket, len, &payload);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Copy message
+    memcpy(payload, buf, len);
+    
+    // Send the message to networkd
+    return sendto_buffer(socket, payload, len, to_addr, to_port);
+    
+}
+
+// Blockingly receive a UDP packet without copying it
+errval_t recvfrom_buffer(struct udp_socket *socket, void **ret_buf,
+                         size_t *ret_len, uint32_t *from_addr,
+                         uint16_t *from_port) {
+    
+    // Receive a packet
+    struct udp_urpc_packet *packet;
+    size_t size;
+    urpc_msg_type_t msg_type;
+    struct ump_bulk_desc desc;
+    errval_t err = socket_take(socket, (void **) &packet, &size, &msg_type,
+                               &desc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    // Check message type
+    if (msg_type != URPC_MessageType_Receive) {
+        socket_release(socket, packet, &desc);
+        return NET_ERR_INVALID_URPC;
+    }
+    
+    // Lend the payload, the descriptor is rebuilt from the header on release
+    *from_addr = packet->addr;
+    *from_port = packet->port;
+    *ret_len = packet->size;
+    *ret_buf = packet->payload;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Return a payload lent by recvfrom_buffer()
+errval_t recvfrom_release(struct udp_socket *socket, void *buf) {
+    
+    struct udp_urpc_packet *packet = packet_of_payload(buf);
+    
+    // Messages copied out of the channel were allocated
+    ptrdiff_t offset = pool_offset(socket, false, packet);
+    if (offset < 0) {
+        free(packet);
+        return SYS_ERR_OK;
+    }
+    
+    // networkd sent exactly the header and the payload
+    struct ump_bulk_desc desc = {
+        .offset = offset,
+        .length = sizeof(struct udp_urpc_packet) + packet->size,
+        .msg_type = URPC_MessageType_Receive
+    };
+    
+    return ump_bulk_release(socket->chan.ump, packet, &desc);
+    
+}
+
+// Get a buffer for a payload of up to len bytes
+errval_t sendto_alloc(struct udp_socket *socket, size_t len, void **ret_buf) {
+    
+    // The size field of the packet limits the payload
+    if (len > UINT16_MAX) {
+        return LIB_ERR_UMP_BUFSIZE_INVALID;
+    }
+    
     // Calculate message size
     size_t msg_size = sizeof(struct udp_urpc_packet) + len;
     
-    // Allocate memory for the message
-    struct udp_urpc_packet *packet = malloc(msg_size);
-    if (!packet) {
-        return LIB_ERR_MALLOC_FAIL;
+    // Allocate the message in our shared pool, or in memory if it is full
+    struct udp_urpc_packet *packet = NULL;
+    struct ump_bulk_desc desc;
+    if (socket->chan.use_lmp ||
+        err_is_fail(ump_bulk_alloc(socket->chan.ump, msg_size,
+                                   (void **) &packet, &desc))) {
+        packet = malloc(msg_size);
+        if (!packet) {
+            return LIB_ERR_MALLOC_FAIL;
+        }
     }
     
+    // Remember the capacity until the buffer is sent
+    packet->size = len;
+    
+    *ret_buf = packet->payload;
+    
+    return SYS_ERR_OK;
+    
+}
+
+// Send a payload of len bytes in a buffer from sendto_alloc()
+errval_t sendto_buffer(struct udp_socket *socket, void *buf, size_t len,
+                       uint32_t to_addr, uint16_t to_port) {
+    
+    errval_t err;
+    
+    struct udp_urpc_packet *packet = packet_of_payload(buf);
+    
+    assert(len <= packet->size);
+    
+    // networkd frees the blocks of the whole buffer
+    size_t capacity = sizeof(struct udp_urpc_packet) + packet->size;
+    
     // Set destination
     packet->addr = to_addr;
     packet->port = to_port;
     packet->size = len;
     
-    // Copy message
-    memcpy(packet->payload, buf, len);
-    
-    // Send the message to networkd
-    err = urpc_send(&socket->chan, packet, msg_size, URPC_MessageType_Send);
-    if (err_is_fail(err)) {
+    ptrdiff_t offset = pool_offset(socket, true, packet);
+    if (offset < 0) {
+        
+        // Send the message to networkd
+        err = urpc_send(&socket->chan, packet,
+                        sizeof(struct udp_urpc_packet) + len,
+                        URPC_MessageType_Send);
+        
+        // Free message
+        free(packet);
+        
         return err;
+        
+    }
+    
+    // Only the descriptor goes through the channel
+    struct ump_bulk_desc desc = {
+        .offset = offset,
+        .length = capacity
+    };
+    
+    return ump_bulk_send(socket->chan.ump, &desc, URPC_MessageType_Send);
+    
+}
+
+// Check whether a message can be received on the socket without blocking
+static errval_t socket_readable(struct udp_socket *socket,
+                                bool *ret_readable) {
+    
+    *ret_readable = true;
+    if (socket->pending) {
+        return SYS_ERR_OK;
     }
     
-    // Free message
-    free(packet);
+    // Keep a received message for recvfrom()
+    errval_t err = socket_recv(socket);
+    if (err == LIB_ERR_NO_URPC_MSG) {
+        // Only an empty channel means not readable
+        *ret_readable = false;
+        return SYS_ERR_OK;
+    }
+    
+    return err;
+    
+}
+
+// Set the readable flags of all sockets and count the readable ones
+static errval_t poll_sockets(struct udp_pollfd *fds, size_t count,
+                             size_t *ret_ready) {
+    
+    errval_t err;
+    
+    *ret_ready = 0;
+    
+    for (size_t i = 0; i < count; i++) {
+        err = socket_readable(fds[i].socket, &fds[i].readable);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        if (fds[i].readable) {
+            (*ret_ready)++;
+        }
+    }
     
     return SYS_ERR_OK;
     
 }
 
+// Handler for waking up from event_dispatch() in udp_poll()
+static void poll_wakeup_handler(void *arg) {
+    
+    bool *woken = arg;
+    *woken = true;
+    
+}
+
+// Wait until at least one of the sockets is readable or timeout microseconds
+// passed (0 only checks, UDP_POLL_FOREVER never times out)
+errval_t udp_poll(struct udp_pollfd *fds, size_t count, delayus_t timeout,
+                  size_t *ret_ready) {
+    
+    errval_t err = poll_sockets(fds, count, ret_ready);
+    if (err_is_fail(err) || *ret_ready > 0 || timeout == 0) {
+        return err;
+    }
+    
+    // Private waitset, so no other events of the domain run in the meantime
+    struct waitset ws;
+    waitset_init(&ws);
+    
+    bool timed_out = false;
+    struct deferred_event timer;
+    deferred_event_init(&timer);
+    if (timeout != UDP_POLL_FOREVER) {
+        err = deferred_event_register(&timer, &ws, timeout,
+                                      MKCLOSURE(poll_wakeup_handler, &timed_out));
+        if (err_is_fail(err)) {
+            goto out;
+        }
+    }
+    
+    while (*ret_ready == 0 && !timed_out) {
+        
+        // Only channels with a message to receive produce an event
+        bool woken = false;
+        for (size_t i = 0; i < count; i++) {
+            err = urpc_register_recv(&fds[i].socket->chan, &ws,
+                                     MKCLOSURE(poll_wakeup_handler, &woken));
+            if (err_is_fail(err)) {
+                break;
+            }
+        }
+        
+        if (err_is_ok(err)) {
+            err = event_dispatch(&ws);
+        }
+        
+        // Registrations that did not fire are dropped
+        for (size_t i = 0; i < count; i++) {
+            urpc_deregister_recv(&fds[i].socket->chan);
+        }
+        
+        if (err_is_fail(err)) {
+            break;
+        }
+        
+        err = poll_sockets(fds, count, ret_ready);
+        if (err_is_fail(err)) {
+            break;
+        }
+        
+    }
+    
+    if (!timed_out && timeout != UDP_POLL_FOREVER) {
+        deferred_event_cancel(&timer);
+    }
+    
+out:
+    waitset_destroy(&ws);
+    
+    return err;
+    
+}
+
 // Close a UDP socket
 errval_t close(struct udp_socket *socket) {
     
+    // Drop a message that was never picked up
+    if (socket->pending) {
+        socket_release(socket, socket->pending, &socket->pending_desc);
+        socket->pending = NULL;
+    }
+    
     // Send message to networkd
     return urpc_send(&socket->chan,
                      &socket->pub,
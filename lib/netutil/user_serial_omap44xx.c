@@ -1,6 +1,10 @@
+#include <string.h>
+
 #include <aos/aos.h>
 #include <aos/inthandler.h>
 #include <aos/kernel_cap_invocations.h>
+#include <aos/waitset_chan.h>
+#include <machine/atomic.h>
 
 #include <arch/arm/omap44xx/device_registers.h>
 #include <dev/omap/omap44xx_uart3_dev.h>
@@ -9,23 +13,114 @@
 #include <netutil/user_serial.h>
 
 
+// Size of the TX ring buffer (power of two)
+#define TX_RING_SIZE    8192
+
+// Number of characters the TX FIFO holds
+#define TX_FIFO_SIZE    64
+
+// Size of the RX ring buffer (power of two)
+#define RX_RING_SIZE    16384
+
 static omap44xx_uart3_t port;
 
+// Characters waiting for space in the TX FIFO. The indices only grow and are
+// masked on access, so the ring is empty when they are equal.
+static uint8_t tx_ring[TX_RING_SIZE];
+static size_t tx_head;      // Next character to be queued
+static size_t tx_tail;      // Next character to be moved into the FIFO
+
+// Characters drained from the RX FIFO by the interrupt handler (producer) and
+// handed to serial_input() from a waitset event (consumer).
+static uint8_t rx_ring[RX_RING_SIZE];
+static volatile size_t rx_head;     // Written by the producer only
+static volatile size_t rx_tail;     // Written by the consumer only
+static size_t rx_dropped;           // Characters lost because the ring was full
+
+// Event that runs the consumer
+static struct waitset_chanstate rx_waitset_chan;
+
+// Move as many queued characters into the TX FIFO as it has room for
+static void serial_tx_fill(omap44xx_uart3_t *uart)
+{
+    size_t room = TX_FIFO_SIZE - omap44xx_uart3_txfifo_lvl_txfifo_lvl_rdf(uart);
+
+    while (room-- > 0 && tx_tail != tx_head) {
+        omap44xx_uart3_thr_thr_wrf(uart, tx_ring[tx_tail++ % TX_RING_SIZE]);
+    }
+
+    // Only ask for the THR interrupt while there is something left to send
+    omap44xx_uart3_ier_thr_it_wrf(uart, tx_tail != tx_head);
+}
+
+// Hand everything in the RX ring to the client in as few calls as possible
+static void serial_rx_event(void *arg)
+{
+    size_t head = rx_head;
+
+    // Read the characters only after the head that covers them
+    dmb();
+
+    size_t tail = rx_tail;
+
+    while (tail != head) {
+        // Contiguous characters up to the head or the end of the ring
+        size_t offset = tail % RX_RING_SIZE;
+        size_t len = MIN(head - tail, RX_RING_SIZE - offset);
+
+        serial_input(&rx_ring[offset], len);
+
+        tail += len;
+    }
+
+    // Release the space only after the characters were consumed
+    dmb();
+    rx_tail = tail;
+
+    if (rx_dropped > 0) {
+        debug_printf("serial: RX ring full, dropped %zu characters\n", rx_dropped);
+        rx_dropped = 0;
+    }
+}
+
 static void serial_poll(omap44xx_uart3_t *uart)
 {
-    // Read while we can
-    while(omap44xx_uart3_lsr_rx_fifo_e_rdf(uart)) {
-        uint8_t c = omap44xx_uart3_rhr_rhr_rdf(uart);
-        serial_input(&c, 1);
+    errval_t err;
+
+    size_t head = rx_head;
+    size_t tail = rx_tail;
+
+    // Drain the whole FIFO, the level is read once per burst
+    size_t count;
+    while ((count = omap44xx_uart3_rxfifo_lvl_rxfifo_lvl_rdf(uart)) > 0) {
+        for (; count > 0; count--) {
+            uint8_t c = omap44xx_uart3_rhr_rhr_rdf(uart);
+            if (head - tail == RX_RING_SIZE) {
+                rx_dropped++;
+                continue;
+            }
+            rx_ring[head++ % RX_RING_SIZE] = c;
+        }
+    }
+
+    // Publish the characters before the head that covers them
+    dmb();
+    rx_head = head;
+
+    // Run the consumer unless it is already pending
+    err = waitset_chan_trigger_closure(get_default_waitset(), &rx_waitset_chan,
+                                       MKCLOSURE(serial_rx_event, NULL));
+    if (err_is_fail(err) && err != LIB_ERR_CHAN_ALREADY_REGISTERED) {
+        DEBUG_ERR(err, "triggering serial RX event");
     }
 }
 
 static void serial_interrupt(void *arg)
 {
-    // get type
+    // get type, RX and TX interrupts can be pending at the same time
     omap44xx_uart3_iir_t iir= omap44xx_uart3_iir_rd(&port);
 
-    if (omap44xx_uart3_iir_it_pending_extract(iir) == 0) {
+    while (omap44xx_uart3_iir_it_pending_extract(iir) == 0) {
         omap44xx_uart3_it_type_status_t it_type=
             omap44xx_uart3_iir_it_type_extract(iir);
         switch(it_type) {
@@ -36,10 +131,15 @@ static void serial_interrupt(void *arg)
             case omap44xx_uart3_it_rhr:
                 serial_poll(&port);
                 break;
+            case omap44xx_uart3_it_thr:
+                // TX FIFO dropped below its threshold, refill it
+                serial_tx_fill(&port);
+                break;
             default:
                 debug_printf("serial_interrupt: unhandled irq: %d\n", it_type);
-                break;
+                return;
         }
+        iir = omap44xx_uart3_iir_rd(&port);
     }
 }
 
@@ -91,8 +191,8 @@ static void omap44xx_uart3_init(omap44xx_uart3_t *uart, lvaddr_t base)
 {
     // XXX: test this with other values
     // rx and tx FIFO threshold values (1 -- 63)
-    uint8_t rx_trig = 1; // amount of characters in fifo
-    uint8_t tx_trig = 63; // amount of free spaces in fifo
+    uint8_t rx_trig = 16; // amount of characters in fifo (rx timeout flushes the rest)
+    uint8_t tx_trig = 32; // amount of free spaces in fifo (refill at half empty)
     // LH: Why not keep these always at 0??
     bool need_rx_1b = convert_rx_simple(&rx_trig);
     bool need_tx_1b = convert_tx_simple(&tx_trig);
@@ -212,6 +312,8 @@ errval_t serial_init(lvaddr_t vbase, uint32_t irq) {
     omap44xx_uart3_init(&port, vbase);
     debug_printf("omap serial_init[%d]: done.\n", port);
 
+    waitset_chanstate_init(&rx_waitset_chan, CHANTYPE_OTHER);
+
     err = inthandler_setup_arm(serial_interrupt, NULL, irq);
     if (err_is_fail(err)) {
         USER_PANIC_ERR(err, "interrupt setup failed.");
@@ -220,24 +322,41 @@ errval_t serial_init(lvaddr_t vbase, uint32_t irq) {
     return SYS_ERR_OK;
 }
 
-/** output a single character */
-static void serial_putchar(uint8_t c)
+uint8_t *serial_tx_reserve(size_t *ret_len)
 {
-    // Wait until FIFO can hold more characters
-    int maxit = 100000;
-    while (!omap44xx_uart3_lsr_tx_fifo_e_rdf(&port) && maxit-- > 0);
-    if(maxit == 0){
-        printf("TX does not get ready.\n");
-    } else {
-        // Write character
-        omap44xx_uart3_thr_thr_wrf(&port, c);
+    // Wait for the FIFO to drain if the ring is full
+    while (tx_head - tx_tail == TX_RING_SIZE) {
+        serial_tx_fill(&port);
     }
 
+    // Free space up to the end of the ring or up to the tail
+    size_t offset = tx_head % TX_RING_SIZE;
+    *ret_len = MIN(TX_RING_SIZE - offset, TX_RING_SIZE - (tx_head - tx_tail));
+
+    return &tx_ring[offset];
+}
+
+void serial_tx_commit(size_t len)
+{
+    assert(tx_head - tx_tail + len <= TX_RING_SIZE);
+
+    tx_head += len;
+
+    // Start sending, the THR interrupt takes over from here
+    serial_tx_fill(&port);
 }
 
 void serial_write(uint8_t *c, size_t len)
 {
-    for (int i = 0; i < len; i++) {
-        serial_putchar(c[i]);
+    while (len > 0) {
+        size_t space;
+        uint8_t *buf = serial_tx_reserve(&space);
+
+        size_t n = MIN(space, len);
+        memcpy(buf, c, n);
+        serial_tx_commit(n);
+
+        c += n;
+        len -= n;
     }
 }
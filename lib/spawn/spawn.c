@@ -268,9 +268,12 @@ static errval_t spawn_setup_vspace(struct spawninfo *si) {
         return err;
     }
     
-    // Add memory to slab allocators
+    // Add memory to slab allocators (the end of the second frame holds the
+    // bitmaps of the first L2 pagetables)
+    size_t l2_slabs_size = sizeof(struct pt_l2_occupancy) * 16;
     slab_grow(&si->child_paging_state->vspace_slabs, slab_frame_1_addr, slab_frame_1_size);
-    slab_grow(&si->child_paging_state->slabs, slab_frame_2_addr, slab_frame_2_size);
+    slab_grow(&si->child_paging_state->slabs, slab_frame_2_addr, slab_frame_2_size - l2_slabs_size);
+    slab_grow(&si->child_paging_state->l2_slabs, (char *) slab_frame_2_addr + slab_frame_2_size - l2_slabs_size, l2_slabs_size);
     
     // Map the slab allocator frames into the child's virtual memory
     paging_alloc_fixed(si->child_paging_state, slab_frame_1_addr, slab_frame_1_size);
@@ -530,44 +533,39 @@ static errval_t spawn_setup_args(struct spawninfo *si, const char *argstring) {
     
 }
 
-static void spawn_recursive_child_l2_tree_walk(struct spawninfo *si, struct pt_cap_tree_node *node, int is_root) {
+static void spawn_child_l2_table_walk(struct spawninfo *si) {
     
-    static size_t next_slot = 0;
+    size_t next_slot = 0;
     
-    // Reinitialise at root
-    if (is_root) {
-        next_slot = 0;
-    }
-    
-    // Recurse to the left
-    if (node->left != NULL) {
-        spawn_recursive_child_l2_tree_walk(si, node->left, 0);
-    }
-    
-    // Build next capref
-    struct capref next_cap;
-    next_cap.cnode = si->slot_alloc0_ref;
-    next_cap.slot = next_slot++;
-    
-    // Copy the capability
-    errval_t err = cap_copy(next_cap, node->cap);
-    if (err_is_fail(err)) {
-        debug_printf("spawn for %s: %s\n", si->binary_name, err_getstring(err));
-    }
-    assert(err_is_ok(err));
-    
-    // Free the slot in the parent cspace
-    //  FIXME: Make this work to recuparate slots
-    //cap_delete(node->cap);
-    //slot_free(node->cap);
-    
-    // Mutate the capref to reference the child cspace
-    next_cap.cnode.croot = CPTR_ROOTCN;
-    node->cap = next_cap;
-    
-    // Recurse to the right
-    if (node->right != NULL) {
-        spawn_recursive_child_l2_tree_walk(si, node->right, 0);
+    // Walk the L1 shadow table in order of L1 offset
+    for (size_t l1_offset = 0; l1_offset < PAGING_L1_USER_ENTRIES; l1_offset++) {
+        
+        struct pt_cap_tree_node *node = si->child_paging_state->l1_shadow[l1_offset];
+        if (node == NULL) {
+            continue;
+        }
+        
+        // Build next capref
+        struct capref next_cap;
+        next_cap.cnode = si->slot_alloc0_ref;
+        next_cap.slot = next_slot++;
+        
+        // Copy the capability
+        errval_t err = cap_copy(next_cap, node->cap);
+        if (err_is_fail(err)) {
+            debug_printf("spawn for %s: %s\n", si->binary_name, err_getstring(err));
+        }
+        assert(err_is_ok(err));
+        
+        // Free the slot in the parent cspace
+        //  FIXME: Make this work to recuparate slots
+        //cap_delete(node->cap);
+        //slot_free(node->cap);
+        
+        // Mutate the capref to reference the child cspace
+        next_cap.cnode.croot = CPTR_ROOTCN;
+        node->cap = next_cap;
+        
     }
     
 }
@@ -741,7 +739,7 @@ errval_t spawn_load_by_name(void *cmd,
     }
     
     // Move all L2 cnode capabilities to the cild's cspace
-    spawn_recursive_child_l2_tree_walk(si, si->child_paging_state->l2_tree_root, 1);
+    spawn_child_l2_table_walk(si);
     
     // Launch dispatcher 🚀
     err = spawn_invoke_dispatcher(si);
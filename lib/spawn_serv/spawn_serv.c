@@ -42,7 +42,7 @@ static errval_t request_remote_spawn(char *name, coreid_t coreid,
     do {
         
         // Receive response of spawn server and save it in recv_buf
-        err = ump_recv(ump_chan, (void **) &recv_buf, &retsize, &msg_type);
+        err = urpc_init_recv(ump_chan, (void **) &recv_buf, &retsize, &msg_type);
         
         // Check for a process register message
         if (err_is_ok(err) && msg_type == UMP_MessageType_RegisterProcess) {
@@ -58,6 +58,20 @@ static errval_t request_remote_spawn(char *name, coreid_t coreid,
             err = LIB_ERR_NO_UMP_MSG;
         }
         
+        // Check for a RAM steal message
+        if (err_is_ok(err) && msg_type == UMP_MessageType_RamSteal) {
+            
+            // Pass message to URPC handler
+            urpc_ram_steal_request_handler(ump_chan,
+                                           (void *)recv_buf,
+                                           retsize,
+                                           msg_type);
+            free(recv_buf);
+            
+            // Continue looping
+            err = LIB_ERR_NO_UMP_MSG;
+        }
+        
     } while (err == LIB_ERR_NO_UMP_MSG);
     
     // Check that receive was successful
@@ -13,6 +13,9 @@
 
 #include <aos/aos.h>
 #include <aos/inthandler.h>
+#include <aos/deferred.h>
+#include <aos/paging.h>
+#include <machine/atomic.h>
 #include <maps/omap44xx_map.h>
 #include <driverkit/driverkit.h>
 #include <arch/arm/omap44xx/device_registers.h>
@@ -26,6 +29,53 @@ static char dbuf[DBUF_SIZE];
 
 static omap44xx_mmchs1_t mmchs;
 
+// MMC1 interrupt (MA_IRQ_83) on the GIC
+#define MMCHS_IRQ               (83 + 32)
+
+// Size of the DMA bounce buffer in blocks
+#define MMCHS_DMA_BLOCKS        128
+
+// Maximum length of a single ADMA2 descriptor
+#define MMCHS_ADMA_MAX_LEN      (32 * 1024)
+
+// Status polls before the driver starts sleeping between them
+#define MMCHS_SPIN_POLLS        10000
+
+// Time a data transfer may take before it is aborted (in us)
+#define MMCHS_XFER_TIMEOUT      (1000 * 1000)
+
+/**
+ * ADMA2 descriptor
+ *
+ * \see SD Host Controller Simplified Specification 3.00, Section 1.13.4
+ */
+struct adma2_desc {
+    uint16_t attr;
+    uint16_t len;
+    uint32_t addr;
+};
+
+#define ADMA2_VALID             (1 << 0)
+#define ADMA2_END               (1 << 1)
+#define ADMA2_ACT_TRAN          (2 << 4)
+
+// State for DMA and interrupt driven data transfers
+static struct {
+
+    bool irq;                               // Completion is signalled by interrupt
+    struct waitset ws;                      // Waitset of the interrupt endpoint
+    struct deferred_event timeout;          // Watchdog for lost interrupts
+    volatile bool timed_out;
+    volatile omap44xx_mmchs1_mmchs_stat_t stat;  // Status captured by the handler
+
+    bool dma;                               // ADMA2 is used for data
+    uint8_t *dma_buf;                       // Bounce buffer (uncached)
+    lpaddr_t dma_buf_phys;
+    struct adma2_desc *desc;                // Descriptor table (uncached)
+    lpaddr_t desc_phys;
+
+} xfer;
+
 static void mmchs_soft_reset(void)
 {
     MMCHS_DEBUG("%s:%d\n", __FUNCTION__, __LINE__);
@@ -135,9 +185,12 @@ static void wait_msec(long msec)
 
 
 /**
+ * \brief Send a command that transfers `nblk` blocks of data (if any).
+ *
  * \see TRM rev Z, Section 24.5.1.2.1.7.1
  */
-static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
+static void send_data_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg,
+                              uint16_t nblk, bool dma)
 {
     MMCHS_DEBUG("%s:%d: cmd = 0x%x arg=0x%x\n", __FUNCTION__, __LINE__, cmd, arg);
 
@@ -154,7 +207,7 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
     omap44xx_mmchs1_mmchs_csre_rawwr(&mmchs, 0x0);
 
     omap44xx_mmchs1_mmchs_blk_blen_wrf(&mmchs, 512);
-    omap44xx_mmchs1_mmchs_blk_nblk_wrf(&mmchs, 0x1);
+    omap44xx_mmchs1_mmchs_blk_nblk_wrf(&mmchs, nblk);
 
     omap44xx_mmchs1_mmchs_sysctl_dto_wrf(&mmchs, 0xE); // omapconf
 
@@ -176,11 +229,20 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
         cmdreg = omap44xx_mmchs1_mmchs_cmd_ccce_insert(cmdreg, 0x1);
         break;
         // R1, R6, R5, R7
+    case omap44xx_mmchs1_INDX_18:
+    case omap44xx_mmchs1_INDX_25:
+        // Block count register ends the transfer, Auto CMD12 stops the card
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_msbs_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_bce_insert(cmdreg, 0x1);
+        // Fallthrough desired!
     case omap44xx_mmchs1_INDX_17:
-        cmdreg = omap44xx_mmchs1_mmchs_cmd_ddir_insert(cmdreg, 0x1);
     case omap44xx_mmchs1_INDX_24:
+        if (cmd == omap44xx_mmchs1_INDX_17 || cmd == omap44xx_mmchs1_INDX_18) {
+            cmdreg = omap44xx_mmchs1_mmchs_cmd_ddir_insert(cmdreg, 0x1);
+        }
         cmdreg = omap44xx_mmchs1_mmchs_cmd_dp_insert(cmdreg, 0x1);
         cmdreg = omap44xx_mmchs1_mmchs_cmd_acen_insert(cmdreg, 0x1);
+        cmdreg = omap44xx_mmchs1_mmchs_cmd_de_insert(cmdreg, dma);
         // Fallthrough desired!
     case omap44xx_mmchs1_INDX_0:
     case omap44xx_mmchs1_INDX_3:
@@ -227,12 +289,15 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
             return;
         }
 
-        if (i++ > 1000) {
+        if (i++ > MMCHS_SPIN_POLLS + 1000) {
             omap44xx_mmchs1_mmchs_stat_pr(dbuf, DBUF_SIZE, &mmchs);
             MMCHS_DEBUG("%s:%d: %s\n", __FUNCTION__, __LINE__, dbuf);
             USER_PANIC("Command not Ackd?");
         }
-        wait_msec(1);
+        // Commands complete within microseconds, only sleep if the card is slow
+        if (i > MMCHS_SPIN_POLLS && cc != 0x1) {
+            wait_msec(1);
+        }
     } while (cc != 0x1);
 
 
@@ -255,6 +320,11 @@ static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
     }
 }
 
+static void send_command(omap44xx_mmchs1_indx_status_t cmd, uint32_t arg)
+{
+    send_data_command(cmd, arg, 0x1, false);
+}
+
 
 /**
  * \see TRM rev Z, Figure 24-38
@@ -339,45 +409,283 @@ static errval_t complete_card_transaction(void)
             }
         }
 
-        wait_msec(10);
-    } while (i++ < 1000);
+        if (i > MMCHS_SPIN_POLLS) {
+            wait_msec(10);
+        }
+    } while (i++ < MMCHS_SPIN_POLLS + 1000);
 
     MMCHS_DEBUG("%s:%d: No transfer complete interrupt?\n", __FUNCTION__, __LINE__);
     return MMC_ERR_TRANSFER;
 }
 
 /**
- * \brief Reads a 512-byte block on the card.
- *
- * \param block_nr Index number of block to read.
- * \param buffer Non-null buffer with a size of at least 512 bytes.
- *
- * \retval SYS_ERR_OK Block successfully written in buffer.
- * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
- * \retval MMC_ERR_READ_READY Card not ready to read.
+ * \brief Interrupt handler, records the status of the finished transfer.
  */
-errval_t mmchs_read_block(size_t block_nr, void *buffer)
+static void mmchs_interrupt_handler(void *arg)
 {
+    omap44xx_mmchs1_mmchs_stat_t stat = omap44xx_mmchs1_mmchs_stat_rd(&mmchs);
+
+    if (omap44xx_mmchs1_mmchs_stat_tc_extract(stat) ||
+        omap44xx_mmchs1_mmchs_stat_erri_extract(stat)) {
+
+        xfer.stat = stat;
+
+        // Mask the interrupt until the next transfer (the line is level triggered)
+        omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+        omap44xx_mmchs1_mmchs_stat_rawwr(&mmchs, stat);
+    }
+}
+
+static void mmchs_timeout_handler(void *arg)
+{
+    xfer.timed_out = true;
+}
+
+/**
+ * \brief Block on the interrupt waitset until the transfer is complete.
+ */
+static errval_t wait_card_transaction(void)
+{
+    errval_t err;
+
+    err = deferred_event_register(&xfer.timeout, &xfer.ws, MMCHS_XFER_TIMEOUT,
+                                  MKCLOSURE(mmchs_timeout_handler, NULL));
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    while (!omap44xx_mmchs1_mmchs_stat_tc_extract(xfer.stat) &&
+           !omap44xx_mmchs1_mmchs_stat_erri_extract(xfer.stat) && !xfer.timed_out) {
+        err = event_dispatch(&xfer.ws);
+        if (err_is_fail(err)) {
+            break;
+        }
+    }
+
+    deferred_event_cancel(&xfer.timeout);
+
+    if (xfer.timed_out) {
+        MMCHS_DEBUG("%s:%d: No transfer complete interrupt?\n", __FUNCTION__, __LINE__);
+        omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+        dat_line_reset();
+        return MMC_ERR_TRANSFER;
+    }
+
+    if (omap44xx_mmchs1_mmchs_stat_erri_extract(xfer.stat)) {
+        MMCHS_DEBUG("%s:%d: Error interrupt during transfer: stat=0x%x.\n",
+                    __FUNCTION__, __LINE__, xfer.stat);
+        dat_line_reset();
+        return MMC_ERR_TRANSFER;
+    }
+
+    return err;
+}
+
+/**
+ * \brief Transfer up to 0xFFFF blocks with a single CMD17/18/24/25.
+ */
+static errval_t transfer_blocks(size_t block_nr, size_t count, void *buffer, bool write)
+{
+    errval_t err;
+
     MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
-    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0);
+    size_t polls = 0;
+    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0) {
+        if (polls++ > MMCHS_SPIN_POLLS + 1000) {
+            return write ? MMC_ERR_WRITE_READY : MMC_ERR_READ_READY;
+        }
+        if (polls > MMCHS_SPIN_POLLS) {
+            wait_msec(1);
+        }
+    }
+
+    if (xfer.dma) {
+
+        // Fill the descriptor table for the bounce buffer
+        size_t bytes = count * MMCHS_BLOCK_SIZE;
+        size_t i;
+        for (i = 0; bytes > 0; i++) {
+            size_t len = MIN(bytes, MMCHS_ADMA_MAX_LEN);
+            xfer.desc[i].addr = xfer.dma_buf_phys + i * MMCHS_ADMA_MAX_LEN;
+            xfer.desc[i].len = len;
+            xfer.desc[i].attr = ADMA2_VALID | ADMA2_ACT_TRAN;
+            bytes -= len;
+        }
+        xfer.desc[i - 1].attr |= ADMA2_END;
+
+        if (write) {
+            memcpy(xfer.dma_buf, buffer, count * MMCHS_BLOCK_SIZE);
+        }
+
+        // Descriptors and data must be in memory before the engine starts
+        dmb();
+
+        omap44xx_mmchs1_mmchs_hctl_dmas_wrf(&mmchs, omap44xx_mmchs1_DMAS_2);
+        omap44xx_mmchs1_mmchs_admasal_wr(&mmchs, xfer.desc_phys);
+
+    }
+
+    xfer.stat = 0;
+    xfer.timed_out = false;
 
     // Send data command
-    send_command(17, block_nr);
+    if (count == 1) {
+        send_data_command(write ? 24 : 17, block_nr, 1, xfer.dma);
+    } else {
+        send_data_command(write ? 25 : 18, block_nr, count, xfer.dma);
+    }
     // TODO(gz): Check for errors
 
-    for (size_t i = 0; i < (omap44xx_mmchs1_mmchs_blk_blen_rdf(&mmchs) + 3) / 4; i++) {
-        size_t timeout = 1000;
-        while (omap44xx_mmchs1_mmchs_stat_brr_rdf(&mmchs) == 0x0 && timeout--) {
-            wait_msec(1);
+    if (xfer.irq) {
+        // Signal transfer complete and all errors
+        omap44xx_mmchs1_mmchs_ise_t ise = omap44xx_mmchs1_mmchs_ise_default;
+        ise = omap44xx_mmchs1_mmchs_ise_tc_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_cto_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_ccrc_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_ceb_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_cie_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_dto_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_dcrc_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_deb_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_ace_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_admae_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_cerr_sigen_insert(ise, 0x1);
+        ise = omap44xx_mmchs1_mmchs_ise_bada_sigen_insert(ise, 0x1);
+        omap44xx_mmchs1_mmchs_ise_wr(&mmchs, ise);
+    }
+
+    if (!xfer.dma) {
+
+        uint32_t *words = buffer;
+
+        for (size_t b = 0; b < count; b++) {
+
+            // Wait until the controller buffer holds (or can take) one block
+            polls = 0;
+            while ((write ? omap44xx_mmchs1_mmchs_stat_bwr_rdf(&mmchs) :
+                            omap44xx_mmchs1_mmchs_stat_brr_rdf(&mmchs)) == 0x0) {
+                if (polls++ > MMCHS_SPIN_POLLS + 1000) {
+                    omap44xx_mmchs1_mmchs_ise_rawwr(&mmchs, 0x0);
+                    return write ? MMC_ERR_WRITE_READY : MMC_ERR_READ_READY;
+                }
+                if (polls > MMCHS_SPIN_POLLS) {
+                    wait_msec(1);
+                }
+            }
+
+            // Clear the buffer ready status before the block is moved
+            omap44xx_mmchs1_mmchs_stat_t stat = omap44xx_mmchs1_mmchs_stat_default;
+            if (write) {
+                stat = omap44xx_mmchs1_mmchs_stat_bwr_insert(stat, 0x1);
+            } else {
+                stat = omap44xx_mmchs1_mmchs_stat_brr_insert(stat, 0x1);
+            }
+            omap44xx_mmchs1_mmchs_stat_wr(&mmchs, stat);
+
+            for (size_t i = 0; i < MMCHS_BLOCK_SIZE / 4; i++, words++) {
+                if (write) {
+                    omap44xx_mmchs1_mmchs_data_wr(&mmchs, *words);
+                } else {
+                    *words = omap44xx_mmchs1_mmchs_data_rd(&mmchs);
+                }
+            }
+
         }
-        if (timeout == 0) {
-            return MMC_ERR_READ_READY;
+
+    }
+
+    if (xfer.irq) {
+        err = wait_card_transaction();
+    } else {
+        err = complete_card_transaction();
+    }
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (xfer.dma && !write) {
+        memcpy(buffer, xfer.dma_buf, count * MMCHS_BLOCK_SIZE);
+    }
+
+    return SYS_ERR_OK;
+}
+
+static errval_t transfer(size_t block_nr, size_t count, void *buffer, bool write)
+{
+    errval_t err;
+
+    // Largest transfer a single command can do
+    size_t max_count = xfer.dma ? MMCHS_DMA_BLOCKS : 0xFFFF;
+
+    uint8_t *buf = buffer;
+
+    while (count > 0) {
+
+        size_t n = MIN(count, max_count);
+
+        err = transfer_blocks(block_nr, n, buf, write);
+        if (err_is_fail(err)) {
+            return err;
         }
 
-        ((uint32_t *) buffer)[i] = omap44xx_mmchs1_mmchs_data_rd(&mmchs);
+        block_nr += n;
+        count -= n;
+        buf += n * MMCHS_BLOCK_SIZE;
+
     }
 
-    return complete_card_transaction();
+    return SYS_ERR_OK;
+}
+
+/**
+ * \brief Reads consecutive 512-byte blocks from the card.
+ *
+ * Multiple blocks are read with CMD18 and stopped with Auto CMD12.
+ *
+ * \param block_nr Index number of the first block to read.
+ * \param count Number of blocks to read.
+ * \param buffer Non-null buffer with a size of at least count * 512 bytes.
+ *
+ * \retval SYS_ERR_OK Blocks successfully written in buffer.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_READ_READY Card not ready to read.
+ */
+errval_t mmchs_read_blocks(size_t block_nr, size_t count, void *buffer)
+{
+    return transfer(block_nr, count, buffer, false);
+}
+
+/**
+ * \brief Writes consecutive 512-byte blocks to the card.
+ *
+ * Multiple blocks are written with CMD25 and stopped with Auto CMD12.
+ *
+ * \param block_nr Index number of the first block to write.
+ * \param count Number of blocks to write.
+ * \param buffer Data to write (must be at least count * 512 bytes in size).
+ *
+ * \retval SYS_ERR_OK Blocks written to card.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_WRITE_READY Card not ready to write.
+ */
+errval_t mmchs_write_blocks(size_t block_nr, size_t count, void *buffer)
+{
+    return transfer(block_nr, count, buffer, true);
+}
+
+/**
+ * \brief Reads a 512-byte block on the card.
+ *
+ * \param block_nr Index number of block to read.
+ * \param buffer Non-null buffer with a size of at least 512 bytes.
+ *
+ * \retval SYS_ERR_OK Block successfully written in buffer.
+ * \retval MMC_ERR_TRANSFER Error interrupt or no transfer complete interrupt.
+ * \retval MMC_ERR_READ_READY Card not ready to read.
+ */
+errval_t mmchs_read_block(size_t block_nr, void *buffer)
+{
+    return mmchs_read_blocks(block_nr, 1, buffer);
 }
 
 /**
@@ -392,25 +700,63 @@ errval_t mmchs_read_block(size_t block_nr, void *buffer)
  */
 errval_t mmchs_write_block(size_t block_nr, void *buffer)
 {
-    MMCHS_DEBUG("%s:%d: Wait for free data lines.\n", __FUNCTION__, __LINE__);
-    size_t timeout = 1000;
-    while (omap44xx_mmchs1_mmchs_pstate_dati_rdf(&mmchs) != 0x0 && timeout--) {
-        wait_msec(1);
+    return mmchs_write_blocks(block_nr, 1, buffer);
+}
+
+/**
+ * \brief Set up the completion interrupt and the ADMA2 bounce buffer.
+ *
+ * Either one is optional, the driver falls back to polling and PIO.
+ */
+static void mmchs_init_transfer(void)
+{
+    errval_t err;
+
+    // Route every MMC1 interrupt to a waitset that is only dispatched while
+    // waiting (the handler re-registers on it after each interrupt)
+    waitset_init(&xfer.ws);
+    deferred_event_init(&xfer.timeout);
+    err = inthandler_setup_arm_ws(mmchs_interrupt_handler, NULL, MMCHS_IRQ, &xfer.ws);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "MMCHS interrupt setup failed, polling for completion");
+    } else {
+        xfer.irq = true;
     }
-    if (timeout == 0) {
-        return MMC_ERR_WRITE_READY;
+
+    // ADMA2 is only available if the module has a DMA master port
+    if (!omap44xx_mmchs1_mmchs_hl_hwinfo_madma_en_rdf(&mmchs) ||
+        !omap44xx_mmchs1_mmchs_capa_ad2s_rdf(&mmchs)) {
+        MMCHS_DEBUG("%s:%d: No ADMA2, using PIO.\n", __FUNCTION__, __LINE__);
+        return;
     }
 
-    // Send data command
-    send_command(24, block_nr);
-    // TODO(gz): Check for errors
+    // Physically contiguous bounce buffer followed by the descriptor table
+    size_t dma_size = MMCHS_DMA_BLOCKS * MMCHS_BLOCK_SIZE;
+    struct capref frame;
+    size_t bytes;
+    err = frame_alloc(&frame, dma_size + BASE_PAGE_SIZE, &bytes);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "MMCHS DMA buffer allocation failed, using PIO");
+        return;
+    }
 
-    for (size_t i = 0; i < (omap44xx_mmchs1_mmchs_blk_blen_rdf(&mmchs) + 3) / 4; i++) {
-        while (omap44xx_mmchs1_mmchs_stat_bwr_rdf(&mmchs) == 0x0);
-        omap44xx_mmchs1_mmchs_data_wr(&mmchs, ((uint32_t *) buffer)[i]);
+    struct frame_identity id;
+    err = frame_identify(frame, &id);
+    assert(err_is_ok(err));
+
+    void *buf;
+    err = paging_map_frame_attr(get_current_paging_state(), &buf, bytes, frame,
+                                VREGION_FLAGS_READ_WRITE_NOCACHE, NULL, NULL);
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "MMCHS DMA buffer mapping failed, using PIO");
+        return;
     }
 
-    return complete_card_transaction();
+    xfer.dma_buf = buf;
+    xfer.dma_buf_phys = id.base;
+    xfer.desc = (struct adma2_desc *) (xfer.dma_buf + dma_size);
+    xfer.desc_phys = id.base + dma_size;
+    xfer.dma = true;
 }
 
 /**
@@ -436,4 +782,6 @@ void mmchs_init(void)
     mmc_host_and_bus_configuration();
 
     mmchs_identify_card();
+
+    mmchs_init_transfer();
 }
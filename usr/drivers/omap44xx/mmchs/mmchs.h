@@ -19,9 +19,13 @@
 #include "twl6030.h"
 
 
+#define MMCHS_BLOCK_SIZE 512
+
 void mmchs_init(void);
 errval_t mmchs_read_block(size_t block_nr, void *buffer);
 errval_t mmchs_write_block(size_t block_nr, void *buffer);
+errval_t mmchs_read_blocks(size_t block_nr, size_t count, void *buffer);
+errval_t mmchs_write_blocks(size_t block_nr, size_t count, void *buffer);
 
 void init_service(void);
 
@@ -243,6 +243,54 @@ errval_t test_frame_alloc_n(int n, size_t b) {
     RETURN_TEST_SUCCESS;
 }
 
+errval_t bench_mm_strategies(int n) {
+    PRINT_TEST_NAME;
+    
+    struct capref frag_array[n];
+    struct capref retcap_array[n];
+    
+    enum mm_strategy strategies[2] = { MM_STRATEGY_FIRST_FIT, MM_STRATEGY_SEGREGATED_FIT };
+    const char *names[2] = { "first-fit", "segregated-fit" };
+    
+    // Fragment the free memory with n single page holes that are too small for the requests below
+    for (int i=0; i<n; ++i) {
+        assert(err_is_ok( ram_alloc(&(frag_array[i]), BASE_PAGE_SIZE) ));
+    }
+    for (int i=1; i<n; i+=2) {
+        assert(err_is_ok( aos_ram_free(frag_array[i]) ));
+    }
+    
+    printf("\n");
+    
+    for (int s=0; s<2; ++s) {
+        
+        mm_set_strategy(&aos_mm, strategies[s]);
+        
+        systime_t start = systime_now();
+        for (int i=0; i<n; ++i) {
+            assert(err_is_ok( ram_alloc(&(retcap_array[i]), 2*BASE_PAGE_SIZE) ));
+        }
+        systime_t middle = systime_now();
+        for (int i=0; i<n; ++i) {
+            assert(err_is_ok( aos_ram_free(retcap_array[i]) ));
+        }
+        systime_t end = systime_now();
+        
+        debug_printf("%s: %d allocs in %" PRIu64 " ns, %d frees in %" PRIu64 " ns\n",
+                     names[s],
+                     n, systime_to_ns(middle - start),
+                     n, systime_to_ns(end - middle));
+    }
+    
+    mm_set_strategy(&aos_mm, MM_STRATEGY_SEGREGATED_FIT);
+    
+    for (int i=0; i<n; i+=2) {
+        assert(err_is_ok( aos_ram_free(frag_array[i]) ));
+    }
+    
+    RETURN_TEST_SUCCESS;
+}
+
 
 void run_all_m1_tests(void) {
     
@@ -280,4 +328,7 @@ void run_all_m1_tests(void) {
     test_frame_alloc(8*4096);
     test_frame_alloc_n(100, 8192);
     
+    printf("Test Phase 9: allocator benchmark\n");
+    bench_mm_strategies(1000);
+    
 }
@@ -15,6 +15,7 @@
 #include <aos/waitset.h>
 #include <aos/morecore.h>
 #include <aos/paging.h>
+#include <aos/systime.h>
 
 #include <mm/mm.h>
 #include "mem_alloc.h"
@@ -41,6 +42,8 @@ errval_t test_frame_alloc(size_t);
 
 errval_t test_frame_alloc_n(int, size_t);
 
+errval_t bench_mm_strategies(int);
+
 void run_all_m1_tests(void);
 
 #define PRINT_TEST_NAME         printf("Test %s: ", __FUNCTION__)
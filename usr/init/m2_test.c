@@ -10,15 +10,18 @@
 #define PRINT_TEST_NAME         printf("\033[37m\033[40m%s\033[49m\033[39m\n", __FUNCTION__)
 #define RETURN_TEST_SUCCESS        do { printf("\033[37m\033[42mSUCCESS\033[49m\033[39m\n"); return SYS_ERR_OK; } while(0)
 
-static size_t free_vspace(struct paging_state *st) {
+static size_t free_vspace_tree(struct vspace_node *node) {
     
-    size_t free_space = 0;
-    struct vspace_node *node = st->free_vspace_head;
-    while (node != NULL) {
-        free_space += node->size;
-        node = node->next;
+    if (node == NULL) {
+        return 0;
     }
-    return free_space;
+    return node->size + free_vspace_tree(node->addr.left) + free_vspace_tree(node->addr.right);
+    
+}
+
+static size_t free_vspace(struct paging_state *st) {
+    
+    return free_vspace_tree(st->free_vspace_root);
     
 }
 
@@ -129,6 +132,40 @@ static errval_t test_map_unmap_random(size_t b) {
     RETURN_TEST_SUCCESS;
 }
 
+static errval_t test_lookup_region(size_t b) {
+    PRINT_TEST_NAME;
+    
+    struct paging_state *st = get_current_paging_state();
+    
+    char *buf;
+    struct capref frame;
+    size_t ret_bytes;
+    
+    errval_t err = frame_alloc(&frame, b, &ret_bytes);
+    assert(err_is_ok(err));
+    err = paging_map_frame(st, (void **) &buf, ret_bytes, frame, NULL, NULL);
+    assert(err_is_ok(err));
+    
+    // Every address in the region resolves to the region
+    lvaddr_t base;
+    size_t size;
+    for (size_t offset = 0; offset < ret_bytes; offset += BASE_PAGE_SIZE) {
+        err = paging_lookup_region(st, (lvaddr_t) buf + offset, &base, &size);
+        assert(err_is_ok(err));
+        assert(base == (lvaddr_t) buf);
+        assert(size >= ret_bytes);
+    }
+    
+    err = paging_unmap(st, (void *) buf);
+    assert(err_is_ok(err));
+    
+    // The region is gone after unmapping
+    err = paging_lookup_region(st, (lvaddr_t) buf, &base, &size);
+    assert(err_no(err) == LIB_ERR_VSPACE_VREGION_NOT_FOUND);
+    
+    RETURN_TEST_SUCCESS;
+}
+
 static errval_t test_spawn_n(size_t n) {
     PRINT_TEST_NAME;
 
@@ -160,7 +197,10 @@ void run_all_m2_tests(void) {
     printf("Test Phase 5: Random map/unmap\n");
     test_map_unmap_random(BASE_PAGE_SIZE*3);
 
-    printf("Test Phase 6: Spawn children\n");
+    printf("Test Phase 6: Region lookup\n");
+    test_lookup_region(BASE_PAGE_SIZE * 4);
+
+    printf("Test Phase 7: Spawn children\n");
     test_spawn_n(10);
     
 }
@@ -18,7 +18,6 @@
 #include <aos/aos.h>
 #include <aos/waitset.h>
 #include <aos/waitset_chan.h>
-#include <aos/event_queue.h>
 #include <aos/morecore.h>
 #include <aos/paging.h>
 #include <spawn/spawn.h>
@@ -39,35 +38,34 @@ coreid_t my_core_id;
 struct bootinfo *bi;
 extern struct ump_chan init_uc; // UMP channel for communicating with the other CPU
 
-struct event_queue_pair {
-    struct event_queue queue;
-    struct event_queue_node node;
-};
-
 static void ump_event_handler(void *arg) {
 
-    // Check if a message was received from different core
+    struct ump_chan *chan = arg;
+    
+    // Handle all messages received from the other core
     errval_t err;
     void *msg;
     size_t msg_size;
     ump_msg_type_t msg_type;
-    err = ump_recv(&init_uc, &msg, &msg_size, &msg_type);
-    if (err_is_ok(err)) {
+    while (err_is_ok(err = urpc_init_recv(chan, &msg, &msg_size, &msg_type))) {
 
         // Invoke the URPC server
-        urpc_init_server_handler(&init_uc, msg, msg_size, msg_type);
+        urpc_init_server_handler(chan, msg, msg_size, msg_type);
         
         // Free the received message buffer
         free(msg);
         
     }
-    else if (err != LIB_ERR_NO_UMP_MSG) {
+    if (err != LIB_ERR_NO_UMP_MSG) {
         DEBUG_ERR(err, "in urpc_recv");
     }
     
-    // Reregister event node
-    struct event_queue_pair *pair = arg;
-    event_queue_add(&pair->queue, &pair->node, MKCLOSURE(ump_event_handler, (void *) pair));
+    // Reregister for the next message
+    err = ump_chan_register_recv(chan, get_default_waitset(),
+                                 MKCLOSURE(ump_event_handler, arg));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "in ump_chan_register_recv");
+    }
     
 }
 
@@ -103,11 +101,17 @@ int main(int argc, char *argv[])
             DEBUG_ERR(err, "initialize ump (1)");
         }
         
-        err = paging_map_frame(get_current_paging_state(), (void **) &init_uc.buf, UMP_BUF_SIZE, urpc_frame_cap, NULL, NULL);
+        err = paging_map_frame(get_current_paging_state(), (void **) &init_uc.buf, init_uc.fi.bytes, urpc_frame_cap, NULL, NULL);
         if(err_is_fail(err)){
             DEBUG_ERR(err, "initialize ump (2)");
         }
         
+        // Use the rings laid out by the BSP
+        err = ump_chan_setup(&init_uc, 0);
+        if(err_is_fail(err)){
+            DEBUG_ERR(err, "initialize ump (3)");
+        }
+        
     }
     
     
@@ -201,6 +205,9 @@ int main(int argc, char *argv[])
     
     // Setting aos_ram_free function pointer to ram_free_handler in lmp.c
     register_ram_free_handler(aos_ram_free);
+    
+    // Hand over RAM when the other core's pool runs low
+    urpc_register_ram_steal_handler(aos_ram_donate);
 
     // Initialize the spawn server
     spawn_serv_init(&init_uc);
@@ -222,6 +229,12 @@ int main(int argc, char *argv[])
         if (err_is_fail(err)) {
             debug_printf("Failed booting core: %s\n", err_getstring(err));
         }
+        else {
+            aos_ram_pool_enable_stealing();
+        }
+    }
+    else {
+        aos_ram_pool_enable_stealing();
     }
 
     // Set bootinfo in lmp such that it can acces multiboot modules
@@ -254,11 +267,12 @@ int main(int argc, char *argv[])
     // Hang around
     struct waitset *default_ws = get_default_waitset();
 
-    // Register Event Queue for UMP
-
-    struct event_queue_pair pair;
-    event_queue_init(&pair.queue, default_ws, EVENT_QUEUE_CONTINUOUS);
-    event_queue_add(&pair.queue, &pair.node, MKCLOSURE(ump_event_handler, (void *) &pair));
+    // Handle messages from the other core as they arrive
+    err = ump_chan_register_recv(&init_uc, default_ws,
+                                 MKCLOSURE(ump_event_handler, &init_uc));
+    if (err_is_fail(err)) {
+        DEBUG_ERR(err, "in ump_chan_register_recv");
+    }
 
     while (true) {
         event_dispatch(default_ws);
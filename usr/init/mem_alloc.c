@@ -6,13 +6,98 @@
 #include "mem_alloc.h"
 #include <mm/mm.h>
 #include <aos/paging.h>
+#include <aos/urpc.h>
+
+/// Number of allocations to skip refilling after the other core refused
+#define RAM_POOL_STEAL_BACKOFF  64
 
 /// MM allocator instance data
 struct mm aos_mm;
 
+/// Watermarks of this core's RAM pool
+static struct ram_pool_config pool_config = {
+    .low_watermark = RAM_POOL_DEFAULT_LOW_WATERMARK,
+    .steal_chunk = RAM_POOL_DEFAULT_STEAL_CHUNK,
+    .donate_reserve = RAM_POOL_DEFAULT_DONATE_RESERVE
+};
+
+/// Set once the other core is up and serving requests over UMP
+static bool pool_stealing_enabled = false;
+
+/// Set while a steal request is in flight
+static bool pool_stealing = false;
+
+/// Remaining allocations before trying to refill the pool again
+static int pool_steal_backoff = 0;
+
+/**
+ * \brief Take over a region of RAM from the other core and add it to our pool
+ */
+static errval_t aos_ram_steal(size_t bytes, size_t alignment)
+{
+    errval_t err;
+    
+    // Don't recurse if allocating the slot below needs more memory
+    if (!pool_stealing_enabled || pool_stealing) {
+        return LIB_ERR_RAM_ALLOC;
+    }
+    pool_stealing = true;
+    
+    // Ask the other core for some of its memory
+    struct frame_identity fi;
+    err = urpc_ram_steal(bytes, alignment, &fi);
+    if (err_is_fail(err)) {
+        pool_stealing = false;
+        return err;
+    }
+    
+    // Forge a capability for the region we were handed
+    struct capref mem_cap;
+    err = slot_alloc(&mem_cap);
+    if (err_is_fail(err)) {
+        pool_stealing = false;
+        return err;
+    }
+    err = ram_forge(mem_cap, fi.base, fi.bytes, disp_get_core_id());
+    if (err_is_fail(err)) {
+        pool_stealing = false;
+        return err;
+    }
+    
+    // Add it to the local pool
+    err = mm_add(&aos_mm, mem_cap, fi.base, fi.bytes);
+    
+    pool_stealing = false;
+    
+    return err;
+}
+
 static errval_t aos_ram_alloc_aligned(struct capref *ret, size_t size, size_t alignment)
 {
-    return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    errval_t err = mm_alloc_aligned(&aos_mm, size, alignment, ret);
+    
+    if (err == MM_ERR_NOT_FOUND) {
+        
+        // The local pool is exhausted, refill it with a chunk that fits the request
+        errval_t err_steal = aos_ram_steal(MAX(size, pool_config.steal_chunk), alignment);
+        if (err_is_fail(err_steal)) {
+            return err;
+        }
+        
+        return mm_alloc_aligned(&aos_mm, size, alignment, ret);
+        
+    }
+    
+    // Refill the pool ahead of time once we drop below the low watermark
+    if (err_is_ok(err) && aos_mm.available < pool_config.low_watermark) {
+        if (pool_steal_backoff > 0) {
+            pool_steal_backoff--;
+        } else if (err_is_fail(aos_ram_steal(pool_config.steal_chunk, BASE_PAGE_SIZE))) {
+            pool_steal_backoff = RAM_POOL_STEAL_BACKOFF;
+        }
+    }
+    
+    return err;
 }
 
 errval_t aos_ram_free(struct capref cap)
@@ -23,6 +108,51 @@ errval_t aos_ram_free(struct capref cap)
     return mm_free(&aos_mm, cap, fi.base, fi.bytes);
 }
 
+/**
+ * \brief Set the watermarks of this core's RAM pool
+ */
+void aos_ram_pool_configure(struct ram_pool_config *config)
+{
+    assert(config != NULL);
+    
+    pool_config = *config;
+    pool_steal_backoff = 0;
+}
+
+/**
+ * \brief Allow refilling the pool from the other core once it can answer
+ */
+void aos_ram_pool_enable_stealing(void)
+{
+    pool_stealing_enabled = true;
+}
+
+/**
+ * \brief Hand over a region of RAM to the other core
+ *
+ * The region stays allocated in our pool for good, the other core forges its
+ * own capability for it.
+ */
+errval_t aos_ram_donate(size_t bytes, size_t alignment, struct frame_identity *ret_fi)
+{
+    errval_t err;
+    
+    // Refuse while we are running low ourselves
+    if (pool_stealing ||
+        aos_mm.available < pool_config.donate_reserve ||
+        aos_mm.available - pool_config.donate_reserve < bytes) {
+        return LIB_ERR_RAM_ALLOC;
+    }
+    
+    struct capref cap;
+    err = mm_alloc_aligned(&aos_mm, bytes, MAX(alignment, BASE_PAGE_SIZE), &cap);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
+    return frame_identify(cap, ret_fi);
+}
+
 /**
  * \brief Setups a local memory allocator for init to use till the memory server
  * is ready to be used.
@@ -18,10 +18,30 @@
 #include <stdio.h>
 #include <aos/aos.h>
 
+/// Refill the local pool from the other core once less than this is free
+#define RAM_POOL_DEFAULT_LOW_WATERMARK  (16 * 1024 * 1024)
+/// Amount of memory taken from the other core at once
+#define RAM_POOL_DEFAULT_STEAL_CHUNK    (32 * 1024 * 1024)
+/// Never hand over memory to the other core if less than this would remain
+#define RAM_POOL_DEFAULT_DONATE_RESERVE (64 * 1024 * 1024)
+
+/**
+ * \brief Watermarks of the per-core RAM pool
+ */
+struct ram_pool_config {
+    gensize_t low_watermark;    ///< Steal from the other core below this
+    gensize_t steal_chunk;      ///< Size of the chunks stolen from the other core
+    gensize_t donate_reserve;   ///< Minimum free memory kept when donating
+};
+
 extern struct bootinfo *bi;
 extern struct mm aos_mm;
 
 errval_t initialize_ram_alloc(coreid_t my_core_id);
 errval_t aos_ram_free(struct capref cap);
 
+void aos_ram_pool_configure(struct ram_pool_config *config);
+void aos_ram_pool_enable_stealing(void);
+errval_t aos_ram_donate(size_t bytes, size_t alignment, struct frame_identity *ret_fi);
+
 #endif /* _INIT_MEM_ALLOC_H_ */
@@ -179,6 +179,12 @@ errval_t boot_core(coreid_t core_id, struct ump_chan *ump_chan) {
         return err;
     }
     
+    // Lay out the rings before the other core sees the frame
+    err = ump_chan_setup(ump_chan, UMP_DEFAULT_DEPTH);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    
     struct frame_identity kcb_frame_identity;
     err = frame_identify(kcb_cap, &kcb_frame_identity);
     if (err_is_fail(err)) {
@@ -0,0 +1,492 @@
+//
+//  main.c
+//  DoritOS
+//
+//  IPC microbenchmarks: latency distributions and throughput of the LMP and
+//  UMP message paths for payloads from 8 B to 1 MB.
+//
+//  Usage: ipcbench [-v] [lmp|ump|bulk|all]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aos/aos.h>
+#include <aos/aos_rpc.h>
+#include <aos/lmp.h>
+#include <aos/ump.h>
+#include <aos/urpc.h>
+#include <aos/systime.h>
+
+#define URPC_MessageType_Ping   URPC_MessageType_User0
+#define URPC_MessageType_Pong   URPC_MessageType_User1
+#define URPC_MessageType_Ack    URPC_MessageType_User2
+#define URPC_MessageType_Stop   URPC_MessageType_User3
+
+#define BENCH_MAX_ITERATIONS    2000
+#define BENCH_MIN_ITERATIONS    16
+#define BENCH_BYTE_BUDGET       (4 * 1024 * 1024)
+#define BENCH_MAX_SIZE          (1024 * 1024)
+#define BENCH_SHORT_BUF_SIZE    (7 * sizeof(uintptr_t))
+
+// Payload sizes measured by every benchmark (if they fit its transport)
+static const size_t bench_sizes[] = {
+    8, 28, 64, 512, 4096, 32768, 131072, 262144, 1048576
+};
+
+#define BENCH_NUM_SIZES (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+// A measured round trip: send `size` bytes and wait for the reply
+typedef errval_t (*bench_op_t)(struct urpc_chan *chan, void *buf, size_t size);
+
+struct bench {
+    const char *name;
+    const char *group;
+    bench_op_t op;
+    size_t max_size;
+    struct urpc_chan *chan;
+};
+
+static bool verbose = false;
+
+// Cost of taking a timestamp, subtracted from every sample
+static systime_t timer_overhead;
+
+// Samples of the current run
+static systime_t samples[BENCH_MAX_ITERATIONS];
+
+
+// MARK: - Server
+
+// Wait for the next message, without copying bulk payloads out of the pool
+static errval_t server_recv(struct urpc_chan *chan, void **buf, size_t *size,
+                            urpc_msg_type_t *msg_type,
+                            struct ump_bulk_desc *desc) {
+
+    if (chan->use_lmp) {
+        desc->length = 0;
+        return urpc_recv_blocking(chan, buf, size, msg_type);
+    }
+
+    // Spin for a while before giving up the CPU, like ump_recv_blocking()
+    size_t polls = 0;
+    while (!ump_chan_can_recv(chan->ump)) {
+        if (++polls > UMP_RECV_SPIN_POLLS) {
+            thread_yield();
+        }
+    }
+
+    return ump_recv_bulk(chan->ump, buf, size, msg_type, desc);
+
+}
+
+// Release a message received with server_recv()
+static void server_release(struct urpc_chan *chan, void *buf,
+                           struct ump_bulk_desc *desc) {
+
+    if (chan->use_lmp) {
+        free(buf);
+    }
+    else {
+        ump_bulk_release(chan->ump, buf, desc);
+    }
+
+}
+
+// Answer requests on one channel until told to stop
+static int server_main(void) {
+
+    errval_t err;
+
+    struct urpc_chan chan;
+    err = urpc_accept_blocking(&chan);
+    if (err_is_fail(err)) {
+        debug_printf("%s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+
+    while (true) {
+
+        void *buf;
+        size_t size;
+        urpc_msg_type_t msg_type;
+        struct ump_bulk_desc desc;
+
+        err = server_recv(&chan, &buf, &size, &msg_type, &desc);
+        if (err_is_fail(err)) {
+            debug_printf("%s\n", err_getstring(err));
+            return EXIT_FAILURE;
+        }
+
+        server_release(&chan, buf, &desc);
+
+        switch (msg_type) {
+
+            case URPC_MessageType_Ping: {
+                uint32_t pong = size;
+                urpc_send(&chan, &pong, sizeof(uint32_t),
+                          URPC_MessageType_Pong);
+                break;
+            }
+
+            case URPC_MessageType_Ack:
+                // Raw acknowledgement as expected by lmp_send_short_buf()
+                lmp_chan_send2(chan.lmp, LMP_SEND_FLAGS_DEFAULT, NULL_CAP,
+                               LMP_RequestType_BufferShort, SYS_ERR_OK);
+                break;
+
+            case URPC_MessageType_Stop:
+                return EXIT_SUCCESS;
+
+            default:
+                debug_printf("Unexpected message type %d\n", msg_type);
+                break;
+
+        }
+
+    }
+
+}
+
+
+// MARK: - Measured operations
+
+// Wait for the server's Pong
+static errval_t bench_wait_pong(struct urpc_chan *chan) {
+
+    void *reply;
+    size_t reply_size;
+    urpc_msg_type_t msg_type;
+
+    errval_t err = urpc_recv_blocking(chan, &reply, &reply_size, &msg_type);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    assert(msg_type == URPC_MessageType_Pong);
+    free(reply);
+
+    return SYS_ERR_OK;
+
+}
+
+// urpc_send() of the payload (LMP frames or UMP slots / bulk copy)
+static errval_t bench_urpc(struct urpc_chan *chan, void *buf, size_t size) {
+
+    errval_t err = urpc_send(chan, buf, size, URPC_MessageType_Ping);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return bench_wait_pong(chan);
+
+}
+
+// lmp_send_short_buf(), which waits for the acknowledgement itself
+static errval_t bench_short_buf(struct urpc_chan *chan, void *buf,
+                                size_t size) {
+
+    uintptr_t type = ((uintptr_t) URPC_MessageType_Ack) << 24;
+    type |= LMP_RequestType_BufferShort;
+
+    return lmp_send_short_buf(chan->lmp, type, buf, size);
+
+}
+
+// lmp_send_short_buf_fast() followed by the same acknowledgement
+static errval_t bench_short_buf_fast(struct urpc_chan *chan, void *buf,
+                                     size_t size) {
+
+    uintptr_t type = ((uintptr_t) URPC_MessageType_Ack) << 24;
+    type |= LMP_RequestType_BufferShort;
+
+    errval_t err = lmp_send_short_buf_fast(chan->lmp, type, buf, size);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    struct capref cap;
+    struct lmp_recv_msg msg = LMP_RECV_MSG_INIT;
+    lmp_client_recv(chan->lmp, &cap, &msg);
+    assert(msg.words[0] == LMP_RequestType_BufferShort);
+
+    return msg.words[1];
+
+}
+
+// Payload written straight into the bulk pool, read in place by the server
+static errval_t bench_bulk(struct urpc_chan *chan, void *buf, size_t size) {
+
+    void *bulk_buf;
+    struct ump_bulk_desc desc;
+    errval_t err = ump_bulk_alloc(chan->ump, size, &bulk_buf, &desc);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    memcpy(bulk_buf, buf, size);
+
+    err = ump_bulk_send(chan->ump, &desc, URPC_MessageType_Ping);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return bench_wait_pong(chan);
+
+}
+
+
+// MARK: - Statistics
+
+static int samples_compare(const void *a, const void *b) {
+
+    systime_t x = *(const systime_t *) a;
+    systime_t y = *(const systime_t *) b;
+    return (x > y) - (x < y);
+
+}
+
+// Value below which `per_mille` of the sorted samples lie
+static systime_t percentile(size_t count, size_t per_mille) {
+
+    size_t index = (count * per_mille) / 1000;
+    return samples[MIN(index, count - 1)];
+
+}
+
+static unsigned log2_floor(systime_t value) {
+
+    unsigned bits = 0;
+    while (value >>= 1) {
+        bits++;
+    }
+    return bits;
+
+}
+
+// Print a log2 histogram of the sorted samples
+static void print_histogram(size_t count) {
+
+    unsigned first = log2_floor(samples[0]);
+    unsigned last = log2_floor(samples[count - 1]);
+
+    size_t i = 0;
+    for (unsigned bucket = first; bucket <= last; bucket++) {
+
+        size_t n = 0;
+        while (i < count && log2_floor(samples[i]) == bucket) {
+            n++;
+            i++;
+        }
+
+        char bar[41];
+        size_t len = (n * 40 + count - 1) / count;
+        memset(bar, '#', len);
+        bar[len] = '\0';
+
+        printf("    [%10llu, %10llu) %6zu %s\n",
+               (unsigned long long) (bucket ? 1ull << bucket : 0),
+               (unsigned long long) (2ull << bucket), n, bar);
+
+    }
+
+}
+
+static uint64_t ticks_to_us(systime_t ticks) {
+
+    uint64_t hz = get_dispatcher_shared_generic(curdispatcher())->systime_frequency;
+    return (ticks * 1000000) / hz;
+
+}
+
+
+// MARK: - Driver
+
+// Number of samples to take for a payload size
+static size_t bench_iterations(size_t size) {
+
+    size_t iterations = BENCH_BYTE_BUDGET / size;
+    return MAX(BENCH_MIN_ITERATIONS, MIN(iterations, BENCH_MAX_ITERATIONS));
+
+}
+
+// Measure the cost of taking a timestamp
+static void calibrate_timer(void) {
+
+    timer_overhead = ~(systime_t) 0;
+
+    for (int i = 0; i < 100; i++) {
+        systime_t start = systime_now();
+        systime_t end = systime_now();
+        timer_overhead = MIN(timer_overhead, end - start);
+    }
+
+}
+
+// Run one benchmark at one payload size and print a result line
+static errval_t bench_run(struct bench *b, void *payload, size_t size) {
+
+    errval_t err;
+
+    size_t count = bench_iterations(size);
+
+    // Warm up the caches and the allocators
+    for (size_t i = 0; i < MAX(1, count / 16); i++) {
+        err = b->op(b->chan, payload, size);
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+
+    systime_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+
+        systime_t start = systime_now();
+        err = b->op(b->chan, payload, size);
+        systime_t end = systime_now();
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        systime_t elapsed = end - start;
+        samples[i] = elapsed > timer_overhead ? elapsed - timer_overhead : 0;
+        total += samples[i];
+
+    }
+
+    qsort(samples, count, sizeof(systime_t), samples_compare);
+
+    // Throughput of the payload in KiB/s
+    uint64_t us = ticks_to_us(total);
+    uint64_t kbps = us ? ((uint64_t) size * count * 1000000 / 1024) / us : 0;
+
+    printf("%-16s %8zu %6zu %10llu %10llu %10llu %10llu %10llu\n",
+           b->name, size, count,
+           (unsigned long long) samples[0],
+           (unsigned long long) percentile(count, 500),
+           (unsigned long long) percentile(count, 990),
+           (unsigned long long) percentile(count, 999),
+           (unsigned long long) kbps);
+
+    if (verbose) {
+        print_histogram(count);
+    }
+
+    return SYS_ERR_OK;
+
+}
+
+// Spawn a benchmark server on `core` and bind to it
+static errval_t bench_connect(struct urpc_chan *chan, coreid_t core,
+                              bool use_lmp, size_t pool_size) {
+
+    errval_t err;
+
+    domainid_t pid;
+    err = aos_rpc_process_spawn(aos_rpc_get_init_channel(), "ipcbench server",
+                                core, &pid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return urpc_bind_bulk(pid, chan, use_lmp, pool_size);
+
+}
+
+int main(int argc, char *argv[]) {
+
+    errval_t err;
+
+    if (argc > 1 && !strcmp(argv[1], "server")) {
+        return server_main();
+    }
+
+    // Parse the arguments
+    const char *group = "all";
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        }
+        else {
+            group = argv[i];
+        }
+    }
+
+    // Servers: one on our core, one per UMP channel on the other core
+    struct urpc_chan lmp_chan, ump_chan, bulk_chan;
+    err = bench_connect(&lmp_chan, disp_get_core_id(), true, 0);
+    if (err_is_ok(err)) {
+        err = bench_connect(&ump_chan, !disp_get_core_id(), false, 0);
+    }
+    if (err_is_ok(err)) {
+        err = bench_connect(&bulk_chan, !disp_get_core_id(), false,
+                            UMP_BULK_POOL_SIZE);
+    }
+    if (err_is_fail(err)) {
+        debug_printf("Failed to set up the servers: %s\n", err_getstring(err));
+        return EXIT_FAILURE;
+    }
+
+    struct bench benches[] = {
+        { "lmp_short_buf", "lmp", bench_short_buf, BENCH_SHORT_BUF_SIZE,
+          &lmp_chan },
+        { "lmp_short_fast", "lmp", bench_short_buf_fast, BENCH_SHORT_BUF_SIZE,
+          &lmp_chan },
+        { "lmp_urpc", "lmp", bench_urpc, BENCH_MAX_SIZE, &lmp_chan },
+        { "ump_urpc", "ump", bench_urpc, BENCH_MAX_SIZE, &ump_chan },
+        { "ump_urpc_pool", "bulk", bench_urpc, BENCH_MAX_SIZE, &bulk_chan },
+        { "ump_bulk", "bulk", bench_bulk, UMP_BULK_POOL_SIZE, &bulk_chan },
+    };
+
+    // Payload to send
+    char *payload = malloc(BENCH_MAX_SIZE);
+    if (payload == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < BENCH_MAX_SIZE; i++) {
+        payload[i] = i;
+    }
+
+    calibrate_timer();
+
+    printf("Timer: %llu Hz, overhead %llu ticks (subtracted)\n",
+           (unsigned long long)
+           get_dispatcher_shared_generic(curdispatcher())->systime_frequency,
+           (unsigned long long) timer_overhead);
+    printf("%-16s %8s %6s %10s %10s %10s %10s %10s\n", "benchmark", "bytes",
+           "n", "min", "p50", "p99", "p999", "KiB/s");
+
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+
+        if (strcmp(group, "all") && strcmp(group, benches[b].group)) {
+            continue;
+        }
+
+        for (size_t s = 0; s < BENCH_NUM_SIZES; s++) {
+
+            if (bench_sizes[s] > benches[b].max_size) {
+                break;
+            }
+
+            err = bench_run(&benches[b], payload, bench_sizes[s]);
+            if (err_is_fail(err)) {
+                printf("%-16s %8zu failed: %s\n", benches[b].name,
+                       bench_sizes[s], err_getstring(err));
+                break;
+            }
+
+        }
+
+    }
+
+    // Shut the servers down
+    uint32_t stop = 0;
+    urpc_send(&lmp_chan, &stop, sizeof(uint32_t), URPC_MessageType_Stop);
+    urpc_send(&ump_chan, &stop, sizeof(uint32_t), URPC_MessageType_Stop);
+    urpc_send(&bulk_chan, &stop, sizeof(uint32_t), URPC_MessageType_Stop);
+
+    free(payload);
+
+    return EXIT_SUCCESS;
+
+}
@@ -183,6 +183,16 @@ int main(int argc, char *argv[])
     *ptr = 'S';
     debug_printf("CHARACTER: %c\n", *ptr);
 
+    // Touch the heap sequentially and count the page faults this takes
+    struct paging_state *pstate = get_current_paging_state();
+    size_t faults = pstate->num_pagefaults;
+    char *seq = (char *) malloc(4*1024*1024);
+    for (size_t i = 0; i < 4*1024*1024; i += BASE_PAGE_SIZE) {
+        seq[i] = 'S';
+    }
+    debug_printf("SEQUENTIAL TOUCH: %zu pages, %zu faults\n",
+                 (size_t) (4*1024*1024 / BASE_PAGE_SIZE), pstate->num_pagefaults - faults);
+
     for (int i = 0; i < 512; i++) {
         struct capref cap;
         debug_printf("%d\n", i);
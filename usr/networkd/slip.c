@@ -39,6 +39,12 @@ static enum {
     PARSER_STATE_ESC
 } parser_state = PARSER_STATE_IDLE;
 
+// The current packet did not fit into the receive buffer and is dropped
+static bool packet_overflow = false;
+
+// UDP events are held back while a packet is only partially received
+static bool udp_events_held = false;
+
 int slip_init(void) {
     
     // Allocating space for receive buffer (max ip packet size)
@@ -56,115 +62,213 @@ int slip_init(void) {
     
 }
 
+// Word with every byte set to c
+#define SLIP_BYTES(c)   (0x01010101u * (uint8_t) (c))
+
+// Whether any byte of the word w is zero
+#define SLIP_HAS_ZERO(w)    (((w) - 0x01010101u) & ~(w) & 0x80808080u)
+
+static inline bool slip_is_special(uint8_t c) {
+    return c == SLIP_END || c == SLIP_ESC;
+}
+
+// Number of bytes before the first SLIP_END or SLIP_ESC
+static size_t slip_scan(const uint8_t *buf, size_t len) {
+    
+    size_t i = 0;
+    
+    // Single bytes up to a word boundary
+    while (i < len && ((uintptr_t) (buf + i) & (sizeof(uint32_t) - 1))) {
+        if (slip_is_special(buf[i])) {
+            return i;
+        }
+        i++;
+    }
+    
+    // Whole words, checking all four bytes at once
+    for (; i + sizeof(uint32_t) <= len; i += sizeof(uint32_t)) {
+        uint32_t w;
+        memcpy(&w, buf + i, sizeof(uint32_t));
+        uint32_t end = w ^ SLIP_BYTES(SLIP_END);
+        uint32_t esc = w ^ SLIP_BYTES(SLIP_ESC);
+        if (SLIP_HAS_ZERO(end) || SLIP_HAS_ZERO(esc)) {
+            break;
+        }
+    }
+    
+    // Locate the byte in the word or handle the remaining bytes
+    while (i < len && !slip_is_special(buf[i])) {
+        i++;
+    }
+    
+    return i;
+    
+}
+
+// Append bytes to the current packet
+static inline void slip_append(const uint8_t *buf, size_t len) {
+    
+    if (current_packet.len + len > MAX_IP_PACKET_SIZE) {
+        packet_overflow = true;
+        return;
+    }
+    
+    memcpy(current_packet.buf + current_packet.len, buf, len);
+    current_packet.len += len;
+    
+}
+
 // Receive and parse bytes from the network
 void slip_recv(uint8_t *buf, size_t len) {
     
-    // Bring the parser out of idle
-    if (parser_state == PARSER_STATE_IDLE) {
-        parser_state = PARSER_STATE_NORMAL;
-        // Cancel UDP events
-        udp_cancel_event_queue();
-    }
+    uint8_t *end = buf + len;
     
-    // Iterate through all received bytes
-    while (len--) {
-        //debug_printf("%x, %zu\n", *buf, current_packet.len);
-        switch (*buf) {
+    while (buf < end) {
+        
+        // Complete an escape sequence (it may have been split between calls)
+        if (parser_state == PARSER_STATE_ESC) {
             
-            // Handle end of packet
-            case SLIP_END:
-                // Sanity check
-                assert(parser_state == PARSER_STATE_NORMAL);
-                
-                // Parse the raw IP packet
-                slip_parse_raw_ip_packet(&current_packet);
-                
-                // Reset the input parser
-                parser_state = PARSER_STATE_IDLE;
-                current_packet.buf -= current_packet.len;
-                current_packet.len = 0;
-                
-                // Allow UDP events again
-                udp_register_event_queue(NULL);
-                
-                continue;
+            uint8_t c = *(buf++);
+            switch (c) {
+                case SLIP_ESC_END:
+                    c = SLIP_END;
+                    break;
+                case SLIP_ESC_ESC:
+                    c = SLIP_ESC;
+                    break;
+                case SLIP_ESC_NUL:
+                    c = 0x00;
+                    break;
+                default:
+                    // Protocol violation, keep the byte as is
+                    break;
+            }
             
-            // Handle escape sequences
-            case SLIP_ESC:
-                assert(parser_state == PARSER_STATE_NORMAL);
-                parser_state = PARSER_STATE_ESC;
-                buf++;
-                continue;
-                
-            case SLIP_ESC_END:
-                if (parser_state == PARSER_STATE_ESC) {
-                    *buf = SLIP_END;
-                    parser_state = PARSER_STATE_NORMAL;
-                }
-                break;
-                
-            case SLIP_ESC_ESC:
-                if (parser_state == PARSER_STATE_ESC) {
-                    *buf = SLIP_ESC;
-                    parser_state = PARSER_STATE_NORMAL;
-                }
-                break;
-                
-            case SLIP_ESC_NUL:
-                if (parser_state == PARSER_STATE_ESC) {
-                    *buf = 0x00;
-                    parser_state = PARSER_STATE_NORMAL;
-                }
-                break;
+            slip_append(&c, 1);
+            parser_state = PARSER_STATE_NORMAL;
+            
+            continue;
             
-            default:
-                // Make sure escape sequences are correct
-                assert(parser_state == PARSER_STATE_NORMAL);
         }
         
-        // Copy the received byte
-        *(current_packet.buf++) = *(buf++);
-        current_packet.len++;
-
+        // Copy the run of plain bytes at once
+        size_t run = slip_scan(buf, end - buf);
+        if (run > 0) {
+            slip_append(buf, run);
+            parser_state = PARSER_STATE_NORMAL;
+            buf += run;
+            continue;
+        }
+        
+        if (*(buf++) == SLIP_ESC) {
+            parser_state = PARSER_STATE_ESC;
+            continue;
+        }
+        
+        // Handle end of packet
+        if (packet_overflow) {
+            debug_printf("Dropped SLIP packet larger than %u bytes\n", MAX_IP_PACKET_SIZE);
+        } else if (current_packet.len > 0) {
+            // Parse the raw IP packet, back-to-back ends carry no packet
+            slip_parse_raw_ip_packet(&current_packet);
+        }
+        
+        // Reset the input parser
+        parser_state = PARSER_STATE_IDLE;
+        current_packet.len = 0;
+        packet_overflow = false;
+        
+    }
+    
+    // Hold back UDP events only while a packet is incomplete, which is
+    // decided once per received buffer instead of once per packet
+    if (parser_state != PARSER_STATE_IDLE && !udp_events_held) {
+        udp_cancel_event_queue();
+        udp_events_held = true;
+    } else if (parser_state == PARSER_STATE_IDLE && udp_events_held) {
+        udp_register_event_queue(NULL);
+        udp_events_held = false;
     }
     
 }
 
-// Send buffer over network
+// Encode buffer into the serial TX ring in one pass
 void slip_send(uint8_t *buf, size_t len, bool end) {
-
-    uint8_t esc_buf[2] = {SLIP_ESC, 0x00};
-
-    for (int i = 0; i < len; i++) {
+    
+    // Free space of the TX ring that is being filled
+    uint8_t *out = NULL;
+    size_t space = 0;
+    size_t used = 0;
+    
+    // Second byte of an escape sequence that did not fit into the space anymore
+    uint8_t escaped = 0;
+    
+    size_t i = 0;
+    
+    while (i < len || escaped != 0 || end) {
+        
+        // Queue what was encoded so far and get more space
+        if (used == space) {
+            if (used > 0) {
+                serial_tx_commit(used);
+            }
+            out = serial_tx_reserve(&space);
+            used = 0;
+        }
+        
+        if (escaped != 0) {
+            out[used++] = escaped;
+            escaped = 0;
+            continue;
+        }
+        
+        if (i == len) {
+            // Terminate the packet
+            out[used++] = SLIP_END;
+            end = false;
+            continue;
+        }
         
         switch (buf[i]) {
                 
             case SLIP_END:
-                esc_buf[1] = SLIP_ESC_END;
-                serial_write(esc_buf, 2);
+                escaped = SLIP_ESC_END;
                 break;
                 
             case SLIP_ESC:
-                esc_buf[1] = SLIP_ESC_ESC;
-                serial_write(esc_buf, 2);
+                escaped = SLIP_ESC_ESC;
                 break;
                 
             case 0x00:
-                esc_buf[1] = SLIP_ESC_NUL;
-                serial_write(esc_buf, 2);
+                escaped = SLIP_ESC_NUL;
                 break;
                 
-            default:
-                serial_write(buf + i, 1);
-                break;
-            
+            default: {
+                
+                // Copy the run of bytes that need no escaping at once
+                size_t run = 1;
+                while (i + run < len && run < space - used && buf[i + run] != SLIP_END &&
+                       buf[i + run] != SLIP_ESC && buf[i + run] != 0x00) {
+                    run++;
+                }
+                
+                memcpy(out + used, buf + i, run);
+                used += run;
+                i += run;
+                
+                continue;
+                
+            }
+                
         }
         
+        out[used++] = SLIP_ESC;
+        i++;
+        
     }
     
-    if (end) {
-        esc_buf[0] = SLIP_END;
-        serial_write(esc_buf, 1);
+    if (used > 0) {
+        serial_tx_commit(used);
     }
     
 }
@@ -179,10 +283,10 @@ static void slip_parse_raw_ip_packet(struct ip_packet_raw *raw_packet) {
     
     if (dump_packets) {
         printf("\n\n");
-        hexdump(raw_packet->buf - raw_packet->len, raw_packet->len);
+        hexdump(raw_packet->buf, raw_packet->len);
         printf("\n");
     }
     
-    ip_handle_packet(raw_packet->buf - raw_packet->len, raw_packet->len);
+    ip_handle_packet(raw_packet->buf, raw_packet->len);
     
 };
@@ -12,8 +12,9 @@
 #include <string.h>
 
 #include <aos/urpc.h>
+#include <aos/ump.h>
 #include <aos/waitset_chan.h>
-#include <aos/event_queue.h>
+#include <aos/deferred.h>
 
 #include <collections/list.h>
 
@@ -24,10 +25,16 @@
 extern bool dump_packets;
 
 
-struct event_queue_pair {
-    struct event_queue queue;
-    struct event_queue_node node;
-};
+// Interval for checking for new bind requests in microseconds
+#define UDP_ACCEPT_POLL_US  10000
+
+// Number of UDP ports
+#define UDP_PORT_COUNT      65536
+
+// Ports handed out when a socket does not ask for a specific one
+#define UDP_EPHEMERAL_FIRST 1024
+
+#define BITS_PER_WORD       32
 
 
 static void udp_handle_urpc(struct udp_socket *socket, void *buf, size_t size,
@@ -40,89 +47,253 @@ extern uint32_t host_ip;
 // List of registered sockets
 static collections_listnode *socket_list;
 
-// Next port to use for port allocation
-static uint32_t port_counter = 1024;
+// Open socket of each port (NULL if the port is free)
+static struct udp_socket *port_table[UDP_PORT_COUNT];
+
+// Bit n is set if port n is in use (port 0 is reserved)
+static uint32_t port_bitmap[UDP_PORT_COUNT / BITS_PER_WORD];
+
+// Port to start the next ephemeral port search at
+static uint32_t port_cursor = UDP_EPHEMERAL_FIRST;
 
 // Simple == predicate
 static int32_t predicate_equals(void *data, void *arg) {
     return data == arg;
 }
 
-// Predicate function for finding an open socket with a specific port
-static int32_t predicate_open_socket_with_port(struct udp_socket *socket,
-                                               uint16_t *port) {
-    return socket->state == UDP_SOCKET_STATE_OPEN && socket->pub.port == *port;
+// MARK: - Port table
+
+static inline bool port_is_used(uint32_t port) {
+    return port_bitmap[port / BITS_PER_WORD] & (1u << (port % BITS_PER_WORD));
+}
+
+// Bind an open socket to a free port
+static void port_bind(uint32_t port, struct udp_socket *socket) {
+    assert(!port_is_used(port));
+    port_bitmap[port / BITS_PER_WORD] |= 1u << (port % BITS_PER_WORD);
+    port_table[port] = socket;
 }
 
-// Handler for waitset events
-static void dispatch_event_handler(void *arg) {
+// Release the port of a socket
+static void port_unbind(uint32_t port) {
+    port_bitmap[port / BITS_PER_WORD] &= ~(1u << (port % BITS_PER_WORD));
+    port_table[port] = NULL;
+}
+
+// Find a free port in [from, end), skipping words of ports that are all in use
+static uint32_t port_find_free(uint32_t from, uint32_t end) {
+    
+    uint32_t port = from;
+    
+    while (port < end) {
+        
+        if (port % BITS_PER_WORD == 0 && port_bitmap[port / BITS_PER_WORD] == 0xFFFFFFFF) {
+            port += BITS_PER_WORD;
+            continue;
+        }
+        
+        if (!port_is_used(port)) {
+            return port;
+        }
+        
+        port++;
+        
+    }
+    
+    return 0;
+    
+}
+
+// Allocate an ephemeral port with a next fit search (0 if all are taken)
+static uint32_t port_alloc(void) {
+    
+    // Search behind the cursor first, then wrap around
+    uint32_t port = port_find_free(port_cursor, UDP_PORT_COUNT);
+    if (port == 0) {
+        port = port_find_free(UDP_EPHEMERAL_FIRST, port_cursor);
+    }
+    
+    if (port != 0) {
+        port_cursor = port + 1 < UDP_PORT_COUNT ? port + 1 : UDP_EPHEMERAL_FIRST;
+    }
+    
+    return port;
+    
+}
+
+// Waitset the UDP events are registered on
+static struct waitset *udp_ws = NULL;
+
+// Whether events are currently held back (e.g. while SLIP parses a packet)
+static bool udp_events_suspended = false;
+
+// Number of sockets with a receive event that was held back
+static size_t udp_deferred_sockets = 0;
+
+// Timer for checking for new bind requests
+static struct periodic_event accept_event;
+
+// Receive a message from a socket's channel, leaving bulk payloads in the
+// pool shared with the client (desc.length is 0 for copied messages)
+static errval_t socket_recv(struct udp_socket *socket, void **buf, size_t *size,
+                            urpc_msg_type_t *msg_type, struct ump_bulk_desc *desc) {
     
     errval_t err;
     
-    // Accept new bind requests
-    static struct udp_socket *socket = NULL;
-    if (!socket) { socket = malloc(sizeof(struct udp_socket)); assert(socket); }
-    err = urpc_accept(&socket->chan);
-    if (err_is_ok(err)) {
-        // Register a new socket
-        socket->state = UDP_SOCKET_STATE_CLOSED;
-        collections_list_insert(socket_list, socket);
-        socket = malloc(sizeof(struct udp_socket));
-        assert(socket);
+    if (socket->chan.use_lmp) {
+        desc->length = 0;
+        return urpc_recv(&socket->chan, buf, size, msg_type);
     }
-    else if (err != LIB_ERR_NO_URPC_BIND_REQ) {
-        debug_printf("Error in urpc_accept(): %s\n", err_getstring(err));
+    
+    err = ump_recv_bulk(socket->chan.ump, buf, size, msg_type, desc);
+    if (err == LIB_ERR_NO_UMP_MSG) {
+        return LIB_ERR_NO_URPC_MSG;
+    }
+    
+    return err;
+    
+}
+
+// Free a received message (or hand it back to the client's pool)
+static void socket_release(struct udp_socket *socket, void *buf,
+                           struct ump_bulk_desc *desc) {
+    
+    if (socket->chan.use_lmp) {
+        free(buf);
+    } else {
+        ump_bulk_release(socket->chan.ump, buf, desc);
     }
     
-    // Iterate all registered sockets
-    struct udp_socket *node;
-    collections_list_traverse_start(socket_list);
-    while ((node = (struct udp_socket *) collections_list_traverse_next(socket_list)) != NULL) {
+}
+
+// Handler for messages on a socket's channel
+static void socket_event_handler(void *arg) {
+    
+    struct udp_socket *socket = arg;
+    errval_t err;
+    
+    // Hold the event back until events are allowed again
+    if (udp_events_suspended) {
+        socket->recv_deferred = true;
+        udp_deferred_sockets++;
+        return;
+    }
+    
+    // Handle all messages received on the socket's channel
+    void *buf;
+    size_t size;
+    urpc_msg_type_t msg_type;
+    struct ump_bulk_desc desc;
+    while (err_is_ok(err = socket_recv(socket, &buf, &size, &msg_type, &desc))) {
         
-        // Receive on the socket's channel if possible
-        void *buf;
-        size_t size;
-        urpc_msg_type_t msg_type;
-        err = urpc_recv(&node->chan, &buf, &size, &msg_type);
-        if (err_is_ok(err)) {
-            // Handle message
-            udp_handle_urpc(node, buf, size, msg_type);
-            free(buf);
-        }
-        else if (err != LIB_ERR_NO_URPC_MSG) {
-            debug_printf("Error in urpc_recv(): %s\n", err_getstring(err));
+        // Closing the socket frees it, so release the message first
+        if (msg_type == URPC_MessageType_SocketClose) {
+            socket_release(socket, buf, &desc);
+            udp_handle_urpc(socket, NULL, 0, msg_type);
+            return;
         }
         
+        // Handle message (payloads to send are read in place)
+        udp_handle_urpc(socket, buf, size, msg_type);
+        socket_release(socket, buf, &desc);
+        
+    }
+    if (err != LIB_ERR_NO_URPC_MSG) {
+        debug_printf("Error in urpc_recv(): %s\n", err_getstring(err));
+    }
+    
+    // Reregister for the next message
+    err = urpc_register_recv(&socket->chan, udp_ws,
+                             MKCLOSURE(socket_event_handler, socket));
+    if (err_is_fail(err)) {
+        debug_printf("Error in urpc_register_recv(): %s\n",
+                     err_getstring(err));
     }
-    collections_list_traverse_end(socket_list);
     
-    // Reregister event node
-    struct event_queue_pair *pair = arg;
-    event_queue_add(&pair->queue,
-                    &pair->node,
-                    MKCLOSURE(dispatch_event_handler, (void *) pair));
+}
+
+// Handler for accepting new bind requests
+static void accept_event_handler(void *arg) {
+    
+    errval_t err;
+    
+    // Bind requests are picked up once events are allowed again
+    if (udp_events_suspended) {
+        return;
+    }
+    
+    // Accept new bind requests
+    static struct udp_socket *socket = NULL;
+    while (true) {
+        if (!socket) { socket = malloc(sizeof(struct udp_socket)); assert(socket); }
+        err = urpc_accept(&socket->chan);
+        if (err_is_fail(err)) {
+            break;
+        }
+        
+        // Register a new socket
+        socket->state = UDP_SOCKET_STATE_CLOSED;
+        socket->recv_deferred = false;
+        collections_list_insert(socket_list, socket);
+        err = urpc_register_recv(&socket->chan, udp_ws,
+                                 MKCLOSURE(socket_event_handler, socket));
+        if (err_is_fail(err)) {
+            debug_printf("Error in urpc_register_recv(): %s\n",
+                         err_getstring(err));
+        }
+        socket = NULL;
+    }
+    if (err != LIB_ERR_NO_URPC_BIND_REQ) {
+        debug_printf("Error in urpc_accept(): %s\n", err_getstring(err));
+    }
     
 }
 
-static struct event_queue_pair event_pair;
+// Predicate function for finding a socket with a held back event
+static int32_t predicate_deferred_socket(struct udp_socket *socket,
+                                         void *arg) {
+    return socket->recv_deferred;
+}
 
-// Register handler for waitset events
+// Register handlers for waitset events
 //  When waitset is NULL, only reregisters
 void udp_register_event_queue(struct waitset *waitset) {
     
+    errval_t err;
+    
     if (waitset) {
-        event_queue_init(&event_pair.queue, waitset, EVENT_QUEUE_CONTINUOUS);
+        udp_ws = waitset;
+        err = periodic_event_create(&accept_event, udp_ws, UDP_ACCEPT_POLL_US,
+                                    MKCLOSURE(accept_event_handler, NULL));
+        if (err_is_fail(err)) {
+            debug_printf("Error in periodic_event_create(): %s\n",
+                         err_getstring(err));
+        }
+    }
+    udp_events_suspended = false;
+    
+    // Deliver the events held back in the meantime
+    while (udp_deferred_sockets) {
+        struct udp_socket *socket = collections_list_find_if(socket_list,
+                                                             (collections_list_predicate) predicate_deferred_socket,
+                                                             NULL);
+        assert(socket);
+        socket->recv_deferred = false;
+        udp_deferred_sockets--;
+        err = urpc_register_recv(&socket->chan, udp_ws,
+                                 MKCLOSURE(socket_event_handler, socket));
+        if (err_is_fail(err)) {
+            debug_printf("Error in urpc_register_recv(): %s\n",
+                         err_getstring(err));
+        }
     }
-    event_queue_add(&event_pair.queue,
-                    &event_pair.node,
-                    MKCLOSURE(dispatch_event_handler, (void *) &event_pair));
     
 }
 
-// Cancel waitset events
+// Hold back waitset events
 void udp_cancel_event_queue(void) {
     
-    event_queue_cancel(&event_pair.queue, &event_pair.node);
+    udp_events_suspended = true;
     
 }
 
@@ -131,6 +302,9 @@ void udp_init(void) {
     
     collections_list_create(&socket_list, free);
     
+    // Port 0 is never bound
+    port_bitmap[0] = 1;
+    
 }
 
 // Parse and validate a UDP header
@@ -165,7 +339,7 @@ int udp_parse_header(struct ip_packet_header *ip, uint8_t *buf, size_t len,
 
 // Encode a UDP header
 static int udp_encode_header(struct udp_header *header,
-                             struct udp_urpc_packet *packet, uint8_t *out) {
+                             uint32_t dest_addr, uint8_t *out) {
     
     uint16_t *out16 = (uint16_t *) out;
     
@@ -178,7 +352,7 @@ static int udp_encode_header(struct udp_header *header,
     // Compute checksum
     struct udp_checksum_ip_pseudo_header ph;
     ph.src_addr = lwip_htonl(host_ip);
-    ph.dest_addr = lwip_htonl(packet->addr);
+    ph.dest_addr = lwip_htonl(dest_addr);
     ph.zeros = 0;
     ph.protocol = IP_PROTOCOL_UDP;
     ph.udp_length = out16[2];
@@ -207,9 +381,7 @@ void udp_handle_packet(struct ip_packet_header *ip, uint8_t *buf, size_t len) {
     }
     
     // Find socket bound to the destination port
-    struct udp_socket *socket = collections_list_find_if(socket_list,
-                                                         (collections_list_predicate) predicate_open_socket_with_port,
-                                                         (void *) &header.dest_port);
+    struct udp_socket *socket = port_table[header.dest_port];
     
     // Check that a socket was found
     if (!socket) {
@@ -220,8 +392,21 @@ void udp_handle_packet(struct ip_packet_header *ip, uint8_t *buf, size_t len) {
     // Calculate size of message to be forwarded to client process
     size_t msg_size = sizeof(struct udp_urpc_packet) + len - 8;
     
-    // Allocate memory to construct the message
-    struct udp_urpc_packet *packet = malloc(msg_size);
+    // Construct the message in the pool shared with the client if possible,
+    // so the client reads the payload in place
+    struct udp_urpc_packet *packet = NULL;
+    struct ump_bulk_desc desc;
+    if (!socket->chan.use_lmp &&
+        err_is_fail(ump_bulk_alloc(socket->chan.ump, msg_size,
+                                   (void **) &packet, &desc))) {
+        packet = NULL;
+    }
+    bool bulk = packet != NULL;
+    
+    // Otherwise allocate memory to construct the message
+    if (!bulk) {
+        packet = malloc(msg_size);
+    }
     if (!packet) {
         debug_printf("UDP: Dropping packet\n");
         return; // Drop packet
@@ -236,10 +421,17 @@ void udp_handle_packet(struct ip_packet_header *ip, uint8_t *buf, size_t len) {
     memcpy(packet->payload, buf + 8, len - 8);
     
     // Forward packet to the process holding the socket
-    errval_t err = urpc_send(&socket->chan,
-                             (void *) packet,
-                             msg_size,
-                             URPC_MessageType_Receive);
+    errval_t err;
+    if (bulk) {
+        err = ump_bulk_send(socket->chan.ump, &desc, URPC_MessageType_Receive);
+    }
+    else {
+        err = urpc_send(&socket->chan,
+                        (void *) packet,
+                        msg_size,
+                        URPC_MessageType_Receive);
+        free(packet);
+    }
     if (err_is_fail(err)) {
         debug_printf("Error in urpc_send(): %s\n", err_getstring(err));
     }
@@ -250,31 +442,32 @@ void udp_handle_packet(struct ip_packet_header *ip, uint8_t *buf, size_t len) {
 static int udp_socket_open(struct udp_socket *socket,
                            struct udp_socket_common *msg) {
     
+    // Reopening a socket releases its previous port
+    if (socket->state == UDP_SOCKET_STATE_OPEN) {
+        port_unbind(socket->pub.port);
+        socket->state = UDP_SOCKET_STATE_CLOSED;
+    }
+    
     // Find a port
-    while (true) {
-        
-        // If no port specified, select a random port
-        uint32_t port = msg->port ? msg->port : port_counter++;
-        
-        // Check if the port is taken
-        if (collections_list_find_if(socket_list,
-                                     (collections_list_predicate) predicate_open_socket_with_port,
-                                     (void *) &port)) {
-            // If a specific port was requested, fail
-            if (msg->port) {
-                return 1;
-            }
-            else {
-                continue;
-            }
+    uint32_t port = msg->port;
+    if (port) {
+        // If a specific port was requested and it is taken, fail
+        if (port_is_used(port)) {
+            return 1;
         }
-        
-        // Use the port
-        msg->port = port;
-        
-        break;
-        
     }
+    else {
+        // If no port specified, select a free ephemeral port
+        port = port_alloc();
+        if (!port) {
+            return 1;
+        }
+    }
+    
+    // Use the port
+    msg->port = port;
+    port_bind(port, socket);
+    
     // Copy over the shared socket data
     memcpy(&socket->pub, msg, sizeof(struct udp_socket_common));
     
@@ -286,32 +479,31 @@ static int udp_socket_open(struct udp_socket *socket,
 }
 
 // Send a UDP packet
-static void udp_socket_send(struct udp_socket *socket,
-                           struct udp_urpc_packet *packet, size_t len) {
+static void udp_socket_send(struct udp_socket *socket, uint32_t addr,
+                            uint16_t port, uint8_t *payload, uint16_t size) {
     
     struct udp_header reply_header;
     
     // Build header
     reply_header.src_port = socket->pub.port;
-    reply_header.dest_port = packet->port;
-    reply_header.length = packet->size + 8;
+    reply_header.dest_port = port;
+    reply_header.length = size + 8;
     
     // Compute checksum for payload
-    reply_header.checksum = inet_checksum((void *) packet->payload,
-                                          packet->size);
+    reply_header.checksum = inet_checksum((void *) payload, size);
     
     // Send IP header
-    ip_send_header(packet->addr, IP_PROTOCOL_UDP, reply_header.length);
+    ip_send_header(addr, IP_PROTOCOL_UDP, reply_header.length);
     
     // Encode header and send it
     uint8_t *reply_buf = malloc(8);
     assert(reply_buf);
-    udp_encode_header(&reply_header, packet, reply_buf);
+    udp_encode_header(&reply_header, addr, reply_buf);
     ip_send(reply_buf, 8, false);
     free(reply_buf);
     
     // Send payload
-    ip_send((uint8_t *) packet->payload, packet->size, true);
+    ip_send(payload, size, true);
     
 }
 
@@ -348,16 +540,41 @@ static void udp_handle_urpc(struct udp_socket *socket, void *buf, size_t size,
             }
             break;
             
-        case URPC_MessageType_Send:
-            udp_socket_send(socket,
-                            (struct udp_urpc_packet *) buf,
-                            size);
+        case URPC_MessageType_Send: {
+            // The client can still write to a shared buffer, so read the
+            // header exactly once and only use the validated copy
+            if (size < sizeof(struct udp_urpc_packet)) {
+                debug_printf("UDP: Dropping malformed send request\n");
+                break;
+            }
+            struct udp_urpc_packet header;
+            memcpy(&header, buf, sizeof(struct udp_urpc_packet));
+            
+            // The message may be larger than the packet, but never smaller
+            if (size < sizeof(struct udp_urpc_packet) + header.size) {
+                debug_printf("UDP: Dropping malformed send request\n");
+                break;
+            }
+
+            // The length field of the UDP header also covers its 8 bytes
+            if (header.size > UINT16_MAX - 8) {
+                debug_printf("UDP: Dropping oversized send request\n");
+                break;
+            }
+            udp_socket_send(socket, header.addr, header.port,
+                            ((struct udp_urpc_packet *) buf)->payload,
+                            header.size);
             break;
+        }
             
         case URPC_MessageType_SocketClose:
-            collections_list_traverse_end(socket_list);
+            if (socket->state == UDP_SOCKET_STATE_OPEN) {
+                port_unbind(socket->pub.port);
+            }
+            // Removing only frees the list node, the socket is freed here
             collections_list_remove_if(socket_list, predicate_equals, socket);
-            collections_list_traverse_start(socket_list);
+            urpc_chan_destroy(&socket->chan);
+            free(socket);
             break;
             
         // For network utilites
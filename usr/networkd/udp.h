@@ -46,14 +46,15 @@ struct udp_socket {
     struct udp_socket_common pub;
     struct urpc_chan chan;
     enum udp_socket_state state;
+    bool recv_deferred;     // Receive event held back while suspended
 };
 
 
-// Register handler for waitset events
+// Register handlers for waitset events
 //  When waitset is NULL, only reregisters
 void udp_register_event_queue(struct waitset *waitset);
 
-// Cancel waitset events
+// Hold back waitset events
 void udp_cancel_event_queue(void);
 
 // Initialize the UDP module